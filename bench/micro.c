@@ -0,0 +1,472 @@
+// bench/micro.c
+
+/* Microbenchmarks of the data structures on the hot paths of civicc, measured in
+ * isolation so whole-program noise does not hide regressions. Every benchmark
+ * reports nanoseconds and allocations per operation, the workloads follow the
+ * shapes of real programs: small scopes, a skewed use of names and constants
+ * and the instruction mix the bytecode generation emits. */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "bytecode/asm.h"
+#include "bytecode/writer.h"
+#include "symbol/scopetree.h"
+#include "symbol/table.h"
+
+#define DEFAULT_OPS 200000
+#define DEFAULT_REPEAT 5
+#define NAME_COUNT 4096                 // Distinct identifiers available to the workloads
+#define SCOPE_SIZE 16                   // Symbols per function scope
+#define GLOBAL_COUNT 200                // Globals and functions of the scope tree benchmark
+#define CONST_POOL_SIZE 64              // Constants in the pool of the lookup benchmark
+#define INSTRS_PER_FUN 24               // Instructions between function labels when writing
+
+/*
+ * Allocation counting. With COUNT_ALLOCS the build links with --wrap for the
+ * allocator, every allocation of the compiler code passes through here.
+ */
+static size_t ALLOC_COUNT = 0;
+
+#ifdef COUNT_ALLOCS
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(const size_t size) {
+    ALLOC_COUNT++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(const size_t count, const size_t size) {
+    ALLOC_COUNT++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, const size_t size) {
+    ALLOC_COUNT++;
+    return __real_realloc(ptr, size);
+}
+#endif // COUNT_ALLOCS
+
+/* Workload data, generated once before any benchmark runs */
+static char* NAMES[NAME_COUNT];
+static size_t* PICKS;                   // Skewed indices into NAMES, one per operation
+static size_t OPS;
+
+static uint64_t RNG_STATE = 0x9e3779b97f4a7c15ULL;
+
+/**
+ * Deterministic xorshift generator, so every run measures the same workload
+ * @return next pseudo random number
+ */
+static uint64_t next_random(void) {
+    RNG_STATE ^= RNG_STATE << 13;
+    RNG_STATE ^= RNG_STATE >> 7;
+    RNG_STATE ^= RNG_STATE << 17;
+    return RNG_STATE;
+}
+
+/**
+ * Picks an index below n with a Zipf-like distribution, low indices are the most
+ * common the way a few names and constants dominate real programs
+ * @param n amount of indices to pick from
+ * @return picked index
+ */
+static size_t pick_skewed(const size_t n) {
+    // The minimum of three uniform picks favours the low indices
+    const size_t a = next_random() % n, b = next_random() % n, c = next_random() % n;
+    size_t m = a < b ? a : b;
+    return m < c ? m : c;
+}
+
+/**
+ * Generates identifiers shaped like the ones in CiviC programs: loop counters,
+ * short words, numbered temporaries and long descriptive names
+ */
+static void generate_names(void) {
+    static const char* short_names[] = {"i", "j", "k", "n", "x", "y", "a", "b"};
+    static const char* words[] = {"sum", "count", "result", "value", "index", "total", "tmp", "arr",
+        "matrix", "row", "col", "left", "right", "mid", "step", "limit"};
+    static const char* long_words[] = {"element_offset", "accumulated_total", "previous_value",
+        "current_row_start"};
+    char buf[MAX_STR_LEN];
+
+    for (size_t i = 0; i < NAME_COUNT; i++) {
+        if (i < 8) {
+            snprintf(buf, MAX_STR_LEN, "%s", short_names[i]);
+        } else if (i < 24) {
+            snprintf(buf, MAX_STR_LEN, "%s", words[i - 8]);
+        } else if (i % 8 == 0) {
+            snprintf(buf, MAX_STR_LEN, "%s_%lu", long_words[i % 4], i);
+        } else {
+            snprintf(buf, MAX_STR_LEN, "%s%lu", words[i % 16], i);
+        }
+        NAMES[i] = STRcpy(buf);
+    }
+}
+
+/*
+ * Benchmarks. setup builds the state outside the measurement, run performs OPS
+ * operations and teardown releases the state again.
+ */
+typedef struct Bench {
+    const char* name;
+    void (*setup)(void);
+    void (*run)(void);
+    void (*teardown)(void);
+} Bench;
+
+static SymbolTable** TABLES;
+static size_t TABLE_COUNT;
+static Symbol** SYMBOLS;
+static SymbolTable* SCOPES[4];          // Global, function, nested function and for-loop scope
+static Assembly* ASSEMBLY;
+static FILE* DEVNULL;
+static char CONST_VALUES[CONST_POOL_SIZE * 3][8];
+static volatile size_t SINK;            // Keeps results of lookups alive
+
+/* Distinct name of the i-th symbol within a function scope */
+#define SCOPE_NAME(i) NAMES[(i) % SCOPE_SIZE * 37 % NAME_COUNT]
+
+static void setup_insert(void) {
+    TABLE_COUNT = (OPS + SCOPE_SIZE - 1) / SCOPE_SIZE;
+    TABLES = MEMmalloc(sizeof(SymbolTable*) * TABLE_COUNT);
+    for (size_t i = 0; i < TABLE_COUNT; i++) TABLES[i] = STnew(NULL, NULL);
+
+    SYMBOLS = MEMmalloc(sizeof(Symbol*) * OPS);
+    for (size_t i = 0; i < OPS; i++) SYMBOLS[i] = SBfromVar(SCOPE_NAME(i), VT_NUM, false);
+}
+
+static void run_insert(void) {
+    // Every function scope receives its own parameters and locals
+    for (size_t i = 0; i < OPS; i++) {
+        STinsert(TABLES[i / SCOPE_SIZE], SCOPE_NAME(i), SYMBOLS[i]);
+    }
+}
+
+static void teardown_tables(void) {
+    for (size_t i = 0; i < TABLE_COUNT; i++) STfree(&TABLES[i]);
+    MEMfree(TABLES);
+    MEMfree(SYMBOLS);
+    TABLES = NULL;
+    SYMBOLS = NULL;
+    TABLE_COUNT = 0;
+}
+
+static void setup_lookup(void) {
+    TABLE_COUNT = 1;
+    TABLES = MEMmalloc(sizeof(SymbolTable*));
+    TABLES[0] = STnew(NULL, NULL);
+    for (size_t i = 0; i < 2 * SCOPE_SIZE; i++) STinsert(TABLES[0], NAMES[i], SBfromVar(NAMES[i], VT_NUM, false));
+}
+
+static void run_lookup(void) {
+    // Picks beyond the table are misses, like names resolved in a parent scope
+    size_t found = 0;
+    for (size_t i = 0; i < OPS; i++) found += STlookup(TABLES[0], NAMES[PICKS[i] % (3 * SCOPE_SIZE)]) != NULL;
+    SINK = found;
+}
+
+static void setup_scope_tree(void) {
+    SCOPES[0] = STnew(NULL, NULL);
+    for (size_t i = 0; i < GLOBAL_COUNT; i++) {
+        STinsert(SCOPES[0], NAMES[NAME_COUNT - 1 - i], SBfromVar(NAMES[NAME_COUNT - 1 - i], VT_NUM, false));
+    }
+
+    // Locals of the function, of a nested function and a for-loop counter
+    SCOPES[1] = STnew(SCOPES[0], NULL);
+    for (size_t i = 0; i < SCOPE_SIZE; i++) STinsert(SCOPES[1], NAMES[8 + i], SBfromVar(NAMES[8 + i], VT_NUM, false));
+    SCOPES[2] = STnew(SCOPES[1], NULL);
+    for (size_t i = 0; i < SCOPE_SIZE / 2; i++) STinsert(SCOPES[2], NAMES[1 + i], SBfromVar(NAMES[1 + i], VT_NUM, false));
+    SCOPES[3] = STnew(SCOPES[2], NULL);
+    STinsert(SCOPES[3], NAMES[0], SBfromVar(NAMES[0], VT_NUM, false));
+}
+
+static void run_scope_tree(void) {
+    size_t found = 0;
+    for (size_t i = 0; i < OPS; i++) {
+        // Mostly locals, a fifth globals and a few unknown names
+        const size_t r = PICKS[i] % 20;
+        const char* name;
+        if (r < 15) name = NAMES[PICKS[i] % (8 + SCOPE_SIZE)];
+        else if (r < 19) name = NAMES[NAME_COUNT - 1 - PICKS[i] % GLOBAL_COUNT];
+        else name = NAMES[NAME_COUNT / 2 + PICKS[i] % 64];
+        found += ScopeTreeFind(SCOPES[3], (char*) name) != NULL;
+    }
+    SINK = found;
+}
+
+static void teardown_scope_tree(void) {
+    for (size_t i = 0; i < 4; i++) STfree(&SCOPES[i]);
+}
+
+/* Instruction mix of the bytecode generation: loads and stores dominate */
+static const char* INSTR_MIX[][3] = {
+    {"iload", "0", NULL}, {"iload", "1", NULL}, {"iloadc", "3", NULL}, {"iadd", NULL, NULL},
+    {"istore", "2", NULL}, {"iload_0", NULL, NULL}, {"iloadc_1", NULL, NULL}, {"ilt", NULL, NULL},
+    {"branch_f", "_lab12_end", NULL}, {"isr", NULL, NULL}, {"jsr", "2", "fib"}, {"ireturn", NULL, NULL},
+    {"floadc", "5", NULL}, {"fmul", NULL, NULL}, {"iinc_1", "0", NULL}, {"jump", "_lab11_while_loop_start", NULL},
+};
+#define INSTR_MIX_SIZE (sizeof(INSTR_MIX) / sizeof(INSTR_MIX[0]))
+
+static void setup_assembly(void) {
+    ASSEMBLY = MEMmalloc(sizeof(Assembly));
+    ASMinit(ASSEMBLY);
+}
+
+static void run_emit(void) {
+    for (size_t i = 0; i < OPS; i++) {
+        const char** instr = INSTR_MIX[PICKS[i] % INSTR_MIX_SIZE];
+        ASMemitInstr(ASSEMBLY, instr[0], instr[1], instr[2], NULL);
+    }
+}
+
+static void teardown_assembly(void) {
+    Assembly* assembly = ASSEMBLY;
+    ASMfree(&ASSEMBLY);
+    MEMfree(assembly);
+}
+
+static void setup_constants(void) {
+    setup_assembly();
+    char buf[MAX_STR_LEN];
+    for (size_t i = 0; i < CONST_POOL_SIZE; i++) {
+        snprintf(buf, MAX_STR_LEN, "%lu", i * 3);
+        ASMemitConst(ASSEMBLY, "int", buf);
+    }
+
+    // Small values are the common ones, values off the multiples of three miss
+    for (size_t i = 0; i < CONST_POOL_SIZE * 3; i++) snprintf(CONST_VALUES[i], 8, "%lu", i);
+}
+
+static void run_find_constant(void) {
+    size_t found = 0;
+    for (size_t i = 0; i < OPS; i++) {
+        found += ASMfindConstant(ASSEMBLY, CONST_VALUES[PICKS[i] % (CONST_POOL_SIZE * 3)]).get != NULL;
+    }
+    SINK = found;
+}
+
+/* Functions of civic.h followed by imports of a user module */
+static const char* IMPORTS[] = {"printInt", "printFloat", "scanInt", "scanFloat", "printSpaces",
+    "printNewlines", "matrixRead", "matrixPrint", "vectorNorm", "randomInt"};
+#define IMPORT_COUNT (sizeof(IMPORTS) / sizeof(IMPORTS[0]))
+
+static void setup_imports(void) {
+    setup_assembly();
+    for (size_t i = 0; i < IMPORT_COUNT; i++) ASMemitFunImport(ASSEMBLY, (char*) IMPORTS[i], "void", 1, NULL);
+}
+
+static void run_find_import(void) {
+    size_t found = 0;
+    for (size_t i = 0; i < OPS; i++) found += ASMfindFunImport(ASSEMBLY, IMPORTS[PICKS[i] % IMPORT_COUNT]).get != NULL;
+    SINK = found;
+}
+
+static void run_label_name(void) {
+    static const char* kinds[] = {"else", "end", "while_loop_start", "while_loop_end", "false", "fill_loop"};
+    for (size_t i = 0; i < OPS; i++) {
+        char* label = generate_label_name(STRcpy(kinds[PICKS[i] % 6]));
+        MEMfree(label);
+    }
+}
+
+static void setup_write(void) {
+    setup_constants();
+    char name[MAX_STR_LEN];
+    for (size_t i = 0; i < OPS; i++) {
+        if (i % INSTRS_PER_FUN == 0) {
+            snprintf(name, MAX_STR_LEN, "fun%lu", i / INSTRS_PER_FUN);
+            ASMemitLabel(ASSEMBLY, name, true);
+            ASMemitFunExport(ASSEMBLY, name, "int", 0, NULL);
+        }
+        const char** instr = INSTR_MIX[PICKS[i] % INSTR_MIX_SIZE];
+        ASMemitInstr(ASSEMBLY, instr[0], instr[1], instr[2], NULL);
+    }
+}
+
+static void run_write(void) {
+    write_assembly(DEVNULL, ASSEMBLY, false);
+    fflush(DEVNULL);
+}
+
+static const Bench BENCHES[] = {
+    {"STinsert", setup_insert, run_insert, teardown_tables},
+    {"STlookup", setup_lookup, run_lookup, teardown_tables},
+    {"ScopeTreeFind", setup_scope_tree, run_scope_tree, teardown_scope_tree},
+    {"ASMemitInstr", setup_assembly, run_emit, teardown_assembly},
+    {"ASMfindConstant", setup_constants, run_find_constant, teardown_assembly},
+    {"ASMfindFunImport", setup_imports, run_find_import, teardown_assembly},
+    {"generate_label_name", NULL, run_label_name, NULL},
+    {"write_assembly", setup_write, run_write, teardown_assembly},
+};
+#define BENCH_COUNT (sizeof(BENCHES) / sizeof(BENCHES[0]))
+
+typedef struct Result {
+    double ns_per_op;
+    double allocs_per_op;
+} Result;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Runs a benchmark repeatedly, the fastest run counts
+ * @param bench benchmark to run
+ * @param repeat amount of runs
+ * @return time and allocations per operation
+ */
+static Result measure(const Bench* bench, const size_t repeat) {
+    uint64_t best = UINT64_MAX;
+    size_t allocs = 0;
+    for (size_t r = 0; r < repeat; r++) {
+        if (bench->setup != NULL) bench->setup();
+
+        const size_t allocs_before = ALLOC_COUNT;
+        const uint64_t start = now_ns();
+        bench->run();
+        const uint64_t elapsed = now_ns() - start;
+        allocs = ALLOC_COUNT - allocs_before;
+
+        if (bench->teardown != NULL) bench->teardown();
+        if (elapsed < best) best = elapsed;
+    }
+
+    return (Result) {(double) best / (double) OPS, (double) allocs / (double) OPS};
+}
+
+/**
+ * Finds the baseline of a benchmark
+ * @param f opened baseline file, lines of name, ns/op and allocations/op
+ * @param name benchmark name
+ * @param base output parameter receiving the baseline
+ * @return whether the benchmark has a baseline
+ */
+static bool find_baseline(FILE* f, const char* name, Result* base) {
+    char line[256], entry[MAX_STR_LEN];
+    rewind(f);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%99s %lf %lf", entry, &base->ns_per_op, &base->allocs_per_op) == 3
+                && strcmp(entry, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage(const char* program) {
+    printf("Usage: %s [OPTION...] [benchmark...]\n", program);
+    printf("Options:\n");
+    printf("  -n <ops>       Operations per run (default %d).\n", DEFAULT_OPS);
+    printf("  -r <repeat>    Runs per benchmark, the fastest one counts (default %d).\n", DEFAULT_REPEAT);
+    printf("  -b <baseline>  Fail when a benchmark allocates more or is slower than its baseline.\n");
+    printf("  -t <percent>   Slowdown accepted against the baseline (default 10).\n");
+    printf("  -w <baseline>  Write the measurements as a new baseline.\n");
+    printf("Benchmarks:");
+    for (size_t i = 0; i < BENCH_COUNT; i++) printf(" %s", BENCHES[i].name);
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    OPS = DEFAULT_OPS;
+    size_t repeat = DEFAULT_REPEAT;
+    double tolerance = 10;
+    const char* baseline_file = NULL;
+    const char* write_file = NULL;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        const char opt = argv[arg][1];
+        if (opt == 'h') {
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (arg + 1 >= argc || strchr("nrbtw", opt) == NULL || argv[arg][2] != '\0') {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        const char* value = argv[++arg];
+        switch (opt) {
+            case 'n': OPS = strtoul(value, NULL, 10); break;
+            case 'r': repeat = strtoul(value, NULL, 10); break;
+            case 'b': baseline_file = value; break;
+            case 't': tolerance = strtod(value, NULL); break;
+            case 'w': write_file = value; break;
+            default: break;
+        }
+    }
+    if (OPS == 0 || repeat == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* baseline = NULL;
+    if (baseline_file != NULL && (baseline = fopen(baseline_file, "r")) == NULL) {
+        fprintf(stderr, "Could not open baseline %s\n", baseline_file);
+        return EXIT_FAILURE;
+    }
+    FILE* out = NULL;
+    if (write_file != NULL) {
+        if ((out = fopen(write_file, "w")) == NULL) {
+            fprintf(stderr, "Could not write baseline %s\n", write_file);
+            return EXIT_FAILURE;
+        }
+        fprintf(out, "# benchmark ns/op allocs/op\n");
+    }
+
+    DEVNULL = fopen("/dev/null", "w");
+    generate_names();
+    PICKS = MEMmalloc(sizeof(size_t) * OPS);
+    for (size_t i = 0; i < OPS; i++) PICKS[i] = pick_skewed(NAME_COUNT);
+
+#ifndef COUNT_ALLOCS
+    fprintf(stderr, "Built without COUNT_ALLOCS, allocations are not counted\n");
+#endif // COUNT_ALLOCS
+
+    size_t failed = 0;
+    printf("%-20s %10s %12s\n", "benchmark", "ns/op", "allocs/op");
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        const Bench* bench = &BENCHES[i];
+
+        // Without arguments every benchmark runs, otherwise only the named ones
+        bool selected = arg == argc;
+        for (int k = arg; k < argc; k++) selected |= strcmp(argv[k], bench->name) == 0;
+        if (!selected) continue;
+
+        const Result res = measure(bench, repeat);
+        printf("%-20s %10.1f %12.2f", bench->name, res.ns_per_op, res.allocs_per_op);
+        if (out != NULL) fprintf(out, "%s %.1f %.2f\n", bench->name, res.ns_per_op, res.allocs_per_op);
+
+        Result base;
+        if (baseline != NULL && find_baseline(baseline, bench->name, &base)) {
+            // Allocations are deterministic, time gets the tolerance
+            if (res.allocs_per_op > base.allocs_per_op + 0.005) {
+                printf("  allocs %.2f > %.2f", res.allocs_per_op, base.allocs_per_op);
+                failed++;
+            } else if (res.ns_per_op > base.ns_per_op * (1 + tolerance / 100)) {
+                printf("  slower than %.1f", base.ns_per_op);
+                failed++;
+            }
+        }
+        printf("\n");
+    }
+
+    if (baseline != NULL) fclose(baseline);
+    if (out != NULL) fclose(out);
+    fclose(DEVNULL);
+    for (size_t i = 0; i < NAME_COUNT; i++) MEMfree(NAMES[i]);
+    MEMfree(PICKS);
+
+    if (failed > 0) {
+        printf("%lu benchmarks regressed\n", failed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
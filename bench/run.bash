@@ -0,0 +1,116 @@
+#!/usr/bin/env bash
+
+# Runtime benchmark of CiviC kernels. Every kernel <name>.cvc has its expected
+# output in <name>.expected and its instruction counts in baseline.txt: the
+# instructions civicc emits and the instructions the VM executes. A kernel
+# fails when its output differs or a count grows beyond the baseline.
+#
+# Usage: run.bash <civicc> [kernel...]
+# Environment:
+#   TOOLCHAIN        directory with civas and civvm, only emitted counts are checked
+#   CIVVM_LITE       civvm-lite, also checks executed counts (used without TOOLCHAIN)
+#   TOLERANCE        growth in percent that is still accepted (default 0)
+#   UPDATE_BASELINE  when 1, writes the measured counts to baseline.txt
+
+CIVCC=$1
+shift
+if [[ -z "$CIVCC" ]]; then
+    echo "Usage: $0 <civicc> [kernel...]"
+    exit 1
+fi
+
+cd "$(dirname "$0")" || exit 1
+
+if [[ -z "${TOOLCHAIN}" ]]; then
+    CIVRUN="$(command -v civrun)"
+    if [[ -n "${CIVRUN}" ]]; then
+        TOOLCHAIN="$(dirname "$CIVRUN")"
+    elif [[ -z "${CIVVM_LITE}" ]]; then
+        echo "Could not find civvm, rerun with TOOLCHAIN=<TOOLCHAIN_DIR> or CIVVM_LITE=<civvm-lite>"
+        exit 1
+    fi
+fi
+
+KERNELS=${*:-$(ls *.cvc | sed 's/\.cvc$//')}
+TOLERANCE=${TOLERANCE-0}
+BASELINE=baseline.txt
+ALIGN=20
+
+# Prints the baseline count of a kernel, field 2 is emitted and 3 executed
+function baseline {
+    awk -v k="$1" -v f="$2" '$1 == k { print $f }' "$BASELINE" 2> /dev/null
+}
+
+# Checks a measured count against its baseline, prints a note and returns 1 on regression
+function check_count {
+    local what=$1 measured=$2 base=$3
+    if [[ -z "$base" || "$base" == "-" || "$measured" == "-" ]]; then
+        return 0
+    fi
+    if awk -v m="$measured" -v b="$base" -v t="$TOLERANCE" 'BEGIN { exit !(m > b * (1 + t / 100)) }'; then
+        printf " %s %s > %s" "$what" "$measured" "$base"
+        return 1
+    fi
+    if [[ $measured -lt $base ]]; then
+        printf " %s improved %s < %s" "$what" "$measured" "$base"
+    fi
+    return 0
+}
+
+failed=0
+results=""
+printf "%-${ALIGN}s %10s %12s\n" "kernel" "emitted" "executed"
+
+for kernel in $KERNELS; do
+    printf "%-${ALIGN}s " "$kernel"
+
+    if ! "$CIVCC" --stats -o "$kernel.s" "$kernel.cvc" > "$kernel.stats" 2> "$kernel.err"; then
+        echo "compilation failed"
+        cat "$kernel.err"
+        failed=$((failed + 1))
+        continue
+    fi
+    emitted=$(awk '$1 == "total" { print $2; exit }' "$kernel.stats")
+
+    executed="-"
+    if [[ -n "${TOOLCHAIN}" ]]; then
+        "${TOOLCHAIN}/civas" -o "$kernel.o" "$kernel.s" && "${TOOLCHAIN}/civvm" "$kernel.o" > "$kernel.out" 2> "$kernel.err"
+    else
+        "${CIVVM_LITE}" --count "$kernel.s" > "$kernel.out" 2> "$kernel.err"
+        executed=$(awk '/^executed instructions:/ { print $3 }' "$kernel.err")
+    fi
+    printf "%10s %12s" "$emitted" "$executed"
+    results="$results$kernel $emitted $executed\n"
+
+    ok=1
+    if ! diff -q "$kernel.out" "$kernel.expected" > /dev/null 2>&1; then
+        printf " output differs"
+        ok=0
+    fi
+    check_count emitted "$emitted" "$(baseline "$kernel" 2)" || ok=0
+    check_count executed "$executed" "$(baseline "$kernel" 3)" || ok=0
+    echo
+
+    if [[ $ok -eq 0 ]]; then
+        failed=$((failed + 1))
+    fi
+    rm -f "$kernel.s" "$kernel.o" "$kernel.out" "$kernel.err" "$kernel.stats"
+done
+
+if [[ "${UPDATE_BASELINE}" == "1" ]]; then
+    # Kernels that did not run keep their old counts
+    old=$(awk -v run=" $(echo $KERNELS) " '!/^#/ && index(run, " " $1 " ") == 0' "$BASELINE" 2> /dev/null)
+    {
+        echo "# kernel emitted executed"
+        printf "$results"
+        [[ -n "$old" ]] && echo "$old"
+    } | sort > "$BASELINE.tmp"
+    mv "$BASELINE.tmp" "$BASELINE"
+    echo "Wrote $BASELINE"
+    exit 0
+fi
+
+if [[ $failed -gt 0 ]]; then
+    echo "$failed kernels regressed"
+    exit 1
+fi
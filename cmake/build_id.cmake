@@ -0,0 +1,27 @@
+# Writes OUTPUT, a header defining CIVICC_BUILD_ID as a hash of the compiler
+# sources and BUILD_CONFIG. Compile caches and incremental state are keyed on it,
+# so nothing written by one build is reused by another. Runs in script mode on
+# every build; the header is only rewritten, and its users only recompiled,
+# when the hash changes.
+#
+# Usage: cmake -DSOURCE_DIR=<repo> -DOUTPUT=<header> -DBUILD_CONFIG=<text> -P build_id.cmake
+
+file(GLOB_RECURSE SOURCES RELATIVE "${SOURCE_DIR}" "${SOURCE_DIR}/src/*" "${SOURCE_DIR}/CMakeLists.txt")
+list(SORT SOURCES)
+
+set(DIGEST "${BUILD_CONFIG}")
+foreach(SOURCE ${SOURCES})
+    file(SHA256 "${SOURCE_DIR}/${SOURCE}" HASH)
+    string(APPEND DIGEST "\n${SOURCE} ${HASH}")
+endforeach()
+string(SHA256 ID "${DIGEST}")
+string(SUBSTRING "${ID}" 0 32 ID)
+
+set(CONTENT "// Generated by cmake/build_id.cmake\n#define CIVICC_BUILD_ID \"${ID}\"\n")
+set(OLD "")
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" OLD)
+endif()
+if(NOT OLD STREQUAL CONTENT)
+    file(WRITE "${OUTPUT}" "${CONTENT}")
+endif()
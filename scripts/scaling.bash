@@ -0,0 +1,177 @@
+#!/usr/bin/env bash
+
+# Compile-time scaling benchmark. Generates CiviC programs that grow along a
+# single axis, times civicc on each size and fits time = a * n^b on a log-log
+# scale. Fails when the exponent b of any axis exceeds MAX_EXPONENT.
+#
+# Usage: scaling.bash <civicc> [axis...]
+# Environment:
+#   BASE          smallest size of every axis, multiplied by 2 per step (default 500)
+#   STEPS         amount of sizes per axis (default 4)
+#   REPEAT        runs per size, the fastest one counts (default 3)
+#   MAX_EXPONENT  largest accepted exponent (default 1.3)
+#   WORK_DIR      where programs are generated (default a temporary directory)
+
+CIVCC=$1
+shift
+if [[ -z "$CIVCC" || ! -x "$CIVCC" ]]; then
+    echo "Usage: $0 <civicc> [axis...]"
+    exit 1
+fi
+
+AXES=${*:-functions nesting globals array_literal statements constants}
+BASE=${BASE-500}
+STEPS=${STEPS-4}
+REPEAT=${REPEAT-3}
+MAX_EXPONENT=${MAX_EXPONENT-1.3}
+
+if [[ -z "$WORK_DIR" ]]; then
+    WORK_DIR=$(mktemp -d)
+    trap 'rm -rf "$WORK_DIR"' EXIT
+fi
+mkdir -p "$WORK_DIR"
+
+# N functions, all called from main
+function gen_functions {
+    for ((i = 0; i < $1; i++)); do
+        echo "int f$i(int x) { return x + $i; }"
+    done
+    echo "export int main() {"
+    echo "    int s = 0;"
+    for ((i = 0; i < $1; i++)); do
+        echo "    s = f$i(s);"
+    done
+    echo "    return s;"
+    echo "}"
+}
+
+# If statements nested N deep
+function gen_nesting {
+    echo "export int main() {"
+    echo "    int s = 0;"
+    for ((i = 0; i < $1; i++)); do
+        echo "if (s < $i) { s = s + 1;"
+    done
+    for ((i = 0; i < $1; i++)); do
+        echo "}"
+    done
+    echo "    return s;"
+    echo "}"
+}
+
+# N initialised globals
+function gen_globals {
+    for ((i = 0; i < $1; i++)); do
+        echo "int g$i = $i;"
+    done
+    echo "export int main() {"
+    echo "    return g0 + g$(($1 - 1));"
+    echo "}"
+}
+
+# An array literal of N elements
+function gen_array_literal {
+    echo "export int main() {"
+    printf "    int[%d] a = [0" "$1"
+    for ((i = 1; i < $1; i++)); do
+        printf ", %d" "$i"
+    done
+    echo "];"
+    echo "    return a[$(($1 - 1))];"
+    echo "}"
+}
+
+# N statements reusing the same few constants
+function gen_statements {
+    echo "export int main() {"
+    echo "    int s = 0;"
+    for ((i = 0; i < $1; i++)); do
+        echo "    s = s + $((i % 4));"
+    done
+    echo "    return s;"
+    echo "}"
+}
+
+# N statements with a distinct constant each
+function gen_constants {
+    echo "export int main() {"
+    echo "    int s = 0;"
+    for ((i = 0; i < $1; i++)); do
+        echo "    s = s + $((i * 7 + 1000));"
+    done
+    echo "    return s;"
+    echo "}"
+}
+
+# Prints the current time in microseconds
+function now_us {
+    if [[ -n "$EPOCHREALTIME" ]]; then
+        local t=${EPOCHREALTIME/[.,]/}
+        echo $((10#$t))
+    else
+        echo $(($(date +%s%N) / 1000))
+    fi
+}
+
+# Prints the fastest of REPEAT compilations of a file in microseconds
+function time_compile {
+    local best=""
+    for ((r = 0; r < REPEAT; r++)); do
+        local start=$(now_us)
+        if ! "$CIVCC" -o "$WORK_DIR/out.s" "$1" > /dev/null 2> "$WORK_DIR/err.txt"; then
+            echo "civicc failed on $1:" >&2
+            head -5 "$WORK_DIR/err.txt" >&2
+            return 1
+        fi
+        local elapsed=$(($(now_us) - start))
+        if [[ -z "$best" || $elapsed -lt $best ]]; then best=$elapsed; fi
+    done
+    echo "$best"
+}
+
+echo "export int main() { return 0; }" > "$WORK_DIR/empty.cvc"
+startup=$(time_compile "$WORK_DIR/empty.cvc") || exit 1
+printf "%-16s %10s %12s\n" "axis" "size" "time (ms)"
+printf "%-16s %10s %12.1f\n" "startup" "-" "$(echo "$startup" | awk '{ print $1 / 1000 }')"
+
+failed=0
+for axis in $AXES; do
+    if ! declare -F "gen_$axis" > /dev/null; then
+        echo "Unknown axis $axis"
+        exit 1
+    fi
+
+    points=""
+    n=$BASE
+    for ((step = 0; step < STEPS; step++)); do
+        file="$WORK_DIR/${axis}_$n.cvc"
+        "gen_$axis" "$n" > "$file"
+        t=$(time_compile "$file") || exit 1
+        printf "%-16s %10d %12.1f\n" "$axis" "$n" "$(echo "$t" | awk '{ print $1 / 1000 }')"
+        points="$points $n $t"
+        n=$((n * 2))
+    done
+
+    # Least squares fit of log(time - startup) against log(size)
+    exponent=$(echo "$points" | awk -v startup="$startup" '{
+        for (i = 1; i < NF; i += 2) {
+            t = $(i + 1) - startup
+            if (t < 1) t = 1
+            x = log($i); y = log(t)
+            n++; sx += x; sy += y; sxx += x * x; sxy += x * y
+        }
+        printf "%.2f", (n * sxy - sx * sy) / (n * sxx - sx * sx)
+    }')
+
+    if awk -v e="$exponent" -v max="$MAX_EXPONENT" 'BEGIN { exit !(e > max) }'; then
+        printf "%-16s exponent %s, more than %s\n" "$axis" "$exponent" "$MAX_EXPONENT"
+        failed=$((failed + 1))
+    else
+        printf "%-16s exponent %s\n" "$axis" "$exponent"
+    fi
+done
+
+if [[ $failed -gt 0 ]]; then
+    echo "$failed axes grow super-linearly"
+    exit 1
+fi
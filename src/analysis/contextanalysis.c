@@ -13,6 +13,7 @@
 
 #include "common.h"
 #include "global/globals.h"
+#include "optimisation/consteval.h"
 #include "symbol/scopetree.h"
 #include "symbol/table.h"
 
@@ -67,12 +68,12 @@ static size_t FUN_EXPORT_OFFSET = 0;
 } while (false)
 
 /**
- * Exits if one or more errors have occurred
+ * Fails the compilation if one or more errors have occurred
  */
-static void exit_if_error() {
+static void fail_if_error() {
     if (HAD_ERROR) {
         USER_ERROR("One or multiple errors occurred, exiting...");
-        exit(1);
+        global.had_error = true;
     }
 }
 
@@ -134,6 +135,21 @@ static size_t count_ids(node_st* ids_node) {
     return count;
 }
 
+/**
+ * Counts the values of an arrexpr, including those of nested arrexprs
+ * @param node arrexpr node
+ * @return amount of values stored by the arrexpr
+ */
+static size_t count_arrexpr_values(node_st* node) {
+    size_t count = 0;
+
+    for (node_st* exprs = ARREXPR_EXPRS(node); exprs != NULL; exprs = EXPRS_NEXT(exprs)) {
+        node_st* expr = EXPRS_EXPR(exprs);
+        count += NODE_TYPE(expr) == NT_ARREXPR ? count_arrexpr_values(expr) : 1;
+    }
+    return count;
+}
+
 /**
  * Counts the amount of parameters. For any array, its dimension identifiers are also counted as a parameter.
  * @param param_node starting parameter node
@@ -342,6 +358,17 @@ void CTAfini() {  }
  */
 node_st *CTAprogram(node_st *node)
 {
+    if (global.had_error) return node;
+
+    // Analysis runs again after functions were specialised, so start from scratch
+    HAD_ERROR = false;
+    HAD_RETURN = false;
+    INDEXING_ARRAY = false;
+    GLOBAL_VAR_OFFSET = 0;
+    FUN_IMPORT_OFFSET = 0;
+    VAR_IMPORT_OFFSET = 0;
+    FUN_EXPORT_OFFSET = 0;
+
     CURRENT_SCOPE = STnew(NULL, NULL);
     GB_GLOBAL_SCOPE = CURRENT_SCOPE;
 
@@ -355,11 +382,8 @@ node_st *CTAprogram(node_st *node)
     PASS = ANALYSIS_PASS;
     TRAVchildren(node);
 
-    // Exit here if an analysis error occurred
-    exit_if_error();
-
-    // If there are globals, we need an __init function in the bytecode
-    GB_REQUIRES_INIT_FUNCTION = GLOBAL_VAR_OFFSET > 0;
+    // Later phases skip the program if an analysis error occurred
+    fail_if_error();
 
     return node;
 }
@@ -508,6 +532,9 @@ node_st *CTAfuncall(node_st *node)
 
     MEMfree(types);
 
+    // Add symbol to AST to retrieve in later traversals
+    FUNCALL_SYMBOL(node) = s;
+
     // Last type is function return type
     LAST_TYPE = s->vtype;
     return node;
@@ -802,29 +829,6 @@ node_st *CTAglobdef(node_st *node)
 
         s->as.array.dim_count = n_dims;
         s->as.array.dims = ids;
-
-        if (GLOBDEF_INIT(node) != NULL && NODE_TYPE(GLOBDEF_INIT(node)) != NT_ARREXPR) {
-            // Create hidden array variables for scalar initialisation
-            char* scalar_symbol_name = safe_concat_str(STRcpy("_scalar_"), STRcpy(s->name));
-            char* counter_symbol_name = safe_concat_str(STRcpy("_counter_"), STRcpy(s->name));
-            char* size_symbol_name = safe_concat_str(STRcpy("_size_"), STRcpy(s->name));
-
-            Symbol* scalar_symbol = SBfromVar(scalar_symbol_name, VT_NUM, false);
-            Symbol* counter_symbol = SBfromVar(scalar_symbol_name, VT_NUM, false);
-            Symbol* size_symbol = SBfromVar(scalar_symbol_name, VT_NUM, false);
-
-            scalar_symbol->offset = GLOBAL_VAR_OFFSET++;
-            counter_symbol->offset = GLOBAL_VAR_OFFSET++;
-            size_symbol->offset = GLOBAL_VAR_OFFSET++;
-
-            STinsert(CURRENT_SCOPE, scalar_symbol_name, scalar_symbol);
-            STinsert(CURRENT_SCOPE, counter_symbol_name, counter_symbol);
-            STinsert(CURRENT_SCOPE, size_symbol_name, size_symbol);
-
-            MEMfree(scalar_symbol_name);
-            MEMfree(counter_symbol_name);
-            MEMfree(size_symbol_name);
-        }
     } else {
         s = SBfromVar(name, type, false);
     }
@@ -887,6 +891,42 @@ node_st *CTAparam(node_st *node)
     return node;
 }
 
+/**
+ * Creates the hidden variables needed to initialise a local array. Arrexprs
+ * with more values than are stored unrolled need a running index. For scalars,
+ * literal values are not stored, arrays of known size need no size variable
+ * and small arrays need no loop counter.
+ * Filling with zero needs nothing, as new arrays are already zeroed.
+ * @param arr array symbol
+ * @param dims first exprs node of the array dimensions
+ * @param init initialisation expression
+ */
+static void add_fill_vars(const Symbol* arr, node_st* dims, node_st* init) {
+    const char* prefixes[3];
+    size_t n_vars = 0;
+
+    ConstValue v;
+    size_t size;
+    const bool is_literal = CEfromLiteral(init, &v);
+    const bool known_size = CEarraySize(dims, &size);
+
+    if (NODE_TYPE(init) == NT_ARREXPR) {
+        if (count_arrexpr_values(init) > FILL_UNROLL_LIMIT) prefixes[n_vars++] = "_counter_";
+    } else if (!is_literal || !CEisZero(v)) {
+        if (!is_literal) prefixes[n_vars++] = "_scalar_";
+        if (!known_size || size > FILL_UNROLL_LIMIT) prefixes[n_vars++] = "_counter_";
+        if (!known_size) prefixes[n_vars++] = "_size_";
+    }
+
+    for (size_t i = 0; i < n_vars; i++) {
+        char* var_name = STRfmt("%s%s", prefixes[i], arr->name);
+        Symbol* var = SBfromVar(var_name, VT_NUM, false);
+        var->offset = CURRENT_SCOPE->localvar_offset_counter++;
+        STinsert(CURRENT_SCOPE, var_name, var);
+        MEMfree(var_name);
+    }
+}
+
 /**
  * @fn CTAvardecl
  */
@@ -918,27 +958,8 @@ node_st *CTAvardecl(node_st *node)
         s->as.array.dim_count = n_dims;
         s->as.array.dims = ids;
 
-        if (VARDECL_INIT(node) != NULL && NODE_TYPE(VARDECL_INIT(node)) != NT_ARREXPR) {
-            // Create hidden array variables for scalar initialisation
-            char* scalar_symbol_name = safe_concat_str(STRcpy("_scalar_"), STRcpy(s->name));
-            char* counter_symbol_name = safe_concat_str(STRcpy("_counter_"), STRcpy(s->name));
-            char* size_symbol_name = safe_concat_str(STRcpy("_size_"), STRcpy(s->name));
-
-            Symbol* scalar_symbol = SBfromVar(scalar_symbol_name, VT_NUM, false);
-            Symbol* counter_symbol = SBfromVar(scalar_symbol_name, VT_NUM, false);
-            Symbol* size_symbol = SBfromVar(scalar_symbol_name, VT_NUM, false);
-
-            scalar_symbol->offset = CURRENT_SCOPE->localvar_offset_counter++;
-            counter_symbol->offset = CURRENT_SCOPE->localvar_offset_counter++;
-            size_symbol->offset = CURRENT_SCOPE->localvar_offset_counter++;
-
-            STinsert(CURRENT_SCOPE, scalar_symbol_name, scalar_symbol);
-            STinsert(CURRENT_SCOPE, counter_symbol_name, counter_symbol);
-            STinsert(CURRENT_SCOPE, size_symbol_name, size_symbol);
-
-            MEMfree(scalar_symbol_name);
-            MEMfree(counter_symbol_name);
-            MEMfree(size_symbol_name);
+        if (VARDECL_INIT(node) != NULL) {
+            add_fill_vars(s, first_expr, VARDECL_INIT(node));
         }
     } else {
         s = SBfromVar(name, type, false);
@@ -1118,11 +1139,14 @@ node_st *CTAvarlet(node_st *node)
     char* name = VARLET_NAME(node);
 
     // Look up variable
-    const Symbol* s = ScopeTreeFind(CURRENT_SCOPE, name);
+    Symbol* s = ScopeTreeFind(CURRENT_SCOPE, name);
 
     // Handle case of missing symbol
     HANDLE_MISSING_SYMBOL(name, s);
 
+    // Add symbol to AST to retrieve in later traversals
+    VARLET_SYMBOL(node) = s;
+
     // Find dimensions, represented as Exprs
     node_st* first_expr = VARLET_INDICES(node);
     const size_t n_dims = count_exprs(first_expr);
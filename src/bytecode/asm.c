@@ -11,6 +11,11 @@ void ASMinit(Assembly* assembly) {
     assembly->last_instr = NULL;
     assembly->init_instrs = NULL;
     assembly->last_init_instr = NULL;
+    assembly->init_local_count = 0;
+    assembly->consts = NULL;
+    assembly->last_const = NULL;
+    assembly->const_count = 0;
+    assembly->const_index = NULL;
     assembly->fun_exports = NULL;
     assembly->last_fun_export = NULL;
     assembly->var_exports = NULL;
@@ -21,10 +26,13 @@ void ASMinit(Assembly* assembly) {
     assembly->last_fun_import = NULL;
     assembly->var_imports = NULL;
     assembly->last_var_import = NULL;
+    assembly->range = (SourceRange) {0, 0, 0, 0};
 }
 
 static Instruction* new_instruction(Assembly* assembly) {
     Instruction* instr = MEMmalloc(sizeof(Instruction));
+    instr->arg0 = instr->arg1 = instr->arg2 = NULL;
+    instr->frame_slots = 0;
     instr->next = NULL;
     if (assembly->last_instr == NULL) {
         assembly->instrs = instr;
@@ -39,6 +47,8 @@ static Instruction* new_instruction(Assembly* assembly) {
 
 static Instruction* new_init_instruction(Assembly* assembly) {
     Instruction* instr = MEMmalloc(sizeof(Instruction));
+    instr->arg0 = instr->arg1 = instr->arg2 = NULL;
+    instr->frame_slots = 0;
     instr->next = NULL;
     if (assembly->last_init_instr == NULL) {
         assembly->init_instrs = instr;
@@ -56,10 +66,12 @@ static void free_instruction(Instruction* instr) {
     MEMfree(instr->arg0);
     MEMfree(instr->arg1);
     MEMfree(instr->arg2);
+    MEMfree(instr);
 }
 
 static Constant* new_constant(Assembly* assembly) {
     Constant* constant = MEMmalloc(sizeof(Constant));
+    constant->index = assembly->const_count++;
     constant->next = NULL;
 
     if (assembly->consts == NULL) assembly->consts = constant;
@@ -73,6 +85,7 @@ static Constant* new_constant(Assembly* assembly) {
 static void free_constant(Constant* constant) {
     MEMfree(constant->type);
     MEMfree(constant->value);
+    MEMfree(constant);
 }
 
 static FunExport* new_fun_export(Assembly* assembly) {
@@ -174,57 +187,66 @@ void ASMfree(Assembly** assembly_ptr) {
     // Free instructions
     Instruction* instr = assembly->instrs;
     while (instr != NULL) {
+        Instruction* next = instr->next;
         free_instruction(instr);
-        instr = instr->next;
+        instr = next;
     }
 
     // Free init instructions
     Instruction* init_inst = assembly->init_instrs;
     while (init_inst != NULL) {
+        Instruction* next = init_inst->next;
         free_instruction(init_inst);
-        init_inst = init_inst->next;
+        init_inst = next;
     }
 
     // Free constants
     Constant* constant = assembly->consts;
     while (constant != NULL) {
+        Constant* next = constant->next;
         free_constant(constant);
-        constant = constant->next;
+        constant = next;
     }
+    if (assembly->const_index != NULL) HTdelete(assembly->const_index);
 
     // Free function exports
     FunExport* fun_export = assembly->fun_exports;
     while (fun_export != NULL) {
+        FunExport* next = fun_export->next;
         free_fun_export(fun_export);
-        fun_export = fun_export->next;
+        fun_export = next;
     }
 
     // Free var exports
     VarExport* var_export = assembly->var_exports;
     while (var_export != NULL) {
+        VarExport* next = var_export->next;
         free_var_export(var_export);
-        var_export = var_export->next;
+        var_export = next;
     }
 
     // Free globvars
     GlobVar* globvar = assembly->glob_vars;
     while (globvar != NULL) {
+        GlobVar* next = globvar->next;
         free_globvar(globvar);
-        globvar = globvar->next;
+        globvar = next;
     }
 
     // Free fun imports
     FunImport* fun_import = assembly->fun_imports;
     while (fun_import != NULL) {
+        FunImport* next = fun_import->next;
         free_fun_import(fun_import);
-        fun_import = fun_import->next;
+        fun_import = next;
     }
 
     // Free var imports
     VarImport* var_import = assembly->var_imports;
     while (var_import != NULL) {
+        VarImport* next = var_import->next;
         free_var_import(var_import);
-        var_import = var_import->next;
+        var_import = next;
     }
 
     ASMinit(assembly);
@@ -239,6 +261,7 @@ void ASMemitInstr(Assembly* assembly, const char* instr_name, const char* arg0,
     instr->arg0 = arg0 ? STRcpy(arg0) : NULL;
     instr->arg1 = arg1 ? STRcpy(arg1) : NULL;
     instr->arg2 = arg2 ? STRcpy(arg2) : NULL;
+    instr->range = assembly->range;
 }
 
 void ASMemitInit(Assembly* assembly, const char* instr_name, const char* arg0, const char* arg1, const char* arg2) {
@@ -249,6 +272,7 @@ void ASMemitInit(Assembly* assembly, const char* instr_name, const char* arg0, c
     instr->arg0 = arg0 ? STRcpy(arg0) : NULL;
     instr->arg1 = arg1 ? STRcpy(arg1) : NULL;
     instr->arg2 = arg2 ? STRcpy(arg2) : NULL;
+    instr->range = assembly->range;
 }
 
 void ASMemitLabel(Assembly* assembly, const char* label, bool const is_fun) {
@@ -256,12 +280,24 @@ void ASMemitLabel(Assembly* assembly, const char* label, bool const is_fun) {
     instr->instr = STRcpy(label);
     instr->is_label = true;
     instr->is_fun = is_fun;
+    instr->range = assembly->range;
 }
 
-void ASMemitConst(Assembly* assembly, char* type, const char* val) {
+void ASMemitInitLabel(Assembly* assembly, const char* label) {
+    Instruction* instr = new_init_instruction(assembly);
+    instr->instr = STRcpy(label);
+    instr->is_label = true;
+    instr->is_fun = false;
+    instr->range = assembly->range;
+}
+
+void ASMemitConst(Assembly* assembly, const char* type, const char* val) {
     Constant* constant = new_constant(assembly);
-    constant->type = type;
+    constant->type = STRcpy(type);
     constant->value = STRcpy(val);
+
+    if (assembly->const_index == NULL) assembly->const_index = HTnew_String(CONSTTABLE_SIZE);
+    HTinsert(assembly->const_index, constant->value, constant);
 }
 
 void ASMemitFunExport(Assembly* assembly, const char* name, const char* ret_type, const size_t arglen, char** args) {
@@ -298,19 +334,11 @@ void ASMemitVarImport(Assembly* assembly, char* name, char* type) {
 }
 
 ConstEntry ASMfindConstant(const Assembly* assembly, const char* value) {
-    size_t idx = 0;
-    Constant* constant = assembly->consts;
-    while (constant != NULL) {
-        if (strcmp(constant->value, value) == 0) {
-            return (ConstEntry){idx, constant};
-        }
+    Constant* constant = assembly->const_index == NULL ? NULL : HTlookup(assembly->const_index, (void*) value);
+    if (constant != NULL) return (ConstEntry){constant->index, constant};
 
-        constant = constant->next;
-        idx++;
-    }
-
-    // Not found
-    return (ConstEntry){idx, NULL};
+    // Not found, a new constant would get the next offset
+    return (ConstEntry){assembly->const_count, NULL};
 }
 
 FunExportEntry ASMfindFunExport(const Assembly* assembly, const char* name) {
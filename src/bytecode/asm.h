@@ -14,11 +14,18 @@
  * - Variable export table
  */
 
+typedef struct SourceRange {  // Range of source code, line 0 if unknown
+    int line, col;
+    int end_line, end_col;
+} SourceRange;
+
 typedef struct Instruction {
     char* instr;                // Instruction string
     char* arg0, * arg1, * arg2; // Optional arguments for instruction
     bool is_label;              // Ugly hack to allow labels in the stream, instr will be label name
     bool is_fun;                // Function labels are prepended by a whitespace
+    SourceRange range;          // Source the instruction was generated from
+    size_t frame_slots;         // Function labels only, frame slots of the function
     struct Instruction* next;   // We won't be changing any instructions once they're generated
                                 // so with a linked list we avoid size checks
 } Instruction;
@@ -26,6 +33,7 @@ typedef struct Instruction {
 typedef struct Constant {
     char* type;
     char* value;
+    size_t index;               // Position in the constant pool
     struct Constant* next;
 } Constant;
 
@@ -67,8 +75,11 @@ typedef struct {
     Instruction* last_instr;
     Instruction* init_instrs;
     Instruction* last_init_instr;
+    size_t init_local_count;            // Amount of frame slots used by __init
     Constant* consts;
     Constant* last_const;
+    size_t const_count;
+    htable_st* const_index;             // Constant value to Constant, created on the first constant
     FunExport* fun_exports;
     FunExport* last_fun_export;
     VarExport* var_exports;
@@ -79,6 +90,7 @@ typedef struct {
     FunImport* last_fun_import;
     VarImport* var_imports;
     VarImport* last_var_import;
+    SourceRange range;                  // Source range given to new instructions
 } Assembly;
 
 typedef struct ConstEntry {             // Used for finding and retrieving values already written to ASM
@@ -102,7 +114,8 @@ void ASMfree(Assembly** assembly_ptr);
 void ASMemitInstr(Assembly* assembly, const char* instr_name, const char* arg0, const char* arg1, const char* arg2);
 void ASMemitInit(Assembly* assembly, const char* instr_name, const char* arg0, const char* arg1, const char* arg2);
 void ASMemitLabel(Assembly* assembly, const char* label, bool is_fun);
-void ASMemitConst(Assembly* assembly, char* type, const char* val);
+void ASMemitInitLabel(Assembly* assembly, const char* label);
+void ASMemitConst(Assembly* assembly, const char* type, const char* val);
 void ASMemitFunExport(Assembly* assembly, const char* name, const char* ret_type, size_t arglen, char** args);
 void ASMemitVarExport(Assembly* assembly, char* name, size_t glob_index);
 void ASMemitGlobVar(Assembly* assembly, char* type);
@@ -0,0 +1,448 @@
+// src/bytecode/binary.c
+
+#include "binary.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Larger counts only occur in corrupt files, reject them before allocating
+#define MAX_TABLE_LEN (1u << 24)
+
+static const char* TYPE_NAMES[BT_COUNT_] = {
+    [BT_INT] = "int",
+    [BT_FLOAT] = "float",
+    [BT_BOOL] = "bool",
+    [BT_VOID] = "void",
+    [BT_INT_ARRAY] = "int[]",
+    [BT_FLOAT_ARRAY] = "float[]",
+    [BT_BOOL_ARRAY] = "bool[]",
+};
+
+/**
+ * Gets the assembly name of a type
+ * @param type binary type
+ * @return type name as used in assembly directives
+ */
+const char* BINtypeName(const BinType type) {
+    return type < BT_COUNT_ ? TYPE_NAMES[type] : "?";
+}
+
+/**
+ * Finds the binary type belonging to an assembly type name
+ * @param name type name as used in assembly directives
+ * @param type output parameter receiving the type
+ * @return true if the type name is known
+ */
+bool BINfindType(const char* name, BinType* type) {
+    for (size_t i = 0; i < BT_COUNT_; i++) {
+        if (strcmp(TYPE_NAMES[i], name) == 0) {
+            *type = (BinType) i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void write_uint(FILE* f, uint64_t v) {
+    do {
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        if (v != 0) byte |= 0x80;
+        fputc(byte, f);
+    } while (v != 0);
+}
+
+static void write_int(FILE* f, const int64_t v) {
+    write_uint(f, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+}
+
+static void write_float(FILE* f, const float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    for (size_t i = 0; i < 4; i++) fputc((bits >> (8 * i)) & 0xff, f);
+}
+
+static void write_name(FILE* f, const char* name) {
+    const size_t len = strlen(name);
+    write_uint(f, len);
+    fwrite(name, 1, len, f);
+}
+
+static void write_funs(FILE* f, const BinFun* funs, const size_t count, const bool exported) {
+    write_uint(f, count);
+    for (size_t i = 0; i < count; i++) {
+        write_name(f, funs[i].name);
+        write_uint(f, funs[i].ret);
+        write_uint(f, funs[i].arg_count);
+        for (size_t j = 0; j < funs[i].arg_count; j++) write_uint(f, funs[i].args[j]);
+        if (exported) write_uint(f, funs[i].target);
+    }
+}
+
+/**
+ * Writes a module in the binary format
+ * @param f file opened in binary mode
+ * @param module module to write, with jump operands holding code indices
+ */
+void BINwrite(FILE* f, const BinModule* module) {
+    fwrite(BIN_MAGIC, 1, BIN_MAGIC_LEN, f);
+    write_uint(f, BIN_VERSION);
+
+    write_uint(f, module->const_count);
+    for (size_t i = 0; i < module->const_count; i++) {
+        const BinConst* c = &module->consts[i];
+        write_uint(f, c->type);
+        switch (c->type) {
+            case BT_FLOAT: write_float(f, c->as.f); break;
+            case BT_BOOL: write_uint(f, c->as.b); break;
+            default: write_int(f, c->as.i); break;
+        }
+    }
+
+    write_uint(f, module->global_count);
+    for (size_t i = 0; i < module->global_count; i++) write_uint(f, module->globals[i]);
+
+    write_funs(f, module->fun_imports, module->fun_import_count, false);
+
+    write_uint(f, module->var_import_count);
+    for (size_t i = 0; i < module->var_import_count; i++) {
+        write_name(f, module->var_imports[i].name);
+        write_uint(f, module->var_imports[i].type);
+    }
+
+    write_funs(f, module->fun_exports, module->fun_export_count, true);
+
+    write_uint(f, module->var_export_count);
+    for (size_t i = 0; i < module->var_export_count; i++) {
+        write_name(f, module->var_exports[i].name);
+        write_uint(f, module->var_exports[i].global_index);
+    }
+
+    write_uint(f, module->code_len);
+    for (size_t i = 0; i < module->code_len; i++) {
+        const BinInstr* instr = &module->code[i];
+        const OpInfo* info = &OPCODE_TABLE[instr->op];
+        write_uint(f, instr->op);
+        for (size_t j = 0; j < info->operand_count; j++) {
+            if (info->operands[j] == OPND_LABEL) write_int(f, (int64_t) instr->args[j] - (int64_t) i);
+            else write_int(f, instr->args[j]);
+        }
+    }
+
+    write_uint(f, module->stack_count);
+    for (size_t i = 0; i < module->stack_count; i++) {
+        write_uint(f, module->stacks[i].target);
+        write_uint(f, module->stacks[i].depth);
+    }
+}
+
+static bool read_uint(FILE* f, uint64_t* v) {
+    *v = 0;
+    for (size_t shift = 0; shift < 64; shift += 7) {
+        const int byte = fgetc(f);
+        if (byte == EOF) return false;
+        *v |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+static bool read_int(FILE* f, int64_t* v) {
+    uint64_t u;
+    if (!read_uint(f, &u)) return false;
+    *v = (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+    return true;
+}
+
+static bool read_count(FILE* f, size_t* count) {
+    uint64_t v;
+    if (!read_uint(f, &v) || v > MAX_TABLE_LEN) return false;
+    *count = (size_t) v;
+    return true;
+}
+
+static bool read_type(FILE* f, BinType* type) {
+    uint64_t v;
+    if (!read_uint(f, &v) || v >= BT_COUNT_) return false;
+    *type = (BinType) v;
+    return true;
+}
+
+static bool read_float(FILE* f, float* v) {
+    uint32_t bits = 0;
+    for (size_t i = 0; i < 4; i++) {
+        const int byte = fgetc(f);
+        if (byte == EOF) return false;
+        bits |= (uint32_t) byte << (8 * i);
+    }
+    memcpy(v, &bits, sizeof(bits));
+    return true;
+}
+
+static bool read_name(FILE* f, char** name) {
+    size_t len;
+    if (!read_count(f, &len)) return false;
+    *name = malloc(len + 1);
+    (*name)[len] = '\0';
+    return fread(*name, 1, len, f) == len;
+}
+
+static bool read_funs(FILE* f, BinFun** funs, size_t* count, const bool exported) {
+    if (!read_count(f, count)) return false;
+    *funs = calloc(*count, sizeof(BinFun));
+
+    for (size_t i = 0; i < *count; i++) {
+        BinFun* fun = &(*funs)[i];
+        if (!read_name(f, &fun->name) || !read_type(f, &fun->ret) || !read_count(f, &fun->arg_count)) return false;
+        fun->args = calloc(fun->arg_count, sizeof(BinType));
+        for (size_t j = 0; j < fun->arg_count; j++) {
+            if (!read_type(f, &fun->args[j])) return false;
+        }
+
+        uint64_t target = 0;
+        if (exported && !read_uint(f, &target)) return false;
+        fun->target = (size_t) target;
+    }
+
+    return true;
+}
+
+/**
+ * Reads the tables and code of a binary module, after its magic number
+ * @param f file positioned right after the magic number
+ * @param module module to fill
+ * @return false if the file is truncated or malformed
+ */
+static bool read_module(FILE* f, BinModule* module) {
+    uint64_t version;
+    if (!read_uint(f, &version) || version == 0 || version > BIN_VERSION) return false;
+
+    if (!read_count(f, &module->const_count)) return false;
+    module->consts = calloc(module->const_count, sizeof(BinConst));
+    for (size_t i = 0; i < module->const_count; i++) {
+        BinConst* c = &module->consts[i];
+        if (!read_type(f, &c->type)) return false;
+
+        int64_t v;
+        switch (c->type) {
+            case BT_FLOAT:
+                if (!read_float(f, &c->as.f)) return false;
+                break;
+            case BT_BOOL:
+                if (!read_int(f, &v)) return false;
+                c->as.b = v != 0;
+                break;
+            default:
+                if (!read_int(f, &v)) return false;
+                c->as.i = (int32_t) v;
+                break;
+        }
+    }
+
+    if (!read_count(f, &module->global_count)) return false;
+    module->globals = calloc(module->global_count, sizeof(BinType));
+    for (size_t i = 0; i < module->global_count; i++) {
+        if (!read_type(f, &module->globals[i])) return false;
+    }
+
+    if (!read_funs(f, &module->fun_imports, &module->fun_import_count, false)) return false;
+
+    if (!read_count(f, &module->var_import_count)) return false;
+    module->var_imports = calloc(module->var_import_count, sizeof(BinVar));
+    for (size_t i = 0; i < module->var_import_count; i++) {
+        if (!read_name(f, &module->var_imports[i].name) || !read_type(f, &module->var_imports[i].type)) return false;
+    }
+
+    if (!read_funs(f, &module->fun_exports, &module->fun_export_count, true)) return false;
+
+    if (!read_count(f, &module->var_export_count)) return false;
+    module->var_exports = calloc(module->var_export_count, sizeof(BinVar));
+    for (size_t i = 0; i < module->var_export_count; i++) {
+        uint64_t index;
+        if (!read_name(f, &module->var_exports[i].name) || !read_uint(f, &index)) return false;
+        module->var_exports[i].global_index = (size_t) index;
+    }
+
+    if (!read_count(f, &module->code_len)) return false;
+    module->code = calloc(module->code_len, sizeof(BinInstr));
+    for (size_t i = 0; i < module->code_len; i++) {
+        BinInstr* instr = &module->code[i];
+        uint64_t op;
+        if (!read_uint(f, &op) || op >= OP_COUNT_) return false;
+        instr->op = (Opcode) op;
+
+        const OpInfo* info = &OPCODE_TABLE[instr->op];
+        for (size_t j = 0; j < info->operand_count; j++) {
+            int64_t v;
+            if (!read_int(f, &v)) return false;
+            if (info->operands[j] == OPND_LABEL) {
+                v += (int64_t) i;
+                if (v < 0 || (uint64_t) v > module->code_len) return false;
+            }
+            instr->args[j] = (int32_t) v;
+        }
+    }
+
+    for (size_t i = 0; i < module->fun_export_count; i++) {
+        if (module->fun_exports[i].target > module->code_len) return false;
+    }
+
+    // Version 1 modules carry no stack depths
+    if (version < 2) return true;
+
+    if (!read_count(f, &module->stack_count)) return false;
+    module->stacks = calloc(module->stack_count, sizeof(BinStack));
+    for (size_t i = 0; i < module->stack_count; i++) {
+        uint64_t target, depth;
+        if (!read_uint(f, &target) || !read_uint(f, &depth) || target >= module->code_len) return false;
+        module->stacks[i] = (BinStack){(size_t) target, (size_t) depth};
+    }
+
+    return true;
+}
+
+/**
+ * Checks whether a file starts with the magic number of the binary format.
+ * The file is rewound afterwards.
+ * @param f file opened in binary mode
+ * @return true if the file is a binary module
+ */
+bool BINisBinary(FILE* f) {
+    char magic[BIN_MAGIC_LEN];
+    const bool is_binary = fread(magic, 1, BIN_MAGIC_LEN, f) == BIN_MAGIC_LEN
+        && memcmp(magic, BIN_MAGIC, BIN_MAGIC_LEN) == 0;
+    rewind(f);
+    return is_binary;
+}
+
+/**
+ * Reads a module in the binary format
+ * @param f file opened in binary mode
+ * @param module module to fill, to be freed with BINfree even if reading fails
+ * @return false if the file is not a valid binary module
+ */
+bool BINread(FILE* f, BinModule* module) {
+    memset(module, 0, sizeof(*module));
+
+    char magic[BIN_MAGIC_LEN];
+    if (fread(magic, 1, BIN_MAGIC_LEN, f) != BIN_MAGIC_LEN || memcmp(magic, BIN_MAGIC, BIN_MAGIC_LEN) != 0) {
+        return false;
+    }
+
+    return read_module(f, module);
+}
+
+static void print_fun_types(FILE* f, const BinFun* fun) {
+    fprintf(f, " %s", BINtypeName(fun->ret));
+    for (size_t i = 0; i < fun->arg_count; i++) fprintf(f, " %s", BINtypeName(fun->args[i]));
+}
+
+/**
+ * Prints a module as textual assembly that loads into the same module.
+ * Exported functions keep their name as label, other jump targets are
+ * named after their code index.
+ * @param f file to write to
+ * @param module module to print
+ */
+void BINdisassemble(FILE* f, const BinModule* module) {
+    const char** labels = calloc(module->code_len + 1, sizeof(char*));
+    bool* is_target = calloc(module->code_len + 1, sizeof(bool));
+
+    for (size_t i = 0; i < module->fun_export_count; i++) {
+        labels[module->fun_exports[i].target] = module->fun_exports[i].name;
+    }
+    for (size_t i = 0; i < module->code_len; i++) {
+        const OpInfo* info = &OPCODE_TABLE[module->code[i].op];
+        for (size_t j = 0; j < info->operand_count; j++) {
+            if (info->operands[j] == OPND_LABEL) is_target[module->code[i].args[j]] = true;
+        }
+    }
+
+    // Depth plus one per function entry, 0 where unknown
+    size_t* stacks = calloc(module->code_len + 1, sizeof(size_t));
+    for (size_t i = 0; i < module->stack_count; i++) stacks[module->stacks[i].target] = module->stacks[i].depth + 1;
+
+    for (size_t i = 0; i <= module->code_len; i++) {
+        if (labels[i] != NULL) fprintf(f, "%s%s:\n", i > 0 ? "\n" : "", labels[i]);
+        else if (is_target[i]) fprintf(f, "_L%lu:\n", i);
+        if (i == module->code_len) break;
+        if (stacks[i] > 0) fprintf(f, "    ; stack depth %lu\n", stacks[i] - 1);
+
+        const BinInstr* instr = &module->code[i];
+        const OpInfo* info = &OPCODE_TABLE[instr->op];
+        fprintf(f, "    %s", info->name);
+        for (size_t j = 0; j < info->operand_count; j++) {
+            if (info->operands[j] != OPND_LABEL) fprintf(f, " %d", instr->args[j]);
+            else if (labels[instr->args[j]] != NULL) fprintf(f, " %s", labels[instr->args[j]]);
+            else fprintf(f, " _L%d", instr->args[j]);
+        }
+        fprintf(f, "\n");
+    }
+    fprintf(f, "\n");
+
+    for (size_t i = 0; i < module->const_count; i++) {
+        const BinConst* c = &module->consts[i];
+        switch (c->type) {
+            case BT_FLOAT: fprintf(f, ".const float %.9g\n", c->as.f); break;
+            case BT_BOOL: fprintf(f, ".const bool %s\n", c->as.b ? "true" : "false"); break;
+            default: fprintf(f, ".const int %d\n", c->as.i); break;
+        }
+    }
+
+    for (size_t i = 0; i < module->fun_export_count; i++) {
+        const BinFun* fun = &module->fun_exports[i];
+        fprintf(f, ".exportfun \"%s\"", fun->name);
+        print_fun_types(f, fun);
+        fprintf(f, " %s\n", fun->name);
+    }
+
+    for (size_t i = 0; i < module->var_export_count; i++) {
+        fprintf(f, ".exportvar \"%s\" %lu\n", module->var_exports[i].name, module->var_exports[i].global_index);
+    }
+
+    for (size_t i = 0; i < module->global_count; i++) fprintf(f, ".global %s\n", BINtypeName(module->globals[i]));
+
+    for (size_t i = 0; i < module->fun_import_count; i++) {
+        fprintf(f, ".importfun \"%s\"", module->fun_imports[i].name);
+        print_fun_types(f, &module->fun_imports[i]);
+        fprintf(f, "\n");
+    }
+
+    for (size_t i = 0; i < module->var_import_count; i++) {
+        fprintf(f, ".importvar \"%s\" %s\n", module->var_imports[i].name, BINtypeName(module->var_imports[i].type));
+    }
+
+    free(labels);
+    free(is_target);
+    free(stacks);
+}
+
+static void free_funs(BinFun* funs, const size_t count) {
+    for (size_t i = 0; funs != NULL && i < count; i++) {
+        free(funs[i].name);
+        free(funs[i].args);
+    }
+    free(funs);
+}
+
+static void free_vars(BinVar* vars, const size_t count) {
+    for (size_t i = 0; vars != NULL && i < count; i++) free(vars[i].name);
+    free(vars);
+}
+
+/**
+ * Frees everything a module owns and clears it
+ * @param module module to free
+ */
+void BINfree(BinModule* module) {
+    free_funs(module->fun_imports, module->fun_import_count);
+    free_funs(module->fun_exports, module->fun_export_count);
+    free_vars(module->var_imports, module->var_import_count);
+    free_vars(module->var_exports, module->var_export_count);
+    free(module->code);
+    free(module->consts);
+    free(module->globals);
+    free(module->stacks);
+    memset(module, 0, sizeof(*module));
+}
@@ -0,0 +1,103 @@
+// src/bytecode/binary.h
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "opcodes.h"
+
+/**
+ * Binary module format, an alternative to the textual assembly that needs no
+ * lexing or label resolution when loading. All integers are LEB128 varints,
+ * signed ones zigzag encoded; floats are 4 little endian bytes. Layout:
+ *   magic "CIVB", version
+ *   constants       count, (type, value)*
+ *   globals         count, type*
+ *   function imports count, (name, return type, arg count, arg type*)*
+ *   variable imports count, (name, type)*
+ *   function exports count, (name, return type, arg count, arg type*, target)*
+ *   variable exports count, (name, global index)*
+ *   code            count, (opcode, operand*)*
+ *   stack depths    count, (code index, depth)*      since version 2
+ * Names are a length followed by the characters. Jump operands are stored
+ * relative to their instruction, export targets as code indices.
+ */
+#define BIN_MAGIC "CIVB"
+#define BIN_MAGIC_LEN 4
+#define BIN_VERSION 2
+
+/* Types of constants, globals, imports and exports */
+typedef enum {
+    BT_INT,
+    BT_FLOAT,
+    BT_BOOL,
+    BT_VOID,
+    BT_INT_ARRAY,
+    BT_FLOAT_ARRAY,
+    BT_BOOL_ARRAY,
+    BT_COUNT_
+} BinType;
+
+typedef struct BinConst {
+    BinType type;
+    union {
+        int32_t i;
+        float f;
+        bool b;
+    } as;
+} BinConst;
+
+typedef struct BinFun {                 // Function import or export
+    char* name;
+    BinType ret;
+    size_t arg_count;
+    BinType* args;
+    size_t target;                      // Code index of an exported function
+} BinFun;
+
+typedef struct BinVar {                 // Variable import or export
+    char* name;
+    BinType type;                       // Type of an imported variable
+    size_t global_index;                // Global of an exported variable
+} BinVar;
+
+typedef struct BinInstr {
+    Opcode op;
+    int32_t args[2];                    // Jump operands hold the code index of their target
+} BinInstr;
+
+typedef struct BinStack {               // Operand stack a function needs beyond its entry
+    size_t target;                      // Code index of the function entry
+    size_t depth;
+} BinStack;
+
+typedef struct BinModule {
+    BinInstr* code;
+    size_t code_len;
+    BinConst* consts;
+    size_t const_count;
+    BinType* globals;
+    size_t global_count;
+    BinFun* fun_imports;
+    size_t fun_import_count;
+    BinVar* var_imports;
+    size_t var_import_count;
+    BinFun* fun_exports;
+    size_t fun_export_count;
+    BinVar* var_exports;
+    size_t var_export_count;
+    BinStack* stacks;
+    size_t stack_count;
+} BinModule;
+
+const char* BINtypeName(BinType type);
+bool BINfindType(const char* name, BinType* type);
+
+void BINwrite(FILE* f, const BinModule* module);
+bool BINread(FILE* f, BinModule* module);
+bool BINisBinary(FILE* f);
+void BINdisassemble(FILE* f, const BinModule* module);
+void BINfree(BinModule* module);
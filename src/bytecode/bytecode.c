@@ -14,7 +14,10 @@
 #include "common.h"
 #include "asm.h"
 #include "writer.h"
+#include "stats.h"
 #include "global/globals.h"
+#include "incremental/incremental.h"
+#include "optimisation/consteval.h"
 #include "symbol/scopetree.h"
 #include "symbol/table.h"
 
@@ -31,14 +34,17 @@ static SymbolTable* CURRENT_SCOPE;
 
 static size_t CONST_COUNT = 0;
 
-static size_t NUMBERED_LABEL_COUNT = 0;
-
 static ValueType LAST_TYPE = VT_NULL;
 static bool HAD_EXPR = false;
 
 // Checks whether a return statement is issued (or if we need to implicitly add one in case of void)
 static bool HAD_RETURN = false;
 
+// Frame slots of __init used when filling global arrays
+#define INIT_COUNTER_SLOT 0
+#define INIT_SCALAR_SLOT 1
+#define INIT_SIZE_SLOT 2
+
 /**
  * Emits instruction; shortcut to prevent manually passing ASM pointer
  * @param instr_name name of instruction
@@ -54,13 +60,30 @@ void Instr(char* instr_name, char* arg0, char* arg1, char* arg2) {
     }
 }
 
+/**
+ * Attributes the instructions emitted from here on to the source range of a node
+ * @param node node whose range to use; nodes without one keep the current range
+ * @return range to restore once the node is generated
+ */
+static SourceRange enter_range(node_st* node) {
+    const SourceRange prev = ASM.range;
+    if (NODE_BLINE(node) > 0) {
+        ASM.range = (SourceRange) {NODE_BLINE(node), NODE_BCOL(node), NODE_ELINE(node), NODE_ECOL(node)};
+    }
+    return prev;
+}
+
 /**
  * Emits label; shortcut to prevent manually passing ASM pointer
  * @param label label name
  * @param is_fun boolean indicating whether label is a function start of regular label
  */
 void Label(char* label, const bool is_fun) {
-    ASMemitLabel(&ASM, label, is_fun);
+    if (CURRENT_SCOPE->nesting_level == 0) {
+        ASMemitInitLabel(&ASM, label);
+    } else {
+        ASMemitLabel(&ASM, label, is_fun);
+    }
 }
 
 /**
@@ -91,15 +114,46 @@ static FunImportEntry find_fun_import(const char* name) {
 }
 
 /**
- * Generates a unique label name that is guaranteed not to collide with
- * any existing names
- * @param name name to append to unique part of name
- * @return unique name
+ * Finds the constant table entry of an integer, adding it if it does not exist yet
+ * @param v value of constant
+ * @return offset of constant as string
  */
-char* generate_label_name(char* name) {
-    char* res = safe_concat_str(STRcpy("_lab"), int_to_str((int) NUMBERED_LABEL_COUNT++));
-    res = safe_concat_str(res, STRcpy("_"));
-    return safe_concat_str(res, name);
+static char* int_const_offset(const int v) {
+    char* val_str = int_to_str(v);
+
+    // Refer to existing constant if possible
+    const ConstEntry res = ASMfindConstant(&ASM, val_str);
+
+    char* const_count_str;
+    INCuseConstant("int", val_str);
+    if (res.get != NULL) {
+        const_count_str = int_to_str((int) res.offset);
+    } else {
+        ASMemitConst(&ASM, "int", val_str);
+        const_count_str = int_to_str((int) CONST_COUNT++);
+    }
+
+    MEMfree(val_str);
+    return const_count_str;
+}
+
+/**
+ * Pushes an integer constant onto the stack, using a dedicated instruction if possible
+ * @param v value to push
+ */
+static void push_int_const(const int v) {
+    switch (v) {
+        case -1: Instr("iloadc_m1", NULL, NULL, NULL); break;
+        case 0: Instr("iloadc_0", NULL, NULL, NULL); break;
+        case 1: Instr("iloadc_1", NULL, NULL, NULL); break;
+        default: ;  // Don't remove this semicolon, it's here because a statement is expected
+                    // and the declaration after is not a statement so the semicolon serves
+                    // as an empty statement :)
+            char* const_count_str = int_const_offset(v);
+            Instr("iloadc", const_count_str, NULL, NULL);
+            MEMfree(const_count_str);
+            break;
+    }
 }
 
 /**
@@ -159,6 +213,11 @@ static void load_array_ref_with_value(const Symbol* arr) {
  * @param dim dim symbol to push
  */
 static void push_array_dim(const Symbol* dim) {
+    if (dim->is_constant) {
+        push_int_const(dim->constant);
+        return;
+    }
+
     char* instr;
     char* offset_str = int_to_str((int) dim->offset);
     if (dim->imported) {
@@ -296,8 +355,22 @@ static void flatten_dim_exprs(const Symbol* arr, node_st* exprs_node) {
 
         // Multiply index with mul-result of all next dim sizes for flattening
         if (i < arr->as.array.dim_count - 1) {
-            push_array_dims(arr, i + 1);
-            for (size_t j = i + 1; j < arr->as.array.dim_count; j++) Instr("imul", NULL, NULL, NULL);
+            // Strides of constant dimensions are multiplied here already
+            bool constant_stride = true;
+            unsigned int stride = 1;
+            for (size_t j = i + 1; j < arr->as.array.dim_count; j++) {
+                const Symbol* dim = arr->as.array.dims[j];
+                constant_stride = constant_stride && dim->is_constant;
+                if (constant_stride) stride *= (unsigned int) dim->constant;
+            }
+
+            if (constant_stride) {
+                push_int_const((int) stride);
+                Instr("imul", NULL, NULL, NULL);
+            } else {
+                push_array_dims(arr, i + 1);
+                for (size_t j = i + 1; j < arr->as.array.dim_count; j++) Instr("imul", NULL, NULL, NULL);
+            }
         }
 
         // Add together with prev size
@@ -307,6 +380,66 @@ static void flatten_dim_exprs(const Symbol* arr, node_st* exprs_node) {
     }
 }
 
+/**
+ * Loads the value of a temporary created by common subexpression elimination
+ * @param temp temporary symbol, always local to the current frame
+ */
+static void load_cse_temp(const Symbol* temp) {
+    char* offset_str = int_to_str((int) temp->offset);
+    switch (temp->vtype) {
+        case VT_NUM: Instr("iload", offset_str, NULL, NULL); break;
+        case VT_FLOAT: Instr("fload", offset_str, NULL, NULL); break;
+        case VT_BOOL: Instr("bload", offset_str, NULL, NULL); break;
+        default:
+#ifdef DEBUGGING
+            ERROR("Unexpected temporary vtype %s", vt_to_str(temp->vtype));
+#endif // DEBUGGING
+    }
+    MEMfree(offset_str);
+
+    LAST_TYPE = temp->vtype;
+}
+
+/**
+ * Saves the value on top of the stack into a temporary created by common
+ * subexpression elimination, leaving the value on the stack
+ * @param temp temporary symbol, always local to the current frame
+ */
+static void save_cse_temp(const Symbol* temp) {
+    char* offset_str = int_to_str((int) temp->offset);
+    switch (temp->vtype) {
+        case VT_NUM: Instr("istore", offset_str, NULL, NULL); break;
+        case VT_FLOAT: Instr("fstore", offset_str, NULL, NULL); break;
+        case VT_BOOL: Instr("bstore", offset_str, NULL, NULL); break;
+        default:
+#ifdef DEBUGGING
+            ERROR("Unexpected temporary vtype %s", vt_to_str(temp->vtype));
+#endif // DEBUGGING
+    }
+    MEMfree(offset_str);
+
+    load_cse_temp(temp);
+}
+
+/**
+ * Pushes the flattened index of an array access onto the stack, reusing
+ * the index computed by an earlier access if possible
+ * @param arr array symbol
+ * @param exprs_node starting exprs node
+ * @param index_temp temporary holding the flattened index, or NULL
+ * @param is_def whether this access computes the index for the temporary
+ */
+static void push_array_index(const Symbol* arr, node_st* exprs_node, const Symbol* index_temp, const bool is_def) {
+    if (index_temp != NULL && !is_def) {
+        load_cse_temp(index_temp);
+        return;
+    }
+
+    flatten_dim_exprs(arr, exprs_node);
+
+    if (index_temp != NULL) save_cse_temp(index_temp);
+}
+
 /**
  * Instantiates an array in bytecode. Pushes its dimensions,
  * which must already have been saved, and then multiplies
@@ -348,123 +481,6 @@ static void create_array_with_size(const Symbol* arr) {
     MEMfree(offset_str);
 }
 
-/**
- * Initialises an array with a single scalar
- * @param arr array symbol
- */
-static void init_array_with_scalar(const Symbol* arr) {
-    // Expr must have been traversed and on stack top
-
-    // Scalar value variable
-    char* scalar_symbol_name = safe_concat_str(STRcpy("_scalar_"), STRcpy(arr->name));
-    const Symbol* scalar_symbol = STlookup(arr->parent_scope, scalar_symbol_name);
-    MEMfree(scalar_symbol_name);
-    char* scalar_offset_str = int_to_str((int) scalar_symbol->offset);
-
-    // Loop counter variable
-    char* counter_symbol_name = safe_concat_str(STRcpy("_counter_"), STRcpy(arr->name));
-    const Symbol* counter_symbol = STlookup(arr->parent_scope, counter_symbol_name);
-    MEMfree(counter_symbol_name);
-    char* counter_offset_str = int_to_str((int) counter_symbol->offset);
-
-    // Array size variable
-    char* size_symbol_name = safe_concat_str(STRcpy("_size_"), STRcpy(arr->name));
-    const Symbol* size_symbol = STlookup(arr->parent_scope, size_symbol_name);
-    MEMfree(size_symbol_name);
-    char* size_offset_str = int_to_str((int) size_symbol->offset);
-
-    // Array variable
-    char* arr_offset_str = int_to_str((int) arr->offset);
-
-    char* for_loop_start_name = generate_label_name(STRcpy("for_loop_start"));
-    char* for_loop_end_name = generate_label_name(STRcpy("for_loop_end"));
-
-    // Save expr to expr variable
-    switch (LAST_TYPE) {
-        case VT_NUM: Instr("istore", scalar_offset_str, NULL, NULL); break;
-        case VT_FLOAT: Instr("fstore", scalar_offset_str, NULL, NULL); break;
-        case VT_BOOL: Instr("bstore", scalar_offset_str, NULL, NULL); break;
-        default:
-#ifdef DEBUGGING
-            ERROR("Trying to scalar-init a variable with a non-scalar");
-#endif
-    }
-
-    // Save loop counter (zero)
-    Instr("iloadc_0", NULL, NULL, NULL);
-    Instr("istore", counter_offset_str, NULL, NULL);
-
-    // Save array size (end value for counter)
-    comp_array_size(arr);
-    Instr("istore", size_offset_str, NULL, NULL);
-
-    // --- START FOR LOOP
-    // Emit label
-    Label(for_loop_start_name, false);
-
-    // Check loop condition
-    Instr("iload", counter_offset_str, NULL, NULL);
-    Instr("iload", size_offset_str, NULL, NULL);
-    Instr("ilt", NULL, NULL, NULL);
-    Instr("branch_f", for_loop_end_name, NULL, NULL);
-
-    // Save scalar to array at index [counter]
-    // Load scalar
-    switch (LAST_TYPE) {
-        case VT_NUM: Instr("iload", scalar_offset_str, NULL, NULL); break;
-        case VT_FLOAT: Instr("fload", scalar_offset_str, NULL, NULL); break;
-        case VT_BOOL: Instr("bload", scalar_offset_str, NULL, NULL); break;
-        default:
-#ifdef DEBUGGING
-            ERROR("Trying to scalar-init a variable with a non-scalar");
-#endif
-    }
-
-    // Load array index (counter) + load array reference
-    if (arr->imported) {
-        Instr("iloade", counter_offset_str, NULL, NULL);
-        Instr("aloade", arr_offset_str, NULL, NULL);
-    } else if (arr->parent_scope->nesting_level == 0) {
-        Instr("iloadg", counter_offset_str, NULL, NULL);
-        Instr("aloadg", arr_offset_str, NULL, NULL);
-    } else if (arr->parent_scope->nesting_level == CURRENT_SCOPE->nesting_level) {
-        Instr("iload", counter_offset_str, NULL, NULL);
-        Instr("aload", arr_offset_str, NULL, NULL);
-    } else {
-        char* nesting_diff_str = int_to_str((int) (CURRENT_SCOPE->nesting_level - arr->parent_scope->nesting_level));
-        Instr("iloadn", nesting_diff_str, counter_offset_str, NULL);
-        Instr("aloadn", nesting_diff_str, arr_offset_str, NULL);
-    }
-
-    // Store value
-    switch (LAST_TYPE) {
-        case VT_NUM: Instr("istorea", NULL, NULL, NULL); break;
-        case VT_FLOAT: Instr("fstorea", NULL, NULL, NULL); break;
-        case VT_BOOL: Instr("bstorea", NULL, NULL, NULL); break;
-        default:
-#ifdef DEBUGGING
-            ERROR("Trying to scalar-init a variable with a non-scalar");
-#endif
-    }
-
-    // Increment counter
-    Instr("iinc_1", counter_offset_str, NULL, NULL);
-
-    // Jump back
-    Instr("jump", for_loop_start_name, NULL, NULL);
-
-    // --- END FOR LOOP
-    // Emit label
-    Label(for_loop_end_name, false);
-
-    MEMfree(scalar_offset_str);
-    MEMfree(counter_offset_str);
-    MEMfree(size_offset_str);
-    MEMfree(arr_offset_str);
-    MEMfree(for_loop_start_name);
-    MEMfree(for_loop_end_name);
-}
-
 /**
  * Counts the amount of expressions an arrexpr contains. Also explores nested
  * arrexprs and errors on inconsistent size.
@@ -490,7 +506,7 @@ static size_t count_arrexpr(node_st* node) {
                 count++;
                 if (only_arrexpr) {
                     USER_ERROR("Inconsistent initialisation value shape of array");
-                    exit(EXIT_FAILURE);
+                    global.had_error = true;
                 }
             }
 
@@ -502,66 +518,400 @@ static size_t count_arrexpr(node_st* node) {
 }
 
 /**
- * Initialises an array with an arrexpr. Supports nested arrexprs.
+ * Pushes a known value onto the stack
+ * @param v value to push
+ */
+static void push_const_value(const ConstValue v) {
+    node_st* literal = CEtoLiteral(v);
+    TRAVdo(literal);
+    CCNfree(literal);
+}
+
+/**
+ * Pushes the value an array is filled with; either a known value or the
+ * contents of a frame slot
  * @param arr array symbol
- * @param count amout of initialisation exprs expected
+ * @param literal known value, or NULL to load the slot
+ * @param scalar_offset_str frame slot holding the value if not known
  */
-static void init_array_with_arrexpr(const Symbol* arr, const size_t count) {
-    // Arrexprs must have been traversed and all stored on stack
-    // We save them in reverse starting from the last initialised array index
+static void push_fill_value(const Symbol* arr, const ConstValue* literal, const char* scalar_offset_str) {
+    if (literal != NULL) {
+        push_const_value(*literal);
+        return;
+    }
 
-    char* instr;
     switch (arr->vtype) {
-        case VT_NUMARRAY: instr = "istorea"; break;
-        case VT_FLOATARRAY: instr = "fstorea"; break;
-        case VT_BOOLARRAY: instr = "bstorea"; break;
+        case VT_NUMARRAY: Instr("iload", (char*) scalar_offset_str, NULL, NULL); break;
+        case VT_FLOATARRAY: Instr("fload", (char*) scalar_offset_str, NULL, NULL); break;
+        case VT_BOOLARRAY: Instr("bload", (char*) scalar_offset_str, NULL, NULL); break;
         default:
 #ifdef DEBUGGING
             ERROR("Unexpected array vtype %s", vt_to_str(arr->vtype));
+#endif // DEBUGGING
+    }
+}
+
+/**
+ * Stores a value into the element at the running index and increments the index
+ * @param arr array symbol
+ * @param literal known value, or NULL to load the value from a frame slot
+ * @param scalar_offset_str frame slot holding the value if not known
+ * @param counter_offset_str frame slot holding the running index
+ */
+static void store_at_counter(const Symbol* arr, const ConstValue* literal, const char* scalar_offset_str,
+                             char* counter_offset_str) {
+    push_fill_value(arr, literal, scalar_offset_str);
+    Instr("iload", counter_offset_str, NULL, NULL);
+    load_array_ref(arr);
+    store_array_ref_with_value(arr);
+    Instr("iinc_1", counter_offset_str, NULL, NULL);
+}
+
+/**
+ * Stores a single value into a range of elements of an array. Without running
+ * index the elements are stored with constant indices. With running index, long
+ * ranges use a loop storing FILL_UNROLL_FACTOR elements per iteration, followed
+ * by the remaining elements.
+ * @param arr array symbol
+ * @param literal known value, or NULL to load the value from a frame slot
+ * @param scalar_offset_str frame slot holding the value if not known
+ * @param start first index of range
+ * @param count amount of elements in range
+ * @param counter_offset_str frame slot holding the running index, which must equal start;
+ *                           NULL to use constant indices
+ */
+static void fill_array_range(const Symbol* arr, const ConstValue* literal, const char* scalar_offset_str,
+                             const size_t start, const size_t count, char* counter_offset_str) {
+    if (counter_offset_str == NULL) {
+        for (size_t i = start; i < start + count; i++) {
+            push_fill_value(arr, literal, scalar_offset_str);
+            push_int_const((int) i);
+            load_array_ref(arr);
+            store_array_ref_with_value(arr);
+        }
+        return;
+    }
+
+    size_t unrolled = 0;
+    if (count > FILL_UNROLL_LIMIT) {
+        unrolled = count - count % FILL_UNROLL_FACTOR;
+        char* fill_loop_name = generate_label_name(STRcpy("fill_loop"));
+
+        Label(fill_loop_name, false);
+        for (size_t i = 0; i < FILL_UNROLL_FACTOR; i++) {
+            store_at_counter(arr, literal, scalar_offset_str, counter_offset_str);
+        }
+
+        Instr("iload", counter_offset_str, NULL, NULL);
+        push_int_const((int) (start + unrolled));
+        Instr("ilt", NULL, NULL, NULL);
+        Instr("branch_t", fill_loop_name, NULL, NULL);
+
+        MEMfree(fill_loop_name);
+    }
+
+    for (size_t i = unrolled; i < count; i++) {
+        store_at_counter(arr, literal, scalar_offset_str, counter_offset_str);
+    }
+}
+
+/**
+ * Finds the frame slot reserved for filling an array. Global arrays are filled
+ * in __init, which reserves its slots on demand. Local arrays use the hidden
+ * variables added by context analysis.
+ * @param arr array symbol
+ * @param prefix prefix of the hidden variable name
+ * @param init_slot slot to use in __init
+ * @return offset of slot as string
+ */
+static char* fill_slot(const Symbol* arr, const char* prefix, const size_t init_slot) {
+    if (arr->parent_scope->nesting_level == 0) {
+        if (ASM.init_local_count <= init_slot) ASM.init_local_count = init_slot + 1;
+        return int_to_str((int) init_slot);
+    }
+
+    char* slot_name = STRfmt("%s%s", prefix, arr->name);
+    const Symbol* slot = STlookup(arr->parent_scope, slot_name);
+#ifdef DEBUGGING
+    ASSERT_MSG((slot != NULL), "Bytecode: Missing hidden variable %s", slot_name);
+#endif // DEBUGGING
+    MEMfree(slot_name);
+    return int_to_str((int) slot->offset);
+}
+
+/**
+ * Initialises an array with a single scalar. Filling with zero is skipped, as
+ * new arrays are zeroed already. Arrays with a known size are filled without
+ * a bounds check per element; others with a counting loop.
+ * @param arr array symbol, which must already have been created
+ * @param dims first exprs node of the array dimensions
+ * @param init scalar initialisation expression, not yet traversed
+ */
+static void init_array_with_scalar(const Symbol* arr, node_st* dims, node_st* init) {
+    ConstValue v;
+    const ConstValue* literal = CEfromLiteral(init, &v) ? &v : NULL;
+    if (literal != NULL && CEisZero(v)) return;
+
+    size_t size;
+    const bool known_size = CEarraySize(dims, &size);
+
+    // Evaluate the scalar once; literals are pushed again for every element instead
+    char* scalar_offset_str = NULL;
+    if (literal == NULL) {
+        scalar_offset_str = fill_slot(arr, "_scalar_", INIT_SCALAR_SLOT);
+        TRAVdo(init);
+        switch (LAST_TYPE) {
+            case VT_NUM: Instr("istore", scalar_offset_str, NULL, NULL); break;
+            case VT_FLOAT: Instr("fstore", scalar_offset_str, NULL, NULL); break;
+            case VT_BOOL: Instr("bstore", scalar_offset_str, NULL, NULL); break;
+            default:
+#ifdef DEBUGGING
+                ERROR("Trying to scalar-init a variable with a non-scalar");
 #endif
+        }
+    }
+
+    if (known_size && size <= FILL_UNROLL_LIMIT) {
+        fill_array_range(arr, literal, scalar_offset_str, 0, size, NULL);
+        MEMfree(scalar_offset_str);
+        return;
     }
 
-    char* arr_offset_str = int_to_str((int) arr->offset);
+    char* counter_offset_str = fill_slot(arr, "_counter_", INIT_COUNTER_SLOT);
 
-    for (int idx = (int) count - 1; idx >= 0; idx--) {
-        // Push index
-        char* idx_str = int_to_str(idx);
-        ASMemitConst(&ASM, "int", idx_str);
+    if (known_size) {
+        Instr("iloadc_0", NULL, NULL, NULL);
+        Instr("istore", counter_offset_str, NULL, NULL);
+        fill_array_range(arr, literal, scalar_offset_str, 0, size, counter_offset_str);
+        MEMfree(scalar_offset_str);
+        MEMfree(counter_offset_str);
+        return;
+    }
 
-        const size_t idx_offset = CONST_COUNT++;
-        char* idx_offset_str = int_to_str((int) idx_offset);
+    // Size only known at runtime, loop while counter < size
+    char* size_offset_str = fill_slot(arr, "_size_", INIT_SIZE_SLOT);
+    char* fill_loop_name = generate_label_name(STRcpy("fill_loop"));
+    char* fill_cond_name = generate_label_name(STRcpy("fill_cond"));
 
-        Instr("iloadc", idx_offset_str, NULL, NULL);
+    comp_array_size(arr);
+    Instr("istore", size_offset_str, NULL, NULL);
+    Instr("iloadc_0", NULL, NULL, NULL);
+    Instr("istore", counter_offset_str, NULL, NULL);
+    Instr("jump", fill_cond_name, NULL, NULL);
 
-        // Push array reference
-        load_array_ref(arr);
+    Label(fill_loop_name, false);
+    push_fill_value(arr, literal, scalar_offset_str);
+    Instr("iload", counter_offset_str, NULL, NULL);
+    load_array_ref(arr);
+    store_array_ref_with_value(arr);
+    Instr("iinc_1", counter_offset_str, NULL, NULL);
 
-        // Save value
-        Instr(instr, NULL, NULL, NULL);
+    Label(fill_cond_name, false);
+    Instr("iload", counter_offset_str, NULL, NULL);
+    Instr("iload", size_offset_str, NULL, NULL);
+    Instr("ilt", NULL, NULL, NULL);
+    Instr("branch_t", fill_loop_name, NULL, NULL);
+
+    MEMfree(scalar_offset_str);
+    MEMfree(counter_offset_str);
+    MEMfree(size_offset_str);
+    MEMfree(fill_loop_name);
+    MEMfree(fill_cond_name);
+}
 
-        MEMfree(idx_str);
-        MEMfree(idx_offset_str);
+/**
+ * Collects the values of an array expression whose elements are all literals
+ * @param node arrexpr or exprs node
+ * @param values array to append values to
+ * @param n amount of values collected so far
+ * @return false if an element is not a literal
+ */
+static bool collect_literal_values(node_st* node, ConstValue* values, size_t* n) {
+    if (NODE_TYPE(node) == NT_ARREXPR) return collect_literal_values(ARREXPR_EXPRS(node), values, n);
+
+    while (node != NULL) {
+        node_st* expr = EXPRS_EXPR(node);
+        if (NODE_TYPE(expr) == NT_ARREXPR) {
+            if (!collect_literal_values(expr, values, n)) return false;
+        } else if (!CEfromLiteral(expr, &values[(*n)++])) {
+            return false;
+        }
+        node = EXPRS_NEXT(node);
     }
+    return true;
+}
 
-    MEMfree(arr_offset_str);
+/**
+ * Stores the values of an arrexpr into consecutive elements of an array, each
+ * value right after it is evaluated. Long arrexprs keep the index in a frame
+ * slot, so no constant is needed per index.
+ * @param arr array symbol
+ * @param node arrexpr or exprs node
+ * @param index index of the next element, incremented per stored value
+ * @param counter_offset_str frame slot holding the index, or NULL to use constant indices
+ */
+static void store_arrexpr_values(const Symbol* arr, node_st* node, size_t* index, char* counter_offset_str) {
+    if (NODE_TYPE(node) == NT_ARREXPR) {
+        store_arrexpr_values(arr, ARREXPR_EXPRS(node), index, counter_offset_str);
+        return;
+    }
+
+    while (node != NULL) {
+        node_st* expr = EXPRS_EXPR(node);
+        if (NODE_TYPE(expr) == NT_ARREXPR) {
+            store_arrexpr_values(arr, expr, index, counter_offset_str);
+        } else {
+            TRAVdo(expr);
+            if (counter_offset_str != NULL) {
+                Instr("iload", counter_offset_str, NULL, NULL);
+            } else {
+                push_int_const((int) *index);
+            }
+            load_array_ref(arr);
+            store_array_ref_with_value(arr);
+            if (counter_offset_str != NULL) Instr("iinc_1", counter_offset_str, NULL, NULL);
+            (*index)++;
+        }
+        node = EXPRS_NEXT(node);
+    }
+}
+
+/**
+ * Initialises an array with literal values as runs of equal values, so repeated
+ * values are stored with a single loop and zeroes are not stored at all. Long
+ * literals keep a running index instead of using a constant per index.
+ * @param arr array symbol
+ * @param values literal values in element order
+ * @param count amount of values
+ */
+static void init_array_with_literal_runs(const Symbol* arr, const ConstValue* values, const size_t count) {
+    char* counter_offset_str = NULL;
+    if (count > FILL_UNROLL_LIMIT) {
+        counter_offset_str = fill_slot(arr, "_counter_", INIT_COUNTER_SLOT);
+        Instr("iloadc_0", NULL, NULL, NULL);
+        Instr("istore", counter_offset_str, NULL, NULL);
+    }
+
+    size_t run_start = 0;
+    for (size_t i = 1; i <= count; i++) {
+        if (i < count && CEequal(values[i], values[run_start])) continue;
+
+        const size_t run_length = i - run_start;
+        if (!CEisZero(values[run_start])) {
+            fill_array_range(arr, &values[run_start], NULL, run_start, run_length, counter_offset_str);
+        } else if (counter_offset_str != NULL && i < count) {
+            // Skip over zeroes
+            char* run_length_str = int_const_offset((int) run_length);
+            Instr("iinc", counter_offset_str, run_length_str, NULL);
+            MEMfree(run_length_str);
+        }
+        run_start = i;
+    }
+
+    MEMfree(counter_offset_str);
+}
+
+/**
+ * Initialises an array with an arrexpr. Supports nested arrexprs. If all values
+ * are literals and fit the array, they are stored as runs of equal values.
+ * Otherwise every value is stored as soon as it is evaluated, so the operand
+ * stack does not grow with the size of the arrexpr.
+ * @param arr array symbol, which must already have been created
+ * @param dims first exprs node of the array dimensions
+ * @param init arrexpr used to initialise the array, not yet traversed
+ */
+static void init_array_with_arrexpr(const Symbol* arr, node_st* dims, node_st* init) {
+    const size_t count = count_arrexpr(init);
+
+    size_t size;
+    if (CEarraySize(dims, &size) && count <= size) {
+        ConstValue* values = MEMmalloc(count * sizeof(ConstValue));
+        size_t n = 0;
+        const bool all_literals = collect_literal_values(init, values, &n);
+        if (all_literals) init_array_with_literal_runs(arr, values, count);
+        MEMfree(values);
+        if (all_literals) return;
+    }
+
+    char* counter_offset_str = NULL;
+    if (count > FILL_UNROLL_LIMIT) {
+        counter_offset_str = fill_slot(arr, "_counter_", INIT_COUNTER_SLOT);
+        Instr("iloadc_0", NULL, NULL, NULL);
+        Instr("istore", counter_offset_str, NULL, NULL);
+    }
+
+    size_t index = 0;
+    store_arrexpr_values(arr, init, &index, counter_offset_str);
+
+    MEMfree(counter_offset_str);
 }
 
 static void init() {
     CURRENT_SCOPE = GB_GLOBAL_SCOPE;
+
+    // Every compilation starts from an empty module
+    ASMinit(&ASM);
+    CONST_COUNT = 0;
+    reset_label_names();
+    LAST_TYPE = VT_NULL;
+    HAD_EXPR = false;
+    HAD_RETURN = false;
+}
+
+/**
+ * Writes the line table next to the output file, output to a stream has none
+ */
+static void write_lines() {
+    if (global.output_stream != NULL || global.output_file == NULL) return;
+
+    char* path = STRfmt("%s.lines", global.output_file);
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        USER_ERROR("Could not create line table %s", path);
+        global.had_error = true;
+    } else {
+        write_line_table(f, &ASM);
+        fclose(f);
+    }
+    MEMfree(path);
 }
 
 static void fini() {
-    // Write assembly output
-    ASM_FILE = fopen(global.output_file, "w");
-    if (ASM_FILE == NULL) {
-        fprintf(stderr, "Error creating bytecode file");
-        exit(1);
+    StackDepths depths;
+    SDanalyse(&ASM, &depths);
+    SDcheckLimit(&depths, global.max_stack);
+
+    // Write assembly output, unless generating it failed
+    if (!global.had_error) {
+        ASM_FILE = GLBopenOutput(global.emit == EMIT_BINARY);
+        if (ASM_FILE == NULL) {
+            USER_ERROR("Could not create bytecode file %s", global.output_file);
+            global.had_error = true;
+        } else {
+            if (global.emit == EMIT_BINARY) write_binary(ASM_FILE, &ASM, &depths);
+            else write_assembly(ASM_FILE, &ASM, global.debug_info);
+            GLBcloseOutput(ASM_FILE);
+        }
+    }
+
+    // The line table maps code indices back to the source
+    if (global.debug_info && !global.had_error) write_lines();
+
+    INCfinish();
+
+    if (global.stats != STATS_NONE) {
+        AsmStats stats;
+        STATScollect(&ASM, &depths, &stats);
+        if (global.stats == STATS_JSON) STATSwriteJson(stdout, &stats);
+        else STATSwriteText(stdout, &stats);
+        STATSfree(&stats);
     }
-    write_assembly(ASM_FILE, &ASM);
-    fclose(ASM_FILE);
 
     // Free memory
+    SDfree(&depths);
     STfree(&GB_GLOBAL_SCOPE);
+    Assembly* assembly = &ASM;
+    ASMfree(&assembly);
 }
 
 /**
@@ -569,14 +919,22 @@ static void fini() {
  */
 node_st *BCprogram(node_st *node)
 {
+    // The native backends already wrote the output, nothing is written after errors
+    if (global.emit == EMIT_C || global.emit == EMIT_X86 || global.had_error) {
+        if (GB_GLOBAL_SCOPE != NULL) STfree(&GB_GLOBAL_SCOPE);
+        return node;
+    }
+
     init();
+    INCbegin(node);
+
+    TRAVchildren(node);
 
-    if (GB_REQUIRES_INIT_FUNCTION) {
+    // Only export __init if global initialisation left anything to execute
+    if (ASM.init_instrs != NULL) {
         ASMemitFunExport(&ASM, "__init", "void", 0, NULL);
     }
 
-    TRAVchildren(node);
-
     // Write collected ASM to file
     fini();
 
@@ -588,7 +946,10 @@ node_st *BCprogram(node_st *node)
  */
 node_st *BCdecls(node_st *node)
 {
-    TRAVchildren(node);
+    const SourceRange prev = enter_range(DECLS_DECL(node));
+    TRAVdecl(node);
+    ASM.range = prev;
+    TRAVnext(node);
 
     /**
      * Do nothing
@@ -681,6 +1042,46 @@ node_st *BCreturn(node_st *node)
     return node;
 }
 
+/**
+ * Counts the parameters of a function that calls pass
+ * @param fun function symbol
+ * @return amount of parameters, excluding those that are dead
+ */
+static size_t live_param_count(const Symbol* fun) {
+    size_t count = fun->as.fun.param_count;
+    if (fun->as.fun.dead_params == NULL) return count;
+
+    for (size_t i = 0; i < fun->as.fun.param_count; i++) count -= fun->as.fun.dead_params[i];
+    return count;
+}
+
+/**
+ * Pushes the arguments of a call, leaving out those for dead parameters. Dead
+ * arguments were replaced by literals, so skipping them skips no computation.
+ * @param fun function symbol
+ * @param exprs_node first exprs node of the arguments
+ */
+static void push_live_args(const Symbol* fun, node_st* exprs_node) {
+    const bool* dead = fun->as.fun.dead_params;
+
+    size_t i = 0;
+    for (; exprs_node != NULL; exprs_node = EXPRS_NEXT(exprs_node)) {
+        node_st* arg = EXPRS_EXPR(exprs_node);
+
+        if (NODE_TYPE(arg) == NT_VAR && VAR_INDICES(arg) == NULL && VAR_SYMBOL(arg)->stype == ST_ARRAYVAR) {
+            // Array arguments pass their dimensions first
+            const Symbol* arr = VAR_SYMBOL(arg);
+            for (size_t j = 0; j < arr->as.array.dim_count; j++) {
+                if (!dead[i++]) push_array_dim(arr->as.array.dims[j]);
+            }
+            if (!dead[i++]) load_array_ref(arr);
+        } else {
+            if (!dead[i]) TRAVexpr(exprs_node);
+            i++;
+        }
+    }
+}
+
 /**
  * @fn BCfuncall
  */
@@ -714,7 +1115,11 @@ node_st *BCfuncall(node_st *node)
         MEMfree(delta_level);
     }
 
-    TRAVchildren(node);
+    if (s->as.fun.dead_params == NULL) {
+        TRAVchildren(node);
+    } else {
+        push_live_args(s, FUNCALL_FUN_ARGS(node));
+    }
 
     if (s->imported) {
         const size_t offset = find_fun_import(name).offset;
@@ -722,7 +1127,7 @@ node_st *BCfuncall(node_st *node)
         Instr("jsre", offset_str, NULL, NULL);
         MEMfree(offset_str);
     } else {
-        char* var_count_str = int_to_str((int) s->as.fun.param_count);
+        char* var_count_str = int_to_str((int) live_param_count(s));
 #ifdef DEBUGGING
         ASSERT_MSG((strcmp(s->as.fun.label_name, "\0") != 0), "Empty label name for fun %s", s->name);
 #endif // DEBUGGING
@@ -743,119 +1148,98 @@ node_st *BCfuncall(node_st *node)
 }
 
 /**
- * @fn BCcast
+ * Checks whether an expression only consists of literals and operations that
+ * common subexpression elimination left alone, so it can be evaluated at
+ * compile time without skipping the computation of a temporary
+ * @param node expression node
+ * @return true if the expression can be replaced by its value
  */
-node_st *BCcast(node_st *node) {
-    TRAVchildren(node);
+static bool is_unmarked_constant(node_st* node) {
+    switch (NODE_TYPE(node)) {
+        case NT_NUM: case NT_FLOAT: case NT_BOOL: return true;
+        case NT_MONOP: return MONOP_CSE_TEMP(node) == NULL && is_unmarked_constant(MONOP_OPERAND(node));
+        case NT_CAST: return CAST_CSE_TEMP(node) == NULL && is_unmarked_constant(CAST_EXPR(node));
+        case NT_BINOP:
+            return BINOP_CSE_TEMP(node) == NULL
+                && is_unmarked_constant(BINOP_LEFT(node)) && is_unmarked_constant(BINOP_RIGHT(node));
+        default: return false;
+    }
+}
 
+/**
+ * Emits the conversion of the value on top of the stack. Conversions to bool
+ * compare with zero. The VM has no instruction turning a bool into a number,
+ * so those select the result with a single branch.
+ * @param from type of the value on the stack
+ * @param to type to convert to
+ */
+static void emit_cast(const ValueType from, const enum Type to) {
     // INTEGER AND FLOAT
-    if (LAST_TYPE == VT_NUM && CAST_TYPE(node) == CT_float) {
+    if (from == VT_NUM && to == CT_float) {
         Instr("i2f", NULL, NULL, NULL);
-    } else if (LAST_TYPE == VT_FLOAT && CAST_TYPE(node) == CT_int) {
+    } else if (from == VT_FLOAT && to == CT_int) {
         Instr("f2i", NULL, NULL, NULL);
     }
 
-    // BOOLEAN AND INTEGER
-    else if (LAST_TYPE == VT_NUM && CAST_TYPE(node) == CT_bool) {
-        /* Create instructions for
-         * if ([lastvalue] != 0) {
-         *     [push] true
-         * } else {
-         *     [push] false
-         * }
-         */
-
-        char* else_label_name = generate_label_name(STRcpy("else"));
-        char* endif_label_name = generate_label_name(STRcpy("end"));
-
+    // TO BOOLEAN: [lastvalue] != 0
+    else if (from == VT_NUM && to == CT_bool) {
         Instr("iloadc_0", NULL, NULL, NULL);
         Instr("ine", NULL, NULL, NULL);
-        Instr("branch_f", else_label_name, NULL, NULL);
-        Instr("bloadc_t", NULL, NULL, NULL);
-        Instr("jump", endif_label_name, NULL, NULL);
-        Label(else_label_name, false);
-        Instr("bloadc_f", NULL, NULL, NULL);
-        Label(endif_label_name, false);
-
-        MEMfree(else_label_name);
-        MEMfree(endif_label_name);
-    } else if (LAST_TYPE == VT_BOOL && CAST_TYPE(node) == CT_int) {
-        /* Create instructions for
-         * if ([lastvalue]) {
-         *     [push] 1
-         * } else {
-         *     [push] 0
-         * }
-         */
-
-        char* else_label_name = generate_label_name(STRcpy("else"));
-        char* endif_label_name = generate_label_name(STRcpy("end"));
-
-        Instr("branch_f", else_label_name, NULL, NULL);
-        Instr("iloadc_1", NULL, NULL, NULL);
-        Instr("jump", endif_label_name, NULL, NULL);
-        Label(else_label_name, false);
-        Instr("iloadc_0", NULL, NULL, NULL);
-        Label(endif_label_name, false);
-
-        MEMfree(else_label_name);
-        MEMfree(endif_label_name);
-    }
-
-    // BOOLEAN AND FLOAT
-    else if (LAST_TYPE == VT_FLOAT && CAST_TYPE(node) == CT_bool) {
-        /* Create instructions for
-         * if ([lastvalue] != 0.0) {
-         *     [push] true
-         * } else {
-         *     [push] false
-         * }
-         */
-
-        char* else_label_name = generate_label_name(STRcpy("else"));
-        char* endif_label_name = generate_label_name(STRcpy("end"));
-
+    } else if (from == VT_FLOAT && to == CT_bool) {
         Instr("floadc_0", NULL, NULL, NULL);
         Instr("fne", NULL, NULL, NULL);
-        Instr("branch_f", else_label_name, NULL, NULL);
-        Instr("bloadc_t", NULL, NULL, NULL);
-        Instr("jump", endif_label_name, NULL, NULL);
-        Label(else_label_name, false);
-        Instr("bloadc_f", NULL, NULL, NULL);
-        Label(endif_label_name, false);
-
-        MEMfree(else_label_name);
-        MEMfree(endif_label_name);
-    } else if (LAST_TYPE == VT_BOOL && CAST_TYPE(node) == CT_float) {
-        /* Create instructions for
-         * if ([lastvalue]) {
-         *     [push] 1.0
-         * } else {
-         *     [push] 0.0
-         * }
-         */
-
-        char* else_label_name = generate_label_name(STRcpy("else"));
-        char* endif_label_name = generate_label_name(STRcpy("end"));
-
-        Instr("branch_f", else_label_name, NULL, NULL);
-        Instr("floadc_1", NULL, NULL, NULL);
-        Instr("jump", endif_label_name, NULL, NULL);
-        Label(else_label_name, false);
-        Instr("floadc_0", NULL, NULL, NULL);
-        Label(endif_label_name, false);
+    }
 
-        MEMfree(else_label_name);
-        MEMfree(endif_label_name);
-    } else {
+    // FROM BOOLEAN: [lastvalue] ? 1 : 0
+    else if (from == VT_BOOL && (to == CT_int || to == CT_float)) {
+        char* false_label_name = generate_label_name(STRcpy("false"));
+        char* end_label_name = generate_label_name(STRcpy("end"));
+        const bool to_int = to == CT_int;
+
+        Instr("branch_f", false_label_name, NULL, NULL);
+        Instr(to_int ? "iloadc_1" : "floadc_1", NULL, NULL, NULL);
+        Instr("jump", end_label_name, NULL, NULL);
+        Label(false_label_name, false);
+        Instr(to_int ? "iloadc_0" : "floadc_0", NULL, NULL, NULL);
+        Label(end_label_name, false);
+
+        MEMfree(false_label_name);
+        MEMfree(end_label_name);
+    }
+
+    // Casts to the same type need no conversion
+    else if (from != ct_to_vt(to, false)) {
         // Should never occur
 #ifdef DEBUGGING
-        ERROR("Unexpected cast from VT type %s to CT type %i", vt_to_str(LAST_TYPE), CAST_TYPE(node));
+        ERROR("Unexpected cast from VT type %s to CT type %i", vt_to_str(from), to);
 #endif // DEBUGGING
     }
+}
+
+/**
+ * @fn BCcast
+ */
+node_st *BCcast(node_st *node) {
+    // Value was already computed earlier in this block
+    if (CAST_CSE_TEMP(node) != NULL && !CAST_CSE_DEF(node)) {
+        load_cse_temp(CAST_CSE_TEMP(node));
+        return node;
+    }
+
+    // Casts of constants are evaluated at compile time
+    ConstValue v;
+    if (is_unmarked_constant(CAST_EXPR(node)) && CEevaluate(node, NULL, &v) && CEisRepresentable(v)) {
+        push_const_value(v);
+    } else {
+        TRAVchildren(node);
+        emit_cast(LAST_TYPE, CAST_TYPE(node));
+    }
 
     LAST_TYPE = ct_to_vt(CAST_TYPE(node), false);
 
+    // Keep value for later occurrences in this block
+    if (CAST_CSE_DEF(node)) save_cse_temp(CAST_CSE_TEMP(node));
+
     /**
      * Traverse children
      * Emit cast
@@ -868,7 +1252,10 @@ node_st *BCcast(node_st *node) {
  */
 node_st *BCfundefs(node_st *node)
 {
-    TRAVchildren(node);
+    const SourceRange prev = enter_range(FUNDEFS_FUNDEF(node));
+    TRAVfundef(node);
+    ASM.range = prev;
+    TRAVnext(node);
 
     /**
      * Do nothing
@@ -911,7 +1298,14 @@ node_st *BCfundef(node_st *node)
         SymbolTable* prev_scope = CURRENT_SCOPE;
         CURRENT_SCOPE = fun_symbol->as.fun.scope;
 
-        TRAVchildren(node);
+        // Unchanged top-level functions reuse their code from the last compilation
+        const bool top_level = prev_scope == GB_GLOBAL_SCOPE;
+        if (top_level && INCenter(&ASM, node)) {
+            CONST_COUNT = ASM.const_count;
+        } else {
+            TRAVchildren(node);
+            if (top_level) INCleave(&ASM);
+        }
 
         // Reset loop counter
         CURRENT_SCOPE->for_loop_counter = 0;
@@ -938,10 +1332,10 @@ node_st *BCfunbody(node_st *node)
 
     char* label_name = CURRENT_SCOPE->parent_fun->as.fun.label_name;
     Label(label_name, true);
+    ASM.last_instr->frame_slots = CURRENT_SCOPE->localvar_offset_counter;
 
     // Only write "esr" if at least one variable (NOT PARAMETER) will be initialised
-    if (CURRENT_SCOPE->localvar_offset_counter
-        - CURRENT_SCOPE->parent_fun->as.fun.param_count > 0) {
+    if (CURRENT_SCOPE->localvar_offset_counter > live_param_count(CURRENT_SCOPE->parent_fun)) {
 
         char* offset_str = int_to_str((int) CURRENT_SCOPE->localvar_offset_counter);
         Instr("esr", offset_str, NULL, NULL);
@@ -1096,47 +1490,67 @@ node_st *BCfor(node_st *node)
     char* cond_offset_str = int_to_str((int) s_cond->offset);
     Instr("istore", cond_offset_str, NULL, NULL);
 
-    TRAVstep(node);
+    // The direction of a literal step is known, so its sign is not checked at runtime
+    ConstValue step;
+    const bool constant_step = is_unmarked_constant(FOR_STEP(node)) && CEevaluate(FOR_STEP(node), NULL, &step);
+
+    char* step_offset_str = NULL;
+    if (!constant_step) {
+        TRAVstep(node);
 #ifdef DEBUGGING
-    ASSERT_MSG((LAST_TYPE == VT_NUM), "Got a non-integer value for loop step expression");
+        ASSERT_MSG((LAST_TYPE == VT_NUM), "Got a non-integer value for loop step expression");
 #endif // DEBUGGING
-    const Symbol* s_step = STlookup(CURRENT_SCOPE, "_step");
-    char* step_offset_str = int_to_str((int) s_step->offset);
-    Instr("istore", step_offset_str, NULL, NULL);
+        const Symbol* s_step = STlookup(CURRENT_SCOPE, "_step");
+        step_offset_str = int_to_str((int) s_step->offset);
+        Instr("istore", step_offset_str, NULL, NULL);
+    }
 
     // Generate bytecode
     char* for_loop_start_name = generate_label_name(STRcpy("for_loop_start"));
-    char* positive_step_size_cond = generate_label_name(STRcpy("positive_step_size"));
-    char* negative_step_size_cond = generate_label_name(STRcpy("negative_step_size"));
-    char* for_loop_common_cond_check = generate_label_name(STRcpy("common_cond_check"));
     char* for_loop_end_name = generate_label_name(STRcpy("for_loop_end"));
 
     // Emit loop start label
     Label(for_loop_start_name, false);
 
     // Evaluate loop condition
-    // --- Perform sign check
-    Instr("iload", step_offset_str, NULL, NULL);
-    Instr("iloadc_0", NULL, NULL, NULL);
-    Instr("ige", NULL, NULL, NULL);
-    Instr("branch_t", positive_step_size_cond, NULL, NULL);
-    Instr("jump", negative_step_size_cond, NULL, NULL);
-
-    // --- Check for positive step size case
-    Label(positive_step_size_cond, false);
-    Instr("iload", loop_offset_str, NULL, NULL);
-    Instr("iload", cond_offset_str, NULL, NULL);
-    Instr("ilt", NULL, NULL, NULL);
-    Instr("jump", for_loop_common_cond_check, NULL, NULL);
+    if (constant_step) {
+        Instr("iload", loop_offset_str, NULL, NULL);
+        Instr("iload", cond_offset_str, NULL, NULL);
+        Instr(step.as.i >= 0 ? "ilt" : "igt", NULL, NULL, NULL);
+    } else {
+        char* positive_step_size_cond = generate_label_name(STRcpy("positive_step_size"));
+        char* negative_step_size_cond = generate_label_name(STRcpy("negative_step_size"));
+        char* for_loop_common_cond_check = generate_label_name(STRcpy("common_cond_check"));
 
-    // Check for negative step size case
-    Label(negative_step_size_cond, false);
-    Instr("iload", loop_offset_str, NULL, NULL);
-    Instr("iload", cond_offset_str, NULL, NULL);
-    Instr("igt", NULL, NULL, NULL);
+        // --- Perform sign check
+        Instr("iload", step_offset_str, NULL, NULL);
+        Instr("iloadc_0", NULL, NULL, NULL);
+        Instr("ige", NULL, NULL, NULL);
+        Instr("branch_t", positive_step_size_cond, NULL, NULL);
+        Instr("jump", negative_step_size_cond, NULL, NULL);
+
+        // --- Check for positive step size case
+        Label(positive_step_size_cond, false);
+        Instr("iload", loop_offset_str, NULL, NULL);
+        Instr("iload", cond_offset_str, NULL, NULL);
+        Instr("ilt", NULL, NULL, NULL);
+        Instr("jump", for_loop_common_cond_check, NULL, NULL);
+
+        // Check for negative step size case
+        Label(negative_step_size_cond, false);
+        Instr("iload", loop_offset_str, NULL, NULL);
+        Instr("iload", cond_offset_str, NULL, NULL);
+        Instr("igt", NULL, NULL, NULL);
+
+        // Common check
+        Label(for_loop_common_cond_check, false);
+
+        MEMfree(positive_step_size_cond);
+        MEMfree(negative_step_size_cond);
+        MEMfree(for_loop_common_cond_check);
+    }
 
-    // Common check, loop exits here if false
-    Label(for_loop_common_cond_check, false);
+    // Loop exits here if false
     Instr("branch_f", for_loop_end_name, NULL, NULL);
 
     // Evaluate body
@@ -1166,9 +1580,6 @@ node_st *BCfor(node_st *node)
     // Clean up
     MEMfree(adjusted_name);
     MEMfree(for_loop_start_name);
-    MEMfree(positive_step_size_cond);
-    MEMfree(negative_step_size_cond);
-    MEMfree(for_loop_common_cond_check);
     MEMfree(for_loop_end_name);
 
     MEMfree(loop_offset_str);
@@ -1270,24 +1681,28 @@ node_st *BCglobdef(node_st *node)
         return node;
     }
 
-    TRAVinit(node);
-
     if (s->stype == ST_ARRAYVAR) {
         // Separate handling for arrays
 
-        if (GLOBDEF_INIT(node) != NULL) {
-            if (NODE_TYPE(GLOBDEF_INIT(node)) == NT_ARREXPR) {
-                // Arrexpr
-                init_array_with_arrexpr(s, count_arrexpr(GLOBDEF_INIT(node)));
-            } else {
-                // Scalar
-                init_array_with_scalar(s);
-            }
-
-            return node;
+        if (NODE_TYPE(GLOBDEF_INIT(node)) == NT_ARREXPR) {
+            // Arrexpr
+            init_array_with_arrexpr(s, GLOBDEF_DIMS(node), GLOBDEF_INIT(node));
+        } else {
+            // Scalar
+            init_array_with_scalar(s, GLOBDEF_DIMS(node), GLOBDEF_INIT(node));
         }
+
+        return node;
+    }
+
+    // Globals start out zeroed
+    ConstValue v;
+    if (CEfromLiteral(GLOBDEF_INIT(node), &v) && CEisZero(v)) {
+        return node;
     }
 
+    TRAVinit(node);
+
     char* offset_str = int_to_str((int) s->offset);
     switch (LAST_TYPE) {
         case VT_NUM: Instr("istoreg", offset_str, NULL, NULL); break;
@@ -1334,6 +1749,8 @@ node_st *BCparam(node_st *node)
  */
 node_st *BCvardecl(node_st *node)
 {
+    const SourceRange prev = enter_range(node);
+
     // Look up symbol and variabletype
     char* name = VARDECL_NAME(node);
     const Symbol* s = STlookup(CURRENT_SCOPE, name);
@@ -1349,29 +1766,29 @@ node_st *BCvardecl(node_st *node)
 
     // Early return if no init
     if (VARDECL_INIT(node) == NULL) {
+        ASM.range = prev;
         TRAVnext(node);
         return node;
     }
 
-    TRAVinit(node);
-
     if (s->stype == ST_ARRAYVAR) {
         // Separate handling for arrays
 
-        if (VARDECL_INIT(node) != NULL) {
-            if (NODE_TYPE(VARDECL_INIT(node)) == NT_ARREXPR) {
-                // Arrexpr
-                init_array_with_arrexpr(s, count_arrexpr(VARDECL_INIT(node)));
-            } else {
-                // Scalar
-                init_array_with_scalar(s);
-            }
-
-            TRAVnext(node);
-            return node;
+        if (NODE_TYPE(VARDECL_INIT(node)) == NT_ARREXPR) {
+            // Arrexpr
+            init_array_with_arrexpr(s, VARDECL_DIMS(node), VARDECL_INIT(node));
+        } else {
+            // Scalar
+            init_array_with_scalar(s, VARDECL_DIMS(node), VARDECL_INIT(node));
         }
+
+        ASM.range = prev;
+        TRAVnext(node);
+        return node;
     }
 
+    TRAVinit(node);
+
     const size_t current_level = CURRENT_SCOPE->nesting_level;
     const size_t var_level = s->parent_scope->nesting_level;
     const size_t var_offset = s->offset;
@@ -1398,6 +1815,7 @@ node_st *BCvardecl(node_st *node)
     MEMfree(instr);
     MEMfree(var_offset_str);
 
+    ASM.range = prev;
     TRAVnext(node);
 
     /**
@@ -1414,7 +1832,10 @@ node_st *BCvardecl(node_st *node)
  */
 node_st *BCstmts(node_st *node)
 {
-    TRAVchildren(node);
+    const SourceRange prev = enter_range(STMTS_STMT(node));
+    TRAVstmt(node);
+    ASM.range = prev;
+    TRAVnext(node);
 
     /**
      * Do nothing
@@ -1441,6 +1862,12 @@ node_st *BCassign(node_st *node)
  */
 node_st *BCbinop(node_st *node)
 {
+    // Value was already computed earlier in this block
+    if (BINOP_CSE_TEMP(node) != NULL && !BINOP_CSE_DEF(node)) {
+        load_cse_temp(BINOP_CSE_TEMP(node));
+        return node;
+    }
+
     // SEPARATE LOGIC FOR AND, AND OR SHORT-CIRCUITING
     const enum BinOpType t = BINOP_OP(node);
     if (t == BO_and) { // Short-circuit AND (&&)
@@ -1610,6 +2037,9 @@ node_st *BCbinop(node_st *node)
 
     MEMfree(instr);
 
+    // Keep value for later occurrences in this block
+    if (BINOP_CSE_DEF(node)) save_cse_temp(BINOP_CSE_TEMP(node));
+
     /**
      * Emit instruction for correct operator
      */
@@ -1621,6 +2051,12 @@ node_st *BCbinop(node_st *node)
  */
 node_st *BCmonop(node_st *node)
 {
+    // Value was already computed earlier in this block
+    if (MONOP_CSE_TEMP(node) != NULL && !MONOP_CSE_DEF(node)) {
+        load_cse_temp(MONOP_CSE_TEMP(node));
+        return node;
+    }
+
     TRAVchildren(node);
 
     switch (MONOP_OP(node)) {
@@ -1644,6 +2080,9 @@ node_st *BCmonop(node_st *node)
 
     // LAST_VALUE unchanged
 
+    // Keep value for later occurrences in this block
+    if (MONOP_CSE_DEF(node)) save_cse_temp(MONOP_CSE_TEMP(node));
+
     /**
      * Emit instruction for correct operator
      */
@@ -1665,7 +2104,7 @@ node_st *BCvarlet(node_st *node)
         // Value should already be at stack
 
         // Push index onto stack (flatten multidim into single scalar)
-        flatten_dim_exprs(s, VARLET_INDICES(node));
+        push_array_index(s, VARLET_INDICES(node), VARLET_INDEX_TEMP(node), VARLET_INDEX_DEF(node));
 
         // Push array reference onto stack
         load_array_ref(s);
@@ -1759,13 +2198,14 @@ node_st *BCvar(node_st *node)
         // If indexed, push value at index onto stack
 
         // Push index onto stack (flatten multidim into single scalar)
-        flatten_dim_exprs(s, VAR_INDICES(node));
+        push_array_index(s, VAR_INDICES(node), VAR_INDEX_TEMP(node), VAR_INDEX_DEF(node));
 
         // Push array reference onto stack
         load_array_ref(s);
 
         // Store value to index of array
         load_array_ref_with_value(s);
+        LAST_TYPE = demote_array_type(s->vtype);
 
         // Return (don't run scalar instructions)
         return node;
@@ -1874,33 +2314,7 @@ node_st *BCnum(node_st *node)
      * Emit instruction to load constant
      */
 
-    const int v = NUM_VAL(node);
-    switch (v) {
-        case -1: Instr("iloadc_m1", NULL, NULL, NULL); break;
-        case 0: Instr("iloadc_0", NULL, NULL, NULL); break;
-        case 1: Instr("iloadc_1", NULL, NULL, NULL); break;
-        default: ;  // Don't remove this semicolon, it's here because a statement is expected
-                    // and the declaration after is not a statement so the semicolon serves
-                    // as an empty statement :)
-            char* val_str = int_to_str(v);
-
-            // Refer to existing constant if possible
-            const ConstEntry res = ASMfindConstant(&ASM, val_str);
-
-            char* const_count_str;
-            if (res.get != NULL) {
-                const_count_str = int_to_str((int) res.offset);
-            } else {
-                ASMemitConst(&ASM, "int", val_str);
-                const_count_str = int_to_str((int) CONST_COUNT++);
-            }
-
-            Instr("iloadc", const_count_str, NULL, NULL);
-
-            MEMfree(val_str);
-            MEMfree(const_count_str);
-            break;
-    }
+    push_int_const(NUM_VAL(node));
 
     LAST_TYPE = VT_NUM;
     HAD_EXPR = true;
@@ -1930,6 +2344,7 @@ node_st *BCfloat(node_st *node)
         const ConstEntry res = ASMfindConstant(&ASM, val_str);
 
         char* const_count_str;
+        INCuseConstant("float", val_str);
         if (res.get != NULL) {
            const_count_str = int_to_str((int) res.offset);
         } else {
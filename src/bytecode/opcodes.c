@@ -0,0 +1,155 @@
+// src/bytecode/opcodes.c
+
+#include "opcodes.h"
+
+#include <string.h>
+
+#define N OPND_NONE
+#define L OPND_LOCAL
+#define D OPND_DEPTH
+#define G OPND_GLOBAL
+#define E OPND_IMPORT_VAR
+#define F OPND_IMPORT_FUN
+#define C OPND_CONST
+#define K OPND_COUNT
+#define J OPND_LABEL
+
+/* Indexed by Opcode; name, operand count, operand kinds, pops, pushes */
+const OpInfo OPCODE_TABLE[OP_COUNT_] = {
+    [OP_ILOAD] = {"iload", 1, {L, N}, 0, 1},
+    [OP_FLOAD] = {"fload", 1, {L, N}, 0, 1},
+    [OP_BLOAD] = {"bload", 1, {L, N}, 0, 1},
+    [OP_ALOAD] = {"aload", 1, {L, N}, 0, 1},
+    [OP_ILOAD_0] = {"iload_0", 0, {N, N}, 0, 1},
+    [OP_ILOAD_1] = {"iload_1", 0, {N, N}, 0, 1},
+    [OP_ILOAD_2] = {"iload_2", 0, {N, N}, 0, 1},
+    [OP_ILOAD_3] = {"iload_3", 0, {N, N}, 0, 1},
+    [OP_FLOAD_0] = {"fload_0", 0, {N, N}, 0, 1},
+    [OP_FLOAD_1] = {"fload_1", 0, {N, N}, 0, 1},
+    [OP_FLOAD_2] = {"fload_2", 0, {N, N}, 0, 1},
+    [OP_FLOAD_3] = {"fload_3", 0, {N, N}, 0, 1},
+    [OP_BLOAD_0] = {"bload_0", 0, {N, N}, 0, 1},
+    [OP_BLOAD_1] = {"bload_1", 0, {N, N}, 0, 1},
+    [OP_BLOAD_2] = {"bload_2", 0, {N, N}, 0, 1},
+    [OP_BLOAD_3] = {"bload_3", 0, {N, N}, 0, 1},
+    [OP_ALOAD_0] = {"aload_0", 0, {N, N}, 0, 1},
+    [OP_ALOAD_1] = {"aload_1", 0, {N, N}, 0, 1},
+    [OP_ALOAD_2] = {"aload_2", 0, {N, N}, 0, 1},
+    [OP_ALOAD_3] = {"aload_3", 0, {N, N}, 0, 1},
+    [OP_ILOADN] = {"iloadn", 2, {D, L}, 0, 1},
+    [OP_FLOADN] = {"floadn", 2, {D, L}, 0, 1},
+    [OP_BLOADN] = {"bloadn", 2, {D, L}, 0, 1},
+    [OP_ALOADN] = {"aloadn", 2, {D, L}, 0, 1},
+    [OP_ILOADG] = {"iloadg", 1, {G, N}, 0, 1},
+    [OP_FLOADG] = {"floadg", 1, {G, N}, 0, 1},
+    [OP_BLOADG] = {"bloadg", 1, {G, N}, 0, 1},
+    [OP_ALOADG] = {"aloadg", 1, {G, N}, 0, 1},
+    [OP_ILOADE] = {"iloade", 1, {E, N}, 0, 1},
+    [OP_FLOADE] = {"floade", 1, {E, N}, 0, 1},
+    [OP_BLOADE] = {"bloade", 1, {E, N}, 0, 1},
+    [OP_ALOADE] = {"aloade", 1, {E, N}, 0, 1},
+    [OP_ILOADC] = {"iloadc", 1, {C, N}, 0, 1},
+    [OP_FLOADC] = {"floadc", 1, {C, N}, 0, 1},
+    [OP_ILOADC_0] = {"iloadc_0", 0, {N, N}, 0, 1},
+    [OP_ILOADC_1] = {"iloadc_1", 0, {N, N}, 0, 1},
+    [OP_ILOADC_M1] = {"iloadc_m1", 0, {N, N}, 0, 1},
+    [OP_FLOADC_0] = {"floadc_0", 0, {N, N}, 0, 1},
+    [OP_FLOADC_1] = {"floadc_1", 0, {N, N}, 0, 1},
+    [OP_BLOADC_T] = {"bloadc_t", 0, {N, N}, 0, 1},
+    [OP_BLOADC_F] = {"bloadc_f", 0, {N, N}, 0, 1},
+    [OP_ISTORE] = {"istore", 1, {L, N}, 1, 0},
+    [OP_FSTORE] = {"fstore", 1, {L, N}, 1, 0},
+    [OP_BSTORE] = {"bstore", 1, {L, N}, 1, 0},
+    [OP_ASTORE] = {"astore", 1, {L, N}, 1, 0},
+    [OP_ISTOREN] = {"istoren", 2, {D, L}, 1, 0},
+    [OP_FSTOREN] = {"fstoren", 2, {D, L}, 1, 0},
+    [OP_BSTOREN] = {"bstoren", 2, {D, L}, 1, 0},
+    [OP_ASTOREN] = {"astoren", 2, {D, L}, 1, 0},
+    [OP_ISTOREG] = {"istoreg", 1, {G, N}, 1, 0},
+    [OP_FSTOREG] = {"fstoreg", 1, {G, N}, 1, 0},
+    [OP_BSTOREG] = {"bstoreg", 1, {G, N}, 1, 0},
+    [OP_ASTOREG] = {"astoreg", 1, {G, N}, 1, 0},
+    [OP_ISTOREE] = {"istoree", 1, {E, N}, 1, 0},
+    [OP_FSTOREE] = {"fstoree", 1, {E, N}, 1, 0},
+    [OP_BSTOREE] = {"bstoree", 1, {E, N}, 1, 0},
+    [OP_ASTOREE] = {"astoree", 1, {E, N}, 1, 0},
+    [OP_INEWA] = {"inewa", 0, {N, N}, 1, 1},
+    [OP_FNEWA] = {"fnewa", 0, {N, N}, 1, 1},
+    [OP_BNEWA] = {"bnewa", 0, {N, N}, 1, 1},
+    [OP_ILOADA] = {"iloada", 0, {N, N}, 2, 1},
+    [OP_FLOADA] = {"floada", 0, {N, N}, 2, 1},
+    [OP_BLOADA] = {"bloada", 0, {N, N}, 2, 1},
+    [OP_ISTOREA] = {"istorea", 0, {N, N}, 3, 0},
+    [OP_FSTOREA] = {"fstorea", 0, {N, N}, 3, 0},
+    [OP_BSTOREA] = {"bstorea", 0, {N, N}, 3, 0},
+    [OP_IADD] = {"iadd", 0, {N, N}, 2, 1},
+    [OP_ISUB] = {"isub", 0, {N, N}, 2, 1},
+    [OP_IMUL] = {"imul", 0, {N, N}, 2, 1},
+    [OP_IDIV] = {"idiv", 0, {N, N}, 2, 1},
+    [OP_IREM] = {"irem", 0, {N, N}, 2, 1},
+    [OP_FADD] = {"fadd", 0, {N, N}, 2, 1},
+    [OP_FSUB] = {"fsub", 0, {N, N}, 2, 1},
+    [OP_FMUL] = {"fmul", 0, {N, N}, 2, 1},
+    [OP_FDIV] = {"fdiv", 0, {N, N}, 2, 1},
+    [OP_BADD] = {"badd", 0, {N, N}, 2, 1},
+    [OP_BMUL] = {"bmul", 0, {N, N}, 2, 1},
+    [OP_INEG] = {"ineg", 0, {N, N}, 1, 1},
+    [OP_FNEG] = {"fneg", 0, {N, N}, 1, 1},
+    [OP_BNOT] = {"bnot", 0, {N, N}, 1, 1},
+    [OP_ILT] = {"ilt", 0, {N, N}, 2, 1},
+    [OP_ILE] = {"ile", 0, {N, N}, 2, 1},
+    [OP_IGT] = {"igt", 0, {N, N}, 2, 1},
+    [OP_IGE] = {"ige", 0, {N, N}, 2, 1},
+    [OP_IEQ] = {"ieq", 0, {N, N}, 2, 1},
+    [OP_INE] = {"ine", 0, {N, N}, 2, 1},
+    [OP_FLT] = {"flt", 0, {N, N}, 2, 1},
+    [OP_FLE] = {"fle", 0, {N, N}, 2, 1},
+    [OP_FGT] = {"fgt", 0, {N, N}, 2, 1},
+    [OP_FGE] = {"fge", 0, {N, N}, 2, 1},
+    [OP_FEQ] = {"feq", 0, {N, N}, 2, 1},
+    [OP_FNE] = {"fne", 0, {N, N}, 2, 1},
+    [OP_BEQ] = {"beq", 0, {N, N}, 2, 1},
+    [OP_BNE] = {"bne", 0, {N, N}, 2, 1},
+    [OP_I2F] = {"i2f", 0, {N, N}, 1, 1},
+    [OP_F2I] = {"f2i", 0, {N, N}, 1, 1},
+    [OP_IINC] = {"iinc", 2, {L, C}, 0, 0},
+    [OP_IINC_1] = {"iinc_1", 1, {L, N}, 0, 0},
+    [OP_IDEC] = {"idec", 2, {L, C}, 0, 0},
+    [OP_IDEC_1] = {"idec_1", 1, {L, N}, 0, 0},
+    [OP_IPOP] = {"ipop", 0, {N, N}, 1, 0},
+    [OP_FPOP] = {"fpop", 0, {N, N}, 1, 0},
+    [OP_BPOP] = {"bpop", 0, {N, N}, 1, 0},
+    [OP_APOP] = {"apop", 0, {N, N}, 1, 0},
+    [OP_JUMP] = {"jump", 1, {J, N}, 0, 0},
+    [OP_BRANCH_T] = {"branch_t", 1, {J, N}, 1, 0},
+    [OP_BRANCH_F] = {"branch_f", 1, {J, N}, 1, 0},
+    [OP_ISR] = {"isr", 0, {N, N}, 0, 0},
+    [OP_ISRN] = {"isrn", 1, {D, N}, 0, 0},
+    [OP_ISRL] = {"isrl", 0, {N, N}, 0, 0},
+    [OP_ISRG] = {"isrg", 0, {N, N}, 0, 0},
+    [OP_JSR] = {"jsr", 2, {K, J}, -1, -1},
+    [OP_JSRE] = {"jsre", 1, {F, N}, -1, -1},
+    [OP_ESR] = {"esr", 1, {K, N}, 0, 0},
+    [OP_IRETURN] = {"ireturn", 0, {N, N}, 1, 0},
+    [OP_FRETURN] = {"freturn", 0, {N, N}, 1, 0},
+    [OP_BRETURN] = {"breturn", 0, {N, N}, 1, 0},
+    [OP_ARETURN] = {"areturn", 0, {N, N}, 1, 0},
+    [OP_RETURN] = {"return", 0, {N, N}, 0, 0},
+};
+
+/**
+ * Finds the opcode belonging to an instruction name
+ * @param name instruction name as written in assembly
+ * @param op output parameter receiving the opcode
+ * @return true if the instruction name is known
+ */
+bool OPfind(const char* name, Opcode* op) {
+    for (size_t i = 0; i < OP_COUNT_; i++) {
+        if (strcmp(OPCODE_TABLE[i].name, name) == 0) {
+            *op = (Opcode) i;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,68 @@
+// src/bytecode/opcodes.h
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Operand kinds of a single instruction argument */
+typedef enum {
+    OPND_NONE,
+    OPND_LOCAL,                         // Local variable index within the frame
+    OPND_DEPTH,                         // Amount of static links to follow
+    OPND_GLOBAL,                        // Index in the global variable table
+    OPND_IMPORT_VAR,                    // Index in the variable import table
+    OPND_IMPORT_FUN,                    // Index in the function import table
+    OPND_CONST,                         // Index in the constant pool
+    OPND_COUNT,                         // Plain count (arguments, frame size)
+    OPND_LABEL,                         // Jump target
+} OperandKind;
+
+typedef enum {
+    OP_ILOAD, OP_FLOAD, OP_BLOAD, OP_ALOAD,
+    OP_ILOAD_0, OP_ILOAD_1, OP_ILOAD_2, OP_ILOAD_3,
+    OP_FLOAD_0, OP_FLOAD_1, OP_FLOAD_2, OP_FLOAD_3,
+    OP_BLOAD_0, OP_BLOAD_1, OP_BLOAD_2, OP_BLOAD_3,
+    OP_ALOAD_0, OP_ALOAD_1, OP_ALOAD_2, OP_ALOAD_3,
+    OP_ILOADN, OP_FLOADN, OP_BLOADN, OP_ALOADN,
+    OP_ILOADG, OP_FLOADG, OP_BLOADG, OP_ALOADG,
+    OP_ILOADE, OP_FLOADE, OP_BLOADE, OP_ALOADE,
+    OP_ILOADC, OP_FLOADC,
+    OP_ILOADC_0, OP_ILOADC_1, OP_ILOADC_M1,
+    OP_FLOADC_0, OP_FLOADC_1,
+    OP_BLOADC_T, OP_BLOADC_F,
+    OP_ISTORE, OP_FSTORE, OP_BSTORE, OP_ASTORE,
+    OP_ISTOREN, OP_FSTOREN, OP_BSTOREN, OP_ASTOREN,
+    OP_ISTOREG, OP_FSTOREG, OP_BSTOREG, OP_ASTOREG,
+    OP_ISTOREE, OP_FSTOREE, OP_BSTOREE, OP_ASTOREE,
+    OP_INEWA, OP_FNEWA, OP_BNEWA,
+    OP_ILOADA, OP_FLOADA, OP_BLOADA,
+    OP_ISTOREA, OP_FSTOREA, OP_BSTOREA,
+    OP_IADD, OP_ISUB, OP_IMUL, OP_IDIV, OP_IREM,
+    OP_FADD, OP_FSUB, OP_FMUL, OP_FDIV,
+    OP_BADD, OP_BMUL,
+    OP_INEG, OP_FNEG, OP_BNOT,
+    OP_ILT, OP_ILE, OP_IGT, OP_IGE, OP_IEQ, OP_INE,
+    OP_FLT, OP_FLE, OP_FGT, OP_FGE, OP_FEQ, OP_FNE,
+    OP_BEQ, OP_BNE,
+    OP_I2F, OP_F2I,
+    OP_IINC, OP_IINC_1, OP_IDEC, OP_IDEC_1,
+    OP_IPOP, OP_FPOP, OP_BPOP, OP_APOP,
+    OP_JUMP, OP_BRANCH_T, OP_BRANCH_F,
+    OP_ISR, OP_ISRN, OP_ISRL, OP_ISRG,
+    OP_JSR, OP_JSRE, OP_ESR,
+    OP_IRETURN, OP_FRETURN, OP_BRETURN, OP_ARETURN, OP_RETURN,
+    OP_COUNT_
+} Opcode;
+
+typedef struct OpInfo {
+    const char* name;
+    size_t operand_count;
+    OperandKind operands[2];
+    int pops;                           // Values popped from the operand stack, -1 if variable
+    int pushes;                         // Values pushed onto the operand stack, -1 if variable
+} OpInfo;
+
+extern const OpInfo OPCODE_TABLE[OP_COUNT_];
+
+bool OPfind(const char* name, Opcode* op);
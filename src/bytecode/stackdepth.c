@@ -0,0 +1,259 @@
+// src/bytecode/stackdepth.c
+
+#include "stackdepth.h"
+
+#include <stdlib.h>
+
+#include "opcodes.h"
+
+/* Instruction with decoded operands, label operands are code indices */
+typedef struct FlatInstr {
+    Opcode op;
+    long args[2];
+    SourceRange range;
+} FlatInstr;
+
+typedef struct Flattener {
+    htable_st* labels;                  // Label name to code index plus one
+    FlatInstr* code;                    // Whole module in code order, __init first
+    size_t len;
+    bool* returns_value;                // Per function, whether it returns a value
+    size_t* import_args;                // Argument count per function import
+    bool* import_returns;               // Whether a function import returns a value
+    StackDepths* depths;
+} Flattener;
+
+/**
+ * Gives every label the code index of the instruction following it
+ * @param labels table from label name to code index plus one
+ * @param instruction first instruction of the list
+ * @param index code index of the first instruction, advanced past the list
+ */
+static void index_labels(htable_st* labels, const Instruction* instruction, size_t* index) {
+    for (; instruction != NULL; instruction = instruction->next) {
+        if (instruction->is_label) HTinsert(labels, instruction->instr, (void*) (*index + 1));
+        else (*index)++;
+    }
+}
+
+static void begin_function(Flattener* fl, const char* name) {
+    StackDepths* depths = fl->depths;
+    ARRAY_RESIZE(depths->funs, depths->fun_count + 1);
+    ARRAY_RESIZE(fl->returns_value, depths->fun_count + 1);
+
+    fl->returns_value[depths->fun_count] = false;
+    FunDepth* fun = &depths->funs[depths->fun_count++];
+    fun->name = STRcpy(name);
+    fun->start = fl->len;
+    fun->max_stack = 0;
+    fun->deepest = (SourceRange) {0, 0, 0, 0};
+}
+
+static void add_op(Flattener* fl, const Opcode op, const long arg0, const long arg1, const SourceRange range) {
+    fl->code[fl->len++] = (FlatInstr) {op, {arg0, arg1}, range};
+    if (op == OP_IRETURN || op == OP_FRETURN || op == OP_BRETURN || op == OP_ARETURN) {
+        fl->returns_value[fl->depths->fun_count - 1] = true;
+    }
+}
+
+static void add_instructions(Flattener* fl, const Instruction* instr) {
+    for (; instr != NULL; instr = instr->next) {
+        if (instr->is_fun) begin_function(fl, instr->instr);
+        if (instr->is_label) continue;
+
+        Opcode op;
+        if (!OPfind(instr->instr, &op)) ERROR("Unknown instruction %s", instr->instr);
+
+        const OpInfo* info = &OPCODE_TABLE[op];
+        const char* args[2] = {instr->arg0, instr->arg1};
+        long values[2] = {0, 0};
+        for (size_t i = 0; i < info->operand_count; i++) {
+            if (info->operands[i] == OPND_LABEL) {
+                const size_t target = (size_t) HTlookup(fl->labels, (void*) args[i]);
+                if (target == 0) ERROR("Unknown label %s", args[i]);
+                values[i] = (long) target - 1;
+            } else {
+                values[i] = strtol(args[i], NULL, 10);
+            }
+        }
+
+        add_op(fl, op, values[0], values[1], instr->range);
+    }
+}
+
+/**
+ * Determines how many values an instruction pops and pushes, calls depend on the callee
+ * @param fl flattened module
+ * @param instr instruction
+ * @param pops output parameter receiving the amount of popped values
+ * @param pushes output parameter receiving the amount of pushed values
+ */
+static void stack_effect(const Flattener* fl, const FlatInstr* instr, long* pops, long* pushes) {
+    *pops = OPCODE_TABLE[instr->op].pops;
+    *pushes = OPCODE_TABLE[instr->op].pushes;
+
+    if (instr->op == OP_JSR) {
+        *pops = instr->args[0];
+        *pushes = 0;
+
+        // Functions are in code order, so the callee is found by bisection
+        size_t lo = 0, hi = fl->depths->fun_count;
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (fl->depths->funs[mid].start < (size_t) instr->args[1]) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo < fl->depths->fun_count && fl->depths->funs[lo].start == (size_t) instr->args[1]) {
+            *pushes = fl->returns_value[lo];
+        }
+    } else if (instr->op == OP_JSRE) {
+        *pops = (long) fl->import_args[instr->args[0]];
+        *pushes = fl->import_returns[instr->args[0]];
+    }
+}
+
+/**
+ * Abstract interpretation of a function with the operand stack depth as state.
+ * Every path into an instruction has to arrive with the same depth, so each
+ * instruction is visited once and disagreeing paths are a codegen bug.
+ * @param fl flattened module
+ * @param fun function to analyse, receives its maximum depth
+ * @param end code index following the function
+ */
+static void analyse_function(const Flattener* fl, FunDepth* fun, const size_t end) {
+    const size_t len = end - fun->start;
+    long* depth = MEMmalloc(sizeof(long) * (len + 1));
+    size_t* work = MEMmalloc(sizeof(size_t) * (len + 1));
+    size_t work_count = 0;
+
+    for (size_t i = 0; i < len; i++) depth[i] = -1;
+    if (len > 0) {
+        depth[0] = 0;
+        work[work_count++] = 0;
+    }
+
+    while (work_count > 0) {
+        const size_t i = work[--work_count];
+        const FlatInstr* instr = &fl->code[fun->start + i];
+
+        long pops, pushes;
+        stack_effect(fl, instr, &pops, &pushes);
+        if (depth[i] < pops) {
+            ERROR("Operand stack underflow at %s in %s", OPCODE_TABLE[instr->op].name, fun->name);
+        }
+        const long d = depth[i] - pops + pushes;
+        if ((size_t) d > fun->max_stack) {
+            fun->max_stack = (size_t) d;
+            fun->deepest = instr->range;
+        }
+
+        size_t succs[2];
+        size_t succ_count = 0;
+        const OpInfo* info = &OPCODE_TABLE[instr->op];
+        for (size_t k = 0; k < info->operand_count; k++) {
+            // Calls leave the function, only jumps stay in it
+            if (info->operands[k] == OPND_LABEL && instr->op != OP_JSR) succs[succ_count++] = (size_t) instr->args[k];
+        }
+        const bool ends_flow = instr->op == OP_JUMP || (instr->op >= OP_IRETURN && instr->op <= OP_RETURN);
+        if (!ends_flow) succs[succ_count++] = fun->start + i + 1;
+
+        for (size_t k = 0; k < succ_count; k++) {
+            if (succs[k] < fun->start || succs[k] >= end) continue;
+            const size_t s = succs[k] - fun->start;
+            if (depth[s] == -1) {
+                depth[s] = d;
+                work[work_count++] = s;
+            } else if (depth[s] != d) {
+                ERROR("Operand stack depths %ld and %ld meet in %s", depth[s], d, fun->name);
+            }
+        }
+    }
+
+    MEMfree(depth);
+    MEMfree(work);
+}
+
+/**
+ * Computes the maximum operand stack depth of every function of the module
+ * @param ASM assembly after code generation
+ * @param depths output parameter, free with SDfree
+ */
+void SDanalyse(const Assembly* ASM, StackDepths* depths) {
+    depths->funs = NULL;
+    depths->fun_count = 0;
+
+    Flattener fl;
+    fl.depths = depths;
+    fl.len = 0;
+    fl.returns_value = NULL;
+    fl.labels = HTnew_String(VARTABLE_SIZE);
+
+    // Code indices as the loader counts them, see write_binary
+    size_t count = 0;
+    if (ASM->init_instrs != NULL) {
+        count += ASM->init_local_count > 0;
+        index_labels(fl.labels, ASM->init_instrs, &count);
+        count++;
+    }
+    index_labels(fl.labels, ASM->instrs, &count);
+    fl.code = MEMmalloc(sizeof(FlatInstr) * (count + 1));
+
+    size_t import_count = 0;
+    for (const FunImport* imp = ASM->fun_imports; imp != NULL; imp = imp->next) import_count++;
+    fl.import_args = MEMmalloc(sizeof(size_t) * (import_count + 1));
+    fl.import_returns = MEMmalloc(sizeof(bool) * (import_count + 1));
+    size_t i = 0;
+    for (const FunImport* imp = ASM->fun_imports; imp != NULL; imp = imp->next, i++) {
+        fl.import_args[i] = imp->arg_amount;
+        fl.import_returns[i] = strcmp(imp->ret_type, "void") != 0;
+    }
+
+    if (ASM->init_instrs != NULL) {
+        const SourceRange none = {0, 0, 0, 0};
+        begin_function(&fl, "__init");
+        if (ASM->init_local_count > 0) add_op(&fl, OP_ESR, (long) ASM->init_local_count, 0, none);
+        add_instructions(&fl, ASM->init_instrs);
+        add_op(&fl, OP_RETURN, 0, 0, none);
+    }
+    add_instructions(&fl, ASM->instrs);
+
+    for (i = 0; i < depths->fun_count; i++) {
+        const size_t end = i + 1 < depths->fun_count ? depths->funs[i + 1].start : fl.len;
+        analyse_function(&fl, &depths->funs[i], end);
+    }
+
+    MEMfree(fl.code);
+    MEMfree(fl.returns_value);
+    MEMfree(fl.import_args);
+    MEMfree(fl.import_returns);
+    HTdelete(fl.labels);
+}
+
+/**
+ * Warns about functions needing more operand stack than a VM may provide
+ * @param depths analysed depths
+ * @param limit maximum depth per function, 0 to disable the check
+ */
+void SDcheckLimit(const StackDepths* depths, const size_t limit) {
+    if (limit == 0) return;
+
+    for (size_t i = 0; i < depths->fun_count; i++) {
+        const FunDepth* fun = &depths->funs[i];
+        if (fun->max_stack <= limit) continue;
+
+        if (fun->deepest.line > 0) {
+            USER_WARNING("Function %s needs %lu operand stack values, more than the limit of %lu, at %d:%d",
+                fun->name, fun->max_stack, limit, fun->deepest.line, fun->deepest.col);
+        } else {
+            USER_WARNING("Function %s needs %lu operand stack values, more than the limit of %lu",
+                fun->name, fun->max_stack, limit);
+        }
+    }
+}
+
+void SDfree(StackDepths* depths) {
+    for (size_t i = 0; i < depths->fun_count; i++) MEMfree(depths->funs[i].name);
+    MEMfree(depths->funs);
+    depths->funs = NULL;
+    depths->fun_count = 0;
+}
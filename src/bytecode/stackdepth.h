@@ -0,0 +1,22 @@
+// src/bytecode/stackdepth.h
+
+#pragma once
+
+#include "asm.h"
+#include "common.h"
+
+typedef struct FunDepth {
+    char* name;                         // Function label, __init for global initialisation
+    size_t start;                       // Code index of the function entry
+    size_t max_stack;                   // Maximum operand stack depth over all paths
+    SourceRange deepest;                // Source of an instruction reaching the maximum
+} FunDepth;
+
+typedef struct StackDepths {
+    FunDepth* funs;                     // In code order, __init first
+    size_t fun_count;
+} StackDepths;
+
+void SDanalyse(const Assembly* ASM, StackDepths* depths);
+void SDcheckLimit(const StackDepths* depths, size_t limit);
+void SDfree(StackDepths* depths);
@@ -0,0 +1,162 @@
+// src/bytecode/stats.c
+
+#include "stats.h"
+
+static void begin_function(AsmStats* stats, const char* name, const size_t frame_slots) {
+    ARRAY_RESIZE(stats->funs, stats->fun_count + 1);
+
+    FunStats* fun = &stats->funs[stats->fun_count++];
+    memset(fun, 0, sizeof(FunStats));
+    fun->name = STRcpy(name);
+    fun->frame_slots = frame_slots;
+}
+
+static void count_op(AsmStats* stats, const char* instr) {
+    Opcode op;
+    if (!OPfind(instr, &op)) ERROR("Unknown instruction %s", instr);
+
+    FunStats* fun = &stats->funs[stats->fun_count - 1];
+    fun->instr_count++;
+    fun->op_counts[op]++;
+}
+
+static void count_instructions(AsmStats* stats, const Instruction* instr) {
+    for (; instr != NULL; instr = instr->next) {
+        if (!instr->is_label) {
+            count_op(stats, instr->instr);
+        } else if (instr->is_fun) {
+            begin_function(stats, instr->instr, instr->frame_slots);
+        } else {
+            stats->funs[stats->fun_count - 1].label_count++;
+        }
+    }
+}
+
+/**
+ * Gathers static statistics of the generated code
+ * @param ASM assembly after code generation
+ * @param depths operand stack depths of the same assembly
+ * @param stats output parameter, free with STATSfree
+ */
+void STATScollect(const Assembly* ASM, const StackDepths* depths, AsmStats* stats) {
+    memset(stats, 0, sizeof(AsmStats));
+
+    if (ASM->init_instrs != NULL) {
+        begin_function(stats, "__init", ASM->init_local_count);
+        if (ASM->init_local_count > 0) count_op(stats, "esr");
+        count_instructions(stats, ASM->init_instrs);
+        count_op(stats, "return");
+        stats->init_size = stats->funs[0].instr_count;
+    }
+    count_instructions(stats, ASM->instrs);
+
+#ifdef DEBUGGING
+    ASSERT_MSG((depths->fun_count == stats->fun_count), "Stack depths of %lu functions for %lu functions",
+        depths->fun_count, stats->fun_count);
+#endif
+
+    FunStats* total = &stats->total;
+    total->name = STRcpy("total");
+    for (size_t i = 0; i < stats->fun_count; i++) {
+        FunStats* fun = &stats->funs[i];
+        fun->max_stack = depths->funs[i].max_stack;
+
+        total->instr_count += fun->instr_count;
+        total->label_count += fun->label_count;
+        if (fun->frame_slots > total->frame_slots) total->frame_slots = fun->frame_slots;
+        if (fun->max_stack > total->max_stack) total->max_stack = fun->max_stack;
+        for (size_t op = 0; op < OP_COUNT_; op++) total->op_counts[op] += fun->op_counts[op];
+    }
+
+    for (const Constant* k = ASM->consts; k != NULL; k = k->next) stats->const_count++;
+    for (const GlobVar* g = ASM->glob_vars; g != NULL; g = g->next) stats->global_count++;
+    for (const FunImport* imp = ASM->fun_imports; imp != NULL; imp = imp->next) stats->fun_import_count++;
+    for (const VarImport* imp = ASM->var_imports; imp != NULL; imp = imp->next) stats->var_import_count++;
+    for (const FunExport* exp = ASM->fun_exports; exp != NULL; exp = exp->next) stats->fun_export_count++;
+    for (const VarExport* exp = ASM->var_exports; exp != NULL; exp = exp->next) stats->var_export_count++;
+}
+
+void STATSfree(AsmStats* stats) {
+    for (size_t i = 0; i < stats->fun_count; i++) MEMfree(stats->funs[i].name);
+    MEMfree(stats->funs);
+    MEMfree(stats->total.name);
+    stats->funs = NULL;
+    stats->fun_count = 0;
+}
+
+static void write_text_row(FILE* f, const FunStats* fun) {
+    fprintf(f, "%-24s %8lu %8lu %8lu %8lu\n", fun->name, fun->instr_count, fun->label_count,
+        fun->frame_slots, fun->max_stack);
+}
+
+static void write_text_histogram(FILE* f, const FunStats* fun) {
+    fprintf(f, "%s:", fun->name);
+    bool first = true;
+    for (size_t op = 0; op < OP_COUNT_; op++) {
+        if (fun->op_counts[op] == 0) continue;
+        fprintf(f, "%s %s %lu", first ? "" : ",", OPCODE_TABLE[op].name, fun->op_counts[op]);
+        first = false;
+    }
+    fprintf(f, "\n");
+}
+
+/**
+ * Writes the statistics as aligned tables, the total row holds maxima for slots and stack
+ * @param f output file
+ * @param stats collected statistics
+ */
+void STATSwriteText(FILE* f, const AsmStats* stats) {
+    fprintf(f, "%-24s %8s %8s %8s %8s\n", "function", "instrs", "labels", "slots", "stack");
+    for (size_t i = 0; i < stats->fun_count; i++) write_text_row(f, &stats->funs[i]);
+    write_text_row(f, &stats->total);
+
+    fprintf(f, "\nopcodes\n");
+    for (size_t i = 0; i < stats->fun_count; i++) write_text_histogram(f, &stats->funs[i]);
+    write_text_histogram(f, &stats->total);
+
+    fprintf(f, "\nconstants %lu, globals %lu, imports %lu functions %lu variables, "
+               "exports %lu functions %lu variables, __init %lu instrs\n",
+        stats->const_count, stats->global_count, stats->fun_import_count, stats->var_import_count,
+        stats->fun_export_count, stats->var_export_count, stats->init_size);
+}
+
+static void write_json_fun(FILE* f, const FunStats* fun, const char* indent) {
+    fprintf(f, "{\n");
+    fprintf(f, "%s  \"name\": \"%s\",\n", indent, fun->name);
+    fprintf(f, "%s  \"instructions\": %lu,\n", indent, fun->instr_count);
+    fprintf(f, "%s  \"labels\": %lu,\n", indent, fun->label_count);
+    fprintf(f, "%s  \"frame_slots\": %lu,\n", indent, fun->frame_slots);
+    fprintf(f, "%s  \"max_stack\": %lu,\n", indent, fun->max_stack);
+    fprintf(f, "%s  \"opcodes\": {", indent);
+    bool first = true;
+    for (size_t op = 0; op < OP_COUNT_; op++) {
+        if (fun->op_counts[op] == 0) continue;
+        fprintf(f, "%s\"%s\": %lu", first ? "" : ", ", OPCODE_TABLE[op].name, fun->op_counts[op]);
+        first = false;
+    }
+    fprintf(f, "}\n%s}", indent);
+}
+
+/**
+ * Writes the statistics as a JSON object, opcodes that do not occur are left out
+ * @param f output file
+ * @param stats collected statistics
+ */
+void STATSwriteJson(FILE* f, const AsmStats* stats) {
+    fprintf(f, "{\n  \"functions\": [");
+    for (size_t i = 0; i < stats->fun_count; i++) {
+        fprintf(f, "%s\n    ", i == 0 ? "" : ",");
+        write_json_fun(f, &stats->funs[i], "    ");
+    }
+    fprintf(f, "%s],\n  \"total\": ", stats->fun_count == 0 ? "" : "\n  ");
+    write_json_fun(f, &stats->total, "  ");
+    fprintf(f, ",\n");
+    fprintf(f, "  \"init_instructions\": %lu,\n", stats->init_size);
+    fprintf(f, "  \"constants\": %lu,\n", stats->const_count);
+    fprintf(f, "  \"globals\": %lu,\n", stats->global_count);
+    fprintf(f, "  \"imports\": {\"functions\": %lu, \"variables\": %lu},\n",
+        stats->fun_import_count, stats->var_import_count);
+    fprintf(f, "  \"exports\": {\"functions\": %lu, \"variables\": %lu}\n",
+        stats->fun_export_count, stats->var_export_count);
+    fprintf(f, "}\n");
+}
@@ -0,0 +1,35 @@
+// src/bytecode/stats.h
+
+#pragma once
+
+#include "asm.h"
+#include "common.h"
+#include "opcodes.h"
+#include "stackdepth.h"
+
+typedef struct FunStats {
+    char* name;                         // Function label, __init for global initialisation
+    size_t instr_count;
+    size_t label_count;                 // Jump targets, the function label excluded
+    size_t frame_slots;                 // Parameters and locals
+    size_t max_stack;                   // Maximum operand stack depth over all paths
+    size_t op_counts[OP_COUNT_];
+} FunStats;
+
+typedef struct AsmStats {
+    FunStats* funs;                     // In code order
+    size_t fun_count;
+    FunStats total;                     // Sums, frame slots and stack depth are maxima
+    size_t init_size;                   // Instructions of __init, 0 without one
+    size_t const_count;
+    size_t global_count;
+    size_t fun_import_count;
+    size_t var_import_count;
+    size_t fun_export_count;
+    size_t var_export_count;
+} AsmStats;
+
+void STATScollect(const Assembly* ASM, const StackDepths* depths, AsmStats* stats);
+void STATSfree(AsmStats* stats);
+void STATSwriteText(FILE* f, const AsmStats* stats);
+void STATSwriteJson(FILE* f, const AsmStats* stats);
@@ -2,8 +2,24 @@
 
 #include "writer.h"
 
+#include <stdlib.h>
+
+#include "binary.h"
+
 bool WRITTEN_FIRST_LABEL = false;
 
+// Source range of the last annotated instruction
+static SourceRange LAST_RANGE;
+
+static bool same_range(const SourceRange a, const SourceRange b) {
+    return a.line == b.line && a.col == b.col && a.end_line == b.end_line && a.end_col == b.end_col;
+}
+
+static void write_range(FILE* f, const SourceRange range) {
+    if (range.line == 0) fprintf(f, "-");
+    else fprintf(f, "%d:%d-%d:%d", range.line, range.col, range.end_line, range.end_col);
+}
+
 static void write_single_instruction(FILE* f, const Instruction* instruction) {
     if (instruction->is_label) {
         // Write extra newline for functions, but not if this is the first label
@@ -23,22 +39,34 @@ static void write_single_instruction(FILE* f, const Instruction* instruction) {
 
 /**
  * Traverses linked list and calls writer for each instruction
+ * @param f output file
+ * @param instruction first instruction
+ * @param annotate whether to precede instructions with a comment holding their source range
  */
-static void write_instructions(FILE* f, const Instruction* instruction) {
+static void write_instructions(FILE* f, const Instruction* instruction, const bool annotate) {
     while (instruction != NULL) {
+        if (annotate && !instruction->is_label && instruction->range.line != 0
+            && !same_range(instruction->range, LAST_RANGE)) {
+            fprintf(f, "    ; ");
+            write_range(f, instruction->range);
+            fprintf(f, "\n");
+            LAST_RANGE = instruction->range;
+        }
         write_single_instruction(f, instruction);
         fprintf(f, "\n");
         instruction = instruction->next;
     }
 }
 
-static void write_init_instructions(FILE* f, const Instruction* init_instruction) {
-    if (init_instruction == NULL) {
+static void write_init_instructions(FILE* f, const Assembly* ASM, const bool annotate) {
+    if (ASM->init_instrs == NULL) {
         return;
     }
 
     fprintf(f, "__init:\n");
-    write_instructions(f, init_instruction);
+    // Reserve frame slots used as loop counters
+    if (ASM->init_local_count > 0) fprintf(f, "    esr %lu\n", ASM->init_local_count);
+    write_instructions(f, ASM->init_instrs, annotate);
     fprintf(f, "    return\n\n");
 }
 
@@ -126,9 +154,17 @@ static void write_var_imports(FILE* f, const VarImport* import) {
     }
 }
 
-void write_assembly(FILE* f, const Assembly* ASM) {
-    write_init_instructions(f, ASM->init_instrs);
-    write_instructions(f, ASM->instrs);
+/**
+ * Writes the assembly as text
+ * @param f output file
+ * @param ASM assembly to write
+ * @param annotate whether to write the source range of instructions as comments
+ */
+void write_assembly(FILE* f, const Assembly* ASM, const bool annotate) {
+    WRITTEN_FIRST_LABEL = false;
+    LAST_RANGE = (SourceRange) {0, 0, 0, 0};
+    write_init_instructions(f, ASM, annotate);
+    write_instructions(f, ASM->instrs, annotate);
     fprintf(f, "\n");  // Extra newline like in examples
     write_constants(f, ASM->consts);
     write_fun_exports(f, ASM->fun_exports);
@@ -137,3 +173,212 @@ void write_assembly(FILE* f, const Assembly* ASM) {
     write_fun_imports(f, ASM->fun_imports);
     write_var_imports(f, ASM->var_imports);
 }
+
+/**
+ * Gives every label the code index of the instruction following it
+ * @param labels table from label name to code index plus one
+ * @param instruction first instruction of the list
+ * @param index code index of the first instruction, advanced past the list
+ */
+static void index_labels(htable_st* labels, const Instruction* instruction, size_t* index) {
+    for (; instruction != NULL; instruction = instruction->next) {
+        if (instruction->is_label) HTinsert(labels, instruction->instr, (void*) (*index + 1));
+        else (*index)++;
+    }
+}
+
+/**
+ * Encodes a single instruction with resolved operands
+ * @param labels table from label name to code index plus one
+ * @param instr instruction name
+ * @param arg0 first operand, may be NULL
+ * @param arg1 second operand, may be NULL
+ * @param out encoded instruction
+ */
+static void encode_instruction(htable_st* labels, const char* instr, const char* arg0, const char* arg1, BinInstr* out) {
+    if (!OPfind(instr, &out->op)) ERROR("Unknown instruction %s", instr);
+
+    const OpInfo* info = &OPCODE_TABLE[out->op];
+    const char* args[2] = {arg0, arg1};
+    out->args[0] = 0;
+    out->args[1] = 0;
+    for (size_t i = 0; i < info->operand_count; i++) {
+        if (info->operands[i] == OPND_LABEL) {
+            const size_t target = (size_t) HTlookup(labels, (void*) args[i]);
+            if (target == 0) ERROR("Unknown label %s", args[i]);
+            out->args[i] = (int32_t) (target - 1);
+        } else {
+            out->args[i] = (int32_t) strtol(args[i], NULL, 10);
+        }
+    }
+}
+
+static void encode_instructions(htable_st* labels, const Instruction* instruction, BinModule* m) {
+    for (; instruction != NULL; instruction = instruction->next) {
+        if (instruction->is_label) continue;
+        encode_instruction(labels, instruction->instr, instruction->arg0, instruction->arg1, &m->code[m->code_len++]);
+    }
+}
+
+static BinType encode_type(const char* type) {
+    BinType t = BT_VOID;
+    if (!BINfindType(type, &t)) ERROR("Unknown type %s", type);
+    return t;
+}
+
+static void encode_fun(const char* name, const char* ret_type, const size_t arg_amount, char** args, BinFun* out) {
+    out->name = (char*) name;
+    out->ret = encode_type(ret_type);
+    out->arg_count = arg_amount;
+    out->args = MEMmalloc(sizeof(BinType) * (arg_amount + 1));
+    for (size_t i = 0; i < arg_amount; i++) out->args[i] = encode_type(args[i]);
+}
+
+/**
+ * Writes the assembly as a binary module, see binary.h. Labels are resolved
+ * here, so loading needs no second pass.
+ * @param f file opened in binary mode
+ * @param ASM assembly to write
+ * @param depths operand stack depths of the functions, stored for the VM
+ */
+void write_binary(FILE* f, const Assembly* ASM, const StackDepths* depths) {
+    BinModule m;
+    memset(&m, 0, sizeof(m));
+
+    htable_st* labels = HTnew_String(VARTABLE_SIZE);
+    size_t count = 0;
+    if (ASM->init_instrs != NULL) {
+        HTinsert(labels, (char*) "__init", (void*) (count + 1));
+        count += ASM->init_local_count > 0;
+        index_labels(labels, ASM->init_instrs, &count);
+        count++;
+    }
+    index_labels(labels, ASM->instrs, &count);
+
+    m.code = MEMmalloc(sizeof(BinInstr) * (count + 1));
+    if (ASM->init_instrs != NULL) {
+        if (ASM->init_local_count > 0) {
+            char* local_count = STRfmt("%lu", ASM->init_local_count);
+            encode_instruction(labels, "esr", local_count, NULL, &m.code[m.code_len++]);
+            MEMfree(local_count);
+        }
+        encode_instructions(labels, ASM->init_instrs, &m);
+        encode_instruction(labels, "return", NULL, NULL, &m.code[m.code_len++]);
+    }
+    encode_instructions(labels, ASM->instrs, &m);
+
+    for (const Constant* c = ASM->consts; c != NULL; c = c->next) m.const_count++;
+    m.consts = MEMmalloc(sizeof(BinConst) * (m.const_count + 1));
+    size_t i = 0;
+    for (const Constant* c = ASM->consts; c != NULL; c = c->next, i++) {
+        BinConst* bc = &m.consts[i];
+        bc->type = encode_type(c->type);
+        switch (bc->type) {
+            case BT_FLOAT: bc->as.f = strtof(c->value, NULL); break;
+            case BT_BOOL: bc->as.b = strcmp(c->value, "true") == 0; break;
+            default: bc->as.i = (int32_t) strtol(c->value, NULL, 10); break;
+        }
+    }
+
+    for (const GlobVar* g = ASM->glob_vars; g != NULL; g = g->next) m.global_count++;
+    m.globals = MEMmalloc(sizeof(BinType) * (m.global_count + 1));
+    i = 0;
+    for (const GlobVar* g = ASM->glob_vars; g != NULL; g = g->next) m.globals[i++] = encode_type(g->type);
+
+    for (const FunImport* imp = ASM->fun_imports; imp != NULL; imp = imp->next) m.fun_import_count++;
+    m.fun_imports = MEMmalloc(sizeof(BinFun) * (m.fun_import_count + 1));
+    i = 0;
+    for (const FunImport* imp = ASM->fun_imports; imp != NULL; imp = imp->next, i++) {
+        encode_fun(imp->name, imp->ret_type, imp->arg_amount, imp->args, &m.fun_imports[i]);
+        m.fun_imports[i].target = 0;
+    }
+
+    for (const VarImport* imp = ASM->var_imports; imp != NULL; imp = imp->next) m.var_import_count++;
+    m.var_imports = MEMmalloc(sizeof(BinVar) * (m.var_import_count + 1));
+    i = 0;
+    for (const VarImport* imp = ASM->var_imports; imp != NULL; imp = imp->next, i++) {
+        m.var_imports[i] = (BinVar){imp->name, encode_type(imp->type), 0};
+    }
+
+    for (const FunExport* exp = ASM->fun_exports; exp != NULL; exp = exp->next) m.fun_export_count++;
+    m.fun_exports = MEMmalloc(sizeof(BinFun) * (m.fun_export_count + 1));
+    i = 0;
+    for (const FunExport* exp = ASM->fun_exports; exp != NULL; exp = exp->next, i++) {
+        encode_fun(exp->name, exp->ret_type, exp->arg_amount, exp->args, &m.fun_exports[i]);
+        const size_t target = (size_t) HTlookup(labels, exp->name);
+        if (target == 0) ERROR("Unknown label %s", exp->name);
+        m.fun_exports[i].target = target - 1;
+    }
+
+    for (const VarExport* exp = ASM->var_exports; exp != NULL; exp = exp->next) m.var_export_count++;
+    m.var_exports = MEMmalloc(sizeof(BinVar) * (m.var_export_count + 1));
+    i = 0;
+    for (const VarExport* exp = ASM->var_exports; exp != NULL; exp = exp->next, i++) {
+        m.var_exports[i] = (BinVar){exp->name, BT_VOID, exp->global_index};
+    }
+
+    m.stack_count = depths->fun_count;
+    m.stacks = MEMmalloc(sizeof(BinStack) * (m.stack_count + 1));
+    for (i = 0; i < depths->fun_count; i++) m.stacks[i] = (BinStack){depths->funs[i].start, depths->funs[i].max_stack};
+
+    BINwrite(f, &m);
+
+    // Names are borrowed from the assembly, so the module is freed by hand
+    for (i = 0; i < m.fun_import_count; i++) MEMfree(m.fun_imports[i].args);
+    for (i = 0; i < m.fun_export_count; i++) MEMfree(m.fun_exports[i].args);
+    MEMfree(m.code);
+    MEMfree(m.consts);
+    MEMfree(m.globals);
+    MEMfree(m.fun_imports);
+    MEMfree(m.var_imports);
+    MEMfree(m.fun_exports);
+    MEMfree(m.var_exports);
+    MEMfree(m.stacks);
+    HTdelete(labels);
+}
+
+/**
+ * Adds the instructions of a list to the line table
+ * @param f output file
+ * @param instruction first instruction of the list
+ * @param index code index of the first instruction, advanced past the list
+ */
+static void write_line_entries(FILE* f, const Instruction* instruction, size_t* index) {
+    for (; instruction != NULL; instruction = instruction->next) {
+        if (instruction->is_label) continue;
+        if (*index == 0 || !same_range(instruction->range, LAST_RANGE)) {
+            fprintf(f, "%lu ", *index);
+            write_range(f, instruction->range);
+            fprintf(f, "\n");
+            LAST_RANGE = instruction->range;
+        }
+        (*index)++;
+    }
+}
+
+/**
+ * Writes the line table of the assembly: a line per run of instructions with
+ * the same source range, holding the code index of the first instruction of
+ * the run and the range. Code indices match the binary module and the order
+ * in which a loader reads the textual assembly, including the instructions
+ * __init gets around its body.
+ * @param f output file
+ * @param ASM assembly to describe
+ */
+void write_line_table(FILE* f, const Assembly* ASM) {
+    const SourceRange unknown = {0, 0, 0, 0};
+    size_t index = 0;
+
+    fprintf(f, "# code index, source line:col-line:col or - when unknown\n");
+    LAST_RANGE = unknown;
+    if (ASM->init_instrs != NULL) {
+        if (ASM->init_local_count > 0) {
+            fprintf(f, "%lu -\n", index++);
+        }
+        write_line_entries(f, ASM->init_instrs, &index);
+        if (!same_range(LAST_RANGE, unknown) || index == 0) fprintf(f, "%lu -\n", index);
+        LAST_RANGE = unknown;
+        index++;
+    }
+    write_line_entries(f, ASM->instrs, &index);
+}
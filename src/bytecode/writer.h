@@ -4,5 +4,8 @@
 
 #include "asm.h"
 #include "common.h"
+#include "stackdepth.h"
 
-void write_assembly(FILE* f, const Assembly* ASM);
+void write_assembly(FILE* f, const Assembly* ASM, bool annotate);
+void write_binary(FILE* f, const Assembly* ASM, const StackDepths* depths);
+void write_line_table(FILE* f, const Assembly* ASM);
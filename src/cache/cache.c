@@ -0,0 +1,497 @@
+// src/cache/cache.c
+
+#include "cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "global/globals.h"
+#include "palm/memory.h"
+#include "palm/str.h"
+
+// Cache size without CIVICC_CACHE_SIZE
+#define DEFAULT_CACHE_SIZE (256UL << 20)
+
+// Length of an entry name, a 128-bit hash in hexadecimal
+#define KEY_LEN 32
+
+/* A compilation that missed the cache and is stored once it succeeds */
+typedef struct Pending {
+    bool active;
+    char* dir;
+    char* key;
+    char* src;                          // Source, also handed to the parser
+    size_t src_len;
+    FILE* diagnostics;                  // Captures warnings to replay on hits
+    char* diagnostics_text;
+    size_t diagnostics_size;
+    FILE* ast;                          // Captures the printed program to replay on hits
+    char* ast_text;
+    size_t ast_size;
+} Pending;
+
+typedef struct Entry {
+    char* name;
+    time_t used;
+    off_t size;
+} Entry;
+
+static Pending PENDING;
+
+/**
+ * @return cache directory from CIVICC_CACHE_DIR, NULL when caching is disabled
+ */
+static const char* cache_dir() {
+    const char* dir = getenv("CIVICC_CACHE_DIR");
+    return dir != NULL && dir[0] != '\0' ? dir : NULL;
+}
+
+/**
+ * @return size bound from CIVICC_CACHE_SIZE, in bytes
+ */
+static size_t cache_limit() {
+    const char* env = getenv("CIVICC_CACHE_SIZE");
+    if (env == NULL || env[0] == '\0') return DEFAULT_CACHE_SIZE;
+
+    char* end;
+    size_t size = strtoul(env, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': size <<= 30; break;
+        case 'M': case 'm': size <<= 20; break;
+        case 'K': case 'k': size <<= 10; break;
+        default: break;
+    }
+    return size;
+}
+
+static bool make_dirs(const char* dir) {
+    char* path = STRcpy(dir);
+    for (char* c = path + 1; *c != '\0'; c++) {
+        if (*c != '/') continue;
+        *c = '\0';
+        mkdir(path, 0777);
+        *c = '/';
+    }
+    const bool made = mkdir(path, 0777) == 0 || errno == EEXIST;
+    MEMfree(path);
+    return made;
+}
+
+/**
+ * Derives the entry name from the compiler build, the options that change the
+ * output and the source. The base name of the input is part of it, generated
+ * C and x86 name it and profile dump functions are named after it, while the
+ * directory it is compiled from does not matter.
+ * @param src source bytes
+ * @param len length of the source
+ * @return entry name of KEY_LEN hexadecimal digits
+ */
+static char* cache_key(const char* src, const size_t len) {
+    char* options = STRfmt("civicc %s\nemit=%d g=%d profile=%d max-stack=%lu ast=%d input=%s\n",
+        GLBbuildId(), (int) global.emit, (int) global.debug_info,
+        (int) global.profile_counts, global.max_stack, (int) global.print_ast, file_basename(global.input_file));
+
+    uint64_t h[2];
+    hash_seed(h);
+    hash_bytes(h, options, strlen(options));
+    hash_bytes(h, src, len);
+    hash_finish(h);
+    MEMfree(options);
+
+    return STRfmt("%016llx%016llx", (unsigned long long) h[0], (unsigned long long) h[1]);
+}
+
+/**
+ * Holds the cache lock while counting and evicting, so concurrent compilers
+ * agree on the statistics
+ * @param dir cache directory
+ * @return descriptor to pass to unlock, -1 if the lock file could not be opened
+ */
+static int lock(const char* dir) {
+    char* path = STRfmt("%s/lock", dir);
+    const int fd = open(path, O_RDWR | O_CREAT, 0666);
+    MEMfree(path);
+    if (fd != -1) flock(fd, LOCK_EX);
+    return fd;
+}
+
+static void unlock(const int fd) {
+    if (fd == -1) return;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static void read_counts(const char* dir, unsigned long* hits, unsigned long* misses) {
+    *hits = 0;
+    *misses = 0;
+
+    char* path = STRfmt("%s/stats", dir);
+    FILE* f = fopen(path, "r");
+    MEMfree(path);
+    if (f == NULL) return;
+
+    if (fscanf(f, "hits %lu\nmisses %lu\n", hits, misses) != 2) {
+        *hits = 0;
+        *misses = 0;
+    }
+    fclose(f);
+}
+
+/**
+ * Writes a file under a temporary name and renames it, readers see the old or the whole new file
+ * @param dir directory of the file
+ * @param name file name
+ * @param data content
+ * @param len length of the content
+ * @return whether the file was written
+ */
+static bool write_atomic(const char* dir, const char* name, const char* data, const size_t len) {
+    char* tmp = STRfmt("%s/tmp.%ld.%s", dir, (long) getpid(), name);
+    char* path = STRfmt("%s/%s", dir, name);
+
+    FILE* f = fopen(tmp, "wb");
+    bool written = f != NULL && fwrite(data, 1, len, f) == len;
+    if (f != NULL) written = fclose(f) == 0 && written;
+    written = written && rename(tmp, path) == 0;
+    if (!written) unlink(tmp);
+
+    MEMfree(tmp);
+    MEMfree(path);
+    return written;
+}
+
+static void count(const char* dir, const bool hit) {
+    const int fd = lock(dir);
+    unsigned long hits, misses;
+    read_counts(dir, &hits, &misses);
+    if (hit) hits++;
+    else misses++;
+
+    char* counts = STRfmt("hits %lu\nmisses %lu\n", hits, misses);
+    write_atomic(dir, "stats", counts, strlen(counts));
+    MEMfree(counts);
+    unlock(fd);
+}
+
+static bool is_entry_name(const char* name) {
+    if (strlen(name) != KEY_LEN) return false;
+    for (const char* c = name; *c != '\0'; c++) {
+        if (!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'f'))) return false;
+    }
+    return true;
+}
+
+/**
+ * Lists the entries of the cache
+ * @param dir cache directory
+ * @param entries output parameter, free the names and the array
+ * @param total output parameter receiving the size of all entries
+ * @return amount of entries
+ */
+static size_t list_entries(const char* dir, Entry** entries, size_t* total) {
+    *entries = NULL;
+    *total = 0;
+
+    DIR* d = opendir(dir);
+    if (d == NULL) return 0;
+
+    size_t count = 0;
+    const struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (!is_entry_name(ent->d_name)) continue;
+
+        char* path = STRfmt("%s/%s", dir, ent->d_name);
+        struct stat st;
+        if (stat(path, &st) == 0) {
+            ARRAY_RESIZE(*entries, count + 1);
+            (*entries)[count++] = (Entry) {STRcpy(ent->d_name), st.st_mtime, st.st_size};
+            *total += (size_t) st.st_size;
+        }
+        MEMfree(path);
+    }
+    closedir(d);
+    return count;
+}
+
+static int compare_used(const void* a, const void* b) {
+    const Entry* x = a;
+    const Entry* y = b;
+    if (x->used != y->used) return x->used < y->used ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+/**
+ * Removes the least recently used entries until the cache fits its bound.
+ * Hits refresh the modification time of an entry, so it orders by use.
+ * @param dir cache directory
+ */
+static void evict(const char* dir) {
+    const size_t limit = cache_limit();
+    const int fd = lock(dir);
+
+    Entry* entries;
+    size_t total;
+    const size_t count = list_entries(dir, &entries, &total);
+    qsort(entries, count, sizeof(Entry), compare_used);
+
+    for (size_t i = 0; i < count; i++) {
+        if (total > limit) {
+            char* path = STRfmt("%s/%s", dir, entries[i].name);
+            if (unlink(path) == 0) total -= (size_t) entries[i].size;
+            MEMfree(path);
+        }
+        MEMfree(entries[i].name);
+    }
+    MEMfree(entries);
+    unlock(fd);
+}
+
+/**
+ * Finds a section of an entry, sections are "<name> <length>\n<bytes>"
+ * @param entry entry content
+ * @param len length of the content
+ * @param name section name
+ * @param section_len output parameter receiving the length of the section
+ * @return start of the section bytes, NULL if the entry has no such section
+ */
+static const char* find_section(const char* entry, const size_t len, const char* name, size_t* section_len) {
+    const char* end = entry + len;
+    const char* pos = memchr(entry, '\n', len);
+    if (pos == NULL) return NULL;
+    pos++;
+
+    while (pos < end) {
+        const char* newline = memchr(pos, '\n', (size_t) (end - pos));
+        if (newline == NULL) return NULL;
+
+        const char* space = memchr(pos, ' ', (size_t) (newline - pos));
+        if (space == NULL) return NULL;
+        const size_t size = strtoul(space + 1, NULL, 10);
+        const char* data = newline + 1;
+        if (size > (size_t) (end - data)) return NULL;
+
+        if ((size_t) (space - pos) == strlen(name) && memcmp(pos, name, strlen(name)) == 0) {
+            *section_len = size;
+            return data;
+        }
+        pos = data + size;
+    }
+    return NULL;
+}
+
+static bool write_section(const char* entry, const size_t len, const char* name, const char* path) {
+    size_t size;
+    const char* data = find_section(entry, len, name, &size);
+    if (data == NULL) return true;
+
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) return false;
+    const bool written = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && written;
+}
+
+/**
+ * Writes the outputs stored in an entry as the compilation would have
+ * @param entry entry content
+ * @param len length of the content
+ * @return false if the entry is damaged or the outputs could not be written
+ */
+static bool replay(const char* entry, const size_t len) {
+    if (len < 15 || memcmp(entry, "civicc-cache 1\n", 15) != 0) return false;
+
+    size_t size;
+    const char* data = find_section(entry, len, "output", &size);
+    if (data == NULL) return false;
+
+    bool written = write_section(entry, len, "output", global.output_file);
+    if (global.debug_info) {
+        char* path = STRfmt("%s.lines", global.output_file);
+        written = written && write_section(entry, len, "lines", path);
+        MEMfree(path);
+    }
+    if (global.profile_counts) {
+        char* path = STRfmt("%s.prof", global.output_file);
+        written = written && write_section(entry, len, "prof", path);
+        MEMfree(path);
+    }
+
+    data = find_section(entry, len, "ast", &size);
+    if (data != NULL) fwrite(data, 1, size, GLBastOutput());
+    data = find_section(entry, len, "diagnostics", &size);
+    if (data != NULL) fwrite(data, 1, size, GLBdiagnostics());
+    return written;
+}
+
+static void append_section(char** entry, size_t* len, const char* name, const char* data, const size_t size) {
+    char* header = STRfmt("%s %lu\n", name, size);
+    const size_t header_len = strlen(header);
+    ARRAY_RESIZE(*entry, *len + header_len + size + 1);
+    memcpy(*entry + *len, header, header_len);
+    memcpy(*entry + *len + header_len, data, size);
+    *len += header_len + size;
+    MEMfree(header);
+}
+
+static bool append_file(char** entry, size_t* len, const char* name, const char* path) {
+    size_t size;
+    char* data = read_file(path, &size);
+    if (data == NULL) return false;
+    append_section(entry, len, name, data, size);
+    MEMfree(data);
+    return true;
+}
+
+/**
+ * Looks the compilation up in the cache and writes its outputs on a hit. The
+ * cache only serves compilations to an output file that print nothing but
+ * the program. On a miss the source is handed to the parser, and warnings
+ * and the printed program are captured for CACHEstore.
+ * @return true on a hit, the compilation is done
+ */
+bool CACHEfetch(void) {
+    PENDING.active = false;
+
+    const char* dir = cache_dir();
+    if (dir == NULL || global.output_file == NULL || global.stats != STATS_NONE || global.verbose) return false;
+    if (!make_dirs(dir)) return false;
+
+    size_t len;
+    char* src = read_file(global.input_file, &len);
+    if (src == NULL) return false;
+
+    char* key = cache_key(src, len);
+    char* path = STRfmt("%s/%s", dir, key);
+    size_t entry_len;
+    char* entry = read_file(path, &entry_len);
+
+    const bool hit = entry != NULL && replay(entry, entry_len);
+    if (hit) {
+        // Refresh the entry for the LRU order
+        utimensat(AT_FDCWD, path, NULL, 0);
+    }
+    count(dir, hit);
+    MEMfree(entry);
+    MEMfree(path);
+
+    if (hit) {
+        MEMfree(src);
+        MEMfree(key);
+        return true;
+    }
+
+    PENDING.active = true;
+    PENDING.dir = STRcpy(dir);
+    PENDING.key = key;
+    PENDING.src = src;
+    PENDING.src_len = len;
+    PENDING.diagnostics_text = NULL;
+    PENDING.diagnostics_size = 0;
+    PENDING.diagnostics = open_memstream(&PENDING.diagnostics_text, &PENDING.diagnostics_size);
+    PENDING.ast_text = NULL;
+    PENDING.ast_size = 0;
+    PENDING.ast = global.print_ast ? open_memstream(&PENDING.ast_text, &PENDING.ast_size) : NULL;
+
+    // The parser reads the source hashed for the key
+    global.input_buffer = PENDING.src;
+    global.input_size = PENDING.src_len;
+    if (PENDING.diagnostics != NULL) global.diagnostics = PENDING.diagnostics;
+    if (PENDING.ast != NULL) global.ast_output = PENDING.ast;
+    return false;
+}
+
+/**
+ * Stores a compilation that missed the cache, unless it failed
+ */
+void CACHEstore(void) {
+    if (!PENDING.active) return;
+    PENDING.active = false;
+
+    if (PENDING.diagnostics != NULL) {
+        global.diagnostics = NULL;
+        fclose(PENDING.diagnostics);
+        fwrite(PENDING.diagnostics_text, 1, PENDING.diagnostics_size, stderr);
+    }
+    if (PENDING.ast != NULL) {
+        global.ast_output = NULL;
+        fclose(PENDING.ast);
+        fwrite(PENDING.ast_text, 1, PENDING.ast_size, stdout);
+    }
+
+    if (!global.had_error) {
+        char* entry = STRcpy("civicc-cache 1\n");
+        size_t len = strlen(entry);
+
+        // A printed program that was not captured cannot be replayed
+        bool complete = !global.print_ast || PENDING.ast != NULL;
+        complete = complete && append_file(&entry, &len, "output", global.output_file);
+        if (global.debug_info) {
+            char* path = STRfmt("%s.lines", global.output_file);
+            complete = complete && append_file(&entry, &len, "lines", path);
+            MEMfree(path);
+        }
+        if (global.profile_counts) {
+            char* path = STRfmt("%s.prof", global.output_file);
+            complete = complete && append_file(&entry, &len, "prof", path);
+            MEMfree(path);
+        }
+        if (PENDING.ast_size > 0) {
+            append_section(&entry, &len, "ast", PENDING.ast_text, PENDING.ast_size);
+        }
+        if (PENDING.diagnostics_size > 0) {
+            append_section(&entry, &len, "diagnostics", PENDING.diagnostics_text, PENDING.diagnostics_size);
+        }
+
+        if (complete && write_atomic(PENDING.dir, PENDING.key, entry, len)) evict(PENDING.dir);
+        MEMfree(entry);
+    }
+
+    global.input_buffer = NULL;
+    global.input_size = 0;
+    // Memory streams allocate with malloc
+    free(PENDING.diagnostics_text);
+    free(PENDING.ast_text);
+    MEMfree(PENDING.src);
+    MEMfree(PENDING.key);
+    MEMfree(PENDING.dir);
+}
+
+/**
+ * Prints the contents and hit rate of the cache
+ * @param f output file
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if caching is disabled
+ */
+int CACHEprintStats(FILE* f) {
+    const char* dir = cache_dir();
+    if (dir == NULL) {
+        fprintf(f, "Caching is disabled, set CIVICC_CACHE_DIR to enable it\n");
+        return EXIT_FAILURE;
+    }
+
+    const int fd = lock(dir);
+    unsigned long hits, misses;
+    read_counts(dir, &hits, &misses);
+    Entry* entries;
+    size_t total;
+    const size_t count = list_entries(dir, &entries, &total);
+    unlock(fd);
+
+    for (size_t i = 0; i < count; i++) MEMfree(entries[i].name);
+    MEMfree(entries);
+
+    const unsigned long lookups = hits + misses;
+    fprintf(f, "%-12s %s\n", "directory", dir);
+    fprintf(f, "%-12s %lu\n", "entries", count);
+    fprintf(f, "%-12s %lu of %lu bytes\n", "size", total, cache_limit());
+    fprintf(f, "%-12s %lu\n", "hits", hits);
+    fprintf(f, "%-12s %lu\n", "misses", misses);
+    fprintf(f, "%-12s %.1f%%\n", "hit rate", lookups > 0 ? 100.0 * (double) hits / (double) lookups : 0.0);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,14 @@
+// src/cache/cache.h
+
+#pragma once
+
+/* On-disk cache of compiled units, keyed by the source and the options that
+ * change the output. Enabled by setting CIVICC_CACHE_DIR, CIVICC_CACHE_SIZE
+ * bounds it in bytes (suffixes K, M and G, default 256M). */
+
+#include <stdbool.h>
+#include <stdio.h>
+
+bool CACHEfetch(void);
+void CACHEstore(void);
+int CACHEprintStats(FILE* f);
@@ -0,0 +1,1226 @@
+/**
+ * @file
+ *
+ * Traversal: CGeneration
+ * UID      : CG
+ *
+ * Generates portable C from the checked AST when civicc runs with --emit=c,
+ * so a host C compiler can build a native executable. The generated code
+ * keeps the semantics of the bytecode:
+ * - Nested functions become static C functions that receive a pointer to the
+ *   environment of their enclosing function. Functions with nested functions
+ *   keep their parameters and variables in such an environment struct.
+ * - Arrays are heap allocated and passed with their dimensions, dimensions first.
+ * - Exported and imported functions and variables are linked by their CiviC
+ *   name with a civic_ prefix; everything else is static.
+ * - Integer arithmetic wraps, and operands are evaluated left to right
+ *   wherever C leaves the order open and a function call could observe it.
+ * The module exporting main also defines the functions of civic.h and the C
+ * entry point. Global initialisation runs as a constructor, which needs a
+ * GCC compatible host compiler.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+#include "ccngen/trav.h"
+
+#include "common.h"
+#include "global/globals.h"
+#include "optimisation/consteval.h"
+#include "symbol/table.h"
+
+typedef struct Buffer {
+    char* data;
+    size_t len;
+    size_t size;
+} Buffer;
+
+typedef struct FunState {
+    Symbol* fun;                        // NULL for the module initialiser
+    bool has_env;                       // Variables live in an environment struct
+    Buffer temps;                       // Declarations of temporaries
+    Buffer body;
+    size_t temp_count;
+    size_t indent;
+    char** arrays;                      // Local arrays, freed when the function returns
+    size_t array_count;
+    size_t array_size;
+} FunState;
+
+static SymbolTable* CURRENT_SCOPE;
+static FunState* FS;
+
+static Buffer DECLS;                    // Environment structs, prototypes and globals
+static Buffer FUNS;                     // Function definitions
+
+static htable_st* LINK_NAMES = NULL;    // Imported and exported global to its CiviC name
+static const Symbol* MAIN_FUN = NULL;   // Exported main function, if this module has one
+
+// Result of the last traversed expression
+static char* RESULT = NULL;
+static ValueType LAST_TYPE = VT_NULL;
+
+static const char* BUILTIN_NAMES[] = {
+    "printInt", "printFloat", "scanInt", "scanFloat", "printSpaces", "printNewlines",
+};
+
+static const char* BUILTIN_DEFS[] = {
+    "void civic_printInt(int val) {\n    printf(\"%d\", val);\n}\n",
+    "void civic_printFloat(float val) {\n    printf(\"%f\", val);\n}\n",
+    "int civic_scanInt(void) {\n    int val = 0;\n    if (scanf(\"%d\", &val) != 1) val = 0;\n    return val;\n}\n",
+    "float civic_scanFloat(void) {\n    float val = 0.0f;\n    if (scanf(\"%f\", &val) != 1) val = 0.0f;\n    return val;\n}\n",
+    "void civic_printSpaces(int num) {\n    for (; num > 0; num--) putchar(' ');\n}\n",
+    "void civic_printNewlines(int num) {\n    for (; num > 0; num--) putchar('\\n');\n}\n",
+};
+
+// Integer division wraps like the VM; INT_MIN / -1 is undefined in C and traps on x86
+static const char* DIVISION_DEFS =
+    "\nstatic inline int civicrt_div(int l, int r) {\n    return r == -1 ? (int) -(unsigned) l : l / r;\n}\n"
+    "\nstatic inline int civicrt_rem(int l, int r) {\n    return r == -1 ? 0 : l % r;\n}\n";
+
+static void buf_vprintf(Buffer* b, const char* fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    const size_t n = (size_t) vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+
+    if (b->len + n + 1 > b->size) {
+        b->size = (b->len + n + 1) * 2;
+        ARRAY_RESIZE(b->data, b->size);
+    }
+    vsnprintf(b->data + b->len, n + 1, fmt, args);
+    b->len += n;
+}
+
+static void buf_printf(Buffer* b, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    buf_vprintf(b, fmt, args);
+    va_end(args);
+}
+
+static void buf_free(Buffer* b) {
+    MEMfree(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->size = 0;
+}
+
+/**
+ * Writes an indented line of code to the function being generated
+ * @param fmt format of the line, without newline
+ */
+static void line(const char* fmt, ...) {
+    for (size_t i = 0; i < FS->indent; i++) buf_printf(&FS->body, "    ");
+
+    va_list args;
+    va_start(args, fmt);
+    buf_vprintf(&FS->body, fmt, args);
+    va_end(args);
+
+    buf_printf(&FS->body, "\n");
+}
+
+static const char* c_type(const ValueType vt) {
+    switch (vt) {
+        case VT_NUM: return "int";
+        case VT_FLOAT: return "float";
+        case VT_BOOL: return "bool";
+        case VT_NUMARRAY: return "int*";
+        case VT_FLOATARRAY: return "float*";
+        case VT_BOOLARRAY: return "bool*";
+        default: return "void";
+    }
+}
+
+/**
+ * Gets the nesting level of a function; global functions have level zero
+ * @param fun function symbol
+ * @return nesting level
+ */
+static size_t fun_level(const Symbol* fun) {
+    return fun->parent_scope->nesting_level;
+}
+
+/**
+ * Generates the C name of a function
+ * @param fun function symbol
+ * @return name, to be freed by the caller
+ */
+static char* fun_name(const Symbol* fun) {
+    if (fun->imported || fun->exported) return STRfmt("civic_%s", fun->name);
+    return STRfmt("f%s", fun->as.fun.label_name);
+}
+
+/**
+ * Generates the expression reaching the environment of an enclosing function
+ * @param depth amount of functions to go outwards, at least one
+ * @return expression, to be freed by the caller
+ */
+static char* env_chain(const size_t depth) {
+    char* res = STRcpy("up");
+    for (size_t i = 1; i < depth; i++) res = safe_concat_str(res, STRcpy("->up"));
+    return res;
+}
+
+/**
+ * Generates the C expression that accesses a variable from the current function
+ * @param s variable symbol
+ * @return expression, to be freed by the caller
+ */
+static char* var_name(const Symbol* s) {
+    const char* link_name = HTlookup(LINK_NAMES, (void*) s);
+    if (link_name != NULL) return STRfmt("civic_%s", link_name);
+
+    const SymbolTable* scope = s->parent_scope;
+    if (scope->nesting_level == 0) return STRfmt("g_%s", s->name);
+
+    // Loop counters are plain variables of their C loop
+    const Symbol* owner = scope->parent_fun;
+    if (scope != owner->as.fun.scope) return STRfmt("v_%s", s->name);
+
+    const size_t depth = fun_level(FS->fun) - fun_level(owner);
+    if (depth == 0) return STRfmt(FS->has_env ? "env.v_%s" : "v_%s", s->name);
+
+    char* chain = env_chain(depth);
+    char* res = STRfmt("%s->v_%s", chain, s->name);
+    MEMfree(chain);
+    return res;
+}
+
+/**
+ * Creates a temporary of the current function
+ * @param vt type of the temporary
+ * @return name of the temporary, to be freed by the caller
+ */
+static char* new_temp(const ValueType vt) {
+    buf_printf(&FS->temps, "    %s t%lu;\n", c_type(vt), FS->temp_count);
+    return STRfmt("t%lu", FS->temp_count++);
+}
+
+/**
+ * Checks whether an expression calls a function
+ * @param node expression node, may be NULL
+ * @return true if a funcall occurs within the expression
+ */
+static bool contains_call(node_st* node) {
+    if (node == NULL) return false;
+
+    switch (NODE_TYPE(node)) {
+        case NT_FUNCALL: return true;
+        case NT_BINOP: return contains_call(BINOP_LEFT(node)) || contains_call(BINOP_RIGHT(node));
+        case NT_MONOP: return contains_call(MONOP_OPERAND(node));
+        case NT_CAST: return contains_call(CAST_EXPR(node));
+        case NT_VAR: return contains_call(VAR_INDICES(node));
+        case NT_ARREXPR: return contains_call(ARREXPR_EXPRS(node));
+        case NT_EXPRS: return contains_call(EXPRS_EXPR(node)) || contains_call(EXPRS_NEXT(node));
+        default: return false;
+    }
+}
+
+/**
+ * Checks whether the value of an expression cannot change during a call
+ * @param node expression node
+ * @return true for literals, array references and locals out of reach of other functions
+ */
+static bool is_stable(node_st* node) {
+    if (CEisLiteral(node)) return true;
+    if (NODE_TYPE(node) != NT_VAR || VAR_INDICES(node) != NULL) return false;
+
+    const Symbol* s = VAR_SYMBOL(node);
+    if (s->stype == ST_ARRAYVAR) return true;
+
+    // Other functions cannot reach locals that are not in an environment struct
+    const SymbolTable* scope = s->parent_scope;
+    if (scope->nesting_level == 0) return false;
+    return scope != scope->parent_fun->as.fun.scope || (scope->parent_fun == FS->fun && !FS->has_env);
+}
+
+/**
+ * Generates C for an expression
+ * @param node expression node
+ * @param type set to the type of the expression, may be NULL
+ * @return C expression, to be freed by the caller
+ */
+static char* gen_expr(node_st* node, ValueType* type) {
+    TRAVdo(node);
+    if (type != NULL) *type = LAST_TYPE;
+
+    char* res = RESULT;
+    RESULT = NULL;
+    return res;
+}
+
+/**
+ * Generates C for expressions that CiviC evaluates from left to right. C
+ * leaves that order open, so an expression moves into a temporary when a
+ * later one could observe or change its value through a call.
+ * @param exprs expression nodes in evaluation order
+ * @param n amount of expressions
+ * @param prefix receives the assignments of temporaries, as "t0 = ..., "
+ * @return generated expressions, to be freed with their array by the caller
+ */
+static char** gen_sequence(node_st** exprs, const size_t n, Buffer* prefix) {
+    char** res = MEMmalloc(sizeof(char*) * (n + 1));
+
+    for (size_t i = 0; i < n; i++) {
+        ValueType vt;
+        res[i] = gen_expr(exprs[i], &vt);
+
+        bool ordered = false;
+        for (size_t j = i + 1; j < n && !is_stable(exprs[i]) && !ordered; j++) {
+            ordered = !is_stable(exprs[j]) && (contains_call(exprs[i]) || contains_call(exprs[j]));
+        }
+        if (!ordered) continue;
+
+        char* temp = new_temp(vt);
+        buf_printf(prefix, "%s = %s, ", temp, res[i]);
+        MEMfree(res[i]);
+        res[i] = temp;
+    }
+
+    return res;
+}
+
+/**
+ * Wraps an expression in the assignments of its temporaries
+ * @param prefix assignments of temporaries, may be empty
+ * @param expr expression, freed by this function
+ * @return combined expression, to be freed by the caller
+ */
+static char* with_prefix(Buffer* prefix, char* expr) {
+    if (prefix->len == 0) return expr;
+
+    char* res = STRfmt("(%s%s)", prefix->data, expr);
+    MEMfree(expr);
+    buf_free(prefix);
+    return res;
+}
+
+static void free_strs(char** strs, const size_t n) {
+    for (size_t i = 0; i < n; i++) MEMfree(strs[i]);
+    MEMfree(strs);
+}
+
+/**
+ * Collects the expressions of an exprs list
+ * @param exprs first exprs node, may be NULL
+ * @param n set to the amount of expressions
+ * @return expression nodes, to be freed by the caller
+ */
+static node_st** exprs_list(node_st* exprs, size_t* n) {
+    *n = 0;
+    for (node_st* e = exprs; e != NULL; e = EXPRS_NEXT(e)) (*n)++;
+
+    node_st** res = MEMmalloc(sizeof(node_st*) * (*n + 1));
+    size_t i = 0;
+    for (node_st* e = exprs; e != NULL; e = EXPRS_NEXT(e)) res[i++] = EXPRS_EXPR(e);
+    return res;
+}
+
+/**
+ * Flattens generated indices into a row-major element index
+ * @param arr array symbol
+ * @param indices generated index expressions, one per dimension
+ * @return element index, to be freed by the caller
+ */
+static char* flat_index(const Symbol* arr, char** indices) {
+    char* res = STRcpy(indices[0]);
+    for (size_t i = 1; i < arr->as.array.dim_count; i++) {
+        char* dim = var_name(arr->as.array.dims[i]);
+        char* next = STRfmt("(%s) * %s + %s", res, dim, indices[i]);
+        MEMfree(dim);
+        MEMfree(res);
+        res = next;
+    }
+    return res;
+}
+
+/**
+ * Generates the amount of elements of an array
+ * @param arr array symbol
+ * @return element count as size_t expression, to be freed by the caller
+ */
+static char* array_size(const Symbol* arr) {
+    char* res = NULL;
+    for (size_t i = 0; i < arr->as.array.dim_count; i++) {
+        char* dim = var_name(arr->as.array.dims[i]);
+        char* next = res == NULL ? STRfmt("(size_t) %s", dim) : STRfmt("%s * %s", res, dim);
+        MEMfree(dim);
+        MEMfree(res);
+        res = next;
+    }
+    return res;
+}
+
+static char* float_literal(const float f) {
+    if (isnan(f)) return STRcpy("NAN");
+    if (isinf(f)) return STRcpy(f > 0 ? "INFINITY" : "(-INFINITY)");
+
+    char* digits = STRfmt("%.9g", (double) f);
+    const char* suffix = strpbrk(digits, ".e") != NULL ? "f" : ".0f";
+    char* res = STRfmt(digits[0] == '-' ? "(%s%s)" : "%s%s", digits, suffix);
+    MEMfree(digits);
+    return res;
+}
+
+/**
+ * Assigns a value to a variable of the current function, declaring it unless
+ * it lives in the environment struct
+ * @param s variable symbol
+ * @param value C expression of the value
+ */
+static void define_local(const Symbol* s, const char* value) {
+    if (FS->has_env) line("env.v_%s = %s;", s->name, value);
+    else line("%s v_%s = %s;", c_type(s->vtype), s->name, value);
+}
+
+/**
+ * Allocates a zeroed array after its dimensions are assigned
+ * @param arr array symbol
+ * @return C name of the array, to be freed by the caller
+ */
+static char* allocate_array(const Symbol* arr) {
+    char* name = var_name(arr);
+    char* size = array_size(arr);
+    const char* elem = c_type(demote_array_type(arr->vtype));
+    if (arr->parent_scope->nesting_level == 0) {
+        line("%s = calloc(%s, sizeof(%s));", name, size, elem);
+    } else {
+        char* value = STRfmt("calloc(%s, sizeof(%s))", size, elem);
+        define_local(arr, value);
+        MEMfree(value);
+
+        if (FS->array_count == FS->array_size) {
+            FS->array_size = FS->array_size == 0 ? INITIAL_LIST_SIZE : FS->array_size * 2;
+            ARRAY_RESIZE(FS->arrays, FS->array_size);
+        }
+        FS->arrays[FS->array_count++] = STRcpy(name);
+    }
+    MEMfree(size);
+    return name;
+}
+
+/**
+ * Stores the values of an array expression in row-major order. Errors on a
+ * value that follows a nested array expression, like the bytecode does.
+ * @param name C name of the array
+ * @param node ArrExpr or value expression
+ * @param index index of the next element, advanced past the stored values
+ */
+static void store_arrexpr(const char* name, node_st* node, size_t* index) {
+    if (NODE_TYPE(node) == NT_ARREXPR) {
+        bool only_arrexpr = false;
+        for (node_st* e = ARREXPR_EXPRS(node); e != NULL; e = EXPRS_NEXT(e)) {
+            if (NODE_TYPE(EXPRS_EXPR(e)) == NT_ARREXPR) {
+                only_arrexpr = true;
+            } else if (only_arrexpr) {
+                USER_ERROR("Inconsistent initialisation value shape of array");
+                global.had_error = true;
+            }
+            store_arrexpr(name, EXPRS_EXPR(e), index);
+        }
+        return;
+    }
+
+    char* value = gen_expr(node, NULL);
+    line("%s[%lu] = %s;", name, (*index)++, value);
+    MEMfree(value);
+}
+
+/**
+ * Generates the dimensions, allocation and initialisation of a declared array
+ * @param arr array symbol
+ * @param dims dimension expressions
+ * @param init initialiser, may be NULL
+ */
+static void define_array(const Symbol* arr, node_st* dims, node_st* init) {
+    size_t i = 0;
+    for (node_st* e = dims; e != NULL; e = EXPRS_NEXT(e), i++) {
+        const Symbol* dim = arr->as.array.dims[i];
+        char* value = gen_expr(EXPRS_EXPR(e), NULL);
+        if (dim->parent_scope->nesting_level == 0) {
+            char* name = var_name(dim);
+            line("%s = %s;", name, value);
+            MEMfree(name);
+        } else {
+            define_local(dim, value);
+        }
+        MEMfree(value);
+    }
+
+    char* name = allocate_array(arr);
+
+    ConstValue v;
+    if (init == NULL || (CEfromLiteral(init, &v) && CEisZero(v))) {
+        // calloc already zeroed the elements
+    } else if (NODE_TYPE(init) == NT_ARREXPR) {
+        size_t index = 0;
+        store_arrexpr(name, init, &index);
+    } else {
+        char* value = gen_expr(init, NULL);
+        if (!CEisLiteral(init)) {
+            char* temp = new_temp(demote_array_type(arr->vtype));
+            line("%s = %s;", temp, value);
+            MEMfree(value);
+            value = temp;
+        }
+
+        char* size = array_size(arr);
+        line("for (size_t i = 0; i < %s; i++) %s[i] = %s;", size, name, value);
+        MEMfree(size);
+        MEMfree(value);
+    }
+
+    MEMfree(name);
+}
+
+/**
+ * Frees the local arrays of the current function before it returns
+ */
+static void free_arrays() {
+    for (size_t i = 0; i < FS->array_count; i++) line("free(%s);", FS->arrays[i]);
+}
+
+/**
+ * Generates the C declaration of a function
+ * @param fun function symbol
+ * @param params first parameter node, may be NULL
+ * @return declaration without semicolon, to be freed by the caller
+ */
+static char* signature(const Symbol* fun, node_st* params) {
+    Buffer b = {NULL, 0, 0};
+    const char* storage = fun->imported ? "extern " : (fun->exported ? "" : "static ");
+    char* name = fun_name(fun);
+    buf_printf(&b, "%s%s %s(", storage, c_type(fun->vtype), name);
+    MEMfree(name);
+
+    const char* sep = "";
+    if (fun_level(fun) > 0) {
+        char* parent = fun_name(fun->parent_scope->parent_fun);
+        buf_printf(&b, "struct env_%s* up", parent);
+        MEMfree(parent);
+        sep = ", ";
+    }
+
+    for (node_st* param = params; param != NULL; param = PARAM_NEXT(param)) {
+        for (node_st* id = PARAM_DIMS(param); id != NULL; id = IDS_NEXT(id)) {
+            buf_printf(&b, "%sint v_%s", sep, IDS_NAME(id));
+            sep = ", ";
+        }
+        buf_printf(&b, "%s%s v_%s", sep, c_type(ct_to_vt(PARAM_TYPE(param), PARAM_DIMS(param) != NULL)),
+            PARAM_NAME(param));
+        sep = ", ";
+    }
+
+    if (sep[0] == '\0') buf_printf(&b, "void");
+    buf_printf(&b, ")");
+    return b.data;
+}
+
+/**
+ * Declares the environment struct of a function with nested functions
+ * @param fun function symbol
+ * @param node FunDef node
+ */
+static void declare_env(const Symbol* fun, node_st* node) {
+    char* name = fun_name(fun);
+    buf_printf(&DECLS, "\nstruct env_%s {\n", name);
+    MEMfree(name);
+
+    if (fun_level(fun) > 0) {
+        char* parent = fun_name(fun->parent_scope->parent_fun);
+        buf_printf(&DECLS, "    struct env_%s* up;\n", parent);
+        MEMfree(parent);
+    }
+
+    for (node_st* param = FUNDEF_PARAMS(node); param != NULL; param = PARAM_NEXT(param)) {
+        for (node_st* id = PARAM_DIMS(param); id != NULL; id = IDS_NEXT(id)) {
+            buf_printf(&DECLS, "    int v_%s;\n", IDS_NAME(id));
+        }
+        buf_printf(&DECLS, "    %s v_%s;\n", c_type(ct_to_vt(PARAM_TYPE(param), PARAM_DIMS(param) != NULL)),
+            PARAM_NAME(param));
+    }
+
+    for (node_st* decl = FUNBODY_DECLS(FUNDEF_BODY(node)); decl != NULL; decl = VARDECL_NEXT(decl)) {
+        const Symbol* s = STlookup(fun->as.fun.scope, VARDECL_NAME(decl));
+        if (s->stype == ST_ARRAYVAR) {
+            for (size_t i = 0; i < s->as.array.dim_count; i++) {
+                buf_printf(&DECLS, "    int v_%s;\n", s->as.array.dims[i]->name);
+            }
+        }
+        buf_printf(&DECLS, "    %s v_%s;\n", c_type(s->vtype), s->name);
+    }
+
+    buf_printf(&DECLS, "};\n\n");
+}
+
+/**
+ * Records the linkage names of the imported and exported globals
+ * @param decls first Decls node
+ */
+static void collect_link_names(node_st* decls) {
+    for (; decls != NULL; decls = DECLS_NEXT(decls)) {
+        node_st* decl = DECLS_DECL(decls);
+        const bool imported = NODE_TYPE(decl) == NT_GLOBDECL;
+        if (!imported && (NODE_TYPE(decl) != NT_GLOBDEF || !GLOBDEF_EXPORT(decl))) continue;
+
+        char* name = imported ? GLOBDECL_NAME(decl) : GLOBDEF_NAME(decl);
+        Symbol* s = STlookup(GB_GLOBAL_SCOPE, name);
+        HTinsert(LINK_NAMES, s, STRcpy(name));
+
+        // Imported dimensions are linked by the name the exporting module gives them
+        for (size_t i = 0; s->stype == ST_ARRAYVAR && i < s->as.array.dim_count; i++) {
+            Symbol* dim = s->as.array.dims[i];
+            HTinsert(LINK_NAMES, dim, imported ? generate_array_dim_name(name, i) : STRcpy(dim->name));
+        }
+    }
+}
+
+static void init_state(FunState* state, Symbol* fun) {
+    memset(state, 0, sizeof(*state));
+    state->fun = fun;
+    state->indent = 1;
+}
+
+static void free_state(FunState* state) {
+    buf_free(&state->temps);
+    buf_free(&state->body);
+    for (size_t i = 0; i < state->array_count; i++) MEMfree(state->arrays[i]);
+    MEMfree(state->arrays);
+}
+
+/**
+ * Writes the generated module and the runtime parts it needs
+ * @param f file to write to
+ * @param init generated module initialiser
+ */
+static void write_module(FILE* f, const FunState* init) {
+    fprintf(f, "// Generated by civicc from %s\n\n", file_basename(global.input_file));
+    fprintf(f, "#include <math.h>\n#include <stdbool.h>\n#include <stdio.h>\n#include <stdlib.h>\n");
+    fprintf(f, "%s", DIVISION_DEFS);
+    if (DECLS.data != NULL) fprintf(f, "%s", DECLS.data);
+    if (FUNS.data != NULL) fprintf(f, "%s", FUNS.data);
+
+    if (init->body.len > 0) {
+        fprintf(f, "\n__attribute__((constructor))\nstatic void module_init(void) {\n");
+        if (init->temps.data != NULL) fprintf(f, "%s", init->temps.data);
+        fprintf(f, "%s}\n", init->body.data);
+    }
+
+    if (MAIN_FUN == NULL) return;
+
+    // Functions of civic.h, unless this module defines a function of the same name
+    for (size_t i = 0; i < sizeof(BUILTIN_NAMES) / sizeof(BUILTIN_NAMES[0]); i++) {
+        const Symbol* s = STlookup(GB_GLOBAL_SCOPE, (char*) BUILTIN_NAMES[i]);
+        if (s == NULL || s->imported) fprintf(f, "\n%s", BUILTIN_DEFS[i]);
+    }
+
+    fprintf(f, "\nint main(void) {\n");
+    if (MAIN_FUN->vtype == VT_NUM) {
+        fprintf(f, "    return civic_main();\n");
+    } else {
+        fprintf(f, "    civic_main();\n    return 0;\n");
+    }
+    fprintf(f, "}\n");
+}
+
+/**
+ * @fn CGprogram
+ */
+node_st *CGprogram(node_st *node)
+{
+    if (global.emit != EMIT_C || global.had_error) return node;
+
+    LINK_NAMES = HTnew_Ptr(VARTABLE_SIZE);
+    collect_link_names(PROGRAM_DECLS(node));
+    CURRENT_SCOPE = GB_GLOBAL_SCOPE;
+    MAIN_FUN = NULL;
+
+    FunState init;
+    init_state(&init, NULL);
+    FS = &init;
+    buf_printf(&DECLS, "\n");
+
+    TRAVchildren(node);
+
+    // Nothing is written after errors
+    FILE* f = global.had_error ? NULL : GLBopenOutput(false);
+    if (f != NULL) {
+        write_module(f, &init);
+        GLBcloseOutput(f);
+    } else if (!global.had_error) {
+        USER_ERROR("Could not create C file %s", global.output_file);
+        global.had_error = true;
+    }
+
+    free_state(&init);
+    buf_free(&DECLS);
+    buf_free(&FUNS);
+    for (htable_iter_st* iter = HTiterate(LINK_NAMES); iter; iter = HTiterateNext(iter)) {
+        MEMfree(HTiterValue(iter));
+    }
+    HTdelete(LINK_NAMES);
+    LINK_NAMES = NULL;
+
+    return node;
+}
+
+/**
+ * @fn CGglobdecl
+ */
+node_st *CGglobdecl(node_st *node)
+{
+    const Symbol* s = STlookup(CURRENT_SCOPE, GLOBDECL_NAME(node));
+
+    if (s->stype == ST_ARRAYVAR) {
+        for (size_t i = 0; i < s->as.array.dim_count; i++) {
+            char* dim = var_name(s->as.array.dims[i]);
+            buf_printf(&DECLS, "extern int %s;\n", dim);
+            MEMfree(dim);
+        }
+    }
+
+    char* name = var_name(s);
+    buf_printf(&DECLS, "extern %s %s;\n", c_type(s->vtype), name);
+    MEMfree(name);
+
+    return node;
+}
+
+/**
+ * @fn CGglobdef
+ */
+node_st *CGglobdef(node_st *node)
+{
+    const Symbol* s = STlookup(CURRENT_SCOPE, GLOBDEF_NAME(node));
+    const char* storage = GLOBDEF_EXPORT(node) ? "" : "static ";
+
+    if (s->stype == ST_ARRAYVAR) {
+        for (size_t i = 0; i < s->as.array.dim_count; i++) {
+            char* dim = var_name(s->as.array.dims[i]);
+            buf_printf(&DECLS, "%sint %s;\n", storage, dim);
+            MEMfree(dim);
+        }
+
+        char* name = var_name(s);
+        buf_printf(&DECLS, "%s%s %s;\n", storage, c_type(s->vtype), name);
+        MEMfree(name);
+
+        define_array(s, GLOBDEF_DIMS(node), GLOBDEF_INIT(node));
+        return node;
+    }
+
+    char* name = var_name(s);
+    node_st* init = GLOBDEF_INIT(node);
+    if (init != NULL && CEisLiteral(init)) {
+        // Literals initialise the variable statically
+        char* value = gen_expr(init, NULL);
+        buf_printf(&DECLS, "%s%s %s = %s;\n", storage, c_type(s->vtype), name, value);
+        MEMfree(value);
+    } else {
+        buf_printf(&DECLS, "%s%s %s;\n", storage, c_type(s->vtype), name);
+        if (init != NULL) {
+            char* value = gen_expr(init, NULL);
+            line("%s = %s;", name, value);
+            MEMfree(value);
+        }
+    }
+    MEMfree(name);
+
+    return node;
+}
+
+/**
+ * @fn CGfundef
+ */
+node_st *CGfundef(node_st *node)
+{
+    Symbol* fun = STlookup(CURRENT_SCOPE, FUNDEF_NAME(node));
+    char* sig = signature(fun, FUNDEF_PARAMS(node));
+    buf_printf(&DECLS, "%s;\n", sig);
+
+    if (fun->imported) {
+        MEMfree(sig);
+        return node;
+    }
+
+    if (fun->exported && STReq(fun->name, "main")) MAIN_FUN = fun;
+
+    node_st* body = FUNDEF_BODY(node);
+    FunState state;
+    init_state(&state, fun);
+    state.has_env = FUNBODY_LOCAL_FUNDEFS(body) != NULL;
+    if (state.has_env) declare_env(fun, node);
+
+    FunState* prev_state = FS;
+    SymbolTable* prev_scope = CURRENT_SCOPE;
+    FS = &state;
+    CURRENT_SCOPE = fun->as.fun.scope;
+
+    // Nested functions only need the environment struct, so they are generated first
+    TRAVopt(FUNBODY_LOCAL_FUNDEFS(body));
+
+    buf_printf(&FUNS, "\n%s {\n", sig);
+    if (state.has_env) {
+        char* name = fun_name(fun);
+        buf_printf(&FUNS, "    struct env_%s env;\n", name);
+        MEMfree(name);
+
+        if (fun_level(fun) > 0) buf_printf(&FUNS, "    env.up = up;\n");
+        for (node_st* param = FUNDEF_PARAMS(node); param != NULL; param = PARAM_NEXT(param)) {
+            for (node_st* id = PARAM_DIMS(param); id != NULL; id = IDS_NEXT(id)) {
+                buf_printf(&FUNS, "    env.v_%s = v_%s;\n", IDS_NAME(id), IDS_NAME(id));
+            }
+            buf_printf(&FUNS, "    env.v_%s = v_%s;\n", PARAM_NAME(param), PARAM_NAME(param));
+        }
+    }
+
+    TRAVopt(FUNBODY_DECLS(body));
+    TRAVopt(FUNBODY_STMTS(body));
+    if (fun->vtype == VT_VOID) free_arrays();
+
+    if (state.temps.data != NULL) buf_printf(&FUNS, "%s", state.temps.data);
+    if (state.body.data != NULL) buf_printf(&FUNS, "%s", state.body.data);
+    buf_printf(&FUNS, "}\n");
+
+    FS = prev_state;
+    CURRENT_SCOPE = prev_scope;
+    free_state(&state);
+    MEMfree(sig);
+
+    return node;
+}
+
+/**
+ * @fn CGvardecl
+ */
+node_st *CGvardecl(node_st *node)
+{
+    const Symbol* s = STlookup(CURRENT_SCOPE, VARDECL_NAME(node));
+
+    if (s->stype == ST_ARRAYVAR) {
+        define_array(s, VARDECL_DIMS(node), VARDECL_INIT(node));
+    } else {
+        char* value = VARDECL_INIT(node) != NULL ? gen_expr(VARDECL_INIT(node), NULL) : STRcpy("0");
+        define_local(s, value);
+        MEMfree(value);
+    }
+
+    TRAVnext(node);
+    return node;
+}
+
+/**
+ * @fn CGassign
+ */
+node_st *CGassign(node_st *node)
+{
+    node_st* let = ASSIGN_LET(node);
+    const Symbol* s = VARLET_SYMBOL(let);
+    char* name = var_name(s);
+
+    if (VARLET_INDICES(let) == NULL) {
+        char* value = gen_expr(ASSIGN_EXPR(node), NULL);
+        line("%s = %s;", name, value);
+        MEMfree(value);
+        MEMfree(name);
+        return node;
+    }
+
+    // The value is computed before the indices
+    size_t n;
+    node_st** indices = exprs_list(VARLET_INDICES(let), &n);
+    node_st** exprs = MEMmalloc(sizeof(node_st*) * (n + 1));
+    exprs[0] = ASSIGN_EXPR(node);
+    for (size_t i = 0; i < n; i++) exprs[i + 1] = indices[i];
+
+    Buffer prefix = {NULL, 0, 0};
+    char** strs = gen_sequence(exprs, n + 1, &prefix);
+    char* index = flat_index(s, strs + 1);
+    line("%s%s[%s] = %s;", prefix.len > 0 ? prefix.data : "", name, index, strs[0]);
+
+    buf_free(&prefix);
+    MEMfree(index);
+    free_strs(strs, n + 1);
+    MEMfree(exprs);
+    MEMfree(indices);
+    MEMfree(name);
+    return node;
+}
+
+/**
+ * @fn CGexprstmt
+ */
+node_st *CGexprstmt(node_st *node)
+{
+    ValueType vt;
+    char* expr = gen_expr(EXPRSTMT_EXPR(node), &vt);
+    line(vt == VT_VOID ? "%s;" : "(void) %s;", expr);
+    MEMfree(expr);
+    return node;
+}
+
+/**
+ * @fn CGreturn
+ */
+node_st *CGreturn(node_st *node)
+{
+    if (RETURN_EXPR(node) == NULL) {
+        free_arrays();
+        line("return;");
+        return node;
+    }
+
+    ValueType vt;
+    char* value = gen_expr(RETURN_EXPR(node), &vt);
+    if (FS->array_count > 0) {
+        // The value may read the arrays that are freed
+        char* temp = new_temp(vt);
+        line("%s = %s;", temp, value);
+        free_arrays();
+        MEMfree(value);
+        value = temp;
+    }
+    line("return %s;", value);
+    MEMfree(value);
+
+    return node;
+}
+
+/**
+ * @fn CGifelse
+ */
+node_st *CGifelse(node_st *node)
+{
+    char* cond = gen_expr(IFELSE_COND(node), NULL);
+    line("if (%s) {", cond);
+    MEMfree(cond);
+
+    FS->indent++;
+    TRAVthen(node);
+    FS->indent--;
+
+    if (IFELSE_ELSE_BLOCK(node) != NULL) {
+        line("} else {");
+        FS->indent++;
+        TRAVelse_block(node);
+        FS->indent--;
+    }
+    line("}");
+
+    return node;
+}
+
+/**
+ * @fn CGwhile
+ */
+node_st *CGwhile(node_st *node)
+{
+    char* cond = gen_expr(WHILE_COND(node), NULL);
+    line("while (%s) {", cond);
+    MEMfree(cond);
+
+    FS->indent++;
+    TRAVblock(node);
+    FS->indent--;
+    line("}");
+
+    return node;
+}
+
+/**
+ * @fn CGdowhile
+ */
+node_st *CGdowhile(node_st *node)
+{
+    line("do {");
+    FS->indent++;
+    TRAVblock(node);
+    FS->indent--;
+
+    char* cond = gen_expr(DOWHILE_COND(node), NULL);
+    line("} while (%s);", cond);
+    MEMfree(cond);
+
+    return node;
+}
+
+/**
+ * @fn CGfor
+ */
+node_st *CGfor(node_st *node)
+{
+    // Bounds are evaluated once, before the loop variable shadows anything
+    char* start = gen_expr(FOR_START_EXPR(node), NULL);
+    if (!CEisLiteral(FOR_START_EXPR(node))) {
+        char* temp = new_temp(VT_NUM);
+        line("%s = %s;", temp, start);
+        MEMfree(start);
+        start = temp;
+    }
+
+    char* stop = gen_expr(FOR_STOP(node), NULL);
+    if (!CEisLiteral(FOR_STOP(node))) {
+        char* temp = new_temp(VT_NUM);
+        line("%s = %s;", temp, stop);
+        MEMfree(stop);
+        stop = temp;
+    }
+
+    char* var = STRfmt("v_%s", FOR_VAR(node));
+    char* cond;
+    char* incr;
+    ConstValue step;
+    if (FOR_STEP(node) == NULL) {
+        cond = STRfmt("%s < %s", var, stop);
+        incr = STRfmt("%s++", var);
+    } else if (CEevaluate(FOR_STEP(node), NULL, &step)) {
+        cond = STRfmt("%s %s %s", var, step.as.i >= 0 ? "<" : ">", stop);
+        if (step.as.i == 1) incr = STRfmt("%s++", var);
+        else if (step.as.i == -1) incr = STRfmt("%s--", var);
+        else incr = STRfmt("%s += %d", var, step.as.i);
+    } else {
+        char* value = gen_expr(FOR_STEP(node), NULL);
+        char* temp = new_temp(VT_NUM);
+        line("%s = %s;", temp, value);
+        cond = STRfmt("%s >= 0 ? %s < %s : %s > %s", temp, var, stop, var, stop);
+        incr = STRfmt("%s += %s", var, temp);
+        MEMfree(value);
+        MEMfree(temp);
+    }
+
+    line("for (int %s = %s; %s; %s) {", var, start, cond, incr);
+    FS->indent++;
+    TRAVblock(node);
+    FS->indent--;
+    line("}");
+
+    MEMfree(start);
+    MEMfree(stop);
+    MEMfree(var);
+    MEMfree(cond);
+    MEMfree(incr);
+    return node;
+}
+
+/**
+ * @fn CGfuncall
+ */
+node_st *CGfuncall(node_st *node)
+{
+    const Symbol* fun = FUNCALL_SYMBOL(node);
+
+    size_t n;
+    node_st** args = exprs_list(FUNCALL_FUN_ARGS(node), &n);
+    Buffer prefix = {NULL, 0, 0};
+    char** strs = gen_sequence(args, n, &prefix);
+
+    Buffer call = {NULL, 0, 0};
+    char* name = fun_name(fun);
+    buf_printf(&call, "%s(", name);
+    MEMfree(name);
+
+    const char* sep = "";
+    if (fun_level(fun) > 0) {
+        // Nested functions get the environment of the function that defines them
+        const size_t depth = fun_level(FS->fun) + 1 - fun_level(fun);
+        char* env = depth == 0 ? STRcpy("&env") : env_chain(depth);
+        buf_printf(&call, "%s", env);
+        MEMfree(env);
+        sep = ", ";
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        // Array arguments pass their dimensions first
+        node_st* arg = args[i];
+        if (NODE_TYPE(arg) == NT_VAR && VAR_INDICES(arg) == NULL && VAR_SYMBOL(arg)->stype == ST_ARRAYVAR) {
+            const Symbol* arr = VAR_SYMBOL(arg);
+            for (size_t j = 0; j < arr->as.array.dim_count; j++) {
+                char* dim = var_name(arr->as.array.dims[j]);
+                buf_printf(&call, "%s%s", sep, dim);
+                MEMfree(dim);
+                sep = ", ";
+            }
+        }
+        buf_printf(&call, "%s%s", sep, strs[i]);
+        sep = ", ";
+    }
+    buf_printf(&call, ")");
+
+    RESULT = with_prefix(&prefix, call.data);
+    LAST_TYPE = fun->vtype;
+
+    free_strs(strs, n);
+    MEMfree(args);
+    return node;
+}
+
+/**
+ * @fn CGcast
+ */
+node_st *CGcast(node_st *node)
+{
+    ValueType from;
+    char* expr = gen_expr(CAST_EXPR(node), &from);
+    const ValueType to = ct_to_vt(CAST_TYPE(node), false);
+
+    if (from == to) {
+        RESULT = expr;
+    } else if (to == VT_BOOL) {
+        RESULT = STRfmt(from == VT_FLOAT ? "(%s != 0.0f)" : "(%s != 0)", expr);
+        MEMfree(expr);
+    } else {
+        RESULT = STRfmt("(%s) %s", c_type(to), expr);
+        MEMfree(expr);
+    }
+
+    LAST_TYPE = to;
+    return node;
+}
+
+/**
+ * @fn CGbinop
+ */
+node_st *CGbinop(node_st *node)
+{
+    const enum BinOpType op = BINOP_OP(node);
+
+    // Short-circuiting matches C
+    if (op == BO_and || op == BO_or) {
+        char* left = gen_expr(BINOP_LEFT(node), NULL);
+        char* right = gen_expr(BINOP_RIGHT(node), NULL);
+        RESULT = STRfmt("(%s %s %s)", left, op == BO_and ? "&&" : "||", right);
+        LAST_TYPE = VT_BOOL;
+        MEMfree(left);
+        MEMfree(right);
+        return node;
+    }
+
+    node_st* operands[2] = {BINOP_LEFT(node), BINOP_RIGHT(node)};
+    Buffer prefix = {NULL, 0, 0};
+    char** strs = gen_sequence(operands, 2, &prefix);
+    const ValueType vt = LAST_TYPE;
+
+    const char* sym = "";
+    switch (op) {
+        case BO_add: sym = vt == VT_BOOL ? "|" : "+"; break;
+        case BO_sub: sym = "-"; break;
+        case BO_mul: sym = vt == VT_BOOL ? "&" : "*"; break;
+        case BO_div: sym = "/"; break;
+        case BO_mod: sym = "%"; break;
+        case BO_lt: sym = "<"; break;
+        case BO_le: sym = "<="; break;
+        case BO_gt: sym = ">"; break;
+        case BO_ge: sym = ">="; break;
+        case BO_eq: sym = "=="; break;
+        case BO_ne: sym = "!="; break;
+        default:
+#ifdef DEBUGGING
+            ERROR("C generation: unexpected binop %i", op);
+#endif // DEBUGGING
+            break;
+    }
+
+    char* expr;
+    if (vt == VT_NUM && (op == BO_add || op == BO_sub || op == BO_mul)) {
+        // Integer arithmetic wraps like the VM; signed overflow is undefined in C
+        expr = STRfmt("(int) ((unsigned) %s %s (unsigned) %s)", strs[0], sym, strs[1]);
+    } else if (vt == VT_NUM && (op == BO_div || op == BO_mod)) {
+        expr = STRfmt("civicrt_%s(%s, %s)", op == BO_div ? "div" : "rem", strs[0], strs[1]);
+    } else if (vt == VT_BOOL && (op == BO_add || op == BO_mul)) {
+        expr = STRfmt("(bool) (%s %s %s)", strs[0], sym, strs[1]);
+    } else {
+        expr = STRfmt("(%s %s %s)", strs[0], sym, strs[1]);
+    }
+
+    RESULT = with_prefix(&prefix, expr);
+    LAST_TYPE = op == BO_add || op == BO_sub || op == BO_mul || op == BO_div || op == BO_mod ? vt : VT_BOOL;
+
+    free_strs(strs, 2);
+    return node;
+}
+
+/**
+ * @fn CGmonop
+ */
+node_st *CGmonop(node_st *node)
+{
+    ValueType vt;
+    char* operand = gen_expr(MONOP_OPERAND(node), &vt);
+
+    if (MONOP_OP(node) == MO_not) RESULT = STRfmt("(!%s)", operand);
+    else if (vt == VT_NUM) RESULT = STRfmt("(int) -(unsigned) %s", operand);
+    else RESULT = STRfmt("(-%s)", operand);
+
+    LAST_TYPE = vt;
+    MEMfree(operand);
+    return node;
+}
+
+/**
+ * @fn CGvar
+ */
+node_st *CGvar(node_st *node)
+{
+    const Symbol* s = VAR_SYMBOL(node);
+    char* name = var_name(s);
+
+    if (VAR_INDICES(node) == NULL) {
+        RESULT = name;
+        LAST_TYPE = s->vtype;
+        return node;
+    }
+
+    size_t n;
+    node_st** indices = exprs_list(VAR_INDICES(node), &n);
+    Buffer prefix = {NULL, 0, 0};
+    char** strs = gen_sequence(indices, n, &prefix);
+    char* index = flat_index(s, strs);
+
+    RESULT = with_prefix(&prefix, STRfmt("%s[%s]", name, index));
+    LAST_TYPE = demote_array_type(s->vtype);
+
+    MEMfree(index);
+    free_strs(strs, n);
+    MEMfree(indices);
+    MEMfree(name);
+    return node;
+}
+
+/**
+ * @fn CGnum
+ */
+node_st *CGnum(node_st *node)
+{
+    const int v = NUM_VAL(node);
+    if (v == INT_MIN) RESULT = STRfmt("(%d - 1)", INT_MIN + 1);
+    else RESULT = STRfmt(v < 0 ? "(%d)" : "%d", v);
+
+    LAST_TYPE = VT_NUM;
+    return node;
+}
+
+/**
+ * @fn CGfloat
+ */
+node_st *CGfloat(node_st *node)
+{
+    RESULT = float_literal(FLOAT_VAL(node));
+    LAST_TYPE = VT_FLOAT;
+    return node;
+}
+
+/**
+ * @fn CGbool
+ */
+node_st *CGbool(node_st *node)
+{
+    RESULT = STRcpy(BOOL_VAL(node) ? "true" : "false");
+    LAST_TYPE = VT_BOOL;
+    return node;
+}
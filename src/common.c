@@ -4,6 +4,8 @@
 
 #include "ccngen/enum.h"
 
+static size_t NUMBERED_LABEL_COUNT = 0;
+
 char* ct_to_str(const enum Type t) {
     switch (t) {
         case CT_int: return "int";
@@ -119,3 +121,115 @@ char* generate_array_dim_name(const char* parent_name, const size_t i) {
                     STRcpy("_")),
                 STRcpy(parent_name));
 }
+
+/**
+ * Generates a unique label name that is guaranteed not to collide with
+ * any existing names
+ * @param name name to append to unique part of name
+ * @return unique name
+ */
+char* generate_label_name(char* name) {
+    char* res = safe_concat_str(STRcpy("_lab"), int_to_str((int) NUMBERED_LABEL_COUNT++));
+    res = safe_concat_str(res, STRcpy("_"));
+    return safe_concat_str(res, name);
+}
+
+/**
+ * Numbers labels from zero again, so every compilation names its labels the same way
+ */
+void reset_label_names(void) {
+    NUMBERED_LABEL_COUNT = 0;
+}
+
+/**
+ * @return number the next generated label name gets
+ */
+size_t next_label_number(void) {
+    return NUMBERED_LABEL_COUNT;
+}
+
+/**
+ * Reserves numbers for labels that were generated by an earlier compilation
+ * @param count amount of numbers to reserve
+ * @return first reserved number
+ */
+size_t reserve_label_numbers(const size_t count) {
+    const size_t first = NUMBERED_LABEL_COUNT;
+    NUMBERED_LABEL_COUNT += count;
+    return first;
+}
+
+/**
+ * Reads a whole file into memory
+ * @param path file to read
+ * @param len receives the length of the contents, may be NULL
+ * @return contents followed by a NUL byte, NULL if the file could not be opened
+ */
+char* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+
+    char* buf = NULL;
+    size_t size = 0;
+    size_t n;
+    do {
+        ARRAY_RESIZE(buf, size + 4096 + 1);
+        n = fread(buf + size, 1, 4096, f);
+        size += n;
+    } while (n == 4096);
+    fclose(f);
+
+    buf[size] = '\0';
+    if (len != NULL) *len = size;
+    return buf;
+}
+
+/**
+ * Starts a 128-bit hash, see hash_bytes
+ * @param h lanes of the hash
+ */
+void hash_seed(uint64_t h[2]) {
+    h[0] = 0xcbf29ce484222325ULL;
+    h[1] = 0x6a09e667f3bcc909ULL;
+}
+
+/**
+ * Adds bytes to a 128-bit hash of two independent lanes. The hash is not
+ * cryptographic, it tells compiler inputs apart for the cache and --incremental.
+ * @param h lanes of the hash
+ * @param data bytes to add
+ * @param len amount of bytes
+ */
+void hash_bytes(uint64_t h[2], const void* data, const size_t len) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        // FNV-1a and an independent multiplicative lane
+        h[0] = (h[0] ^ bytes[i]) * 0x100000001b3ULL;
+        h[1] = (h[1] ^ bytes[i]) * 0x9e3779b97f4a7c15ULL;
+        h[1] ^= h[1] >> 29;
+    }
+}
+
+/**
+ * Mixes the lanes of a 128-bit hash so every input bit reaches every output bit
+ * @param h lanes of the hash
+ */
+void hash_finish(uint64_t h[2]) {
+    for (size_t i = 0; i < 2; i++) {
+        h[i] ^= h[i] >> 33;
+        h[i] *= 0xff51afd7ed558ccdULL;
+        h[i] ^= h[i] >> 33;
+        h[i] *= 0xc4ceb9fe1a85ec53ULL;
+        h[i] ^= h[i] >> 33;
+    }
+}
+
+/**
+ * Gets the file name of a path without its directories
+ * @param path file path
+ * @return part of path after the last slash
+ */
+const char* file_basename(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
@@ -15,13 +15,28 @@
 
 #include "ccngen/enum.h"
 
+#include "global/globals.h"
 #include "types/types.h"
 
 #define VARTABLE_STACK_SIZE 10
 #define VARTABLE_SIZE 100
+#define CONSTTABLE_SIZE 1024
 #define INITIAL_LIST_SIZE 5
 #define MAX_STR_LEN 100
 
+// Array fills of at most this many elements are emitted as straight-line stores
+#define FILL_UNROLL_LIMIT 8
+// Amount of stores per iteration of longer array fill loops
+#define FILL_UNROLL_FACTOR 4
+
+// Functions of at most this many expressions are copied to specialise them for constant arguments
+#define SPECIALISE_SIZE_LIMIT 64
+// Maximum amount of specialised copies of a single function
+#define SPECIALISE_CLONE_LIMIT 4
+
+// Operand stack values a single function may need before compilation warns, see --max-stack
+#define MAX_STACK_DEPTH 1024
+
 #define DEBUGGING false
 
 /* Error with debug information for developing civic */
@@ -38,9 +53,16 @@
 
 /* Error for developers using civic */
 #define USER_ERROR(fmt, ...) do { \
-    fprintf(stderr, "ERROR: "); \
-    fprintf(stderr, fmt, ##__VA_ARGS__); \
-    fprintf(stderr, "\n"); \
+    fprintf(GLBdiagnostics(), "ERROR: "); \
+    fprintf(GLBdiagnostics(), fmt, ##__VA_ARGS__); \
+    fprintf(GLBdiagnostics(), "\n"); \
+} while (false)
+
+/* Warning for developers using civic, compilation continues */
+#define USER_WARNING(fmt, ...) do { \
+    fprintf(GLBdiagnostics(), "WARNING: "); \
+    fprintf(GLBdiagnostics(), fmt, ##__VA_ARGS__); \
+    fprintf(GLBdiagnostics(), "\n"); \
 } while (false)
 
 #define ARRAY_RESIZE(arr, new_size) (arr = MEMrealloc(arr, (new_size) * sizeof(*(arr))))
@@ -55,3 +77,12 @@ char* int_to_str(int i);
 ValueType demote_array_type(ValueType array_type);
 char* safe_concat_str(char* s1, char* s2);
 char* generate_array_dim_name(const char* parent_name, size_t i);
+char* generate_label_name(char* name);
+void reset_label_names(void);
+size_t next_label_number(void);
+size_t reserve_label_numbers(size_t count);
+char* read_file(const char* path, size_t* len);
+void hash_seed(uint64_t h[2]);
+void hash_bytes(uint64_t h[2], const void* data, size_t len);
+void hash_finish(uint64_t h[2]);
+const char* file_basename(const char* path);
@@ -1,11 +1,15 @@
 #include "globals.h"
 
+#include "build_id.h"
 #include "symbol/table.h"
 
+#ifndef CIVICC_VERSION
+#define CIVICC_VERSION "unknown"
+#endif
+
 struct globals global;
 
 SymbolTable* GB_GLOBAL_SCOPE;
-bool GB_REQUIRES_INIT_FUNCTION;
 
 /*
  * Initialize global variables from globals.mac
@@ -16,4 +20,63 @@ void GLBinitializeGlobals()
     global.line = 0;
     global.input_file = NULL;
     global.output_file = NULL;
+    global.emit = EMIT_ASM;
+    global.profile_counts = false;
+    global.debug_info = false;
+    global.stats = STATS_NONE;
+    global.max_stack = MAX_STACK_DEPTH;
+    global.incremental = false;
+    global.print_ast = true;
+    global.input_buffer = NULL;
+    global.input_size = 0;
+    global.output_stream = NULL;
+    global.diagnostics = NULL;
+    global.ast_output = NULL;
+    global.had_error = false;
+}
+
+/**
+ * Opens the destination of the compiled program
+ * @param binary whether the output is a binary module
+ * @return output_stream if set, otherwise output_file opened for writing or STDOUT without one
+ */
+FILE *GLBopenOutput(const bool binary)
+{
+    if (global.output_stream != NULL) return global.output_stream;
+    if (global.output_file == NULL) return stdout;
+    return fopen(global.output_file, binary ? "wb" : "w");
+}
+
+/**
+ * Closes an output opened by GLBopenOutput, streams that are not owned stay open
+ * @param f output to close
+ */
+void GLBcloseOutput(FILE *f)
+{
+    if (f == global.output_stream || f == stdout) fflush(f);
+    else fclose(f);
+}
+
+/**
+ * @return identity of this compiler build, outputs of other builds must not be reused
+ */
+const char *GLBbuildId(void)
+{
+    return CIVICC_VERSION "-" CIVICC_BUILD_ID;
+}
+
+/**
+ * @return destination of errors and warnings
+ */
+FILE *GLBdiagnostics(void)
+{
+    return global.diagnostics != NULL ? global.diagnostics : stderr;
+}
+
+/**
+ * @return destination of the printed program
+ */
+FILE *GLBastOutput(void)
+{
+    return global.ast_output != NULL ? global.ast_output : stdout;
 }
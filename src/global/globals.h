@@ -2,6 +2,20 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+
+typedef enum {
+    EMIT_ASM,                           // Textual assembly
+    EMIT_BINARY,                        // Binary bytecode module
+    EMIT_C,                             // C source for the host compiler
+    EMIT_X86                            // x86-64 assembly for the GNU assembler
+} EmitKind;
+
+typedef enum {
+    STATS_NONE,
+    STATS_TEXT,                         // Aligned tables
+    STATS_JSON                          // For diffing between compiler versions
+} StatsFormat;
 
 struct globals {
     int line;
@@ -9,10 +23,27 @@ struct globals {
     int verbose;
     char *input_file;
     char *output_file;
+    EmitKind emit;                      // Kind of output to write
+    bool profile_counts;                // Instrument the program with execution counters
+    bool debug_info;                    // Map the generated code back to the source
+    StatsFormat stats;                  // Bytecode statistics to print to STDOUT
+    size_t max_stack;                   // Operand stack depth per function to warn above, 0 for none
+    bool incremental;                   // Reuse the code of unchanged functions from <output>.inc
+    bool print_ast;                     // Print the parsed program to ast_output
+    const char *input_buffer;           // Source to compile instead of input_file when set
+    size_t input_size;
+    FILE *output_stream;                // Receives the output instead of output_file when set
+    FILE *diagnostics;                  // Receives errors and warnings, STDERR when NULL
+    FILE *ast_output;                   // Receives the printed program, STDOUT when NULL
+    bool had_error;                     // An error was reported, later phases skip the program
 };
 
 extern struct SymbolTable* GB_GLOBAL_SCOPE;
-extern bool GB_REQUIRES_INIT_FUNCTION;
 
 extern struct globals global;
 extern void GLBinitializeGlobals(void);
+extern FILE *GLBopenOutput(bool binary);
+extern void GLBcloseOutput(FILE *f);
+extern FILE *GLBdiagnostics(void);
+extern FILE *GLBastOutput(void);
+extern const char *GLBbuildId(void);
@@ -0,0 +1,554 @@
+/**
+ * @file
+ *
+ * Traversal: Fingerprint
+ * UID      : FP
+ *
+ * Hashes the optimised program for --incremental, right before bytecode
+ * generation. Every top-level function gets a fingerprint of its body and of
+ * the symbols in its scope, including nested functions and the temporaries of
+ * common subexpression elimination. Everything else the bytecode of a function
+ * depends on goes into the module fingerprint: the global declarations, the
+ * headers of all functions and the global symbols, which carry the labels,
+ * removed parameters and offsets that calls and global accesses use. The code
+ * of a function can only be reused while both fingerprints are unchanged.
+ *
+ * Source lines inside a function are hashed relative to the line of the
+ * function, so a function that only moved keeps its fingerprint.
+ */
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+#include "ccngen/trav.h"
+
+#include "common.h"
+#include "incremental/incremental.h"
+#include "symbol/table.h"
+
+static Fingerprints* PRINTS;
+static Fingerprint* CURRENT;            // Fingerprint the traversal hashes into
+static int BASE_LINE;                   // Line of the top-level function being hashed
+
+static void hash_int(Fingerprint* fp, const long v) {
+    hash_bytes(fp->lanes, &v, sizeof(v));
+}
+
+static void hash_str(Fingerprint* fp, const char* s) {
+    if (s == NULL) hash_int(fp, -1);
+    else hash_bytes(fp->lanes, s, strlen(s) + 1);
+}
+
+static void hash_scope(Fingerprint* fp, const SymbolTable* st, bool nested);
+
+/**
+ * Hashes everything code generation reads from a symbol
+ * @param fp fingerprint to hash into
+ * @param s symbol to hash
+ * @param nested whether to hash the scopes of functions and for-loops as well
+ */
+static void hash_symbol(Fingerprint* fp, const Symbol* s, const bool nested) {
+    hash_str(fp, s->name);
+    hash_int(fp, s->stype);
+    hash_int(fp, s->vtype);
+    hash_int(fp, (long) s->offset);
+    hash_int(fp, s->imported);
+    hash_int(fp, s->exported);
+    hash_int(fp, s->is_constant);
+    if (s->is_constant) hash_int(fp, s->constant);
+
+    switch (s->stype) {
+        case ST_ARRAYVAR:
+            hash_int(fp, (long) s->as.array.dim_count);
+            for (size_t i = 0; i < s->as.array.dim_count; i++) hash_str(fp, s->as.array.dims[i]->name);
+            break;
+        case ST_FUNCTION: {
+            const FunData* fun = &s->as.fun;
+            hash_str(fp, fun->label_name);
+            hash_int(fp, (long) fun->param_count);
+            for (size_t i = 0; i < fun->param_count; i++) {
+                hash_int(fp, fun->param_types[i]);
+                hash_int(fp, (long) fun->param_dim_counts[i]);
+                hash_int(fp, fun->dead_params != NULL && fun->dead_params[i]);
+            }
+            if (nested && fun->scope != NULL) hash_scope(fp, fun->scope, true);
+            break;
+        }
+        case ST_FORLOOP:
+            if (nested && s->as.forloop.scope != NULL) hash_scope(fp, s->as.forloop.scope, true);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Hashes the symbols of a scope. The symbol table has no order, so every
+ * symbol is hashed on its own and the results are summed.
+ * @param fp fingerprint to hash into
+ * @param st scope to hash
+ * @param nested whether to hash the scopes of functions and for-loops as well
+ */
+static void hash_scope(Fingerprint* fp, const SymbolTable* st, const bool nested) {
+    Fingerprint sum = {{0, 0}};
+    for (htable_iter_st* iter = HTiterate(st->table); iter; iter = HTiterateNext(iter)) {
+        Fingerprint symbol;
+        hash_seed(symbol.lanes);
+        hash_str(&symbol, HTiterKey(iter));
+        hash_symbol(&symbol, HTiterValue(iter), nested);
+        hash_finish(symbol.lanes);
+        sum.lanes[0] += symbol.lanes[0];
+        sum.lanes[1] += symbol.lanes[1];
+    }
+
+    hash_bytes(fp->lanes, sum.lanes, sizeof(sum.lanes));
+    hash_int(fp, (long) st->localvar_offset_counter);
+    hash_int(fp, (long) st->nesting_level);
+    hash_int(fp, (long) st->for_loop_counter);
+}
+
+/**
+ * Hashes a symbol a node refers to
+ * @param s referred symbol, may be NULL
+ */
+static void hash_ref(const Symbol* s) {
+    if (s == NULL) {
+        hash_int(CURRENT, 0);
+        return;
+    }
+    hash_str(CURRENT, s->name);
+    hash_int(CURRENT, s->stype);
+    hash_int(CURRENT, (long) s->offset);
+    hash_int(CURRENT, s->parent_scope == NULL ? -1 : (long) s->parent_scope->nesting_level);
+}
+
+/**
+ * Hashes the type of a node and, inside functions, its source range
+ * @param node node to hash
+ */
+static void hash_node(node_st* node) {
+    hash_int(CURRENT, NODE_TYPE(node));
+
+    // Outside functions, lines only end up in __init, which is always generated
+    if (CURRENT == &PRINTS->module) return;
+
+    hash_int(CURRENT, NODE_BLINE(node) > 0 ? NODE_BLINE(node) - BASE_LINE + 1 : 0);
+    hash_int(CURRENT, NODE_BCOL(node));
+    hash_int(CURRENT, NODE_ELINE(node) > 0 ? NODE_ELINE(node) - BASE_LINE + 1 : 0);
+    hash_int(CURRENT, NODE_ECOL(node));
+}
+
+/**
+ * Hashes an optional child, so a missing child is told apart from a present one
+ * @param child child to traverse, may be NULL
+ */
+static void hash_child(node_st* child) {
+    if (child == NULL) hash_int(CURRENT, 0);
+    else TRAVdo(child);
+}
+
+/**
+ * Fingerprints a program
+ * @param program root of the program, after all optimisations
+ * @param prints receives the fingerprints, free with FPfree
+ */
+void FPcompute(node_st* program, Fingerprints* prints) {
+    prints->funs = NULL;
+    prints->fun_prints = NULL;
+    prints->fun_count = 0;
+    PRINTS = prints;
+    CURRENT = &prints->module;
+
+    TRAVstart(program, TRAV_FP);
+
+    PRINTS = NULL;
+    CURRENT = NULL;
+}
+
+void FPfree(Fingerprints* prints) {
+    MEMfree(prints->funs);
+    MEMfree(prints->fun_prints);
+    prints->funs = NULL;
+    prints->fun_prints = NULL;
+    prints->fun_count = 0;
+}
+
+/**
+ * @param fp fingerprint
+ * @return fingerprint in hexadecimal
+ */
+char* FPtoStr(const Fingerprint fp) {
+    return STRfmt("%016llx%016llx", (unsigned long long) fp.lanes[0], (unsigned long long) fp.lanes[1]);
+}
+
+/**
+ * @fn FPprogram
+ */
+node_st *FPprogram(node_st *node)
+{
+    hash_seed(CURRENT->lanes);
+    hash_str(CURRENT, GLBbuildId());
+    hash_scope(CURRENT, GB_GLOBAL_SCOPE, false);
+    hash_child(PROGRAM_DECLS(node));
+    hash_finish(CURRENT->lanes);
+    return node;
+}
+
+/**
+ * @fn FPdecls
+ */
+node_st *FPdecls(node_st *node)
+{
+    hash_node(node);
+    hash_child(DECLS_DECL(node));
+    hash_child(DECLS_NEXT(node));
+    return node;
+}
+
+/**
+ * @fn FPexprs
+ */
+node_st *FPexprs(node_st *node)
+{
+    hash_node(node);
+    hash_child(EXPRS_EXPR(node));
+    hash_child(EXPRS_NEXT(node));
+    return node;
+}
+
+/**
+ * @fn FParrexpr
+ */
+node_st *FParrexpr(node_st *node)
+{
+    hash_node(node);
+    hash_child(ARREXPR_EXPRS(node));
+    return node;
+}
+
+/**
+ * @fn FPids
+ */
+node_st *FPids(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, IDS_NAME(node));
+    hash_child(IDS_NEXT(node));
+    return node;
+}
+
+/**
+ * @fn FPexprstmt
+ */
+node_st *FPexprstmt(node_st *node)
+{
+    hash_node(node);
+    hash_child(EXPRSTMT_EXPR(node));
+    return node;
+}
+
+/**
+ * @fn FPreturn
+ */
+node_st *FPreturn(node_st *node)
+{
+    hash_node(node);
+    hash_child(RETURN_EXPR(node));
+    return node;
+}
+
+/**
+ * @fn FPfuncall
+ */
+node_st *FPfuncall(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, FUNCALL_NAME(node));
+    hash_ref(FUNCALL_SYMBOL(node));
+    hash_child(FUNCALL_FUN_ARGS(node));
+    return node;
+}
+
+/**
+ * @fn FPcast
+ */
+node_st *FPcast(node_st *node)
+{
+    hash_node(node);
+    hash_int(CURRENT, CAST_TYPE(node));
+    hash_ref(CAST_CSE_TEMP(node));
+    hash_int(CURRENT, CAST_CSE_DEF(node));
+    hash_child(CAST_EXPR(node));
+    return node;
+}
+
+/**
+ * @fn FPfundefs
+ */
+node_st *FPfundefs(node_st *node)
+{
+    hash_node(node);
+    hash_child(FUNDEFS_FUNDEF(node));
+    hash_child(FUNDEFS_NEXT(node));
+    return node;
+}
+
+/**
+ * @fn FPfundef
+ */
+node_st *FPfundef(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, FUNDEF_NAME(node));
+    hash_int(CURRENT, FUNDEF_TYPE(node));
+    hash_int(CURRENT, FUNDEF_EXPORT(node));
+    hash_int(CURRENT, FUNDEF_IS_EXTERN(node));
+    hash_child(FUNDEF_PARAMS(node));
+
+    const Symbol* s = STlookup(GB_GLOBAL_SCOPE, FUNDEF_NAME(node));
+    if (CURRENT != &PRINTS->module || FUNDEF_IS_EXTERN(node) || s == NULL) {
+        hash_child(FUNDEF_BODY(node));
+        return node;
+    }
+
+    // The body of a top-level function gets a fingerprint of its own
+    const size_t n = PRINTS->fun_count++;
+    ARRAY_RESIZE(PRINTS->funs, PRINTS->fun_count);
+    ARRAY_RESIZE(PRINTS->fun_prints, PRINTS->fun_count);
+    PRINTS->funs[n] = node;
+
+    Fingerprint fp;
+    hash_seed(fp.lanes);
+    CURRENT = &fp;
+    BASE_LINE = NODE_BLINE(node);
+    hash_str(CURRENT, FUNDEF_NAME(node));
+    hash_scope(CURRENT, s->as.fun.scope, true);
+    hash_child(FUNDEF_BODY(node));
+    hash_finish(fp.lanes);
+    CURRENT = &PRINTS->module;
+
+    PRINTS->fun_prints[n] = fp;
+    return node;
+}
+
+/**
+ * @fn FPfunbody
+ */
+node_st *FPfunbody(node_st *node)
+{
+    hash_node(node);
+    hash_child(FUNBODY_DECLS(node));
+    hash_child(FUNBODY_LOCAL_FUNDEFS(node));
+    hash_child(FUNBODY_STMTS(node));
+    return node;
+}
+
+/**
+ * @fn FPifelse
+ */
+node_st *FPifelse(node_st *node)
+{
+    hash_node(node);
+    hash_child(IFELSE_COND(node));
+    hash_child(IFELSE_THEN(node));
+    hash_child(IFELSE_ELSE_BLOCK(node));
+    return node;
+}
+
+/**
+ * @fn FPwhile
+ */
+node_st *FPwhile(node_st *node)
+{
+    hash_node(node);
+    hash_child(WHILE_COND(node));
+    hash_child(WHILE_BLOCK(node));
+    return node;
+}
+
+/**
+ * @fn FPdowhile
+ */
+node_st *FPdowhile(node_st *node)
+{
+    hash_node(node);
+    hash_child(DOWHILE_COND(node));
+    hash_child(DOWHILE_BLOCK(node));
+    return node;
+}
+
+/**
+ * @fn FPfor
+ */
+node_st *FPfor(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, FOR_VAR(node));
+    hash_child(FOR_START_EXPR(node));
+    hash_child(FOR_STOP(node));
+    hash_child(FOR_STEP(node));
+    hash_child(FOR_BLOCK(node));
+    return node;
+}
+
+/**
+ * @fn FPglobdecl
+ */
+node_st *FPglobdecl(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, GLOBDECL_NAME(node));
+    hash_int(CURRENT, GLOBDECL_TYPE(node));
+    hash_child(GLOBDECL_DIMS(node));
+    return node;
+}
+
+/**
+ * @fn FPglobdef
+ */
+node_st *FPglobdef(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, GLOBDEF_NAME(node));
+    hash_int(CURRENT, GLOBDEF_TYPE(node));
+    hash_int(CURRENT, GLOBDEF_EXPORT(node));
+    hash_child(GLOBDEF_DIMS(node));
+    hash_child(GLOBDEF_INIT(node));
+    return node;
+}
+
+/**
+ * @fn FPparam
+ */
+node_st *FPparam(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, PARAM_NAME(node));
+    hash_int(CURRENT, PARAM_TYPE(node));
+    hash_child(PARAM_DIMS(node));
+    hash_child(PARAM_NEXT(node));
+    return node;
+}
+
+/**
+ * @fn FPvardecl
+ */
+node_st *FPvardecl(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, VARDECL_NAME(node));
+    hash_int(CURRENT, VARDECL_TYPE(node));
+    hash_child(VARDECL_DIMS(node));
+    hash_child(VARDECL_INIT(node));
+    hash_child(VARDECL_NEXT(node));
+    return node;
+}
+
+/**
+ * @fn FPstmts
+ */
+node_st *FPstmts(node_st *node)
+{
+    hash_node(node);
+    hash_child(STMTS_STMT(node));
+    hash_child(STMTS_NEXT(node));
+    return node;
+}
+
+/**
+ * @fn FPassign
+ */
+node_st *FPassign(node_st *node)
+{
+    hash_node(node);
+    hash_child(ASSIGN_LET(node));
+    hash_child(ASSIGN_EXPR(node));
+    return node;
+}
+
+/**
+ * @fn FPbinop
+ */
+node_st *FPbinop(node_st *node)
+{
+    hash_node(node);
+    hash_int(CURRENT, BINOP_OP(node));
+    hash_int(CURRENT, BINOP_TYPE(node));
+    hash_ref(BINOP_CSE_TEMP(node));
+    hash_int(CURRENT, BINOP_CSE_DEF(node));
+    hash_child(BINOP_LEFT(node));
+    hash_child(BINOP_RIGHT(node));
+    return node;
+}
+
+/**
+ * @fn FPmonop
+ */
+node_st *FPmonop(node_st *node)
+{
+    hash_node(node);
+    hash_int(CURRENT, MONOP_OP(node));
+    hash_int(CURRENT, MONOP_TYPE(node));
+    hash_ref(MONOP_CSE_TEMP(node));
+    hash_int(CURRENT, MONOP_CSE_DEF(node));
+    hash_child(MONOP_OPERAND(node));
+    return node;
+}
+
+/**
+ * @fn FPvarlet
+ */
+node_st *FPvarlet(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, VARLET_NAME(node));
+    hash_ref(VARLET_SYMBOL(node));
+    hash_ref(VARLET_INDEX_TEMP(node));
+    hash_int(CURRENT, VARLET_INDEX_DEF(node));
+    hash_child(VARLET_INDICES(node));
+    return node;
+}
+
+/**
+ * @fn FPvar
+ */
+node_st *FPvar(node_st *node)
+{
+    hash_node(node);
+    hash_str(CURRENT, VAR_NAME(node));
+    hash_ref(VAR_SYMBOL(node));
+    hash_ref(VAR_INDEX_TEMP(node));
+    hash_int(CURRENT, VAR_INDEX_DEF(node));
+    hash_child(VAR_INDICES(node));
+    return node;
+}
+
+/**
+ * @fn FPnum
+ */
+node_st *FPnum(node_st *node)
+{
+    hash_node(node);
+    hash_int(CURRENT, NUM_VAL(node));
+    return node;
+}
+
+/**
+ * @fn FPfloat
+ */
+node_st *FPfloat(node_st *node)
+{
+    hash_node(node);
+    const float v = FLOAT_VAL(node);
+    hash_bytes(CURRENT->lanes, &v, sizeof(v));
+    return node;
+}
+
+/**
+ * @fn FPbool
+ */
+node_st *FPbool(node_st *node)
+{
+    hash_node(node);
+    hash_int(CURRENT, BOOL_VAL(node));
+    return node;
+}
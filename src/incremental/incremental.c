@@ -0,0 +1,427 @@
+// src/incremental/incremental.c
+
+#include "incremental.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bytecode/opcodes.h"
+#include "common.h"
+#include "global/globals.h"
+#include "palm/memory.h"
+#include "palm/str.h"
+
+#define STATE_HEADER "civicc-incremental 1\n"
+
+// Fields of an instruction line in a record
+#define LINE_FIELDS 11
+
+/* Code of a top-level function in the state file. The record starts with
+ *     function <fingerprint> <labels> <lines>
+ * followed by <lines> lines. "c <type> <value>" lines list the constants the
+ * function looked up, in order. "i <kind> <frame slots> <range> <instr> <args>"
+ * lines are its instructions, kind 1 for labels and 2 for function labels.
+ * Constant operands are stored as $<value>, labels generated for the function
+ * as @<n>_<name> with n counted from its first label, missing arguments as -.
+ * Lines of the range are counted from the line of the function. */
+typedef struct Record {
+    const char* text;
+    size_t len;
+} Record;
+
+typedef struct State {
+    bool active;
+    char* path;                         // State file, <output>.inc
+    Fingerprints prints;
+    size_t cursor;                      // Next top-level function to look for
+    size_t reused;                      // Functions whose code was spliced
+    char* previous;                     // State file of the last compilation
+    htable_st* records;                 // Fingerprint to Record in previous
+    char** texts;                       // Records of this compilation, by top-level function
+    size_t* text_lens;
+
+    // Function whose code is being recorded
+    bool recording;
+    size_t fun;
+    const Instruction* before;          // Last instruction before the function, NULL if none
+    size_t first_label;
+    FILE* uses;                         // Constant lookups of the function
+    char* uses_text;
+    size_t uses_size;
+    size_t use_count;
+
+    // Constants of the assembly by index, filled as operands refer to them
+    const Constant** consts;
+    size_t const_count;
+} State;
+
+static State STATE;
+
+/**
+ * @param text first line of lines to skip
+ * @param lines amount of lines to skip
+ * @return start of the line after them, NULL if the text ends before
+ */
+static const char* skip_lines(const char* text, size_t lines) {
+    for (; lines > 0; lines--) {
+        text = strchr(text, '\n');
+        if (text == NULL) return NULL;
+        text++;
+    }
+    return text;
+}
+
+/**
+ * Indexes the records of the last compilation, if it had the same module fingerprint
+ */
+static void load(void) {
+    STATE.previous = read_file(STATE.path, NULL);
+    if (STATE.previous == NULL) return;
+
+    char* module = FPtoStr(STATE.prints.module);
+    char* header = STRfmt("%smodule %s\n", STATE_HEADER, module);
+    MEMfree(module);
+    const bool same_module = strncmp(STATE.previous, header, strlen(header)) == 0;
+    const char* text = STATE.previous + strlen(header);
+    MEMfree(header);
+    if (!same_module) return;
+
+    STATE.records = HTnew_String(VARTABLE_SIZE);
+    while (*text != '\0') {
+        char key[33];
+        size_t labels, lines;
+        if (sscanf(text, "function %32s %zu %zu", key, &labels, &lines) != 3) break;
+
+        const char* end = skip_lines(text, lines + 1);
+        if (end == NULL) break;
+
+        Record* record = MEMmalloc(sizeof(Record));
+        record->text = text;
+        record->len = end - text;
+        if (!HTinsert(STATE.records, STRcpy(key), record)) MEMfree(record);
+        text = end;
+    }
+}
+
+/**
+ * Starts reusing code for a program about to be generated, if --incremental
+ * is on and the output goes to a file
+ * @param program root of the program
+ */
+void INCbegin(node_st* program) {
+    STATE.active = global.incremental && global.output_stream == NULL && global.output_file != NULL;
+    if (!STATE.active) return;
+
+    STATE.path = STRfmt("%s.inc", global.output_file);
+    FPcompute(program, &STATE.prints);
+    STATE.cursor = 0;
+    STATE.texts = MEMmalloc(STATE.prints.fun_count * sizeof(char*));
+    STATE.text_lens = MEMmalloc(STATE.prints.fun_count * sizeof(size_t));
+    for (size_t i = 0; i < STATE.prints.fun_count; i++) STATE.texts[i] = NULL;
+    load();
+}
+
+/**
+ * @param fundef top-level function definition
+ * @return index of the function in the fingerprints, fun_count if it has none
+ */
+static size_t find_fun(node_st* fundef) {
+    for (size_t i = STATE.cursor; i < STATE.prints.fun_count; i++) {
+        if (STATE.prints.funs[i] == fundef) {
+            STATE.cursor = i + 1;
+            return i;
+        }
+    }
+    return STATE.prints.fun_count;
+}
+
+/**
+ * @param name label name
+ * @param labels amount of labels generated for the function
+ * @return number of a label generated for the function, counted from its first label, -1 for other labels
+ */
+static long label_number(const char* name, const size_t labels) {
+    if (strncmp(name, "_lab", 4) != 0) return -1;
+
+    char* end;
+    const size_t n = strtoul(name + 4, &end, 10);
+    if (end == name + 4 || *end != '_' || n < STATE.first_label || n >= STATE.first_label + labels) return -1;
+    return (long) (n - STATE.first_label);
+}
+
+/**
+ * @param assembly assembly being generated
+ * @param index index in the constant pool
+ * @return constant at the index
+ */
+static const Constant* constant_at(const Assembly* assembly, const size_t index) {
+    if (STATE.const_count < assembly->const_count) {
+        ARRAY_RESIZE(STATE.consts, assembly->const_count);
+        const Constant* c = STATE.const_count == 0 ? assembly->consts : STATE.consts[STATE.const_count - 1]->next;
+        for (; c != NULL; c = c->next) STATE.consts[STATE.const_count++] = c;
+    }
+    return index < STATE.const_count ? STATE.consts[index] : NULL;
+}
+
+static void write_label(FILE* f, const char* name, const size_t labels) {
+    const long n = label_number(name, labels);
+    if (n < 0) fprintf(f, " %s", name);
+    else fprintf(f, " @%ld%s", n, strchr(name + 4, '_'));
+}
+
+static void write_operand(FILE* f, const Assembly* assembly, const char* arg, const OperandKind kind,
+                          const size_t labels) {
+    if (arg == NULL) {
+        fprintf(f, " -");
+    } else if (kind == OPND_LABEL) {
+        write_label(f, arg, labels);
+    } else if (kind == OPND_CONST) {
+        const Constant* c = constant_at(assembly, strtoul(arg, NULL, 10));
+        fprintf(f, " $%s", c->value);
+    } else {
+        fprintf(f, " %s", arg);
+    }
+}
+
+/**
+ * Writes an instruction line of a record
+ * @param f record being written
+ * @param assembly assembly the instruction belongs to
+ * @param instr instruction to write
+ * @param labels amount of labels generated for the function
+ * @param base_line line of the function
+ */
+static void write_instr(FILE* f, const Assembly* assembly, const Instruction* instr, const size_t labels,
+                        const int base_line) {
+    const SourceRange r = instr->range;
+    fprintf(f, "i %d %zu %d %d %d %d", instr->is_fun ? 2 : instr->is_label, instr->frame_slots,
+        r.line > 0 ? r.line - base_line + 1 : 0, r.col, r.end_line > 0 ? r.end_line - base_line + 1 : 0, r.end_col);
+
+    if (instr->is_label) {
+        write_label(f, instr->instr, labels);
+        fprintf(f, " - - -\n");
+        return;
+    }
+
+    Opcode op;
+    const OpInfo* info = OPfind(instr->instr, &op) ? &OPCODE_TABLE[op] : NULL;
+    const char* args[] = {instr->arg0, instr->arg1, instr->arg2};
+    fprintf(f, " %s", instr->instr);
+    for (size_t i = 0; i < 3; i++) {
+        const OperandKind kind = info != NULL && i < info->operand_count ? info->operands[i] : OPND_NONE;
+        write_operand(f, assembly, args[i], kind, labels);
+    }
+    fprintf(f, "\n");
+}
+
+/**
+ * Parses the instruction lines of a record and emits them
+ * @param assembly assembly to emit into
+ * @param text copy of the record without its first line, split in place
+ * @param lines amount of lines
+ * @param labels amount of labels generated for the function
+ * @param base_line line of the function
+ * @return false if the record is malformed, nothing is emitted then
+ */
+static bool emit_record(Assembly* assembly, char* text, const size_t lines, const size_t labels,
+                        const int base_line) {
+    char*** fields = MEMmalloc(lines * sizeof(char**));
+    size_t parsed = 0;
+    bool valid = true;
+
+    char* save;
+    for (char* line = strtok_r(text, "\n", &save); line != NULL && parsed < lines; line = strtok_r(NULL, "\n", &save)) {
+        char** f = MEMmalloc(LINE_FIELDS * sizeof(char*));
+        size_t n = 0;
+        char* field_save;
+        for (char* field = strtok_r(line, " ", &field_save); field != NULL && n < LINE_FIELDS;
+             field = strtok_r(NULL, " ", &field_save)) {
+            f[n++] = field;
+        }
+        fields[parsed++] = f;
+
+        const bool is_constant = n == 3 && strcmp(f[0], "c") == 0;
+        const bool is_instr = n == LINE_FIELDS && strcmp(f[0], "i") == 0;
+        if (!is_constant && !is_instr) valid = false;
+    }
+    valid = valid && parsed == lines;
+
+    // Same constant lookups as generating the function, so the pool gets the same order
+    for (size_t i = 0; valid && i < parsed; i++) {
+        if (strcmp(fields[i][0], "c") != 0) continue;
+        if (ASMfindConstant(assembly, fields[i][2]).get == NULL) ASMemitConst(assembly, fields[i][1], fields[i][2]);
+    }
+
+    const size_t first_label = reserve_label_numbers(valid ? labels : 0);
+    for (size_t i = 0; valid && i < parsed; i++) {
+        char** f = fields[i];
+        if (strcmp(f[0], "i") != 0) continue;
+
+        char* args[4] = {NULL, NULL, NULL, NULL};
+        for (size_t a = 0; a < 4; a++) {
+            const char* field = f[7 + a];
+            if (strcmp(field, "-") == 0) {
+                args[a] = NULL;
+            } else if (field[0] == '$') {
+                args[a] = int_to_str((int) ASMfindConstant(assembly, field + 1).offset);
+            } else if (field[0] == '@') {
+                char* end;
+                const size_t n = strtoul(field + 1, &end, 10);
+                args[a] = STRfmt("_lab%zu%s", first_label + n, end);
+            } else {
+                args[a] = STRcpy(field);
+            }
+        }
+
+        const int kind = atoi(f[1]);
+        if (kind == 0) ASMemitInstr(assembly, args[0], args[1], args[2], args[3]);
+        else ASMemitLabel(assembly, args[0], kind == 2);
+
+        Instruction* instr = assembly->last_instr;
+        const int line = atoi(f[3]);
+        const int end_line = atoi(f[5]);
+        instr->frame_slots = strtoul(f[2], NULL, 10);
+        instr->range = (SourceRange) {line > 0 ? line + base_line - 1 : 0, atoi(f[4]),
+                                      end_line > 0 ? end_line + base_line - 1 : 0, atoi(f[6])};
+
+        for (size_t a = 0; a < 4; a++) MEMfree(args[a]);
+    }
+
+    for (size_t i = 0; i < parsed; i++) MEMfree(fields[i]);
+    MEMfree(fields);
+    return valid;
+}
+
+/**
+ * Called before generating a top-level function. Splices the code of the last
+ * compilation if the function did not change, otherwise starts recording its code.
+ * @param assembly assembly being generated
+ * @param fundef top-level function definition
+ * @return true if the code was spliced, the function must not be generated then
+ */
+bool INCenter(Assembly* assembly, node_st* fundef) {
+    if (!STATE.active) return false;
+
+    const size_t fun = find_fun(fundef);
+    if (fun == STATE.prints.fun_count) return false;
+
+    char* key = FPtoStr(STATE.prints.fun_prints[fun]);
+    const Record* record = STATE.records == NULL ? NULL : HTlookup(STATE.records, key);
+    MEMfree(key);
+
+    size_t labels, lines;
+    if (record != NULL && sscanf(record->text, "function %*s %zu %zu", &labels, &lines) == 2) {
+        const char* body = strchr(record->text, '\n') + 1;
+        const size_t body_len = record->len - (body - record->text);
+        char* text = MEMmalloc(body_len + 1);
+        memcpy(text, body, body_len);
+        text[body_len] = '\0';
+        const bool spliced = emit_record(assembly, text, lines, labels, NODE_BLINE(fundef));
+        MEMfree(text);
+
+        if (spliced) {
+            STATE.texts[fun] = MEMmalloc(record->len);
+            memcpy(STATE.texts[fun], record->text, record->len);
+            STATE.text_lens[fun] = record->len;
+            STATE.reused++;
+            return true;
+        }
+    }
+
+    STATE.recording = true;
+    STATE.fun = fun;
+    STATE.before = assembly->last_instr;
+    STATE.first_label = next_label_number();
+    STATE.uses = open_memstream(&STATE.uses_text, &STATE.uses_size);
+    STATE.use_count = 0;
+    return false;
+}
+
+/**
+ * Called after generating a top-level function, records its code
+ * @param assembly assembly being generated
+ */
+void INCleave(const Assembly* assembly) {
+    if (!STATE.recording) return;
+    STATE.recording = false;
+    fclose(STATE.uses);
+
+    node_st* fundef = STATE.prints.funs[STATE.fun];
+    const size_t labels = next_label_number() - STATE.first_label;
+    const Instruction* first = STATE.before == NULL ? assembly->instrs : STATE.before->next;
+
+    char* instrs_text = NULL;
+    size_t instrs_size = 0;
+    FILE* f = open_memstream(&instrs_text, &instrs_size);
+    size_t lines = STATE.use_count;
+    for (const Instruction* instr = first; instr != NULL; instr = instr->next, lines++) {
+        write_instr(f, assembly, instr, labels, NODE_BLINE(fundef));
+    }
+    fclose(f);
+
+    char* key = FPtoStr(STATE.prints.fun_prints[STATE.fun]);
+    STATE.texts[STATE.fun] = STRfmt("function %s %zu %zu\n%s%s", key, labels, lines, STATE.uses_text, instrs_text);
+    STATE.text_lens[STATE.fun] = strlen(STATE.texts[STATE.fun]);
+    MEMfree(key);
+    free(STATE.uses_text);
+    free(instrs_text);
+    STATE.uses_text = NULL;
+}
+
+/**
+ * Notes a constant lookup of the function being recorded
+ * @param type type of the constant
+ * @param value value of the constant
+ */
+void INCuseConstant(const char* type, const char* value) {
+    if (!STATE.recording) return;
+    fprintf(STATE.uses, "c %s %s\n", type, value);
+    STATE.use_count++;
+}
+
+/**
+ * Writes the records of this compilation to the state file if it succeeded
+ * and forgets the last compilation
+ */
+void INCfinish(void) {
+    if (!STATE.active) return;
+
+    if (global.verbose) {
+        fprintf(GLBdiagnostics(), "Reused the code of %zu of %zu functions\n", STATE.reused, STATE.prints.fun_count);
+    }
+
+    if (!global.had_error) {
+        char* module = FPtoStr(STATE.prints.module);
+        char* tmp = STRfmt("%s.tmp.%ld", STATE.path, (long) getpid());
+        FILE* f = fopen(tmp, "w");
+        bool written = f != NULL && fprintf(f, "%smodule %s\n", STATE_HEADER, module) > 0;
+        for (size_t i = 0; written && i < STATE.prints.fun_count; i++) {
+            if (STATE.texts[i] == NULL) continue;
+            written = fwrite(STATE.texts[i], 1, STATE.text_lens[i], f) == STATE.text_lens[i];
+        }
+        if (f != NULL) written = fclose(f) == 0 && written;
+        written = written && rename(tmp, STATE.path) == 0;
+        if (!written) {
+            unlink(tmp);
+            USER_WARNING("Could not write incremental state %s", STATE.path);
+        }
+        MEMfree(tmp);
+        MEMfree(module);
+    }
+
+    if (STATE.records != NULL) {
+        for (htable_iter_st* iter = HTiterate(STATE.records); iter; iter = HTiterateNext(iter)) {
+            MEMfree(HTiterKey(iter));
+            MEMfree(HTiterValue(iter));
+        }
+        HTdelete(STATE.records);
+    }
+    for (size_t i = 0; i < STATE.prints.fun_count; i++) MEMfree(STATE.texts[i]);
+    MEMfree(STATE.texts);
+    MEMfree(STATE.text_lens);
+    MEMfree(STATE.previous);
+    MEMfree(STATE.path);
+    MEMfree(STATE.consts);
+    FPfree(&STATE.prints);
+    STATE = (State) {0};
+}
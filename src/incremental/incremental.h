@@ -0,0 +1,38 @@
+// src/incremental/incremental.h
+
+#pragma once
+
+/* Reuse of the bytecode of unchanged top-level functions, see --incremental.
+ * Every compilation writes the code of its top-level functions to
+ * <output>.inc, keyed by a fingerprint of the optimised function and the
+ * symbols it refers to. The next compilation of the same output splices the
+ * code of functions whose fingerprint did not change instead of generating it
+ * again. Labels are renumbered and constants looked up again while splicing,
+ * so the output is the same as without --incremental. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bytecode/asm.h"
+#include "ccngen/ast.h"
+
+typedef struct Fingerprint {
+    uint64_t lanes[2];
+} Fingerprint;
+
+typedef struct Fingerprints {
+    Fingerprint module;                 // Everything outside the bodies of top-level functions
+    node_st** funs;                     // Top-level function definitions, in program order
+    Fingerprint* fun_prints;
+    size_t fun_count;
+} Fingerprints;
+
+void FPcompute(node_st* program, Fingerprints* prints);
+void FPfree(Fingerprints* prints);
+char* FPtoStr(Fingerprint fp);
+
+void INCbegin(node_st* program);
+bool INCenter(Assembly* assembly, node_st* fundef);
+void INCleave(const Assembly* assembly);
+void INCuseConstant(const char* type, const char* value);
+void INCfinish(void);
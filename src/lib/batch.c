@@ -0,0 +1,219 @@
+// src/lib/batch.c
+
+#include "batch.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "lib/civicc.h"
+#include "palm/hash_table.h"
+#include "palm/memory.h"
+#include "palm/str.h"
+
+typedef struct BatchJob {
+    const char* path;
+    char* output_path;
+    int status;
+    char* diagnostics;                  // Printed in input order once every job finished
+} BatchJob;
+
+typedef struct BatchPool {
+    const struct globals* options;
+    BatchJob* jobs;
+    size_t job_count;
+    atomic_size_t next_job;
+} BatchPool;
+
+/**
+ * Adds an input file, or every file listed in a response file @<file>
+ * @param inputs inputs to extend
+ * @param arg command line argument
+ * @return false if a response file could not be read
+ */
+bool BATCHaddInput(BatchInputs* inputs, const char* arg) {
+    if (arg[0] != '@') {
+        ARRAY_RESIZE(inputs->paths, inputs->count + 1);
+        inputs->paths[inputs->count++] = STRcpy(arg);
+        return true;
+    }
+
+    FILE* f = fopen(arg + 1, "r");
+    if (f == NULL) return false;
+
+    // Paths are separated by whitespace, like the command line
+    char path[4096];
+    while (fscanf(f, "%4095s", path) == 1) {
+        ARRAY_RESIZE(inputs->paths, inputs->count + 1);
+        inputs->paths[inputs->count++] = STRcpy(path);
+    }
+    fclose(f);
+    return true;
+}
+
+void BATCHfreeInputs(BatchInputs* inputs) {
+    for (size_t i = 0; i < inputs->count; i++) MEMfree(inputs->paths[i]);
+    MEMfree(inputs->paths);
+    inputs->paths = NULL;
+    inputs->count = 0;
+}
+
+static const char* output_extension(const EmitKind emit) {
+    switch (emit) {
+        case EMIT_BINARY: return ".o";
+        case EMIT_C: return ".c";
+        case EMIT_ASM:
+        case EMIT_X86: return ".s";
+    }
+    return ".s";
+}
+
+/**
+ * Names the output of an input after its file name, a.cvc becomes <outdir>/a.s
+ * @param outdir output directory
+ * @param path input path
+ * @param emit output kind
+ * @return output path
+ */
+static char* output_path(const char* outdir, const char* path, const EmitKind emit) {
+    const char* base = file_basename(path);
+
+    size_t len = strlen(base);
+    if (len > 4 && strcmp(base + len - 4, ".cvc") == 0) len -= 4;
+
+    return STRfmt("%s/%.*s%s", outdir, (int) len, base, output_extension(emit));
+}
+
+/**
+ * Creates a library context with the options of the command line, also used by --watch
+ * @param options options of the command line
+ * @return new context, free with civicc_context_free
+ */
+CiviccContext* BATCHnewContext(const struct globals* options) {
+    CiviccContext* ctx = civicc_context_new();
+    switch (options->emit) {
+        case EMIT_ASM: civicc_set_emit(ctx, CIVICC_EMIT_ASM); break;
+        case EMIT_BINARY: civicc_set_emit(ctx, CIVICC_EMIT_BINARY); break;
+        case EMIT_C: civicc_set_emit(ctx, CIVICC_EMIT_C); break;
+        case EMIT_X86: civicc_set_emit(ctx, CIVICC_EMIT_X86); break;
+    }
+    civicc_set_debug_info(ctx, options->debug_info);
+    civicc_set_profile_counts(ctx, options->profile_counts);
+    civicc_set_max_stack(ctx, options->max_stack);
+    civicc_set_incremental(ctx, options->incremental);
+    return ctx;
+}
+
+/**
+ * Worker of the pool, takes the next job until none are left. Reading the
+ * sources overlaps, the compilations themselves take turns in libcivicc.
+ * @param arg pool
+ * @return NULL
+ */
+static void* run_worker(void* arg) {
+    BatchPool* pool = arg;
+    CiviccContext* ctx = BATCHnewContext(pool->options);
+
+    size_t i;
+    while ((i = atomic_fetch_add(&pool->next_job, 1)) < pool->job_count) {
+        BatchJob* job = &pool->jobs[i];
+
+        size_t len;
+        char* src = read_file(job->path, &len);
+        if (src == NULL) {
+            job->status = 1;
+            job->diagnostics = STRfmt("ERROR: Could not open %s\n", job->path);
+            continue;
+        }
+
+        CiviccOutput out;
+        civicc_set_name(ctx, job->path);
+        job->status = civicc_compile_to_file(ctx, src, len, job->output_path, &out);
+        job->diagnostics = out.diagnostics != NULL ? STRcpy(out.diagnostics) : NULL;
+        civicc_output_free(&out);
+        MEMfree(src);
+    }
+
+    civicc_context_free(ctx);
+    return NULL;
+}
+
+/**
+ * Compiles every input to its own file in the output directory
+ * @param options options of the command line
+ * @param inputs source files
+ * @param outdir directory receiving the compiled files, created when missing
+ * @param jobs amount of worker threads, 0 for one per online processor
+ * @return EXIT_SUCCESS if every input compiled, otherwise EXIT_FAILURE
+ */
+int BATCHcompile(const struct globals* options, const BatchInputs* inputs, const char* outdir, size_t jobs) {
+    if (mkdir(outdir, 0777) != 0 && errno != EEXIST) {
+        USER_ERROR("Could not create output directory %s", outdir);
+        return EXIT_FAILURE;
+    }
+
+    BatchPool pool;
+    pool.options = options;
+    pool.job_count = inputs->count;
+    pool.jobs = MEMmalloc(sizeof(BatchJob) * (inputs->count + 1));
+    atomic_init(&pool.next_job, 0);
+
+    // Inputs sharing a file name would overwrite each other's output
+    bool clash = false;
+    htable_st* outputs = HTnew_String(VARTABLE_SIZE);
+    for (size_t i = 0; i < inputs->count; i++) {
+        BatchJob* job = &pool.jobs[i];
+        job->path = inputs->paths[i];
+        job->output_path = output_path(outdir, job->path, options->emit);
+        job->status = 0;
+        job->diagnostics = NULL;
+
+        const char* other = HTlookup(outputs, job->output_path);
+        if (other != NULL) {
+            USER_ERROR("Inputs %s and %s both compile to %s", other, job->path, job->output_path);
+            clash = true;
+        } else {
+            HTinsert(outputs, job->output_path, (void*) job->path);
+        }
+    }
+    HTdelete(outputs);
+
+    if (!clash) {
+        if (jobs == 0) {
+            const long online = sysconf(_SC_NPROCESSORS_ONLN);
+            jobs = online > 0 ? (size_t) online : 1;
+        }
+        if (jobs > inputs->count) jobs = inputs->count;
+
+        pthread_t* workers = MEMmalloc(sizeof(pthread_t) * (jobs + 1));
+        size_t started = 0;
+        while (started < jobs && pthread_create(&workers[started], NULL, run_worker, &pool) == 0) started++;
+
+        // Without any worker the inputs still get compiled, in this thread
+        if (started == 0) run_worker(&pool);
+        for (size_t i = 0; i < started; i++) pthread_join(workers[i], NULL);
+        MEMfree(workers);
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < pool.job_count; i++) {
+        BatchJob* job = &pool.jobs[i];
+        if (job->diagnostics != NULL && job->diagnostics[0] != '\0') {
+            fprintf(stderr, "%s:\n%s", job->path, job->diagnostics);
+        }
+        failed += job->status != 0;
+        MEMfree(job->output_path);
+        MEMfree(job->diagnostics);
+    }
+    MEMfree(pool.jobs);
+
+    if (clash) return EXIT_FAILURE;
+    if (failed > 0) fprintf(stderr, "%lu of %lu files failed to compile\n", failed, pool.job_count);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,20 @@
+// src/lib/batch.h
+
+#pragma once
+
+/* Compiles many sources in one process, see civicc --batch */
+
+#include <stddef.h>
+
+#include "global/globals.h"
+#include "lib/civicc.h"
+
+typedef struct BatchInputs {
+    char** paths;
+    size_t count;
+} BatchInputs;
+
+bool BATCHaddInput(BatchInputs* inputs, const char* arg);
+void BATCHfreeInputs(BatchInputs* inputs);
+CiviccContext* BATCHnewContext(const struct globals* options);
+int BATCHcompile(const struct globals* options, const BatchInputs* inputs, const char* outdir, size_t jobs);
@@ -0,0 +1,189 @@
+// src/lib/civicc.c
+
+#include "lib/civicc.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "ccn/ccn.h"
+#include "common.h"
+#include "global/globals.h"
+
+struct CiviccContext {
+    struct globals options;             // Options of every compilation, input and output are set per call
+    char* name;                         // Module name used in diagnostics and generated symbols
+};
+
+/* CoCoNut's phase driver and the flex/bison parser keep their state in process
+ * globals, so compilations take turns on them. Everything else a compilation
+ * needs is reset when its phases start. */
+static pthread_mutex_t COMPILE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Creates a context with the options civicc uses without flags
+ * @return new context, free with civicc_context_free
+ */
+CiviccContext* civicc_context_new(void) {
+    CiviccContext* ctx = MEMmalloc(sizeof(CiviccContext));
+
+    pthread_mutex_lock(&COMPILE_LOCK);
+    const struct globals saved = global;
+    GLBinitializeGlobals();
+    ctx->options = global;
+    global = saved;
+    pthread_mutex_unlock(&COMPILE_LOCK);
+
+    // Nothing is printed to STDOUT of the host
+    ctx->options.print_ast = false;
+    ctx->options.stats = STATS_NONE;
+    ctx->name = STRcpy("module");
+    return ctx;
+}
+
+void civicc_context_free(CiviccContext* ctx) {
+    MEMfree(ctx->name);
+    MEMfree(ctx);
+}
+
+/**
+ * Names the compiled module, the name of a source file fits best
+ * @param ctx context
+ * @param name module name
+ */
+void civicc_set_name(CiviccContext* ctx, const char* name) {
+    MEMfree(ctx->name);
+    ctx->name = STRcpy(name);
+}
+
+void civicc_set_emit(CiviccContext* ctx, const CiviccEmit emit) {
+    switch (emit) {
+        case CIVICC_EMIT_ASM: ctx->options.emit = EMIT_ASM; break;
+        case CIVICC_EMIT_BINARY: ctx->options.emit = EMIT_BINARY; break;
+        case CIVICC_EMIT_C: ctx->options.emit = EMIT_C; break;
+        case CIVICC_EMIT_X86: ctx->options.emit = EMIT_X86; break;
+    }
+}
+
+/**
+ * Annotates assembly with source ranges. Without an output file there is no line table.
+ * @param ctx context
+ * @param debug_info whether to annotate
+ */
+void civicc_set_debug_info(CiviccContext* ctx, const bool debug_info) {
+    ctx->options.debug_info = debug_info;
+}
+
+/**
+ * Instruments the program with execution counters. Without an output file
+ * the counter mapping is not written.
+ * @param ctx context
+ * @param profile_counts whether to instrument
+ */
+void civicc_set_profile_counts(CiviccContext* ctx, const bool profile_counts) {
+    ctx->options.profile_counts = profile_counts;
+}
+
+void civicc_set_max_stack(CiviccContext* ctx, const size_t max_stack) {
+    ctx->options.max_stack = max_stack;
+}
+
+/**
+ * Reuses the code of unchanged functions from the last compilation to the
+ * same file, see civicc --incremental. Only civicc_compile_to_file has a file.
+ * @param ctx context
+ * @param incremental whether to reuse code
+ */
+void civicc_set_incremental(CiviccContext* ctx, const bool incremental) {
+    ctx->options.incremental = incremental;
+}
+
+/**
+ * Runs the compiler phases on a source held in memory
+ * @param ctx context with the options
+ * @param src source, does not need to be NUL terminated
+ * @param len length of the source in bytes
+ * @param path file to write the unit and its side files to, NULL to write the unit to out
+ * @param out receives the diagnostics and, without path, the unit
+ * @return 0 on success, 1 if the source has errors, -1 if the output could not be allocated
+ */
+static int compile(CiviccContext* ctx, const char* src, const size_t len, const char* path, CiviccOutput* out) {
+    out->data = NULL;
+    out->size = 0;
+    out->diagnostics = NULL;
+    out->diagnostics_size = 0;
+
+    FILE* output = path == NULL ? open_memstream(&out->data, &out->size) : NULL;
+    FILE* diagnostics = open_memstream(&out->diagnostics, &out->diagnostics_size);
+    if ((path == NULL && output == NULL) || diagnostics == NULL) {
+        if (output != NULL) fclose(output);
+        if (diagnostics != NULL) fclose(diagnostics);
+        civicc_output_free(out);
+        return -1;
+    }
+
+    pthread_mutex_lock(&COMPILE_LOCK);
+    const struct globals saved = global;
+    global = ctx->options;
+    global.input_file = ctx->name;
+    global.input_buffer = src;
+    global.input_size = len;
+    global.output_file = (char*) path;
+    global.output_stream = output;
+    global.diagnostics = diagnostics;
+    global.had_error = false;
+
+    CCNrun(NULL);
+
+    const bool failed = global.had_error;
+    global = saved;
+    pthread_mutex_unlock(&COMPILE_LOCK);
+
+    if (output != NULL) fclose(output);
+    fclose(diagnostics);
+    return failed ? 1 : 0;
+}
+
+/**
+ * Compiles a CiviC source held in memory
+ * @param ctx context with the options
+ * @param src source, does not need to be NUL terminated
+ * @param len length of the source in bytes
+ * @param out receives the compiled unit and the diagnostics, free with civicc_output_free
+ * @return 0 on success, 1 if the source has errors, -1 if the output could not be allocated
+ */
+int civicc_compile_buffer(CiviccContext* ctx, const char* src, const size_t len, CiviccOutput* out) {
+    return compile(ctx, src, len, NULL, out);
+}
+
+/**
+ * Compiles a CiviC source held in memory to a file, like civicc -o does. The
+ * line table and counter mapping are written next to it when enabled.
+ * @param ctx context with the options
+ * @param src source, does not need to be NUL terminated
+ * @param len length of the source in bytes
+ * @param path file to write the compiled unit to
+ * @param out receives the diagnostics, data stays empty, free with civicc_output_free
+ * @return 0 on success, 1 if the source has errors or the file could not be written, -1 if
+ * the diagnostics could not be allocated
+ */
+int civicc_compile_to_file(CiviccContext* ctx, const char* src, const size_t len, const char* path,
+                           CiviccOutput* out) {
+    return compile(ctx, src, len, path, out);
+}
+
+void civicc_output_free(CiviccOutput* out) {
+    // Memory streams allocate with malloc
+    free(out->data);
+    free(out->diagnostics);
+    out->data = NULL;
+    out->size = 0;
+    out->diagnostics = NULL;
+    out->diagnostics_size = 0;
+}
+
+// What to do when a breakpoint is reached.
+void BreakpointHandler(node_st *root)
+{
+    TRAVstart(root, TRAV_PRT);
+    return;
+}
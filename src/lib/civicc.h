@@ -0,0 +1,43 @@
+// src/lib/civicc.h
+
+#pragma once
+
+/* Compiles CiviC sources from memory inside a host process. A context holds the
+ * options, every compilation starts from a clean compiler state, so one process
+ * can compile any amount of units. The functions may be called from several
+ * threads, but compilations do not run concurrently: they are serialised
+ * process-wide by a single lock, as the parser and phase driver keep their
+ * state in globals. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    CIVICC_EMIT_ASM,                    // Textual assembly
+    CIVICC_EMIT_BINARY,                 // Binary bytecode module
+    CIVICC_EMIT_C,                      // C source for the host compiler
+    CIVICC_EMIT_X86                     // x86-64 assembly for the GNU assembler
+} CiviccEmit;
+
+typedef struct CiviccContext CiviccContext;
+
+typedef struct CiviccOutput {
+    char* data;                         // Compiled unit, always followed by a NUL byte
+    size_t size;                        // Size of data without the NUL byte
+    char* diagnostics;                  // Errors and warnings, NUL terminated
+    size_t diagnostics_size;
+} CiviccOutput;
+
+CiviccContext* civicc_context_new(void);
+void civicc_context_free(CiviccContext* ctx);
+
+void civicc_set_name(CiviccContext* ctx, const char* name);
+void civicc_set_emit(CiviccContext* ctx, CiviccEmit emit);
+void civicc_set_debug_info(CiviccContext* ctx, bool debug_info);
+void civicc_set_profile_counts(CiviccContext* ctx, bool profile_counts);
+void civicc_set_max_stack(CiviccContext* ctx, size_t max_stack);
+void civicc_set_incremental(CiviccContext* ctx, bool incremental);
+
+int civicc_compile_buffer(CiviccContext* ctx, const char* src, size_t len, CiviccOutput* out);
+int civicc_compile_to_file(CiviccContext* ctx, const char* src, size_t len, const char* path, CiviccOutput* out);
+void civicc_output_free(CiviccOutput* out);
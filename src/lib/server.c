@@ -0,0 +1,580 @@
+// src/lib/server.c
+
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "lib/civicc.h"
+#include "palm/memory.h"
+#include "palm/str.h"
+
+// Longest header line a client may send
+#define MAX_HEADER_LEN 4096
+
+// Largest source a client may send inline, larger ones are rejected before buffering
+#define MAX_SOURCE_LEN ((size_t) 64 << 20)
+
+typedef struct Client {
+    int fd;
+    CiviccContext* ctx;                 // Reused by every request of the connection
+    char* in;                           // Received bytes not yet handled
+    size_t in_len;
+    char* out;                          // Responses not yet sent
+    size_t out_len;
+    size_t out_sent;
+    bool closing;                       // Close once the responses are sent
+} Client;
+
+static volatile sig_atomic_t STOP = 0;
+
+// Directory the side files of a request are compiled into
+static char* SCRATCH_DIR = NULL;
+
+// Files written next to a compiled unit, in the order of a response
+static const char* SIDE_FILES[] = {"lines", "prof"};
+#define SIDE_FILE_COUNT (sizeof(SIDE_FILES) / sizeof(SIDE_FILES[0]))
+
+static void handle_stop(const int sig) {
+    (void) sig;
+    STOP = 1;
+}
+
+static bool set_nonblocking(const int fd) {
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static bool socket_address(const char* socket_path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        USER_ERROR("Socket path %s is too long", socket_path);
+        return false;
+    }
+    strcpy(addr->sun_path, socket_path);
+    return true;
+}
+
+static void append_out(Client* client, const char* data, const size_t len) {
+    ARRAY_RESIZE(client->out, client->out_len + len + 1);
+    memcpy(client->out + client->out_len, data, len);
+    client->out_len += len;
+}
+
+/**
+ * Queues the response to a request
+ * @param client connection
+ * @param status status of the compilation
+ * @param out compiled unit and diagnostics
+ * @param side contents of the side files in the order of SIDE_FILES, NULL for none
+ * @param side_len lengths of the side files
+ */
+static void append_response(Client* client, const int status, const CiviccOutput* out, char* const* side,
+                            const size_t* side_len) {
+    char header[128];
+    const int len = snprintf(header, sizeof(header), "%d %lu %lu %lu %lu\n", status, out->size,
+        out->diagnostics_size, side != NULL ? side_len[0] : 0, side != NULL ? side_len[1] : 0);
+    append_out(client, header, (size_t) len);
+    if (out->size > 0) append_out(client, out->data, out->size);
+    if (out->diagnostics_size > 0) append_out(client, out->diagnostics, out->diagnostics_size);
+    for (size_t i = 0; side != NULL && i < SIDE_FILE_COUNT; i++) {
+        if (side_len[i] > 0) append_out(client, side[i], side_len[i]);
+    }
+}
+
+static void append_error(Client* client, const char* message) {
+    CiviccOutput out = {NULL, 0, (char*) message, strlen(message)};
+    append_response(client, 1, &out, NULL, NULL);
+}
+
+/**
+ * Compiles a request that needs side files into the scratch directory and
+ * queues the unit together with them
+ * @param client connection
+ * @param src source
+ * @param len length of the source
+ */
+static void compile_with_side_files(Client* client, const char* src, const size_t len) {
+    char* path = STRfmt("%s/unit", SCRATCH_DIR);
+    CiviccOutput out;
+    int status = civicc_compile_to_file(client->ctx, src, len, path, &out);
+
+    char* unit = NULL;
+    char* side[SIDE_FILE_COUNT] = {NULL};
+    size_t side_len[SIDE_FILE_COUNT] = {0};
+    if (status == 0) {
+        unit = read_file(path, &out.size);
+        if (unit == NULL) status = 1;
+        for (size_t i = 0; i < SIDE_FILE_COUNT; i++) {
+            char* side_path = STRfmt("%s.%s", path, SIDE_FILES[i]);
+            side[i] = read_file(side_path, &side_len[i]);
+            MEMfree(side_path);
+        }
+    }
+    if (unit == NULL) out.size = 0;
+
+    // The unit is sent from the file, out only holds the diagnostics
+    CiviccOutput response = {unit, out.size, out.diagnostics, out.diagnostics_size};
+    append_response(client, status, &response, side, side_len);
+
+    unlink(path);
+    for (size_t i = 0; i < SIDE_FILE_COUNT; i++) {
+        char* side_path = STRfmt("%s.%s", path, SIDE_FILES[i]);
+        unlink(side_path);
+        MEMfree(side_path);
+        MEMfree(side[i]);
+    }
+    MEMfree(unit);
+    MEMfree(path);
+    civicc_output_free(&out);
+}
+
+/**
+ * Applies the options of a request header to the context of the connection
+ * @param ctx context of the connection
+ * @param options remaining header tokens, separated by spaces
+ * @param name module name unless the options name one
+ * @param side_files set to whether the options ask for side files
+ * @return false on an unknown option
+ */
+static bool apply_options(CiviccContext* ctx, char* options, const char* name, bool* side_files) {
+    *side_files = false;
+    civicc_set_name(ctx, name);
+    civicc_set_emit(ctx, CIVICC_EMIT_ASM);
+    civicc_set_debug_info(ctx, false);
+    civicc_set_profile_counts(ctx, false);
+    civicc_set_max_stack(ctx, MAX_STACK_DEPTH);
+
+    char* rest = NULL;
+    for (char* opt = strtok_r(options, " ", &rest); opt != NULL; opt = strtok_r(NULL, " ", &rest)) {
+        if (strcmp(opt, "g") == 0) civicc_set_debug_info(ctx, true);
+        else if (strcmp(opt, "profile-counts") == 0) civicc_set_profile_counts(ctx, true);
+        else if (strcmp(opt, "emit=asm") == 0) civicc_set_emit(ctx, CIVICC_EMIT_ASM);
+        else if (strcmp(opt, "emit=binary") == 0) civicc_set_emit(ctx, CIVICC_EMIT_BINARY);
+        else if (strcmp(opt, "emit=c") == 0) civicc_set_emit(ctx, CIVICC_EMIT_C);
+        else if (strcmp(opt, "emit=x86") == 0) civicc_set_emit(ctx, CIVICC_EMIT_X86);
+        else if (strncmp(opt, "max-stack=", 10) == 0) civicc_set_max_stack(ctx, strtoul(opt + 10, NULL, 10));
+        else if (strncmp(opt, "name=", 5) == 0) civicc_set_name(ctx, opt + 5);
+        else return false;
+        if (strcmp(opt, "g") == 0 || strcmp(opt, "profile-counts") == 0) *side_files = true;
+    }
+    return true;
+}
+
+/**
+ * Parses the length of an inline source
+ * @param arg length as sent by the client
+ * @param len set to the length
+ * @return false if arg is not a decimal number up to MAX_SOURCE_LEN
+ */
+static bool parse_source_len(const char* arg, size_t* len) {
+    if (arg[0] < '0' || arg[0] > '9') return false;
+
+    errno = 0;
+    char* end;
+    const unsigned long value = strtoul(arg, &end, 10);
+    if (errno != 0 || *end != '\0' || value > MAX_SOURCE_LEN) return false;
+
+    *len = (size_t) value;
+    return true;
+}
+
+/**
+ * Answers the first request in the input of a client, if it arrived completely
+ * @param client connection
+ * @return the amount of input bytes consumed, 0 if the request is incomplete
+ */
+static size_t handle_request(Client* client) {
+    char* newline = memchr(client->in, '\n', client->in_len);
+    if (newline == NULL) {
+        if (client->in_len > MAX_HEADER_LEN) {
+            append_error(client, "ERROR: Request header too long\n");
+            client->closing = true;
+        }
+        return 0;
+    }
+
+    const size_t header_len = (size_t) (newline - client->in) + 1;
+    char* header = STRfmt("%.*s", (int) (header_len - 1), client->in);
+    char* rest = NULL;
+    const char* kind = strtok_r(header, " ", &rest);
+    const char* arg = strtok_r(NULL, " ", &rest);
+
+    size_t consumed = header_len;
+    const char* src = NULL;
+    char* file = NULL;
+    size_t len = 0;
+    if (kind == NULL || arg == NULL) {
+        append_error(client, "ERROR: Malformed request\n");
+    } else if (strcmp(kind, "source") == 0) {
+        // The source that follows cannot be skipped without its length
+        if (!parse_source_len(arg, &len)) {
+            append_error(client, "ERROR: Malformed source length\n");
+            client->closing = true;
+            MEMfree(header);
+            return client->in_len;
+        }
+        if (len > client->in_len - header_len) {
+            MEMfree(header);
+            return 0;
+        }
+        src = client->in + header_len;
+        consumed += len;
+    } else if (strcmp(kind, "path") == 0) {
+        file = read_file(arg, &len);
+        src = file;
+        if (file == NULL) {
+            char* message = STRfmt("ERROR: Could not open %s\n", arg);
+            append_error(client, message);
+            MEMfree(message);
+        }
+    } else {
+        append_error(client, "ERROR: Unknown request\n");
+    }
+
+    bool side_files;
+    if (src != NULL) {
+        if (!apply_options(client->ctx, rest, file != NULL ? arg : "module", &side_files)) {
+            append_error(client, "ERROR: Unknown option\n");
+        } else if (side_files) {
+            compile_with_side_files(client, src, len);
+        } else {
+            CiviccOutput out;
+            const int status = civicc_compile_buffer(client->ctx, src, len, &out);
+            append_response(client, status, &out, NULL, NULL);
+            civicc_output_free(&out);
+        }
+    }
+
+    MEMfree(file);
+    MEMfree(header);
+    return consumed;
+}
+
+/**
+ * Reads what a client sent and answers every complete request. A client that
+ * stops sending still receives the responses to its requests.
+ * @param client connection
+ * @return false if the connection failed
+ */
+static bool receive(Client* client) {
+    char buf[65536];
+    while (true) {
+        const ssize_t n = read(client->fd, buf, sizeof(buf));
+        if (n == 0) {
+            client->closing = true;
+            break;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return false;
+        }
+        ARRAY_RESIZE(client->in, client->in_len + (size_t) n + 1);
+        memcpy(client->in + client->in_len, buf, (size_t) n);
+        client->in_len += (size_t) n;
+    }
+
+    size_t consumed;
+    while (client->in_len > 0 && (consumed = handle_request(client)) > 0) {
+        memmove(client->in, client->in + consumed, client->in_len - consumed);
+        client->in_len -= consumed;
+    }
+    return true;
+}
+
+/**
+ * Sends as much of the pending responses as the socket takes
+ * @param client connection
+ * @return false if the connection failed
+ */
+static bool send_pending(Client* client) {
+    while (client->out_sent < client->out_len) {
+        const ssize_t n = send(client->fd, client->out + client->out_sent, client->out_len - client->out_sent,
+                               MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if (errno == EINTR) continue;
+            return false;
+        }
+        client->out_sent += (size_t) n;
+    }
+    client->out_len = 0;
+    client->out_sent = 0;
+    return true;
+}
+
+static void close_client(Client* client) {
+    close(client->fd);
+    civicc_context_free(client->ctx);
+    MEMfree(client->in);
+    MEMfree(client->out);
+}
+
+/**
+ * Makes way for the socket of a new server. Only a socket no server listens on
+ * is removed, anything else at the path stays.
+ * @param socket_path path of the socket to create
+ * @param addr address of the socket
+ * @return false if the path is in use
+ */
+static bool remove_stale_socket(const char* socket_path, const struct sockaddr_un* addr) {
+    struct stat st;
+    if (lstat(socket_path, &st) != 0) return errno == ENOENT;
+    if (!S_ISSOCK(st.st_mode)) return false;
+
+    const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe == -1) return false;
+    const bool stale = connect(probe, (const struct sockaddr*) addr, sizeof(*addr)) != 0 && errno == ECONNREFUSED;
+    close(probe);
+    return stale && unlink(socket_path) == 0;
+}
+
+/**
+ * Serves compile requests until SIGINT or SIGTERM. A single poll loop serves
+ * every connection, compilations take turns in libcivicc anyway.
+ * @param socket_path path of the socket to create, only a stale socket is replaced
+ * @return EXIT_SUCCESS after a clean shutdown, EXIT_FAILURE if the socket could not be created
+ */
+int SRVserve(const char* socket_path) {
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr)) return EXIT_FAILURE;
+
+    if (!remove_stale_socket(socket_path, &addr)) {
+        USER_ERROR("Could not listen on %s: address in use", socket_path);
+        return EXIT_FAILURE;
+    }
+
+    const char* tmp = getenv("TMPDIR");
+    SCRATCH_DIR = STRfmt("%s/civicc-server-XXXXXX", tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp");
+    if (mkdtemp(SCRATCH_DIR) == NULL) {
+        USER_ERROR("Could not create a scratch directory: %s", strerror(errno));
+        MEMfree(SCRATCH_DIR);
+        return EXIT_FAILURE;
+    }
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct stat created;
+    if (listener == -1 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0
+        || lstat(socket_path, &created) != 0
+        || listen(listener, SOMAXCONN) != 0 || !set_nonblocking(listener)) {
+        USER_ERROR("Could not listen on %s: %s", socket_path, strerror(errno));
+        if (listener != -1) close(listener);
+        rmdir(SCRATCH_DIR);
+        MEMfree(SCRATCH_DIR);
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = handle_stop;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    Client* clients = NULL;
+    size_t client_count = 0;
+    struct pollfd* fds = NULL;
+
+    while (!STOP) {
+        ARRAY_RESIZE(fds, client_count + 1);
+        fds[0] = (struct pollfd) {listener, POLLIN, 0};
+        for (size_t i = 0; i < client_count; i++) {
+            const short events = (short) ((clients[i].closing ? 0 : POLLIN) | (clients[i].out_len > 0 ? POLLOUT : 0));
+            fds[i + 1] = (struct pollfd) {clients[i].fd, events, 0};
+        }
+
+        if (poll(fds, client_count + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            USER_ERROR("Could not wait for clients: %s", strerror(errno));
+            break;
+        }
+
+        // Handle existing clients first, accepting appends to the array
+        size_t kept = 0;
+        for (size_t i = 0; i < client_count; i++) {
+            Client* client = &clients[i];
+            bool open = (fds[i + 1].revents & (POLLERR | POLLNVAL)) == 0;
+            if (open && (fds[i + 1].revents & (POLLIN | POLLHUP))) open = receive(client);
+            if (open && client->out_len > 0) open = send_pending(client);
+            if (open && client->closing && client->out_len == 0) open = false;
+
+            if (open) clients[kept++] = *client;
+            else close_client(client);
+        }
+        client_count = kept;
+
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listener, NULL, NULL)) != -1) {
+                if (!set_nonblocking(fd)) {
+                    close(fd);
+                    continue;
+                }
+                ARRAY_RESIZE(clients, client_count + 1);
+                clients[client_count++] = (Client) {fd, civicc_context_new(), NULL, 0, NULL, 0, 0, false};
+            }
+        }
+    }
+
+    for (size_t i = 0; i < client_count; i++) close_client(&clients[i]);
+    MEMfree(clients);
+    MEMfree(fds);
+    close(listener);
+    rmdir(SCRATCH_DIR);
+    MEMfree(SCRATCH_DIR);
+
+    // Another server may have replaced the socket in the meantime
+    struct stat st;
+    if (lstat(socket_path, &st) == 0 && st.st_dev == created.st_dev && st.st_ino == created.st_ino) unlink(socket_path);
+    return EXIT_SUCCESS;
+}
+
+static bool write_all(const int fd, const char* data, size_t len) {
+    while (len > 0) {
+        const ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static bool read_all(const int fd, char* data, size_t len) {
+    while (len > 0) {
+        const ssize_t n = read(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static const char* emit_option(const EmitKind emit) {
+    switch (emit) {
+        case EMIT_ASM: return "emit=asm";
+        case EMIT_BINARY: return "emit=binary";
+        case EMIT_C: return "emit=c";
+        case EMIT_X86: return "emit=x86";
+    }
+    return "emit=asm";
+}
+
+/**
+ * Compiles input_file on a running server, with the options of the command
+ * line. The output goes to output_file or STDOUT, diagnostics to STDERR.
+ * @param socket_path socket of the server
+ * @param options options of the command line
+ * @return exit status for civicc
+ */
+int SRVcompile(const char* socket_path, const struct globals* options) {
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr)) return EXIT_FAILURE;
+
+    size_t len;
+    char* src = read_file(options->input_file, &len);
+    if (src == NULL) {
+        USER_ERROR("Could not open %s", options->input_file);
+        return EXIT_FAILURE;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        USER_ERROR("Could not connect to %s: %s", socket_path, strerror(errno));
+        if (fd != -1) close(fd);
+        MEMfree(src);
+        return EXIT_FAILURE;
+    }
+
+    // Names with spaces cannot be sent, the server then uses its default
+    const bool named = strchr(options->input_file, ' ') == NULL;
+    char* header = STRfmt("source %lu %s%s%s max-stack=%lu%s%s\n",
+        len, emit_option(options->emit), options->debug_info ? " g" : "",
+        options->profile_counts ? " profile-counts" : "", options->max_stack,
+        named ? " name=" : "", named ? options->input_file : "");
+    const bool sent = write_all(fd, header, strlen(header)) && write_all(fd, src, len);
+    MEMfree(header);
+    MEMfree(src);
+
+    // The response header is short, read it a byte at a time up to the newline
+    char line[128];
+    size_t line_len = 0;
+    bool received = sent;
+    while (received && line_len < sizeof(line) - 1) {
+        received = read_all(fd, &line[line_len], 1);
+        if (line[line_len] == '\n') break;
+        line_len++;
+    }
+    line[line_len] = '\0';
+
+    int status = -1;
+    size_t out_size = 0, diag_size = 0;
+    size_t side_len[SIDE_FILE_COUNT] = {0};
+    if (!received || sscanf(line, "%d %lu %lu %lu %lu", &status, &out_size, &diag_size,
+                            &side_len[0], &side_len[1]) != 5) {
+        USER_ERROR("Invalid response from %s", socket_path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    char* out = MEMmalloc(out_size + 1);
+    char* diag = MEMmalloc(diag_size + 1);
+    char* side[SIDE_FILE_COUNT];
+    received = read_all(fd, out, out_size) && read_all(fd, diag, diag_size);
+    for (size_t i = 0; i < SIDE_FILE_COUNT; i++) {
+        side[i] = MEMmalloc(side_len[i] + 1);
+        received = received && read_all(fd, side[i], side_len[i]);
+    }
+    close(fd);
+
+    if (!received) {
+        USER_ERROR("Invalid response from %s", socket_path);
+        status = -1;
+    } else {
+        fwrite(diag, 1, diag_size, stderr);
+    }
+    if (status == 0) {
+        FILE* f = options->output_file != NULL ? fopen(options->output_file, "wb") : stdout;
+        if (f == NULL) {
+            USER_ERROR("Could not create %s", options->output_file);
+            status = 1;
+        } else {
+            fwrite(out, 1, out_size, f);
+            if (f != stdout) fclose(f);
+        }
+    }
+
+    // Side files go where a compilation in process puts them
+    const bool wanted[SIDE_FILE_COUNT] = {options->debug_info && options->output_file != NULL, options->profile_counts};
+    const char* base = options->output_file != NULL ? options->output_file : options->input_file;
+    for (size_t i = 0; i < SIDE_FILE_COUNT; i++) {
+        if (status == 0 && wanted[i] && side_len[i] > 0) {
+            char* path = STRfmt("%s.%s", base, SIDE_FILES[i]);
+            FILE* f = fopen(path, "w");
+            if (f == NULL) {
+                USER_ERROR("Could not create %s", path);
+                status = 1;
+            } else {
+                fwrite(side[i], 1, side_len[i], f);
+                fclose(f);
+            }
+            MEMfree(path);
+        }
+        MEMfree(side[i]);
+    }
+    MEMfree(out);
+    MEMfree(diag);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
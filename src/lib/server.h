@@ -0,0 +1,22 @@
+// src/lib/server.h
+
+#pragma once
+
+/* Compile server on a Unix domain socket, see civicc --server and --connect.
+ *
+ * A request is a header line followed by the source:
+ *     source <length> [option...]\n<length bytes of CiviC>
+ *     path <file> [option...]\n
+ * with the options emit=<asm|binary|c|x86>, g, profile-counts, max-stack=<n>
+ * and name=<module name>. Every request gets the response
+ *     <status> <output length> <diagnostics length> <lines length> <prof length>\n
+ *     <output><diagnostics><lines><prof>
+ * where status is that of civicc_compile_buffer. With g or profile-counts the
+ * line table and counter mapping a compilation to a file writes next to it
+ * follow, otherwise their lengths are 0. A connection can send any amount of
+ * requests, they are answered in order. */
+
+#include "global/globals.h"
+
+int SRVserve(const char* socket_path);
+int SRVcompile(const char* socket_path, const struct globals* options);
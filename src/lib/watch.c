@@ -0,0 +1,161 @@
+// src/lib/watch.c
+
+#include "watch.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "lib/batch.h"
+#include "lib/civicc.h"
+#include "palm/memory.h"
+#include "palm/str.h"
+
+// Quiet period after the last change before compiling, editors write a file in several steps
+#define DEBOUNCE_MS 30
+
+// Changes to the watched directory that can mean the source was saved
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY)
+
+typedef struct Watch {
+    const char* input;
+    const char* output;
+    const char* name;                   // File name of the input within its directory
+    CiviccContext* ctx;
+    char* src;                          // Source of the last compilation
+    size_t src_len;
+} Watch;
+
+static volatile sig_atomic_t STOP = 0;
+
+static void handle_stop(const int sig) {
+    (void) sig;
+    STOP = 1;
+}
+
+static double elapsed_ms(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) * 1e3 + (double) (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * Compiles the input if it changed since the last compilation
+ * @param watch watch state
+ */
+static void compile(Watch* watch) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t len;
+    char* src = read_file(watch->input, &len);
+    if (src == NULL) {
+        fprintf(stderr, "ERROR: Could not open %s\n", watch->input);
+        return;
+    }
+
+    // Saving without changes, or a second event for the same save
+    if (watch->src != NULL && len == watch->src_len && memcmp(src, watch->src, len) == 0) {
+        MEMfree(src);
+        return;
+    }
+    MEMfree(watch->src);
+    watch->src = src;
+    watch->src_len = len;
+
+    CiviccOutput out;
+    const int status = civicc_compile_to_file(watch->ctx, src, len, watch->output, &out);
+    if (out.diagnostics_size > 0) fputs(out.diagnostics, stderr);
+    civicc_output_free(&out);
+
+    if (status == 0) fprintf(stderr, "Compiled %s to %s in %.1f ms\n", watch->input, watch->output, elapsed_ms(&start));
+    else fprintf(stderr, "Compiling %s failed\n", watch->input);
+}
+
+/**
+ * Reads the pending events of the watched directory
+ * @param fd inotify descriptor
+ * @param name file name of the input
+ * @return whether an event concerned the input
+ */
+static bool read_events(const int fd, const char* name) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len; ) {
+            const struct inotify_event* event = (const struct inotify_event*) p;
+            if (event->len > 0 && strcmp(event->name, name) == 0) changed = true;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Compiles options->input_file to options->output_file, then again every
+ * time the input is saved, until interrupted
+ * @param options options of the command line
+ * @return EXIT_SUCCESS once interrupted, EXIT_FAILURE if the input cannot be watched
+ */
+int WATCHrun(const struct globals* options) {
+    const char* slash = strrchr(options->input_file, '/');
+    char* dir = slash == NULL ? STRcpy(".") : STRfmt("%.*s", (int) (slash - options->input_file), options->input_file);
+    if (dir[0] == '\0') {
+        MEMfree(dir);
+        dir = STRcpy("/");
+    }
+
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1 || inotify_add_watch(fd, dir, WATCH_EVENTS) == -1) {
+        USER_ERROR("Could not watch %s: %s", dir, strerror(errno));
+        if (fd != -1) close(fd);
+        MEMfree(dir);
+        return EXIT_FAILURE;
+    }
+    MEMfree(dir);
+
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = handle_stop;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    Watch watch = {options->input_file, options->output_file, slash == NULL ? options->input_file : slash + 1,
+                   BATCHnewContext(options), NULL, 0};
+    civicc_set_name(watch.ctx, options->input_file);
+    civicc_set_incremental(watch.ctx, true);
+    compile(&watch);
+
+    bool pending = false;
+    while (!STOP) {
+        struct pollfd p = {fd, POLLIN, 0};
+        const int ready = poll(&p, 1, pending ? DEBOUNCE_MS : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            USER_ERROR("Could not wait for changes: %s", strerror(errno));
+            break;
+        }
+
+        // Compile once the input has been quiet for a moment
+        if (ready == 0) {
+            pending = false;
+            compile(&watch);
+        } else if (read_events(fd, watch.name)) {
+            pending = true;
+        }
+    }
+
+    civicc_context_free(watch.ctx);
+    MEMfree(watch.src);
+    close(fd);
+    return EXIT_SUCCESS;
+}
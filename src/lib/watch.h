@@ -0,0 +1,13 @@
+// src/lib/watch.h
+
+#pragma once
+
+/* Recompiles a source file whenever it is saved, see civicc --watch. Changes
+ * are noticed with inotify on the directory of the file, so editors that save
+ * by renaming a new file over the old one are noticed as well. The compiler
+ * stays loaded between compilations and reuses the code of unchanged
+ * functions, like --incremental. */
+
+#include "global/globals.h"
+
+int WATCHrun(const struct globals* options);
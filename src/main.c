@@ -5,7 +5,11 @@
 #include <ctype.h>
 #include <string.h>
 
+#include "cache/cache.h"
 #include "global/globals.h"
+#include "lib/batch.h"
+#include "lib/server.h"
+#include "lib/watch.h"
 #include "palm/str.h"
 #include "ccn/ccn.h"
 
@@ -16,16 +20,42 @@ void Usage(char *program) {
         program = program_bin + 1;
 
     printf("Usage: %s [OPTION...] <civic file>\n", program);
+    printf("       %s --batch [OPTION...] -d <output_dir> <civic file|@response file>...\n", program);
+    printf("       %s --server <socket>\n", program);
+    printf("       %s --cache-stats\n", program);
     printf("Options:\n");
     printf("  -h                           This help message.\n");
     printf("  --output/-o <output_file>    Output assembly to output file instead of STDOUT.\n");
     printf("  --verbose/-v                 Enable verbose mode.\n");
     printf("  --breakpoint/-b <breakpoint> Set a breakpoint.\n");
     printf("  --structure/-s               Pretty print the structure of the compiler.\n");
+    printf("  -g                           Annotate assembly with source ranges, write a line table to <output>.lines.\n");
+    printf("  --stats[=text|json]          Print bytecode statistics per function to STDOUT.\n");
+    printf("  --max-stack=<n>              Warn about functions needing more than n operand stack values, 0 disables.\n");
+    printf("  -fprofile-counts             Count executions of functions, loops and branches, see <output>.prof.\n");
+    printf("  --emit=<asm|binary|c|x86>    Output textual assembly (default), a binary module, C or x86-64 assembly.\n");
+    printf("  --incremental                Reuse the code of unchanged functions from <output>.inc, needs -o.\n");
+    printf("  --watch                      Compile again whenever the input is saved, until interrupted, needs -o.\n");
+    printf("  --batch                      Compile every input in one process, a.cvc to <output_dir>/a.s.\n");
+    printf("  --outdir/-d <output_dir>     Directory receiving the outputs of --batch.\n");
+    printf("  --jobs/-j <n>                Threads compiling in --batch, one per processor by default.\n");
+    printf("  --server <socket>            Serve compile requests on a Unix domain socket until interrupted.\n");
+    printf("  --connect <socket>           Compile on a running server instead of in this process.\n");
+    printf("  --cache-stats                Print the size and hit rate of the cache in CIVICC_CACHE_DIR.\n");
 }
 
 
 
+static bool BATCH = false;
+static char *BATCH_OUTDIR = NULL;
+static size_t BATCH_JOBS = 0;
+static BatchInputs BATCH_INPUTS = {NULL, 0};
+static char *SERVER_SOCKET = NULL;
+static char *CONNECT_SOCKET = NULL;
+static bool CACHE_STATS = false;
+static bool WATCH = false;
+static bool DEBUGGING_PHASES = false;
+
 /* Parse command lines. Usages the globals struct to store data. */
 static int ProcessArgs(int argc, char *argv[])
 {
@@ -34,13 +64,24 @@ static int ProcessArgs(int argc, char *argv[])
         {"output",  required_argument, 0, 'o'},
         {"breakpoint", required_argument, 0, 'b'},
         {"structure", no_argument, 0, 's'},
+        {"emit", required_argument, 0, 'e'},
+        {"stats", optional_argument, 0, 'S'},
+        {"max-stack", required_argument, 0, 'M'},
+        {"incremental", no_argument, 0, 'I'},
+        {"watch", no_argument, 0, 'W'},
+        {"batch", no_argument, 0, 'B'},
+        {"outdir", required_argument, 0, 'd'},
+        {"jobs", required_argument, 0, 'j'},
+        {"server", required_argument, 0, 'L'},
+        {"connect", required_argument, 0, 'C'},
+        {"cache-stats", no_argument, 0, 'K'},
         {0, 0, 0, 0}};
 
   int option_index;
   int c;
 
   while (1) {
-      c = getopt_long(argc, argv, "hsvo:b:", long_options, &option_index);
+      c = getopt_long(argc, argv, "hgsvo:b:f:d:j:", long_options, &option_index);
 
       // End of options
       if (c == -1)
@@ -52,6 +93,7 @@ static int ProcessArgs(int argc, char *argv[])
         CCNsetVerbosity(PD_V_MEDIUM);
         break;
       case 'b':
+        DEBUGGING_PHASES = true;
         if (optarg != NULL && isdigit(optarg[0])) {
           CCNsetBreakpointWithID((int)strtol(optarg, NULL, 10));
         } else {
@@ -59,11 +101,82 @@ static int ProcessArgs(int argc, char *argv[])
         }
         break;
       case 's':
+        DEBUGGING_PHASES = true;
         CCNshowTree();
         break;
       case 'o':
         global.output_file = optarg;
         break;
+      case 'e':
+        if (strcmp(optarg, "binary") == 0) {
+            global.emit = EMIT_BINARY;
+        } else if (strcmp(optarg, "asm") == 0) {
+            global.emit = EMIT_ASM;
+        } else if (strcmp(optarg, "c") == 0) {
+            global.emit = EMIT_C;
+        } else if (strcmp(optarg, "x86") == 0) {
+            global.emit = EMIT_X86;
+        } else {
+            Usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        break;
+      case 'S':
+        if (optarg == NULL || strcmp(optarg, "text") == 0) {
+            global.stats = STATS_TEXT;
+        } else if (strcmp(optarg, "json") == 0) {
+            global.stats = STATS_JSON;
+        } else {
+            Usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        break;
+      case 'M':
+        if (!isdigit(optarg[0])) {
+            Usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        global.max_stack = strtoul(optarg, NULL, 10);
+        break;
+      case 'I':
+        global.incremental = true;
+        break;
+      case 'W':
+        WATCH = true;
+        break;
+      case 'B':
+        BATCH = true;
+        break;
+      case 'L':
+        SERVER_SOCKET = optarg;
+        break;
+      case 'C':
+        CONNECT_SOCKET = optarg;
+        break;
+      case 'K':
+        CACHE_STATS = true;
+        break;
+      case 'd':
+        BATCH_OUTDIR = optarg;
+        break;
+      case 'j':
+        if (!isdigit(optarg[0])) {
+            Usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        BATCH_JOBS = strtoul(optarg, NULL, 10);
+        break;
+      case 'g':
+        global.debug_info = true;
+        break;
+      case 'f':
+        if (strcmp(optarg, "profile-counts") == 0) {
+            global.profile_counts = true;
+        } else {
+            Usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        break;
       case 'h':
         Usage(argv[0]);
         exit(EXIT_SUCCESS);
@@ -72,7 +185,23 @@ static int ProcessArgs(int argc, char *argv[])
         exit(EXIT_FAILURE);
       }
   }
-   if (optind == argc - 1) {
+   if (SERVER_SOCKET != NULL || CACHE_STATS) {
+        if (optind != argc) {
+            Usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    } else if (BATCH) {
+        if (BATCH_OUTDIR == NULL || optind == argc) {
+            Usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        for (int i = optind; i < argc; i++) {
+            if (!BATCHaddInput(&BATCH_INPUTS, argv[i])) {
+                fprintf(stderr, "ERROR: Could not read response file %s\n", argv[i] + 1);
+                exit(EXIT_FAILURE);
+            }
+        }
+    } else if (optind == argc - 1 && (!WATCH || global.output_file != NULL)) {
         global.input_file = argv[optind];
     } else {
         Usage(argv[0]);
@@ -81,18 +210,35 @@ static int ProcessArgs(int argc, char *argv[])
   return 0;
 }
 
-// What to do when a breakpoint is reached.
-void BreakpointHandler(node_st *root)
-{
-    TRAVstart(root, TRAV_PRT);
-    return;
-}
-
 int main (int argc, char **argv)
 {
     GLBinitializeGlobals();
     ProcessArgs(argc, argv);
 
+    if (CACHE_STATS) {
+        return CACHEprintStats(stdout);
+    }
+    if (SERVER_SOCKET != NULL) {
+        return SRVserve(SERVER_SOCKET);
+    }
+    if (CONNECT_SOCKET != NULL) {
+        return SRVcompile(CONNECT_SOCKET, &global);
+    }
+    if (WATCH) {
+        return WATCHrun(&global);
+    }
+    if (BATCH) {
+        const int status = BATCHcompile(&global, &BATCH_INPUTS, BATCH_OUTDIR, BATCH_JOBS);
+        BATCHfreeInputs(&BATCH_INPUTS);
+        return status;
+    }
+
+    // A cached compilation never reaches the parser, breakpoints need the phases to run
+    if (!DEBUGGING_PHASES && CACHEfetch()) {
+        return EXIT_SUCCESS;
+    }
+
     CCNrun(NULL);
-    return 0;
+    CACHEstore();
+    return global.had_error ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,303 @@
+// src/optimisation/consteval.c
+
+#include "consteval.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "palm/memory.h"
+
+/**
+ * Evaluates a binary operation on two known integers, with the wrapping
+ * behaviour of the VM
+ * @param op operator
+ * @param l left operand
+ * @param r right operand
+ * @param res set to the result
+ * @return false if the operation would fail at runtime
+ */
+static bool eval_int_binop(const enum BinOpType op, const int l, const int r, ConstValue* res) {
+    res->vtype = VT_NUM;
+    switch (op) {
+        case BO_add: res->as.i = (int) ((unsigned int) l + (unsigned int) r); return true;
+        case BO_sub: res->as.i = (int) ((unsigned int) l - (unsigned int) r); return true;
+        case BO_mul: res->as.i = (int) ((unsigned int) l * (unsigned int) r); return true;
+        case BO_div:
+        case BO_mod:
+            // Leave division by zero and overflow to the VM
+            if (r == 0 || (l == INT_MIN && r == -1)) return false;
+            res->as.i = op == BO_div ? l / r : l % r;
+            return true;
+        default: break;
+    }
+
+    res->vtype = VT_BOOL;
+    switch (op) {
+        case BO_lt: res->as.b = l < r; return true;
+        case BO_le: res->as.b = l <= r; return true;
+        case BO_gt: res->as.b = l > r; return true;
+        case BO_ge: res->as.b = l >= r; return true;
+        case BO_eq: res->as.b = l == r; return true;
+        case BO_ne: res->as.b = l != r; return true;
+        default: return false;
+    }
+}
+
+/**
+ * Evaluates a binary operation on two known floats
+ * @param op operator
+ * @param l left operand
+ * @param r right operand
+ * @param res set to the result
+ * @return false if the operator is not defined on floats
+ */
+static bool eval_float_binop(const enum BinOpType op, const float l, const float r, ConstValue* res) {
+    res->vtype = VT_FLOAT;
+    switch (op) {
+        case BO_add: res->as.f = l + r; return true;
+        case BO_sub: res->as.f = l - r; return true;
+        case BO_mul: res->as.f = l * r; return true;
+        case BO_div: res->as.f = l / r; return true;
+        default: break;
+    }
+
+    res->vtype = VT_BOOL;
+    switch (op) {
+        case BO_lt: res->as.b = l < r; return true;
+        case BO_le: res->as.b = l <= r; return true;
+        case BO_gt: res->as.b = l > r; return true;
+        case BO_ge: res->as.b = l >= r; return true;
+        case BO_eq: res->as.b = l == r; return true;
+        case BO_ne: res->as.b = l != r; return true;
+        default: return false;
+    }
+}
+
+/**
+ * Evaluates a binary operation on two known booleans
+ * @param op operator
+ * @param l left operand
+ * @param r right operand
+ * @param res set to the result
+ * @return false if the operator is not defined on booleans
+ */
+static bool eval_bool_binop(const enum BinOpType op, const bool l, const bool r, ConstValue* res) {
+    res->vtype = VT_BOOL;
+    switch (op) {
+        case BO_add: case BO_or: res->as.b = l || r; return true;
+        case BO_mul: case BO_and: res->as.b = l && r; return true;
+        case BO_eq: res->as.b = l == r; return true;
+        case BO_ne: res->as.b = l != r; return true;
+        default: return false;
+    }
+}
+
+/**
+ * Evaluates a cast of a known value
+ * @param v value to cast
+ * @param target type to cast to
+ * @param res set to the result
+ * @return false if the cast has no defined result
+ */
+static bool eval_cast(const ConstValue v, const enum Type target, ConstValue* res) {
+    res->vtype = ct_to_vt(target, false);
+    switch (res->vtype) {
+        case VT_NUM:
+            switch (v.vtype) {
+                case VT_NUM: res->as.i = v.as.i; return true;
+                case VT_BOOL: res->as.i = v.as.b ? 1 : 0; return true;
+                case VT_FLOAT:
+                    // Out of range conversions have no defined result
+                    if (!isfinite(v.as.f) || v.as.f >= 2147483648.0f || v.as.f < -2147483648.0f) return false;
+                    res->as.i = (int) v.as.f;
+                    return true;
+                default: return false;
+            }
+        case VT_FLOAT:
+            switch (v.vtype) {
+                case VT_NUM: res->as.f = (float) v.as.i; return true;
+                case VT_FLOAT: res->as.f = v.as.f; return true;
+                case VT_BOOL: res->as.f = v.as.b ? 1.0f : 0.0f; return true;
+                default: return false;
+            }
+        case VT_BOOL:
+            switch (v.vtype) {
+                case VT_NUM: res->as.b = v.as.i != 0; return true;
+                case VT_FLOAT: res->as.b = v.as.f != 0.0f; return true;
+                case VT_BOOL: res->as.b = v.as.b; return true;
+                default: return false;
+            }
+        default: return false;
+    }
+}
+
+/**
+ * Evaluates an expression at compile time
+ * @param expr expression node
+ * @param lookup provides values of variables, may be NULL if no variables are known
+ * @param res set to the value of the expression
+ * @return true if the value of the expression is known
+ */
+bool CEevaluate(node_st* expr, const ConstLookup lookup, ConstValue* res) {
+    switch (NODE_TYPE(expr)) {
+        case NT_NUM: case NT_FLOAT: case NT_BOOL:
+            return CEfromLiteral(expr, res);
+        case NT_VAR:
+            if (lookup == NULL || VAR_INDICES(expr) != NULL || VAR_SYMBOL(expr) == NULL) return false;
+            if (VAR_SYMBOL(expr)->stype != ST_VALUEVAR) return false;
+            return lookup(VAR_SYMBOL(expr), res);
+        case NT_MONOP: {
+            ConstValue v;
+            if (!CEevaluate(MONOP_OPERAND(expr), lookup, &v)) return false;
+
+            *res = v;
+            switch (MONOP_OP(expr)) {
+                case MO_neg:
+                    if (v.vtype == VT_NUM) res->as.i = (int) (0u - (unsigned int) v.as.i);
+                    else if (v.vtype == VT_FLOAT) res->as.f = -v.as.f;
+                    else return false;
+                    return true;
+                case MO_not:
+                    if (v.vtype != VT_BOOL) return false;
+                    res->as.b = !v.as.b;
+                    return true;
+                default: return false;
+            }
+        }
+        case NT_BINOP: {
+            const enum BinOpType op = BINOP_OP(expr);
+            ConstValue l, r;
+            if (!CEevaluate(BINOP_LEFT(expr), lookup, &l)) return false;
+
+            // Short-circuited right operand is never evaluated, so it need not be known
+            if (l.vtype == VT_BOOL && ((op == BO_and && !l.as.b) || (op == BO_or && l.as.b))) {
+                *res = l;
+                return true;
+            }
+
+            if (!CEevaluate(BINOP_RIGHT(expr), lookup, &r)) return false;
+            if (l.vtype != r.vtype) return false;
+
+            switch (l.vtype) {
+                case VT_NUM: return eval_int_binop(op, l.as.i, r.as.i, res);
+                case VT_FLOAT: return eval_float_binop(op, l.as.f, r.as.f, res);
+                case VT_BOOL: return eval_bool_binop(op, l.as.b, r.as.b, res);
+                default: return false;
+            }
+        }
+        case NT_CAST: {
+            ConstValue v;
+            if (!CEevaluate(CAST_EXPR(expr), lookup, &v)) return false;
+            return eval_cast(v, CAST_TYPE(expr), res);
+        }
+        default:
+            // Function calls and array expressions are not evaluated
+            return false;
+    }
+}
+
+/**
+ * Computes the amount of elements of an array whose dimensions are literals
+ * @param dims first exprs node of the array dimensions
+ * @param size set to the amount of elements
+ * @return false if a dimension is not a non-negative literal or the size does not fit an int
+ */
+bool CEarraySize(node_st* dims, size_t* size) {
+    *size = 1;
+    for (; dims != NULL; dims = EXPRS_NEXT(dims)) {
+        node_st* dim = EXPRS_EXPR(dims);
+        if (NODE_TYPE(dim) != NT_NUM || NUM_VAL(dim) < 0) return false;
+        if (NUM_VAL(dim) != 0 && *size > (size_t) INT_MAX / (size_t) NUM_VAL(dim)) return false;
+        *size *= (size_t) NUM_VAL(dim);
+    }
+    return true;
+}
+
+/**
+ * Checks whether a node is a literal constant
+ * @param node any node
+ * @return true for num, float and bool nodes
+ */
+bool CEisLiteral(const node_st* node) {
+    const enum ccn_nodetype type = NODE_TYPE(node);
+    return type == NT_NUM || type == NT_FLOAT || type == NT_BOOL;
+}
+
+/**
+ * Retrieves the value of a literal node
+ * @param node literal node
+ * @param res set to the value of the literal
+ * @return false if the node is not a literal
+ */
+bool CEfromLiteral(const node_st* node, ConstValue* res) {
+    switch (NODE_TYPE(node)) {
+        case NT_NUM: res->vtype = VT_NUM; res->as.i = NUM_VAL(node); return true;
+        case NT_FLOAT: res->vtype = VT_FLOAT; res->as.f = FLOAT_VAL(node); return true;
+        case NT_BOOL: res->vtype = VT_BOOL; res->as.b = BOOL_VAL(node); return true;
+        default: return false;
+    }
+}
+
+/**
+ * Checks whether a value survives being written to the constant table. Floats
+ * are written with a fixed amount of decimals, so not every float can be
+ * written back exactly.
+ * @param v value to check
+ * @return true if a literal of this value generates the exact same value
+ */
+bool CEisRepresentable(const ConstValue v) {
+    if (v.vtype != VT_FLOAT) return true;
+    // Negative zero is written as "-0.000000", which is not a valid literal
+    if (!isfinite(v.as.f) || (v.as.f == 0.0f && signbit(v.as.f))) return false;
+
+    char* str = float_to_str(v.as.f);
+    const bool exact = strtof(str, NULL) == v.as.f;
+    MEMfree(str);
+    return exact;
+}
+
+/**
+ * Compares two known values
+ * @return true if both values have the same type and value
+ */
+bool CEequal(const ConstValue a, const ConstValue b) {
+    if (a.vtype != b.vtype) return false;
+    switch (a.vtype) {
+        case VT_NUM: return a.as.i == b.as.i;
+        case VT_FLOAT: return a.as.f == b.as.f && signbit(a.as.f) == signbit(b.as.f);
+        case VT_BOOL: return a.as.b == b.as.b;
+        default: return false;
+    }
+}
+
+/**
+ * Checks whether a value equals the value new arrays are filled with
+ * @return true for 0, 0.0 and false
+ */
+bool CEisZero(const ConstValue v) {
+    switch (v.vtype) {
+        case VT_NUM: return v.as.i == 0;
+        case VT_FLOAT: return v.as.f == 0.0f && !signbit(v.as.f);
+        case VT_BOOL: return !v.as.b;
+        default: return false;
+    }
+}
+
+/**
+ * Creates a literal node holding a known value
+ * @param v value
+ * @return new num, float or bool node
+ */
+node_st* CEtoLiteral(const ConstValue v) {
+    switch (v.vtype) {
+        case VT_NUM: return ASTnum(v.as.i);
+        case VT_FLOAT: return ASTfloat(v.as.f);
+        case VT_BOOL: return ASTbool(v.as.b);
+        default:
+#ifdef DEBUGGING
+            ERROR("Cannot create literal of vtype %s", vt_to_str(v.vtype));
+#endif // DEBUGGING
+            return NULL;
+    }
+}
@@ -0,0 +1,33 @@
+// src/optimisation/consteval.h
+
+#pragma once
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+
+#include "common.h"
+#include "symbol/symbol.h"
+
+/*
+Value of an expression that is known at compile time
+*/
+typedef struct {
+    ValueType vtype;                    // VT_NUM, VT_FLOAT or VT_BOOL
+    union {
+        int i;
+        float f;
+        bool b;
+    } as;
+} ConstValue;
+
+// Provides the known value of a variable; returns false if the value is not known
+typedef bool (*ConstLookup)(const Symbol* s, ConstValue* res);
+
+bool CEevaluate(node_st* expr, ConstLookup lookup, ConstValue* res);
+bool CEarraySize(node_st* dims, size_t* size);
+bool CEisLiteral(const node_st* node);
+bool CEfromLiteral(const node_st* node, ConstValue* res);
+bool CEisRepresentable(ConstValue v);
+bool CEequal(ConstValue a, ConstValue b);
+bool CEisZero(ConstValue v);
+node_st* CEtoLiteral(ConstValue v);
@@ -0,0 +1,649 @@
+/**
+ * @file
+ *
+ * Traversal: InterproceduralConstantPropagation
+ * UID      : ICP
+ *
+ * Propagates constant arguments into functions that are only called from within
+ * this module. A parameter that every call passes the same constant value, which
+ * includes the dimensions of array arguments declared with constant sizes, is
+ * replaced by that value inside the function as long as the function never
+ * assigns it. Expressions, loop bounds and array strides using it then fold at
+ * compile time. Small functions whose calls disagree are copied once for every
+ * distinct combination of constant arguments and each call is redirected to its
+ * copy, after which the program is analysed again and the copies receive their
+ * constants like any other function.
+ */
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+#include "ccngen/trav.h"
+
+#include "common.h"
+#include "global/globals.h"
+#include "optimisation/consteval.h"
+#include "symbol/table.h"
+
+typedef enum {
+    COLLECT_MODE,                       // Gathers calls, declarations and variable usage
+    INSERT_MODE,                        // Adds specialised copies next to their original
+    REMOVE_MODE,                        // Removes originals that are no longer called
+    SUBSTITUTE_MODE                     // Replaces constant parameters by their value
+} PropagationMode;
+
+typedef struct {
+    Symbol* symbol;                     // Parameter, or dimension of an array parameter
+    bool is_dim;
+} ParamSlot;
+
+typedef struct {
+    bool known;
+    ConstValue value;
+} ArgValue;
+
+typedef struct {
+    Symbol* symbol;                     // Function symbol
+    node_st* fundef;                    // Definition; NULL for imported functions
+    node_st** calls;                    // Every call of the function
+    size_t call_count;
+    size_t call_size;
+    size_t size;                        // Amount of expressions, including those of local functions
+    node_st* copies[SPECIALISE_CLONE_LIMIT];
+    size_t copy_count;
+} FunInfo;
+
+static PropagationMode MODE;
+
+// Scope of the function currently being traversed
+static SymbolTable* CURRENT_SCOPE;
+static FunInfo* CURRENT_FUN = NULL;
+
+static FunInfo** FUNS = NULL;
+static size_t FUN_COUNT = 0;
+static size_t FUN_SIZE = 0;
+
+static htable_st* FUN_INFO = NULL;      // Function symbol to its FunInfo
+static htable_st* ARRAY_DIMS = NULL;    // Array symbol to the dimensions of its declaration
+static htable_st* READ = NULL;          // Set of variables that are read
+static htable_st* ASSIGNED = NULL;      // Set of variables that are assigned
+static htable_st* SUBSTITUTE = NULL;    // Parameter symbol to its constant value
+static htable_st* SPECIALISED = NULL;   // Set of FunDef nodes that have specialised copies
+
+// True if a parameter was substituted within the expression currently being traversed
+static bool FOLDABLE = false;
+
+/**
+ * Finds the information of a function, creating it on first use
+ * @param s function symbol
+ * @return information of the function
+ */
+static FunInfo* get_info(Symbol* s) {
+    FunInfo* info = HTlookup(FUN_INFO, s);
+    if (info != NULL) return info;
+
+    info = MEMmalloc(sizeof(FunInfo));
+    info->symbol = s;
+    info->fundef = NULL;
+    info->calls = NULL;
+    info->call_count = 0;
+    info->call_size = 0;
+    info->size = 0;
+    info->copy_count = 0;
+    HTinsert(FUN_INFO, s, info);
+
+    if (FUN_COUNT == FUN_SIZE) {
+        FUN_SIZE = FUN_SIZE == 0 ? INITIAL_LIST_SIZE : FUN_SIZE * 2;
+        ARRAY_RESIZE(FUNS, FUN_SIZE);
+    }
+    FUNS[FUN_COUNT++] = info;
+    return info;
+}
+
+/**
+ * Finds the information of a function definition in the current scope
+ * @param fundef FunDef node
+ * @return information of the function, or NULL if it was not collected
+ */
+static FunInfo* fundef_info(node_st* fundef) {
+    Symbol* s = STlookup(CURRENT_SCOPE, FUNDEF_NAME(fundef));
+    return s == NULL ? NULL : HTlookup(FUN_INFO, s);
+}
+
+/**
+ * Registers a call of a function
+ * @param info information of the called function
+ * @param call FunCall node
+ */
+static void add_call(FunInfo* info, node_st* call) {
+    if (info->call_count == info->call_size) {
+        info->call_size = info->call_size == 0 ? INITIAL_LIST_SIZE : info->call_size * 2;
+        ARRAY_RESIZE(info->calls, info->call_size);
+    }
+    info->calls[info->call_count++] = call;
+}
+
+/**
+ * Traverses the program in the given mode, starting in the global scope
+ * @param node Program node
+ * @param mode mode to traverse in
+ */
+static void run_mode(node_st* node, const PropagationMode mode) {
+    MODE = mode;
+    CURRENT_SCOPE = GB_GLOBAL_SCOPE;
+    CURRENT_FUN = NULL;
+    TRAVchildren(node);
+}
+
+/**
+ * Collects the calls of every function and the usage of every variable
+ * @param node Program node
+ */
+static void collect(node_st* node) {
+    FUN_INFO = HTnew_Ptr(VARTABLE_SIZE);
+    ARRAY_DIMS = HTnew_Ptr(VARTABLE_SIZE);
+    READ = HTnew_Ptr(VARTABLE_SIZE);
+    ASSIGNED = HTnew_Ptr(VARTABLE_SIZE);
+
+    run_mode(node, COLLECT_MODE);
+}
+
+/**
+ * Frees everything gathered by collect
+ */
+static void clear_collected() {
+    for (size_t i = 0; i < FUN_COUNT; i++) {
+        MEMfree(FUNS[i]->calls);
+        MEMfree(FUNS[i]);
+    }
+    MEMfree(FUNS);
+    FUNS = NULL;
+    FUN_COUNT = 0;
+    FUN_SIZE = 0;
+
+    HTdelete(FUN_INFO);
+    HTdelete(ARRAY_DIMS);
+    HTdelete(READ);
+    HTdelete(ASSIGNED);
+}
+
+/**
+ * Checks whether constants can be propagated into a function. Exported functions
+ * may be called with any value from other modules.
+ * @param info information of the function
+ * @return true if all calls of the function are known
+ */
+static bool is_propagatable(const FunInfo* info) {
+    return info->fundef != NULL && !info->symbol->imported && !info->symbol->exported
+        && info->call_count > 0 && info->symbol->as.fun.param_count > 0;
+}
+
+/**
+ * Lists the parameter symbols of a function in the order their values are passed
+ * @param info information of the function
+ * @return array of param_count slots, to be freed by the caller
+ */
+static ParamSlot* param_slots(const FunInfo* info) {
+    const SymbolTable* scope = info->symbol->as.fun.scope;
+    ParamSlot* slots = MEMmalloc(sizeof(ParamSlot) * info->symbol->as.fun.param_count);
+
+    size_t i = 0;
+    for (node_st* param = FUNDEF_PARAMS(info->fundef); param != NULL; param = PARAM_NEXT(param)) {
+        // Dimensions are passed before the array itself
+        for (node_st* id = PARAM_DIMS(param); id != NULL; id = IDS_NEXT(id)) {
+            slots[i++] = (ParamSlot) { STlookup(scope, IDS_NAME(id)), true };
+        }
+        slots[i++] = (ParamSlot) { STlookup(scope, PARAM_NAME(param)), false };
+    }
+
+    return slots;
+}
+
+/**
+ * Checks whether knowing the value of a parameter can improve its function
+ * @param slot parameter slot
+ * @return true if the parameter is a scalar that is used but never assigned
+ */
+static bool is_useful(const ParamSlot slot) {
+    return slot.symbol->stype == ST_VALUEVAR && HTlookup(ASSIGNED, slot.symbol) == NULL
+        && (slot.is_dim || HTlookup(READ, slot.symbol) != NULL);
+}
+
+/**
+ * Finds the constant values passed by a call
+ * @param call FunCall node
+ * @param count amount of values passed, including array dimensions
+ * @param args set to the value passed for each parameter slot
+ */
+static void call_args(node_st* call, const size_t count, ArgValue* args) {
+    size_t i = 0;
+    for (node_st* exprs = FUNCALL_FUN_ARGS(call); exprs != NULL && i < count; exprs = EXPRS_NEXT(exprs)) {
+        node_st* arg = EXPRS_EXPR(exprs);
+
+        if (NODE_TYPE(arg) == NT_VAR && VAR_INDICES(arg) == NULL && VAR_SYMBOL(arg)->stype == ST_ARRAYVAR) {
+            // Array arguments pass their dimensions, which are known if they were declared as constants
+            const Symbol* arr = VAR_SYMBOL(arg);
+            node_st* dims = HTlookup(ARRAY_DIMS, (void*) arr);
+            for (size_t j = 0; j < arr->as.array.dim_count && i < count; j++) {
+                args[i].known = dims != NULL && CEevaluate(EXPRS_EXPR(dims), NULL, &args[i].value)
+                    && args[i].value.vtype == VT_NUM;
+                if (dims != NULL) dims = EXPRS_NEXT(dims);
+                i++;
+            }
+            if (i < count) args[i++].known = false;
+        } else {
+            args[i].known = CEevaluate(arg, NULL, &args[i].value) && CEisRepresentable(args[i].value);
+            i++;
+        }
+    }
+}
+
+/**
+ * Finds the constant values passed by every call of a function
+ * @param info information of the function
+ * @return array of param_count values for each call, to be freed by the caller
+ */
+static ArgValue* all_call_args(const FunInfo* info) {
+    const size_t n = info->symbol->as.fun.param_count;
+    ArgValue* args = MEMmalloc(sizeof(ArgValue) * n * info->call_count);
+    for (size_t c = 0; c < info->call_count; c++) call_args(info->calls[c], n, &args[c * n]);
+    return args;
+}
+
+/**
+ * Checks whether two calls pass the same constants to all useful parameters
+ * @param a values passed by first call
+ * @param b values passed by second call
+ * @param slots parameter slots of the function
+ * @param n amount of parameter slots
+ * @return true if the calls can share a specialised copy
+ */
+static bool same_constants(const ArgValue* a, const ArgValue* b, const ParamSlot* slots, const size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!is_useful(slots[i])) continue;
+        if (a[i].known != b[i].known) return false;
+        if (a[i].known && !CEequal(a[i].value, b[i].value)) return false;
+    }
+    return true;
+}
+
+/**
+ * Copies a function for every distinct combination of constants its calls pass,
+ * and redirects those calls to the copy. Calls without useful constants keep
+ * calling the original, as do the calls left once the copy limit is reached.
+ * @param info information of the function
+ * @return true if any copy was made
+ */
+static bool specialise(FunInfo* info) {
+    const size_t n = info->symbol->as.fun.param_count;
+    ParamSlot* slots = param_slots(info);
+    ArgValue* args = all_call_args(info);
+
+    // Only functions whose calls disagree on a constant need copies
+    bool disagree = false;
+    for (size_t i = 0; i < n && !disagree; i++) {
+        if (!is_useful(slots[i])) continue;
+
+        bool any_known = false;
+        bool agreed = true;
+        for (size_t c = 0; c < info->call_count; c++) {
+            const ArgValue* a = &args[c * n + i];
+            any_known = any_known || a->known;
+            agreed = agreed && a->known && CEequal(a->value, args[i].value);
+        }
+        disagree = any_known && !agreed;
+    }
+
+    if (!disagree) {
+        MEMfree(slots);
+        MEMfree(args);
+        return false;
+    }
+
+    // Assign every call with useful constants to a copy, keyed by its first call
+    size_t first_call[SPECIALISE_CLONE_LIMIT];
+    size_t* copy_of = MEMmalloc(sizeof(size_t) * info->call_count);
+    for (size_t c = 0; c < info->call_count; c++) {
+        copy_of[c] = SPECIALISE_CLONE_LIMIT;
+
+        bool has_constant = false;
+        for (size_t i = 0; i < n; i++) has_constant = has_constant || (is_useful(slots[i]) && args[c * n + i].known);
+        if (!has_constant) continue;
+
+        for (size_t k = 0; k < info->copy_count && copy_of[c] == SPECIALISE_CLONE_LIMIT; k++) {
+            if (same_constants(&args[c * n], &args[first_call[k] * n], slots, n)) copy_of[c] = k;
+        }
+
+        if (copy_of[c] == SPECIALISE_CLONE_LIMIT && info->copy_count < SPECIALISE_CLONE_LIMIT) {
+            // Copy before any call is redirected, so calls within the function keep their target
+            node_st* copy = CCNcopy(info->fundef);
+            MEMfree(FUNDEF_NAME(copy));
+            // Names starting with an underscore cannot clash with user functions
+            FUNDEF_NAME(copy) = STRfmt("_%s_%lu", FUNDEF_NAME(info->fundef), info->copy_count + 1);
+
+            first_call[info->copy_count] = c;
+            copy_of[c] = info->copy_count;
+            info->copies[info->copy_count++] = copy;
+        }
+    }
+
+    for (size_t c = 0; c < info->call_count; c++) {
+        if (copy_of[c] == SPECIALISE_CLONE_LIMIT) continue;
+
+        node_st* call = info->calls[c];
+        MEMfree(FUNCALL_NAME(call));
+        FUNCALL_NAME(call) = STRcpy(FUNDEF_NAME(info->copies[copy_of[c]]));
+    }
+
+    HTinsert(SPECIALISED, info->fundef, info->fundef);
+
+    MEMfree(copy_of);
+    MEMfree(slots);
+    MEMfree(args);
+    return info->copy_count > 0;
+}
+
+/**
+ * Registers the parameters of a function that every call passes the same constant
+ * @param info information of the function
+ */
+static void find_constant_params(const FunInfo* info) {
+    const size_t n = info->symbol->as.fun.param_count;
+    ParamSlot* slots = param_slots(info);
+    ArgValue* args = all_call_args(info);
+
+    for (size_t i = 0; i < n; i++) {
+        if (!is_useful(slots[i])) continue;
+
+        bool agreed = true;
+        for (size_t c = 0; c < info->call_count && agreed; c++) {
+            const ArgValue* a = &args[c * n + i];
+            agreed = a->known && CEequal(a->value, args[i].value);
+        }
+        if (!agreed) continue;
+
+        Symbol* s = slots[i].symbol;
+        ConstValue* value = MEMmalloc(sizeof(ConstValue));
+        *value = args[i].value;
+        HTinsert(SUBSTITUTE, s, value);
+
+        // Lets code generation use the value for dimensions and strides
+        if (s->vtype == VT_NUM) {
+            s->is_constant = true;
+            s->constant = value->as.i;
+        }
+    }
+
+    MEMfree(slots);
+    MEMfree(args);
+}
+
+/**
+ * Folds an operation after a parameter within it was replaced by a constant
+ * @param node Binop, Monop or Cast node
+ * @return folded expression, replacing the given node
+ */
+static node_st* fold_operation(node_st* node) {
+    if (MODE != SUBSTITUTE_MODE) {
+        if (MODE == COLLECT_MODE && CURRENT_FUN != NULL) CURRENT_FUN->size++;
+        TRAVchildren(node);
+        return node;
+    }
+
+    const bool outer_foldable = FOLDABLE;
+    FOLDABLE = false;
+
+    TRAVchildren(node);
+
+    ConstValue v;
+    if (FOLDABLE && CEevaluate(node, NULL, &v) && CEisRepresentable(v)) {
+        CCNfree(node);
+        node = CEtoLiteral(v);
+    }
+
+    FOLDABLE = FOLDABLE || outer_foldable;
+    return node;
+}
+
+/**
+ * @fn ICPprogram
+ */
+node_st *ICPprogram(node_st *node)
+{
+    if (global.had_error) return node;
+
+    collect(node);
+
+    // Copy small functions whose calls pass different constants
+    SPECIALISED = HTnew_Ptr(VARTABLE_SIZE);
+    bool copied = false;
+    for (size_t i = 0; i < FUN_COUNT; i++) {
+        FunInfo* info = FUNS[i];
+        if (is_propagatable(info) && info->size <= SPECIALISE_SIZE_LIMIT) copied = specialise(info) || copied;
+    }
+
+    if (copied) {
+        run_mode(node, INSERT_MODE);
+        clear_collected();
+
+        // Analyse the program again, so the copies get their own symbols
+        STfree(&GB_GLOBAL_SCOPE);
+        node = TRAVstart(node, TRAV_CTA);
+
+        // Originals whose calls all moved to copies are no longer needed
+        collect(node);
+        run_mode(node, REMOVE_MODE);
+        clear_collected();
+
+        collect(node);
+    }
+    HTdelete(SPECIALISED);
+    SPECIALISED = NULL;
+
+    SUBSTITUTE = HTnew_Ptr(VARTABLE_SIZE);
+    for (size_t i = 0; i < FUN_COUNT; i++) {
+        if (is_propagatable(FUNS[i])) find_constant_params(FUNS[i]);
+    }
+
+    if (HTelementCount(SUBSTITUTE) > 0) run_mode(node, SUBSTITUTE_MODE);
+
+    for (htable_iter_st* iter = HTiterate(SUBSTITUTE); iter; iter = HTiterateNext(iter)) {
+        MEMfree(HTiterValue(iter));
+    }
+    HTdelete(SUBSTITUTE);
+    SUBSTITUTE = NULL;
+
+    clear_collected();
+    return node;
+}
+
+/**
+ * @fn ICPdecls
+ */
+node_st *ICPdecls(node_st *node)
+{
+    TRAVchildren(node);
+
+    node_st* decl = DECLS_DECL(node);
+    if (NODE_TYPE(decl) != NT_FUNDEF) return node;
+
+    if (MODE == INSERT_MODE) {
+        const FunInfo* info = fundef_info(decl);
+        for (size_t i = info == NULL ? 0 : info->copy_count; i > 0; i--) {
+            DECLS_NEXT(node) = ASTdecls(info->copies[i - 1], DECLS_NEXT(node));
+        }
+    } else if (MODE == REMOVE_MODE && HTlookup(SPECIALISED, decl) != NULL) {
+        const FunInfo* info = fundef_info(decl);
+        if (info != NULL && info->call_count == 0) {
+            node_st* next = DECLS_NEXT(node);
+            DECLS_NEXT(node) = NULL;
+            CCNfree(node);
+            return next;
+        }
+    }
+
+    return node;
+}
+
+/**
+ * @fn ICPfundefs
+ */
+node_st *ICPfundefs(node_st *node)
+{
+    TRAVchildren(node);
+
+    node_st* fundef = FUNDEFS_FUNDEF(node);
+
+    if (MODE == INSERT_MODE) {
+        const FunInfo* info = fundef_info(fundef);
+        for (size_t i = info == NULL ? 0 : info->copy_count; i > 0; i--) {
+            node_st* copy = ASTfundefs(info->copies[i - 1]);
+            FUNDEFS_NEXT(copy) = FUNDEFS_NEXT(node);
+            FUNDEFS_NEXT(node) = copy;
+        }
+    } else if (MODE == REMOVE_MODE && HTlookup(SPECIALISED, fundef) != NULL) {
+        const FunInfo* info = fundef_info(fundef);
+        if (info != NULL && info->call_count == 0) {
+            node_st* next = FUNDEFS_NEXT(node);
+            FUNDEFS_NEXT(node) = NULL;
+            CCNfree(node);
+            return next;
+        }
+    }
+
+    return node;
+}
+
+/**
+ * @fn ICPfundef
+ */
+node_st *ICPfundef(node_st *node)
+{
+    Symbol* s = STlookup(CURRENT_SCOPE, FUNDEF_NAME(node));
+    if (s->imported) return node;
+
+    FunInfo* prev_fun = CURRENT_FUN;
+    SymbolTable* prev_scope = CURRENT_SCOPE;
+    CURRENT_SCOPE = s->as.fun.scope;
+
+    if (MODE == COLLECT_MODE) {
+        CURRENT_FUN = get_info(s);
+        CURRENT_FUN->fundef = node;
+    }
+
+    TRAVbody(node);
+
+    // Local functions are copied along with their parent
+    if (MODE == COLLECT_MODE && prev_fun != NULL) prev_fun->size += CURRENT_FUN->size;
+
+    CURRENT_FUN = prev_fun;
+    CURRENT_SCOPE = prev_scope;
+    return node;
+}
+
+/**
+ * @fn ICPglobdef
+ */
+node_st *ICPglobdef(node_st *node)
+{
+    // Other modules might change the dimensions of exported arrays
+    if (MODE == COLLECT_MODE && GLOBDEF_DIMS(node) != NULL && !GLOBDEF_EXPORT(node)) {
+        Symbol* s = STlookup(GB_GLOBAL_SCOPE, GLOBDEF_NAME(node));
+        HTinsert(ARRAY_DIMS, s, GLOBDEF_DIMS(node));
+    }
+
+    TRAVchildren(node);
+    return node;
+}
+
+/**
+ * @fn ICPvardecl
+ */
+node_st *ICPvardecl(node_st *node)
+{
+    if (MODE == COLLECT_MODE && VARDECL_DIMS(node) != NULL) {
+        Symbol* s = STlookup(CURRENT_SCOPE, VARDECL_NAME(node));
+        HTinsert(ARRAY_DIMS, s, VARDECL_DIMS(node));
+    }
+
+    TRAVchildren(node);
+    return node;
+}
+
+/**
+ * @fn ICPfuncall
+ */
+node_st *ICPfuncall(node_st *node)
+{
+    TRAVchildren(node);
+
+    if (MODE == COLLECT_MODE) {
+        if (CURRENT_FUN != NULL) CURRENT_FUN->size++;
+        add_call(get_info(FUNCALL_SYMBOL(node)), node);
+    }
+
+    return node;
+}
+
+/**
+ * @fn ICPbinop
+ */
+node_st *ICPbinop(node_st *node)
+{
+    return fold_operation(node);
+}
+
+/**
+ * @fn ICPmonop
+ */
+node_st *ICPmonop(node_st *node)
+{
+    return fold_operation(node);
+}
+
+/**
+ * @fn ICPcast
+ */
+node_st *ICPcast(node_st *node)
+{
+    return fold_operation(node);
+}
+
+/**
+ * @fn ICPvar
+ */
+node_st *ICPvar(node_st *node)
+{
+    TRAVchildren(node);
+
+    Symbol* s = VAR_SYMBOL(node);
+
+    if (MODE == COLLECT_MODE) {
+        if (CURRENT_FUN != NULL) CURRENT_FUN->size++;
+        if (HTlookup(READ, s) == NULL) HTinsert(READ, s, s);
+    } else if (MODE == SUBSTITUTE_MODE && VAR_INDICES(node) == NULL) {
+        const ConstValue* value = HTlookup(SUBSTITUTE, s);
+        if (value != NULL) {
+            CCNfree(node);
+            FOLDABLE = true;
+            return CEtoLiteral(*value);
+        }
+    }
+
+    return node;
+}
+
+/**
+ * @fn ICPvarlet
+ */
+node_st *ICPvarlet(node_st *node)
+{
+    TRAVchildren(node);
+
+    if (MODE == COLLECT_MODE) {
+        if (CURRENT_FUN != NULL) CURRENT_FUN->size++;
+        Symbol* s = VARLET_SYMBOL(node);
+        if (HTlookup(ASSIGNED, s) == NULL) HTinsert(ASSIGNED, s, s);
+    }
+
+    return node;
+}
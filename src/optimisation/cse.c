@@ -0,0 +1,633 @@
+/**
+ * @file
+ *
+ * Traversal: CommonSubexpressionElimination
+ * UID      : CSE
+ *
+ * Block-local common subexpression elimination. Within a straight-line sequence
+ * of statements, a pure expression or flattened multidimensional array index that
+ * occurs more than once is computed once into a frame temporary. The first
+ * occurrence is marked as definition of the temporary, later occurrences only
+ * load the temporary. Assignments invalidate every expression that reads the
+ * assigned variable, function calls invalidate every expression that reads a
+ * variable the called function might write.
+ */
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+#include "ccngen/trav.h"
+
+#include "common.h"
+#include "global/globals.h"
+#include "symbol/table.h"
+
+// Minimum amount of instructions an expression should take before reusing it pays off
+#define CSE_MIN_COST 4
+
+typedef struct {
+    char* key;                          // Structural representation of the expression
+    node_st* def_node;                  // First occurrence, which computes the value
+    Symbol* temp;                       // Temporary holding the value; NULL until reused
+    ValueType vtype;                    // Type of the value
+    Symbol** deps;                      // Variables the value is computed from
+    size_t dep_count;
+    size_t dep_size;
+} AvailableExpr;
+
+// Expressions computed earlier in the current block
+static AvailableExpr* AVAILABLE = NULL;
+static size_t AVAILABLE_COUNT = 0;
+static size_t AVAILABLE_SIZE = 0;
+
+// Scope of the function currently being optimised
+static SymbolTable* CURRENT_SCOPE;
+
+// Nonzero while inside an operand that is not always evaluated (short-circuiting)
+static size_t CONDITIONAL_DEPTH = 0;
+
+/**
+ * Creates a key representing a pure expression. Two expressions with equal keys
+ * always evaluate to the same value as long as none of their variables changed
+ * @param node expression node
+ * @param cost set to the amount of instructions the expression takes
+ * @param vt set to the type the expression evaluates to
+ * @return key, or NULL if the expression is not pure
+ */
+static char* expr_key(node_st* node, size_t* cost, ValueType* vt) {
+    switch (NODE_TYPE(node)) {
+        case NT_NUM:
+            *cost = 1;
+            *vt = VT_NUM;
+            return STRfmt("%d", NUM_VAL(node));
+        case NT_FLOAT:
+            *cost = 1;
+            *vt = VT_FLOAT;
+            return STRfmt("%af", (double) FLOAT_VAL(node));
+        case NT_BOOL:
+            *cost = 1;
+            *vt = VT_BOOL;
+            return STRcpy(BOOL_VAL(node) ? "true" : "false");
+        case NT_VAR: {
+            // Array reads depend on array contents, which are not tracked
+            const Symbol* s = VAR_SYMBOL(node);
+            if (VAR_INDICES(node) != NULL || s->stype != ST_VALUEVAR) return NULL;
+
+            *cost = 1;
+            *vt = s->vtype;
+            return STRfmt("v%p", (void*) s);
+        }
+        case NT_BINOP: {
+            // Short-circuiting operators contain branches; keep them out of reach
+            const enum BinOpType op = BINOP_OP(node);
+            if (op == BO_and || op == BO_or) return NULL;
+
+            size_t left_cost, right_cost;
+            ValueType left_vt, right_vt;
+            char* left = expr_key(BINOP_LEFT(node), &left_cost, &left_vt);
+            char* right = left == NULL ? NULL : expr_key(BINOP_RIGHT(node), &right_cost, &right_vt);
+            if (right == NULL) {
+                MEMfree(left);
+                return NULL;
+            }
+
+            // Order operands of commutative operators, so a + b and b + a are recognised as equal
+            const bool commutative = op == BO_add || op == BO_mul || op == BO_eq || op == BO_ne;
+            if (commutative && strcmp(left, right) > 0) {
+                char* tmp = left;
+                left = right;
+                right = tmp;
+            }
+
+            *cost = left_cost + right_cost + 1;
+            *vt = op == BO_lt || op == BO_le || op == BO_gt || op == BO_ge || op == BO_eq || op == BO_ne
+                ? VT_BOOL : left_vt;
+
+            char* key = STRfmt("(%s %s %s)", bo_to_str(op), left, right);
+            MEMfree(left);
+            MEMfree(right);
+            return key;
+        }
+        case NT_MONOP: {
+            char* operand = expr_key(MONOP_OPERAND(node), cost, vt);
+            if (operand == NULL) return NULL;
+
+            *cost += 1;
+            char* key = STRfmt("(%s %s)", mo_to_str(MONOP_OP(node)), operand);
+            MEMfree(operand);
+            return key;
+        }
+        case NT_CAST: {
+            ValueType src_vt;
+            char* operand = expr_key(CAST_EXPR(node), cost, &src_vt);
+            if (operand == NULL) return NULL;
+
+            *vt = ct_to_vt(CAST_TYPE(node), false);
+
+            // Casts from booleans select the result with a branch, casts to
+            // booleans compare with a loaded zero
+            if (src_vt == VT_BOOL && *vt != VT_BOOL) *cost += 5;
+            else if (*vt == VT_BOOL && src_vt != VT_BOOL) *cost += 2;
+            else *cost += 1;
+            char* key = STRfmt("(%s %s)", ct_to_str(CAST_TYPE(node)), operand);
+            MEMfree(operand);
+            return key;
+        }
+        default:
+            // Function calls and array expressions are never pure
+            return NULL;
+    }
+}
+
+/**
+ * Creates a key representing the flattened index of a multidimensional array access
+ * @param arr array symbol
+ * @param exprs_node first index expression
+ * @param cost set to the amount of instructions the index computation takes
+ * @return key, or NULL if an index expression is not pure
+ */
+static char* index_key(const Symbol* arr, node_st* exprs_node, size_t* cost) {
+    // Flattened index is identified by the dimension variables it multiplies with
+    // Keys can be long, so they are not built with safe_concat_str, which truncates
+    char* key = STRcpy("[");
+    for (size_t i = 0; i < arr->as.array.dim_count; i++) {
+        char* next = STRfmt("%s%p ", key, (void*) arr->as.array.dims[i]);
+        MEMfree(key);
+        key = next;
+    }
+
+    *cost = 0;
+    for (size_t i = 0; i < arr->as.array.dim_count; i++) {
+        size_t expr_cost;
+        ValueType vt;
+        char* expr = expr_key(EXPRS_EXPR(exprs_node), &expr_cost, &vt);
+        if (expr == NULL) {
+            MEMfree(key);
+            return NULL;
+        }
+
+        // Index, then a load and multiplication for every next dimension, then an addition
+        *cost += expr_cost + 2 * (arr->as.array.dim_count - i - 1) + (i != 0 ? 1 : 0);
+        char* next = STRfmt("%s%s;", key, expr);
+        MEMfree(key);
+        MEMfree(expr);
+        key = next;
+
+        exprs_node = EXPRS_NEXT(exprs_node);
+    }
+
+    char* res = STRfmt("%s]", key);
+    MEMfree(key);
+    return res;
+}
+
+/**
+ * Adds a variable to the dependencies of an available expression
+ * @param e available expression
+ * @param s variable symbol
+ */
+static void add_dep(AvailableExpr* e, Symbol* s) {
+    if (e->dep_count == e->dep_size) {
+        e->dep_size = e->dep_size == 0 ? INITIAL_LIST_SIZE : e->dep_size * 2;
+        ARRAY_RESIZE(e->deps, e->dep_size);
+    }
+    e->deps[e->dep_count++] = s;
+}
+
+/**
+ * Collects all variables an expression or array index reads
+ * @param e available expression to add dependencies to
+ * @param node expression node
+ */
+static void collect_deps(AvailableExpr* e, node_st* node) {
+    node_st* indices = NULL;
+    const Symbol* arr = NULL;
+
+    switch (NODE_TYPE(node)) {
+        case NT_VAR:
+            if (VAR_INDICES(node) == NULL) {
+                add_dep(e, VAR_SYMBOL(node));
+                return;
+            }
+            arr = VAR_SYMBOL(node);
+            indices = VAR_INDICES(node);
+            break;
+        case NT_VARLET:
+            arr = VARLET_SYMBOL(node);
+            indices = VARLET_INDICES(node);
+            break;
+        case NT_BINOP:
+            collect_deps(e, BINOP_LEFT(node));
+            collect_deps(e, BINOP_RIGHT(node));
+            return;
+        case NT_MONOP: collect_deps(e, MONOP_OPERAND(node)); return;
+        case NT_CAST: collect_deps(e, CAST_EXPR(node)); return;
+        default: return;
+    }
+
+    // Flattened index reads the dimensions and all index expressions
+    for (size_t i = 0; i < arr->as.array.dim_count; i++) add_dep(e, arr->as.array.dims[i]);
+    while (indices != NULL) {
+        collect_deps(e, EXPRS_EXPR(indices));
+        indices = EXPRS_NEXT(indices);
+    }
+}
+
+/**
+ * Finds an available expression by its key
+ * @param key key of the expression
+ * @return available expression if found, otherwise NULL
+ */
+static AvailableExpr* find_available(const char* key) {
+    for (size_t i = 0; i < AVAILABLE_COUNT; i++) {
+        if (STReq(AVAILABLE[i].key, key)) return &AVAILABLE[i];
+    }
+    return NULL;
+}
+
+/**
+ * Makes an expression available for reuse by later occurrences in the block
+ * @param node first occurrence of the expression
+ * @param key key of the expression, ownership is taken
+ * @param cost amount of instructions the expression takes
+ * @param vt type the expression evaluates to
+ */
+static void add_available(node_st* node, char* key, const size_t cost, const ValueType vt) {
+    // Only expressions that are always evaluated and expensive enough are worth a temporary
+    if (key == NULL || cost < CSE_MIN_COST || CONDITIONAL_DEPTH > 0) {
+        MEMfree(key);
+        return;
+    }
+
+    if (AVAILABLE_COUNT == AVAILABLE_SIZE) {
+        AVAILABLE_SIZE = AVAILABLE_SIZE == 0 ? INITIAL_LIST_SIZE : AVAILABLE_SIZE * 2;
+        ARRAY_RESIZE(AVAILABLE, AVAILABLE_SIZE);
+    }
+
+    AvailableExpr* e = &AVAILABLE[AVAILABLE_COUNT++];
+    e->key = key;
+    e->def_node = node;
+    e->temp = NULL;
+    e->vtype = vt;
+    e->deps = NULL;
+    e->dep_count = 0;
+    e->dep_size = 0;
+    collect_deps(e, node);
+}
+
+/**
+ * Removes the available expression at the given index
+ * @param i index into the available expressions
+ */
+static void remove_available(const size_t i) {
+    MEMfree(AVAILABLE[i].key);
+    MEMfree(AVAILABLE[i].deps);
+    AVAILABLE[i] = AVAILABLE[--AVAILABLE_COUNT];
+}
+
+/**
+ * Forgets all available expressions, used at the end of a straight-line block
+ */
+static void clear_available() {
+    while (AVAILABLE_COUNT > 0) remove_available(AVAILABLE_COUNT - 1);
+}
+
+/**
+ * Forgets all available expressions that read a variable
+ * @param s variable symbol that is written
+ */
+static void kill_dependents(const Symbol* s) {
+    size_t i = 0;
+    while (i < AVAILABLE_COUNT) {
+        bool depends = false;
+        for (size_t j = 0; j < AVAILABLE[i].dep_count && !depends; j++) {
+            depends = AVAILABLE[i].deps[j] == s;
+        }
+
+        if (depends) remove_available(i);
+        else i++;
+    }
+}
+
+/**
+ * Forgets all available expressions that read a global or imported variable
+ */
+static void kill_global_dependents() {
+    size_t i = 0;
+    while (i < AVAILABLE_COUNT) {
+        bool depends = false;
+        for (size_t j = 0; j < AVAILABLE[i].dep_count && !depends; j++) {
+            depends = AVAILABLE[i].deps[j]->parent_scope->nesting_level == 0;
+        }
+
+        if (depends) remove_available(i);
+        else i++;
+    }
+}
+
+/**
+ * Creates a hidden local variable in the current function to hold a reused value
+ * @param vt type of the value
+ * @return temporary symbol
+ */
+static Symbol* new_temp(const ValueType vt) {
+    const size_t offset = CURRENT_SCOPE->localvar_offset_counter++;
+    char* name = safe_concat_str(STRcpy("_cse"), int_to_str((int) offset));
+
+    Symbol* s = SBfromVar(name, vt, false);
+    s->offset = offset;
+    STinsert(CURRENT_SCOPE, name, s);
+
+    MEMfree(name);
+    return s;
+}
+
+/**
+ * Links an expression node to the temporary that holds its value
+ * @param node expression or array access node
+ * @param temp temporary symbol
+ * @param is_def whether the node computes the value and stores it to the temporary
+ */
+static void set_temp(node_st* node, Symbol* temp, const bool is_def) {
+    switch (NODE_TYPE(node)) {
+        case NT_BINOP: BINOP_CSE_TEMP(node) = temp; BINOP_CSE_DEF(node) = is_def; break;
+        case NT_MONOP: MONOP_CSE_TEMP(node) = temp; MONOP_CSE_DEF(node) = is_def; break;
+        case NT_CAST: CAST_CSE_TEMP(node) = temp; CAST_CSE_DEF(node) = is_def; break;
+        case NT_VAR: VAR_INDEX_TEMP(node) = temp; VAR_INDEX_DEF(node) = is_def; break;
+        case NT_VARLET: VARLET_INDEX_TEMP(node) = temp; VARLET_INDEX_DEF(node) = is_def; break;
+        default:
+#ifdef DEBUGGING
+            ERROR("CSE: Cannot store value of node type %i in temporary", NODE_TYPE(node));
+#endif // DEBUGGING
+    }
+}
+
+/**
+ * Replaces an expression by a temporary if an equal expression is available
+ * @param node expression or array access node
+ * @param key key of the expression, may be NULL
+ * @return true if the node will load the temporary instead of computing its value
+ */
+static bool try_reuse(node_st* node, const char* key) {
+    if (key == NULL) return false;
+
+    AvailableExpr* e = find_available(key);
+    if (e == NULL) return false;
+
+    // First reuse of this expression; its first occurrence must now save the value
+    if (e->temp == NULL) {
+        e->temp = new_temp(e->vtype);
+        set_temp(e->def_node, e->temp, true);
+    }
+
+    set_temp(node, e->temp, false);
+    return true;
+}
+
+/**
+ * Handles a pure expression node; either reuses an earlier occurrence, or
+ * traverses its operands and makes it available to later occurrences
+ * @param node binop, monop or cast node
+ */
+static void handle_expr(node_st* node) {
+    size_t cost = 0;
+    ValueType vt = VT_NULL;
+    char* key = expr_key(node, &cost, &vt);
+
+    if (try_reuse(node, key)) {
+        MEMfree(key);
+        return;
+    }
+
+    TRAVchildren(node);
+
+    add_available(node, key, cost, vt);
+}
+
+/**
+ * Handles an array access; either reuses the flattened index of an earlier
+ * access, or traverses the indices and makes the flattened index available
+ * @param node var or varlet node
+ * @param arr array symbol
+ * @param indices first index expression
+ */
+static void handle_index(node_st* node, const Symbol* arr, node_st* indices) {
+    // Single dimension index is a plain expression, handled by the index expression itself
+    if (indices == NULL || arr->as.array.dim_count < 2) {
+        TRAVindices(node);
+        return;
+    }
+
+    size_t cost = 0;
+    char* key = index_key(arr, indices, &cost);
+
+    if (try_reuse(node, key)) {
+        MEMfree(key);
+        return;
+    }
+
+    TRAVindices(node);
+
+    add_available(node, key, cost, VT_NUM);
+}
+
+/**
+ * @fn CSEprogram
+ */
+node_st *CSEprogram(node_st *node)
+{
+    if (global.had_error) return node;
+
+    CURRENT_SCOPE = GB_GLOBAL_SCOPE;
+
+    TRAVchildren(node);
+
+    clear_available();
+    MEMfree(AVAILABLE);
+    AVAILABLE = NULL;
+    AVAILABLE_SIZE = 0;
+
+    return node;
+}
+
+/**
+ * @fn CSEglobdef
+ */
+node_st *CSEglobdef(node_st *node)
+{
+    // Global initialisation runs once; nothing to gain
+    return node;
+}
+
+/**
+ * @fn CSEfundef
+ */
+node_st *CSEfundef(node_st *node)
+{
+    const Symbol* s = STlookup(CURRENT_SCOPE, FUNDEF_NAME(node));
+    if (s->imported) return node;
+
+    // Temporaries are added to the scope of the function
+    SymbolTable* prev_scope = CURRENT_SCOPE;
+    CURRENT_SCOPE = s->as.fun.scope;
+
+    TRAVbody(node);
+
+    CURRENT_SCOPE = prev_scope;
+    return node;
+}
+
+/**
+ * @fn CSEfunbody
+ */
+node_st *CSEfunbody(node_st *node)
+{
+    TRAVlocal_fundefs(node);
+
+    clear_available();
+    TRAVstmts(node);
+    clear_available();
+
+    return node;
+}
+
+/**
+ * @fn CSEifelse
+ */
+node_st *CSEifelse(node_st *node)
+{
+    // Every branch is its own block, nothing is shared with the surrounding statements
+    clear_available();
+    TRAVthen(node);
+    clear_available();
+    TRAVelse_block(node);
+    clear_available();
+
+    return node;
+}
+
+/**
+ * @fn CSEwhile
+ */
+node_st *CSEwhile(node_st *node)
+{
+    clear_available();
+    TRAVblock(node);
+    clear_available();
+
+    return node;
+}
+
+/**
+ * @fn CSEdowhile
+ */
+node_st *CSEdowhile(node_st *node)
+{
+    clear_available();
+    TRAVblock(node);
+    clear_available();
+
+    return node;
+}
+
+/**
+ * @fn CSEfor
+ */
+node_st *CSEfor(node_st *node)
+{
+    // Step expression is generated twice, so the loop header is left untouched
+    clear_available();
+    TRAVblock(node);
+    clear_available();
+
+    return node;
+}
+
+/**
+ * @fn CSEassign
+ */
+node_st *CSEassign(node_st *node)
+{
+    // Same order as the generated code: value, then array index, then the store
+    TRAVexpr(node);
+    TRAVlet(node);
+
+    // Storing into an array element does not change any scalar
+    node_st* let = ASSIGN_LET(node);
+    if (VARLET_INDICES(let) == NULL) kill_dependents(VARLET_SYMBOL(let));
+
+    return node;
+}
+
+/**
+ * @fn CSEfuncall
+ */
+node_st *CSEfuncall(node_st *node)
+{
+    TRAVfun_args(node);
+
+    // Global functions can only write globals, nested functions can write any enclosing frame
+    const Symbol* s = FUNCALL_SYMBOL(node);
+    if (s->imported || s->parent_scope->nesting_level == 0) {
+        kill_global_dependents();
+    } else {
+        clear_available();
+    }
+
+    return node;
+}
+
+/**
+ * @fn CSEbinop
+ */
+node_st *CSEbinop(node_st *node)
+{
+    const enum BinOpType op = BINOP_OP(node);
+    if (op != BO_and && op != BO_or) {
+        handle_expr(node);
+        return node;
+    }
+
+    // Right operand is only evaluated sometimes, so it cannot define a temporary
+    TRAVleft(node);
+    CONDITIONAL_DEPTH++;
+    TRAVright(node);
+    CONDITIONAL_DEPTH--;
+
+    return node;
+}
+
+/**
+ * @fn CSEmonop
+ */
+node_st *CSEmonop(node_st *node)
+{
+    handle_expr(node);
+    return node;
+}
+
+/**
+ * @fn CSEcast
+ */
+node_st *CSEcast(node_st *node)
+{
+    handle_expr(node);
+    return node;
+}
+
+/**
+ * @fn CSEvar
+ */
+node_st *CSEvar(node_st *node)
+{
+    handle_index(node, VAR_SYMBOL(node), VAR_INDICES(node));
+    return node;
+}
+
+/**
+ * @fn CSEvarlet
+ */
+node_st *CSEvarlet(node_st *node)
+{
+    handle_index(node, VARLET_SYMBOL(node), VARLET_INDICES(node));
+    return node;
+}
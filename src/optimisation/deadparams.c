@@ -0,0 +1,323 @@
+/**
+ * @file
+ *
+ * Traversal: DeadParameterElimination
+ * UID      : DPE
+ *
+ * Removes the parameters that functions only called from within this module
+ * never use. Passing an array also passes every dimension, which the function
+ * often does not need: the first dimension is only used to pass the array on,
+ * and dimensions with a constant value are never loaded. Dead parameters get no
+ * slot in the frame of the function and calls no longer push them. Arguments
+ * for dead parameters are replaced by literals; parameters whose arguments call
+ * a function are kept, so the call still happens.
+ */
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+#include "ccngen/trav.h"
+
+#include "common.h"
+#include "global/globals.h"
+#include "optimisation/consteval.h"
+#include "symbol/table.h"
+
+typedef struct {
+    Symbol* symbol;                     // Function symbol
+    node_st* fundef;                    // Definition; NULL for imported functions
+    node_st** calls;                    // Every call of the function
+    size_t call_count;
+    size_t call_size;
+} FunUse;
+
+// Scope of the function currently being traversed
+static SymbolTable* CURRENT_SCOPE;
+
+static FunUse** FUNS = NULL;
+static size_t FUN_COUNT = 0;
+static size_t FUN_SIZE = 0;
+
+static htable_st* FUN_USE = NULL;       // Function symbol to its FunUse
+static htable_st* USED = NULL;          // Set of variables that are read or assigned
+static htable_st* INDEXED = NULL;       // Set of arrays that are indexed
+static htable_st* PASSED = NULL;        // Set of arrays that are passed to a function
+
+/**
+ * Finds the usage of a function, creating it on first use
+ * @param s function symbol
+ * @return usage of the function
+ */
+static FunUse* get_use(Symbol* s) {
+    FunUse* use = HTlookup(FUN_USE, s);
+    if (use != NULL) return use;
+
+    use = MEMmalloc(sizeof(FunUse));
+    use->symbol = s;
+    use->fundef = NULL;
+    use->calls = NULL;
+    use->call_count = 0;
+    use->call_size = 0;
+    HTinsert(FUN_USE, s, use);
+
+    if (FUN_COUNT == FUN_SIZE) {
+        FUN_SIZE = FUN_SIZE == 0 ? INITIAL_LIST_SIZE : FUN_SIZE * 2;
+        ARRAY_RESIZE(FUNS, FUN_SIZE);
+    }
+    FUNS[FUN_COUNT++] = use;
+    return use;
+}
+
+/**
+ * Adds a symbol to a set
+ * @param set set of symbols
+ * @param s symbol to add
+ */
+static void mark(htable_st* set, Symbol* s) {
+    if (HTlookup(set, s) == NULL) HTinsert(set, s, s);
+}
+
+/**
+ * Checks whether an expression calls a function
+ * @param node expression node, may be NULL
+ * @return true if a funcall occurs within the expression
+ */
+static bool contains_call(node_st* node) {
+    if (node == NULL) return false;
+
+    switch (NODE_TYPE(node)) {
+        case NT_FUNCALL: return true;
+        case NT_BINOP: return contains_call(BINOP_LEFT(node)) || contains_call(BINOP_RIGHT(node));
+        case NT_MONOP: return contains_call(MONOP_OPERAND(node));
+        case NT_CAST: return contains_call(CAST_EXPR(node));
+        case NT_VAR: return contains_call(VAR_INDICES(node));
+        case NT_EXPRS: return contains_call(EXPRS_EXPR(node)) || contains_call(EXPRS_NEXT(node));
+        default: return false;
+    }
+}
+
+/**
+ * Finds the argument passed by a call for every parameter slot. An array
+ * argument provides the slots of its dimensions and of the array itself.
+ * @param call FunCall node
+ * @param count amount of parameter slots
+ * @return array of count Exprs nodes, to be freed by the caller
+ */
+static node_st** slot_args(node_st* call, const size_t count) {
+    node_st** args = MEMmalloc(sizeof(node_st*) * count);
+
+    size_t i = 0;
+    for (node_st* exprs = FUNCALL_FUN_ARGS(call); exprs != NULL && i < count; exprs = EXPRS_NEXT(exprs)) {
+        node_st* arg = EXPRS_EXPR(exprs);
+        size_t width = 1;
+        if (NODE_TYPE(arg) == NT_VAR && VAR_INDICES(arg) == NULL && VAR_SYMBOL(arg)->stype == ST_ARRAYVAR) {
+            width += VAR_SYMBOL(arg)->as.array.dim_count;
+        }
+
+        for (size_t j = 0; j < width && i < count; j++) args[i++] = exprs;
+    }
+
+    return args;
+}
+
+/**
+ * Moves every variable of a function frame down past the removed parameters
+ * @param st scope of the function, or of a for-loop within it
+ * @param dead dead parameter slots
+ * @param n amount of parameter slots
+ */
+static void compact_frame(SymbolTable* st, const bool* dead, const size_t n) {
+    for (htable_iter_st* iter = HTiterate(st->table); iter; iter = HTiterateNext(iter)) {
+        Symbol* s = HTiterValue(iter);
+
+        // Local functions have their own frame
+        if (s->stype == ST_FUNCTION) continue;
+
+        // For-loop variables live in the frame of the function
+        if (s->stype == ST_FORLOOP) {
+            compact_frame(s->as.forloop.scope, dead, n);
+            continue;
+        }
+
+        if (s->offset < n && dead[s->offset]) continue;
+
+        size_t removed = 0;
+        for (size_t i = 0; i < n && i < s->offset; i++) removed += dead[i];
+        s->offset -= removed;
+    }
+}
+
+/**
+ * Creates a literal that replaces the argument for a dead parameter
+ * @param vt type of the parameter
+ * @return literal node
+ */
+static node_st* dead_arg(const ValueType vt) {
+    ConstValue v;
+    v.vtype = vt;
+    switch (vt) {
+        case VT_FLOAT: v.as.f = 0.0f; break;
+        case VT_BOOL: v.as.b = false; break;
+        default: v.as.i = 0; break;
+    }
+    return CEtoLiteral(v);
+}
+
+/**
+ * Finds the dead parameters of a function and removes them from its frame and calls
+ * @param use usage of the function
+ */
+static void eliminate(const FunUse* use) {
+    Symbol* fun = use->symbol;
+    const size_t n = fun->as.fun.param_count;
+    if (use->fundef == NULL || fun->imported || fun->exported || n == 0) return;
+
+    SymbolTable* scope = fun->as.fun.scope;
+    bool* dead = MEMmalloc(sizeof(bool) * n);
+    size_t dead_count = 0;
+
+    size_t i = 0;
+    for (node_st* param = FUNDEF_PARAMS(use->fundef); param != NULL; param = PARAM_NEXT(param)) {
+        Symbol* s = STlookup(scope, PARAM_NAME(param));
+
+        // Indexing needs every dimension but the first to compute strides; passing the array needs all
+        size_t j = 0;
+        for (node_st* id = PARAM_DIMS(param); id != NULL; id = IDS_NEXT(id)) {
+            const Symbol* dim = STlookup(scope, IDS_NAME(id));
+            const bool loaded = !dim->is_constant
+                && (HTlookup(PASSED, s) != NULL || (j > 0 && HTlookup(INDEXED, s) != NULL));
+            dead[i] = HTlookup(USED, (void*) dim) == NULL && !loaded;
+            dead_count += dead[i];
+            i++;
+            j++;
+        }
+
+        dead[i] = HTlookup(USED, s) == NULL;
+        for (size_t c = 0; c < use->call_count && dead[i] && s->stype == ST_VALUEVAR; c++) {
+            node_st** args = slot_args(use->calls[c], n);
+            dead[i] = !contains_call(EXPRS_EXPR(args[i]));
+            MEMfree(args);
+        }
+        dead_count += dead[i];
+        i++;
+    }
+
+    if (dead_count == 0) {
+        MEMfree(dead);
+        return;
+    }
+
+    fun->as.fun.dead_params = dead;
+    compact_frame(scope, dead, n);
+    scope->localvar_offset_counter -= dead_count;
+
+    // Code generation skips dead arguments, so they should not compute anything
+    for (size_t c = 0; c < use->call_count; c++) {
+        node_st** args = slot_args(use->calls[c], n);
+        for (size_t k = 0; k < n; k++) {
+            node_st* arg = EXPRS_EXPR(args[k]);
+            if (!dead[k] || (NODE_TYPE(arg) == NT_VAR && VAR_SYMBOL(arg)->stype == ST_ARRAYVAR)) continue;
+            if (CEisLiteral(arg)) continue;
+
+            EXPRS_EXPR(args[k]) = dead_arg(fun->as.fun.param_types[k]);
+            CCNfree(arg);
+        }
+        MEMfree(args);
+    }
+}
+
+/**
+ * @fn DPEprogram
+ */
+node_st *DPEprogram(node_st *node)
+{
+    if (global.had_error) return node;
+
+    FUN_USE = HTnew_Ptr(VARTABLE_SIZE);
+    USED = HTnew_Ptr(VARTABLE_SIZE);
+    INDEXED = HTnew_Ptr(VARTABLE_SIZE);
+    PASSED = HTnew_Ptr(VARTABLE_SIZE);
+    CURRENT_SCOPE = GB_GLOBAL_SCOPE;
+
+    TRAVchildren(node);
+
+    for (size_t i = 0; i < FUN_COUNT; i++) {
+        eliminate(FUNS[i]);
+        MEMfree(FUNS[i]->calls);
+        MEMfree(FUNS[i]);
+    }
+    MEMfree(FUNS);
+    FUNS = NULL;
+    FUN_COUNT = 0;
+    FUN_SIZE = 0;
+
+    HTdelete(FUN_USE);
+    HTdelete(USED);
+    HTdelete(INDEXED);
+    HTdelete(PASSED);
+
+    return node;
+}
+
+/**
+ * @fn DPEfundef
+ */
+node_st *DPEfundef(node_st *node)
+{
+    Symbol* s = STlookup(CURRENT_SCOPE, FUNDEF_NAME(node));
+    if (s->imported) return node;
+
+    get_use(s)->fundef = node;
+
+    SymbolTable* prev_scope = CURRENT_SCOPE;
+    CURRENT_SCOPE = s->as.fun.scope;
+
+    TRAVbody(node);
+
+    CURRENT_SCOPE = prev_scope;
+    return node;
+}
+
+/**
+ * @fn DPEfuncall
+ */
+node_st *DPEfuncall(node_st *node)
+{
+    TRAVchildren(node);
+
+    FunUse* use = get_use(FUNCALL_SYMBOL(node));
+    if (use->call_count == use->call_size) {
+        use->call_size = use->call_size == 0 ? INITIAL_LIST_SIZE : use->call_size * 2;
+        ARRAY_RESIZE(use->calls, use->call_size);
+    }
+    use->calls[use->call_count++] = node;
+
+    return node;
+}
+
+/**
+ * @fn DPEvar
+ */
+node_st *DPEvar(node_st *node)
+{
+    TRAVchildren(node);
+
+    Symbol* s = VAR_SYMBOL(node);
+    mark(USED, s);
+    if (s->stype == ST_ARRAYVAR) mark(VAR_INDICES(node) != NULL ? INDEXED : PASSED, s);
+
+    return node;
+}
+
+/**
+ * @fn DPEvarlet
+ */
+node_st *DPEvarlet(node_st *node)
+{
+    TRAVchildren(node);
+
+    Symbol* s = VARLET_SYMBOL(node);
+    mark(USED, s);
+    if (VARLET_INDICES(node) != NULL) mark(INDEXED, s);
+
+    return node;
+}
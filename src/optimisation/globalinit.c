@@ -0,0 +1,178 @@
+/**
+ * @file
+ *
+ * Traversal: GlobalInitEvaluation
+ * UID      : GIE
+ *
+ * Evaluates global initialisers and global array dimensions at compile time.
+ * Every pure subexpression is replaced by a literal, including the elements of
+ * array expressions, so code generation can lay out constant global arrays
+ * without running their initialisers in __init. Globals initialised with a
+ * known value can be used by later initialisers, until an initialiser calls a
+ * function that might change them.
+ */
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+#include "ccngen/trav.h"
+
+#include "common.h"
+#include "global/globals.h"
+#include "optimisation/consteval.h"
+#include "symbol/table.h"
+
+typedef struct {
+    const Symbol* symbol;
+    ConstValue value;
+} KnownGlobal;
+
+// Scalar globals whose value is known at this point in __init
+static KnownGlobal* KNOWN = NULL;
+static size_t KNOWN_COUNT = 0;
+static size_t KNOWN_SIZE = 0;
+
+// Disables substituting known globals, while a function call may run before the variable is read
+static bool SUBSTITUTE_KNOWN = true;
+
+/**
+ * Provides the value of a known global
+ * @param s symbol of variable
+ * @param res set to the value of the global
+ * @return true if the global has a known value
+ */
+static bool lookup_known(const Symbol* s, ConstValue* res) {
+    if (!SUBSTITUTE_KNOWN) return false;
+
+    for (size_t i = 0; i < KNOWN_COUNT; i++) {
+        if (KNOWN[i].symbol == s) {
+            *res = KNOWN[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Registers a global whose value is known after its initialisation
+ * @param s symbol of global
+ * @param value value of global
+ */
+static void add_known(const Symbol* s, const ConstValue value) {
+    if (KNOWN_COUNT == KNOWN_SIZE) {
+        KNOWN_SIZE = KNOWN_SIZE == 0 ? 8 : KNOWN_SIZE * 2;
+        ARRAY_RESIZE(KNOWN, KNOWN_SIZE);
+    }
+    KNOWN[KNOWN_COUNT++] = (KnownGlobal) { s, value };
+}
+
+/**
+ * Checks whether an expression calls a function
+ * @param node expression node, may be NULL
+ * @return true if a funcall occurs within the expression
+ */
+static bool contains_call(node_st* node) {
+    if (node == NULL) return false;
+
+    switch (NODE_TYPE(node)) {
+        case NT_FUNCALL: return true;
+        case NT_BINOP: return contains_call(BINOP_LEFT(node)) || contains_call(BINOP_RIGHT(node));
+        case NT_MONOP: return contains_call(MONOP_OPERAND(node));
+        case NT_CAST: return contains_call(CAST_EXPR(node));
+        case NT_VAR: return contains_call(VAR_INDICES(node));
+        case NT_ARREXPR: return contains_call(ARREXPR_EXPRS(node));
+        case NT_EXPRS: return contains_call(EXPRS_EXPR(node)) || contains_call(EXPRS_NEXT(node));
+        default: return false;
+    }
+}
+
+static void fold_exprs(node_st* exprs);
+
+/**
+ * Replaces an expression, or otherwise its largest pure subexpressions, by literals
+ * @param node expression node
+ * @return folded expression, replacing the given node
+ */
+static node_st* fold_expr(node_st* node) {
+    ConstValue v;
+    if (!CEisLiteral(node) && CEevaluate(node, lookup_known, &v) && CEisRepresentable(v)) {
+        CCNfree(node);
+        return CEtoLiteral(v);
+    }
+
+    switch (NODE_TYPE(node)) {
+        case NT_BINOP:
+            BINOP_LEFT(node) = fold_expr(BINOP_LEFT(node));
+            BINOP_RIGHT(node) = fold_expr(BINOP_RIGHT(node));
+            break;
+        case NT_MONOP: MONOP_OPERAND(node) = fold_expr(MONOP_OPERAND(node)); break;
+        case NT_CAST: CAST_EXPR(node) = fold_expr(CAST_EXPR(node)); break;
+        case NT_FUNCALL: fold_exprs(FUNCALL_FUN_ARGS(node)); break;
+        case NT_VAR: fold_exprs(VAR_INDICES(node)); break;
+        case NT_ARREXPR: fold_exprs(ARREXPR_EXPRS(node)); break;
+        default: break;
+    }
+    return node;
+}
+
+/**
+ * Folds every expression in a list of expressions
+ * @param exprs first exprs node, may be NULL
+ */
+static void fold_exprs(node_st* exprs) {
+    while (exprs != NULL) {
+        EXPRS_EXPR(exprs) = fold_expr(EXPRS_EXPR(exprs));
+        exprs = EXPRS_NEXT(exprs);
+    }
+}
+
+/**
+ * @fn GIEprogram
+ */
+node_st *GIEprogram(node_st *node)
+{
+    if (global.had_error) return node;
+
+    TRAVchildren(node);
+
+    MEMfree(KNOWN);
+    KNOWN = NULL;
+    KNOWN_COUNT = 0;
+    KNOWN_SIZE = 0;
+    SUBSTITUTE_KNOWN = true;
+
+    return node;
+}
+
+/**
+ * @fn GIEglobdef
+ */
+node_st *GIEglobdef(node_st *node)
+{
+    // A call might be evaluated before a variable is read and change its value
+    SUBSTITUTE_KNOWN = !contains_call(GLOBDEF_DIMS(node)) && !contains_call(GLOBDEF_INIT(node));
+
+    fold_exprs(GLOBDEF_DIMS(node));
+    if (GLOBDEF_INIT(node) != NULL) GLOBDEF_INIT(node) = fold_expr(GLOBDEF_INIT(node));
+
+    // Remaining calls might change any global
+    if (contains_call(GLOBDEF_DIMS(node)) || contains_call(GLOBDEF_INIT(node))) KNOWN_COUNT = 0;
+    SUBSTITUTE_KNOWN = true;
+
+    const Symbol* s = STlookup(GB_GLOBAL_SCOPE, GLOBDEF_NAME(node));
+    ConstValue v;
+    if (s != NULL && s->stype == ST_VALUEVAR && GLOBDEF_INIT(node) != NULL
+        && CEfromLiteral(GLOBDEF_INIT(node), &v)) {
+        add_known(s, v);
+    }
+
+    return node;
+}
+
+/**
+ * @fn GIEfundef
+ */
+node_st *GIEfundef(node_st *node)
+{
+    // Globals may change at any point in a function, so function bodies are left alone
+    return node;
+}
@@ -15,6 +15,7 @@
 #include "palm/dbug.h"
 
 static int INDENT = 0;
+static FILE *OUT;                       // Receives the printed program
 
 static char *TRUE_STRING = "true";
 static char *FALSE_STRING = "false";
@@ -43,7 +44,7 @@ static char *type_to_string(const enum Type type) {
 
 static void print_indent() {
     for(int i = 0; i < INDENT; i++) {
-        printf("\t");
+        fprintf(OUT, "\t");
     }
 }
 
@@ -54,9 +55,12 @@ static void print_indent() {
  */
 node_st *PRTprogram(node_st *node)
 {
-    printf("START OF PROGRAM");
+    if (!global.print_ast || global.had_error) return node;
+
+    OUT = GLBastOutput();
+    fprintf(OUT, "START OF PROGRAM");
     TRAVchildren(node);
-    printf("\nEND OF PROGRAM\n");
+    fprintf(OUT, "\nEND OF PROGRAM\n");
     return node;
 }
 
@@ -66,7 +70,7 @@ node_st *PRTprogram(node_st *node)
 node_st *PRTdecls(node_st *node)
 {
     if (DECLS_DECL(node) != NULL) {
-        printf("\n");
+        fprintf(OUT, "\n");
         TRAVdecl(node);
     }
     TRAVnext(node);
@@ -114,9 +118,9 @@ node_st *PRTexprstmt(node_st *node)
  */
 node_st *PRTreturn(node_st *node)
 {
-    printf("RETURN(");
+    fprintf(OUT, "RETURN(");
     TRAVchildren(node);
-    printf(")");
+    fprintf(OUT, ")");
     return node;
 }
 
@@ -125,9 +129,9 @@ node_st *PRTreturn(node_st *node)
  */
 node_st *PRTfuncall(node_st *node)
 {
-    printf("FUNCALL(name=%s", FUNCALL_NAME(node));
+    fprintf(OUT, "FUNCALL(name=%s", FUNCALL_NAME(node));
     TRAVchildren(node);
-    printf(")");
+    fprintf(OUT, ")");
     return node;
 }
 
@@ -146,7 +150,7 @@ node_st *PRTcast(node_st *node)
 node_st *PRTfundefs(node_st *node)
 {
     if (FUNDEFS_FUNDEF(node) != NULL) {
-        printf("\n");
+        fprintf(OUT, "\n");
     }
 
     TRAVchildren(node);
@@ -163,27 +167,27 @@ node_st *PRTfundef(node_st *node)
 
     print_indent();
 
-    if (has_body) printf("BEGIN ");
+    if (has_body) fprintf(OUT, "BEGIN ");
 
-    printf("FUNDEF(name=%s, type=%s",
+    fprintf(OUT, "FUNDEF(name=%s, type=%s",
         FUNDEF_NAME(node), type_to_string(FUNDEF_TYPE(node)));
     
     // Print args if they exist
     if (FUNDEF_PARAMS(node) != NULL) {
-        printf(", params=(");
+        fprintf(OUT, ", params=(");
         TRAVparams(node);
-        printf(")");
+        fprintf(OUT, ")");
     }
 
-    printf(")");
+    fprintf(OUT, ")");
     
     if (has_body) {
         INDENT++;
         TRAVchildren(node);
         INDENT--;
-        printf("\n");
+        fprintf(OUT, "\n");
         print_indent();
-        printf("END FUNDEF(name=%s)", FUNDEF_NAME(node));
+        fprintf(OUT, "END FUNDEF(name=%s)", FUNDEF_NAME(node));
     }
     
     
@@ -204,23 +208,23 @@ node_st *PRTfunbody(node_st *node)
  */
 node_st *PRTifelse(node_st *node)
 {
-    printf("START IF(cond=");
+    fprintf(OUT, "START IF(cond=");
     TRAVcond(node);
-    printf(")");
+    fprintf(OUT, ")");
     INDENT++;
     TRAVthen(node);
     INDENT--;
-    printf("\n");
+    fprintf(OUT, "\n");
     if IFELSE_ELSE_BLOCK(node) {
         print_indent();
-        printf("ELSE");
+        fprintf(OUT, "ELSE");
         INDENT++;
         TRAVelse_block(node);
         INDENT--;
-        printf("\n");
+        fprintf(OUT, "\n");
     }
     print_indent();
-    printf("END IF");
+    fprintf(OUT, "END IF");
     return node;
 }
 
@@ -229,15 +233,15 @@ node_st *PRTifelse(node_st *node)
  */
 node_st *PRTwhile(node_st *node)
 {
-    printf("START WHILE(cond=");
+    fprintf(OUT, "START WHILE(cond=");
     TRAVcond(node);
-    printf(")");
+    fprintf(OUT, ")");
     INDENT++;
     TRAVblock(node);
     INDENT--;
-    printf("\n");
+    fprintf(OUT, "\n");
     print_indent();
-    printf("END WHILE");
+    fprintf(OUT, "END WHILE");
     return node;
 }
 
@@ -264,7 +268,7 @@ node_st *PRTfor(node_st *node)
  */
 node_st *PRTglobdecl(node_st *node)  // TODO: ADD DIMS
 {
-    printf("GLOBDECL(name=%s, type=%s)",
+    fprintf(OUT, "GLOBDECL(name=%s, type=%s)",
         GLOBDECL_NAME(node), type_to_string(GLOBDECL_TYPE(node)));
     TRAVchildren(node);
     return node;
@@ -275,11 +279,11 @@ node_st *PRTglobdecl(node_st *node)  // TODO: ADD DIMS
  */
 node_st *PRTglobdef(node_st *node)  // TODO: ADD DIMS
 {
-    printf("GLOBDEF(export=%s name=%s, type=%s)",
+    fprintf(OUT, "GLOBDEF(export=%s name=%s, type=%s)",
         bool_to_string(GLOBDEF_EXPORT(node)), GLOBDEF_NAME(node), type_to_string(GLOBDEF_TYPE(node)));
 
     if (GLOBDEF_INIT(node) != NULL) {
-        printf(" <- ");
+        fprintf(OUT, " <- ");
         TRAVinit(node);
     }
 
@@ -291,9 +295,9 @@ node_st *PRTglobdef(node_st *node)  // TODO: ADD DIMS
  */
 node_st *PRTparam(node_st *node)
 {
-    printf("%s %s", ct_to_str(PARAM_TYPE(node)), PARAM_NAME(node));
+    fprintf(OUT, "%s %s", ct_to_str(PARAM_TYPE(node)), PARAM_NAME(node));
     if (PARAM_NEXT(node) != NULL) {
-        printf(", ");
+        fprintf(OUT, ", ");
     }
     TRAVchildren(node);
     return node;
@@ -304,13 +308,13 @@ node_st *PRTparam(node_st *node)
  */
 node_st *PRTvardecl(node_st *node)
 {
-    printf("\n");
+    fprintf(OUT, "\n");
     print_indent();
-    printf("VARDECL(name=%s, type=%s)",
+    fprintf(OUT, "VARDECL(name=%s, type=%s)",
         VARDECL_NAME(node), type_to_string(VARDECL_TYPE(node)));
 
     if VARDECL_INIT(node) {
-        printf(" <- ");
+        fprintf(OUT, " <- ");
     }
     TRAVchildren(node);
     return node;
@@ -321,7 +325,7 @@ node_st *PRTvardecl(node_st *node)
  */
 node_st *PRTstmts(node_st *node)
 {
-    printf("\n");
+    fprintf(OUT, "\n");
     print_indent();
     TRAVchildren(node);
     return node;
@@ -332,11 +336,11 @@ node_st *PRTstmts(node_st *node)
  */
 node_st *PRTassign(node_st *node)
 {
-    printf("ASSIGN(");
+    fprintf(OUT, "ASSIGN(");
     TRAVlet(node);
-    printf(" <- ");
+    fprintf(OUT, " <- ");
     TRAVexpr(node);
-    printf(")");
+    fprintf(OUT, ")");
     return node;
 }
 
@@ -345,11 +349,11 @@ node_st *PRTassign(node_st *node)
  */
 node_st *PRTbinop(node_st *node)
 {
-    printf("BINOP(");
+    fprintf(OUT, "BINOP(");
     TRAVleft(node);
-    printf(" %s ", BINOP_OP_STRINGS[BINOP_OP(node)]);
+    fprintf(OUT, " %s ", BINOP_OP_STRINGS[BINOP_OP(node)]);
     TRAVright(node);
-    printf(")");
+    fprintf(OUT, ")");
     return node;
 }
 
@@ -358,9 +362,9 @@ node_st *PRTbinop(node_st *node)
  */
 node_st *PRTmonop(node_st *node)
 {
-    printf("MONOP(%s", MONOP_OP_STRINGS[MONOP_OP(node)]);
+    fprintf(OUT, "MONOP(%s", MONOP_OP_STRINGS[MONOP_OP(node)]);
     TRAVchildren(node);
-    printf(")");
+    fprintf(OUT, ")");
     return node;
 }
 
@@ -369,7 +373,7 @@ node_st *PRTmonop(node_st *node)
  */
 node_st *PRTvarlet(node_st *node)
 {
-    printf("VARLET(%s)", VARLET_NAME(node));
+    fprintf(OUT, "VARLET(%s)", VARLET_NAME(node));
     TRAVchildren(node);
     return node;
 }
@@ -379,7 +383,7 @@ node_st *PRTvarlet(node_st *node)
  */
 node_st *PRTvar(node_st *node)
 {
-    printf("VAR(%s)", VAR_NAME(node));
+    fprintf(OUT, "VAR(%s)", VAR_NAME(node));
     TRAVchildren(node);
     return node;
 }
@@ -389,7 +393,7 @@ node_st *PRTvar(node_st *node)
  */
 node_st *PRTnum(node_st *node)
 {
-    printf("NUM(%i)", NUM_VAL(node));
+    fprintf(OUT, "NUM(%i)", NUM_VAL(node));
     TRAVchildren(node);
     return node;
 }
@@ -399,7 +403,7 @@ node_st *PRTnum(node_st *node)
  */
 node_st *PRTfloat(node_st *node)
 {
-    printf("FLOAT(%f)", FLOAT_VAL(node));
+    fprintf(OUT, "FLOAT(%f)", FLOAT_VAL(node));
     TRAVchildren(node);
     return node;
 }
@@ -409,7 +413,7 @@ node_st *PRTfloat(node_st *node)
  */
 node_st *PRTbool(node_st *node)
 {
-    printf("BOOL(%s)", bool_to_string(BOOL_VAL(node)));
+    fprintf(OUT, "BOOL(%s)", bool_to_string(BOOL_VAL(node)));
     TRAVchildren(node);
     return node;
 }
@@ -423,11 +427,11 @@ node_st *PRTbool(node_st *node)
 //
 //     if (ASSIGN_LET(node) != NULL) {
 //         TRAVlet(node);
-//         printf( " = ");
+//         fprintf(OUT,  " = ");
 //     }
 //
 //     TRAVexpr(node);
-//     printf( ";\n");
+//     fprintf(OUT,  ";\n");
 //
 //
 //     return node;
@@ -439,7 +443,7 @@ node_st *PRTbool(node_st *node)
 // node_st *PRTbinop(node_st *node)
 // {
 //     char *tmp = NULL;
-//     printf( "( ");
+//     fprintf(OUT,  "( ");
 //
 //     TRAVleft(node);
 //
@@ -487,11 +491,11 @@ node_st *PRTbool(node_st *node)
 //       DBUG_ASSERT(false, "unknown binop detected!");
 //     }
 //
-//     printf( " %s ", tmp);
+//     fprintf(OUT,  " %s ", tmp);
 //
 //     TRAVright(node);
 //
-//     printf( ")(%d:%d-%d)", NODE_BLINE(node), NODE_BCOL(node), NODE_ECOL(node));
+//     fprintf(OUT,  ")(%d:%d-%d)", NODE_BLINE(node), NODE_BCOL(node), NODE_ECOL(node));
 //
 //     return node;
 // }
@@ -501,7 +505,7 @@ node_st *PRTbool(node_st *node)
 //  */
 // node_st *PRTvarlet(node_st *node)
 // {
-//     printf("%s(%d:%d)", VARLET_NAME(node), NODE_BLINE(node), NODE_BCOL(node));
+//     fprintf(OUT, "%s(%d:%d)", VARLET_NAME(node), NODE_BLINE(node), NODE_BCOL(node));
 //     return node;
 // }
 //
@@ -510,7 +514,7 @@ node_st *PRTbool(node_st *node)
 //  */
 // node_st *PRTvar(node_st *node)
 // {
-//     printf( "%s", VAR_NAME(node));
+//     fprintf(OUT,  "%s", VAR_NAME(node));
 //     return node;
 // }
 //
@@ -519,7 +523,7 @@ node_st *PRTbool(node_st *node)
 //  */
 // node_st *PRTnum(node_st *node)
 // {
-//     printf("%d", NUM_VAL(node));
+//     fprintf(OUT, "%d", NUM_VAL(node));
 //     return node;
 // }
 //
@@ -528,7 +532,7 @@ node_st *PRTbool(node_st *node)
 //  */
 // node_st *PRTfloat(node_st *node)
 // {
-//     printf( "%f", FLOAT_VAL(node));
+//     fprintf(OUT,  "%f", FLOAT_VAL(node));
 //     return node;
 // }
 //
@@ -538,6 +542,6 @@ node_st *PRTbool(node_st *node)
 // node_st *PRTbool(node_st *node)
 // {
 //     char *bool_str = BOOL_VAL(node) ? "true" : "false";
-//     printf("%s", bool_str);
+//     fprintf(OUT, "%s", bool_str);
 //     return node;
 // }
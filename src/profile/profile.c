@@ -0,0 +1,353 @@
+/**
+ * @file
+ *
+ * Traversal: ProfileInstrumentation
+ * UID      : PRF
+ *
+ * Instruments the program for -fprofile-counts, before context analysis, so
+ * every backend and an unmodified VM run the counters like any other code.
+ * - A hidden global array counts function entries, loop iterations and the
+ *   arms of each if statement; an if without else gets an else arm that only
+ *   counts.
+ * - An exported function _profile_<module> prints an empty line and then one
+ *   line per counter with its index and count. The exported main calls it
+ *   when it returns.
+ * - A mapping file next to the output, <output>.prof, lists the kind,
+ *   function and source location of every counter index.
+ * Identifiers cannot start with an underscore, so the added names do not
+ * collide with those of the program.
+ */
+
+#include <ctype.h>
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+#include "ccngen/trav.h"
+
+#include "common.h"
+#include "global/globals.h"
+
+#define COUNTS_NAME "_prof_counts"
+#define RETURN_NAME "_prof_ret"
+#define INDEX_NAME "_prof_i"
+
+typedef struct Counter {
+    const char* kind;
+    const char* fun;
+    int line;
+    int col;
+} Counter;
+
+// Functions of civic.h the dump function prints with
+static const char* PRINT_NAMES[] = {"printInt", "printSpaces", "printNewlines"};
+
+static Counter* COUNTERS = NULL;
+static size_t COUNTER_COUNT = 0;
+static size_t COUNTER_SIZE = 0;
+
+static const char* CURRENT_FUN = NULL;
+static bool IN_MAIN = false;
+static enum Type MAIN_TYPE = CT_void;
+static char* DUMP_NAME = NULL;
+
+/**
+ * Registers a counter for a node
+ * @param kind what the counter counts
+ * @param node node whose location identifies the counter
+ * @return index of the counter
+ */
+static size_t add_counter(const char* kind, node_st* node) {
+    if (COUNTER_COUNT == COUNTER_SIZE) {
+        COUNTER_SIZE = COUNTER_SIZE == 0 ? INITIAL_LIST_SIZE : COUNTER_SIZE * 2;
+        ARRAY_RESIZE(COUNTERS, COUNTER_SIZE);
+    }
+    COUNTERS[COUNTER_COUNT] = (Counter) {kind, CURRENT_FUN, NODE_BLINE(node), NODE_BCOL(node)};
+    return COUNTER_COUNT++;
+}
+
+/**
+ * Creates an access to an element of the counter array
+ * @param index counter index, or NULL to index with the loop variable of the dump function
+ * @param let whether to create a VarLet instead of a Var
+ * @return Var or VarLet node
+ */
+static node_st* counter_ref(node_st* index, const bool let) {
+    node_st* indices = ASTexprs(index != NULL ? index : ASTvar(STRcpy(INDEX_NAME)), NULL);
+    if (let) {
+        node_st* varlet = ASTvarlet(STRcpy(COUNTS_NAME));
+        VARLET_INDICES(varlet) = indices;
+        return varlet;
+    }
+    node_st* var = ASTvar(STRcpy(COUNTS_NAME));
+    VAR_INDICES(var) = indices;
+    return var;
+}
+
+/**
+ * Prepends the increment of a new counter to a block
+ * @param block statements, may be NULL
+ * @param kind what the counter counts
+ * @param node node whose location identifies the counter
+ * @return the new block
+ */
+static node_st* count_at_start(node_st* block, const char* kind, node_st* node) {
+    const int index = (int) add_counter(kind, node);
+    node_st* increment = ASTassign(counter_ref(ASTnum(index), true),
+                                   ASTbinop(counter_ref(ASTnum(index), false), ASTnum(1), BO_add));
+    return ASTstmts(increment, block);
+}
+
+/**
+ * Appends a statement to a block
+ * @param block statements, may be NULL
+ * @param stmt statement to append
+ * @return the new block
+ */
+static node_st* append_stmt(node_st* block, node_st* stmt) {
+    if (block == NULL) return ASTstmts(stmt, NULL);
+
+    node_st* last = block;
+    while (STMTS_NEXT(last) != NULL) last = STMTS_NEXT(last);
+    STMTS_NEXT(last) = ASTstmts(stmt, NULL);
+    return block;
+}
+
+static node_st* call_stmt(const char* name, node_st* arg) {
+    node_st* call = ASTfuncall(STRcpy(name));
+    if (arg != NULL) FUNCALL_FUN_ARGS(call) = ASTexprs(arg, NULL);
+    return ASTexprstmt(call);
+}
+
+/**
+ * Names the dump function after the module, so every instrumented module
+ * exports its own
+ * @return name, to be freed by the caller
+ */
+static char* dump_name() {
+    const char* file = global.input_file != NULL ? global.input_file : "module";
+    const char* base = file_basename(file);
+    const char* dot = strrchr(base, '.');
+    const size_t len = dot != NULL ? (size_t) (dot - base) : strlen(base);
+
+    char* name = STRfmt("_profile_%.*s", (int) len, base);
+    for (char* c = name; *c != '\0'; c++) {
+        if (!isalnum((unsigned char) *c)) *c = '_';
+    }
+    return name;
+}
+
+/**
+ * Builds the exported function that prints every counter
+ * @return FunDef node
+ */
+static node_st* build_dump() {
+    node_st* body = NULL;
+    body = append_stmt(body, call_stmt("printInt", ASTvar(STRcpy(INDEX_NAME))));
+    body = append_stmt(body, call_stmt("printSpaces", ASTnum(1)));
+    body = append_stmt(body, call_stmt("printInt", counter_ref(NULL, false)));
+    body = append_stmt(body, call_stmt("printNewlines", ASTnum(1)));
+
+    node_st* loop = ASTfor(ASTnum(0), ASTnum((int) COUNTER_COUNT));
+    FOR_VAR(loop) = STRcpy(INDEX_NAME);
+    FOR_BLOCK(loop) = body;
+
+    node_st* fun = ASTfundef(STRcpy(DUMP_NAME), CT_void);
+    FUNDEF_EXPORT(fun) = true;
+    FUNDEF_IS_EXTERN(fun) = false;
+    FUNDEF_BODY(fun) = ASTfunbody();
+    // Start on a new line, the output of the program may not end with one
+    FUNBODY_STMTS(FUNDEF_BODY(fun)) = ASTstmts(call_stmt("printNewlines", ASTnum(1)), ASTstmts(loop, NULL));
+    return fun;
+}
+
+/**
+ * Checks whether the program declares or defines a function
+ * @param decls first Decls node
+ * @param name function name
+ * @return true if a function with this name exists
+ */
+static bool has_function(node_st* decls, const char* name) {
+    for (; decls != NULL; decls = DECLS_NEXT(decls)) {
+        node_st* decl = DECLS_DECL(decls);
+        if (NODE_TYPE(decl) == NT_FUNDEF && STReq(FUNDEF_NAME(decl), name)) return true;
+    }
+    return false;
+}
+
+/**
+ * Writes the mapping from counter index to source location, output to a stream has none
+ */
+static void write_mapping() {
+    if (global.output_stream != NULL) return;
+
+    const char* output = global.output_file != NULL ? global.output_file : global.input_file;
+    char* path = STRfmt("%s.prof", output);
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        USER_ERROR("Could not write profile mapping %s", path);
+        global.had_error = true;
+        MEMfree(path);
+        return;
+    }
+
+    fprintf(f, "# index kind function line:col, counts are printed by %s\n", DUMP_NAME);
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+        const Counter* c = &COUNTERS[i];
+        fprintf(f, "%lu %s %s %d:%d\n", i, c->kind, c->fun, c->line, c->col);
+    }
+
+    fclose(f);
+    MEMfree(path);
+}
+
+/**
+ * @fn PRFprogram
+ */
+node_st *PRFprogram(node_st *node)
+{
+    if (!global.profile_counts || global.had_error) return node;
+
+    DUMP_NAME = dump_name();
+    TRAVchildren(node);
+
+    if (COUNTER_COUNT > 0) {
+        node_st* decls = PROGRAM_DECLS(node);
+
+        // The dump function follows the program; the counters and the functions it prints with precede it
+        node_st* last = decls;
+        while (DECLS_NEXT(last) != NULL) last = DECLS_NEXT(last);
+        DECLS_NEXT(last) = ASTdecls(build_dump(), NULL);
+
+        node_st* counts = ASTglobdef(STRcpy(COUNTS_NAME), CT_int);
+        GLOBDEF_DIMS(counts) = ASTexprs(ASTnum((int) COUNTER_COUNT), NULL);
+        GLOBDEF_INIT(counts) = ASTnum(0);
+        decls = ASTdecls(counts, decls);
+
+        if (MAIN_TYPE != CT_void) decls = ASTdecls(ASTglobdef(STRcpy(RETURN_NAME), MAIN_TYPE), decls);
+
+        for (size_t i = 0; i < sizeof(PRINT_NAMES) / sizeof(PRINT_NAMES[0]); i++) {
+            if (has_function(decls, PRINT_NAMES[i])) continue;
+            node_st* fun = ASTfundef(STRcpy(PRINT_NAMES[i]), CT_void);
+            FUNDEF_PARAMS(fun) = ASTparam(STRcpy("val"), CT_int);
+            FUNDEF_IS_EXTERN(fun) = true;
+            decls = ASTdecls(fun, decls);
+        }
+
+        PROGRAM_DECLS(node) = decls;
+    }
+
+    write_mapping();
+
+    MEMfree(COUNTERS);
+    COUNTERS = NULL;
+    COUNTER_COUNT = 0;
+    COUNTER_SIZE = 0;
+    MEMfree(DUMP_NAME);
+    DUMP_NAME = NULL;
+    MAIN_TYPE = CT_void;
+    return node;
+}
+
+/**
+ * @fn PRFfundef
+ */
+node_st *PRFfundef(node_st *node)
+{
+    if (FUNDEF_BODY(node) == NULL) return node;
+
+    const char* prev_fun = CURRENT_FUN;
+    const bool prev_in_main = IN_MAIN;
+    CURRENT_FUN = FUNDEF_NAME(node);
+    IN_MAIN = FUNDEF_EXPORT(node) && STReq(FUNDEF_NAME(node), "main");
+    if (IN_MAIN) MAIN_TYPE = FUNDEF_TYPE(node);
+
+    node_st* body = FUNDEF_BODY(node);
+    FUNBODY_STMTS(body) = count_at_start(FUNBODY_STMTS(body), "entry", node);
+
+    // Nested functions are not part of main
+    const bool is_main = IN_MAIN;
+    IN_MAIN = false;
+    TRAVopt(FUNBODY_LOCAL_FUNDEFS(body));
+    IN_MAIN = is_main;
+    TRAVopt(FUNBODY_STMTS(body));
+
+    // Dump when a void main runs off its end
+    if (IN_MAIN && MAIN_TYPE == CT_void) {
+        node_st* last = FUNBODY_STMTS(body);
+        while (STMTS_NEXT(last) != NULL) last = STMTS_NEXT(last);
+        if (NODE_TYPE(STMTS_STMT(last)) != NT_RETURN) append_stmt(last, call_stmt(DUMP_NAME, NULL));
+    }
+
+    CURRENT_FUN = prev_fun;
+    IN_MAIN = prev_in_main;
+    return node;
+}
+
+/**
+ * @fn PRFstmts
+ */
+node_st *PRFstmts(node_st *node)
+{
+    TRAVstmt(node);
+
+    // Main dumps the counters once its return value is computed
+    node_st* stmt = STMTS_STMT(node);
+    if (IN_MAIN && NODE_TYPE(stmt) == NT_RETURN) {
+        node_st* next = STMTS_NEXT(node);
+        if (RETURN_EXPR(stmt) != NULL) {
+            node_st* save = ASTassign(ASTvarlet(STRcpy(RETURN_NAME)), RETURN_EXPR(stmt));
+            RETURN_EXPR(stmt) = ASTvar(STRcpy(RETURN_NAME));
+            STMTS_STMT(node) = save;
+            STMTS_NEXT(node) = ASTstmts(call_stmt(DUMP_NAME, NULL), ASTstmts(stmt, next));
+        } else {
+            STMTS_STMT(node) = call_stmt(DUMP_NAME, NULL);
+            STMTS_NEXT(node) = ASTstmts(stmt, next);
+        }
+        TRAVopt(next);
+        return node;
+    }
+
+    TRAVnext(node);
+    return node;
+}
+
+/**
+ * @fn PRFifelse
+ */
+node_st *PRFifelse(node_st *node)
+{
+    IFELSE_THEN(node) = count_at_start(IFELSE_THEN(node), "then", node);
+    IFELSE_ELSE_BLOCK(node) = count_at_start(IFELSE_ELSE_BLOCK(node), "else", node);
+    TRAVchildren(node);
+    return node;
+}
+
+/**
+ * @fn PRFwhile
+ */
+node_st *PRFwhile(node_st *node)
+{
+    WHILE_BLOCK(node) = count_at_start(WHILE_BLOCK(node), "loop", node);
+    TRAVchildren(node);
+    return node;
+}
+
+/**
+ * @fn PRFdowhile
+ */
+node_st *PRFdowhile(node_st *node)
+{
+    DOWHILE_BLOCK(node) = count_at_start(DOWHILE_BLOCK(node), "loop", node);
+    TRAVchildren(node);
+    return node;
+}
+
+/**
+ * @fn PRFfor
+ */
+node_st *PRFfor(node_st *node)
+{
+    FOR_BLOCK(node) = count_at_start(FOR_BLOCK(node), "loop", node);
+    TRAVchildren(node);
+    return node;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file
+ *
+ * Runtime for programs compiled with --emit=x86: the functions of civic.h,
+ * under the names the generated assembly links against. They are weak, so a
+ * module that exports a function of the same name takes precedence.
+ */
+
+#include <stdio.h>
+
+__attribute__((weak)) void civic_printInt(int val) {
+    printf("%d", val);
+}
+
+__attribute__((weak)) void civic_printFloat(float val) {
+    printf("%f", val);
+}
+
+__attribute__((weak)) int civic_scanInt(void) {
+    int val = 0;
+    if (scanf("%d", &val) != 1) val = 0;
+    return val;
+}
+
+__attribute__((weak)) float civic_scanFloat(void) {
+    float val = 0.0f;
+    if (scanf("%f", &val) != 1) val = 0.0f;
+    return val;
+}
+
+__attribute__((weak)) void civic_printSpaces(int num) {
+    for (; num > 0; num--) putchar(' ');
+}
+
+__attribute__((weak)) void civic_printNewlines(int num) {
+    for (; num > 0; num--) putchar('\n');
+}
@@ -17,9 +17,13 @@ static node_st *parseresult = NULL;
 extern int yylex();
 int yyerror(char *errname);
 extern FILE *yyin;
+void SPstartScanning(FILE *in);
 void AddLocToNode(node_st *node, void *begin_loc, void *end_loc);
 node_st* reverse_vardecls(node_st* head);
 
+// Lists such as exprs are right-recursive, so large array literals need a deep parser stack
+#define YYMAXDEPTH 1000000
+
 
 %}
 
@@ -243,7 +247,7 @@ assign: varlet LET expr SEMICOLON
         }
         ;
 
-exprstmt: expr SEMICOLON { $$ = ASTexprstmt($1); };
+exprstmt: expr SEMICOLON { $$ = ASTexprstmt($1); AddLocToNode($$, &@1, &@2); };
 
 ifstmt: IF BRACKET_L expr[cond] BRACKET_R ifstmtblock[thenblock] %prec THEN
         {
@@ -282,11 +286,13 @@ dowhilestmt: DO BRACE_L stmts[block] BRACE_R WHILE BRACKET_L expr[cond] BRACKET_
             {
               $$ = ASTdowhile($cond);
               DOWHILE_BLOCK($$) = $block;
+              AddLocToNode($$, &@1, &@9);
             }
            | DO stmt[block] WHILE BRACKET_L expr[cond] BRACKET_R SEMICOLON
             {
               $$ = ASTdowhile($cond);
               DOWHILE_BLOCK($$) = ASTstmts($block, NULL);
+              AddLocToNode($$, &@1, &@7);
             }
           ;
 
@@ -296,12 +302,14 @@ forstmt: FOR BRACKET_L INTTYPE ID[var] LET expr[init] COMMA expr[stop] COMMA exp
           FOR_STEP($$) = $step;
           FOR_BLOCK($$) = $block;
           FOR_VAR($$) = $var;
+          AddLocToNode($$, &@1, &@14);
         }
        | FOR BRACKET_L INTTYPE ID[var] LET expr[init] COMMA expr[stop] BRACKET_R BRACE_L stmts[block] BRACE_R
         {
           $$ = ASTfor($init, $stop);
           FOR_BLOCK($$) = $block;
           FOR_VAR($$) = $var;
+          AddLocToNode($$, &@1, &@12);
         }
        | FOR BRACKET_L INTTYPE ID[var] LET expr[init] COMMA expr[stop] COMMA expr[step] BRACKET_R stmt[block]
         {
@@ -309,12 +317,14 @@ forstmt: FOR BRACKET_L INTTYPE ID[var] LET expr[init] COMMA expr[stop] COMMA exp
           FOR_STEP($$) = $step;
           FOR_BLOCK($$) = ASTstmts($block, NULL);
           FOR_VAR($$) = $var;
+          AddLocToNode($$, &@1, &@block);
         }
        | FOR BRACKET_L INTTYPE ID[var] LET expr[init] COMMA expr[stop] BRACKET_R stmt[block]
         {
           $$ = ASTfor($init, $stop);
           FOR_BLOCK($$) = ASTstmts($block, NULL);
           FOR_VAR($$) = $var;
+          AddLocToNode($$, &@1, &@block);
         }
         ;
 
@@ -322,10 +332,12 @@ returnstmt: RETURN expr[val] SEMICOLON
             {
               $$ = ASTreturn();
               RETURN_EXPR($$) = $val;
+              AddLocToNode($$, &@1, &@3);
             }
           | RETURN SEMICOLON
             {
               $$ = ASTreturn();
+              AddLocToNode($$, &@1, &@2);
             }
           ;
 
@@ -368,21 +380,25 @@ vardecl: type[t] SBRACKET_L exprs[e] SBRACKET_R ID[name] SEMICOLON
         {
           $$ = ASTvardecl($name, $t);
           VARDECL_DIMS($$) = $e;
+          AddLocToNode($$, &@t, &@6);
         }
        | type[t] SBRACKET_L exprs[e] SBRACKET_R ID[name] LET expr[init] SEMICOLON
         {
           $$ = ASTvardecl($name, $t);
           VARDECL_INIT($$) = $init;
           VARDECL_DIMS($$) = $e;
+          AddLocToNode($$, &@t, &@8);
         }
        | type[t] ID[name] SEMICOLON
         {
           $$ = ASTvardecl($name, $t);
+          AddLocToNode($$, &@t, &@3);
         }
        | type[t] ID[name] LET expr[init] SEMICOLON
         {
           $$ = ASTvardecl($name, $t);
           VARDECL_INIT($$) = $init;
+          AddLocToNode($$, &@t, &@5);
         }
         ;
 
@@ -511,20 +527,39 @@ void AddLocToNode(node_st *node, void *begin_loc, void *end_loc)
 
 int yyerror(char *error)
 {
-  CTI(CTI_ERROR, true, "line %d, col %d\nError parsing source code: %s\n",
-            global.line, global.col, error);
-  CTIabortOnError();
+  // After a lexer error the parser only sees the end of the input
+  if (global.had_error) return 0;
+
+  fprintf(GLBdiagnostics(), "ERROR: line %d, col %d\nError parsing source code: %s\n",
+          global.line, global.col, error);
+  global.had_error = true;
   return 0;
 }
 
+/**
+ * Parses global.input_buffer if set, otherwise global.input_file. Errors leave
+ * an empty program that the other phases skip.
+ */
 node_st *SPdoScanParse(node_st *root)
 {
     DBUG_ASSERT(root == NULL, "Started parsing with existing syntax tree.");
-    yyin = fopen(global.input_file, "r");
+    if (global.input_buffer != NULL) {
+        yyin = fmemopen((void *) global.input_buffer, global.input_size, "r");
+    } else {
+        yyin = fopen(global.input_file, "r");
+    }
     if (yyin == NULL) {
-        CTI(CTI_ERROR, true, "Cannot open file '%s'.", global.input_file);
-        CTIabortOnError();
+        fprintf(GLBdiagnostics(), "ERROR: Cannot open file '%s'.\n", global.input_file);
+        global.had_error = true;
+        return ASTprogram(NULL);
     }
-    yyparse();
+
+    parseresult = NULL;
+    SPstartScanning(yyin);
+    const int failed = yyparse();
+    fclose(yyin);
+    yyin = NULL;
+
+    if (failed != 0 || global.had_error) return ASTprogram(NULL);
     return parseresult;
 }
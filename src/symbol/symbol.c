@@ -18,6 +18,8 @@ static Symbol* SBnew(const char* name, const ValueType vt, const bool imported)
     s->name = STRcpy(name);
     s->imported = imported;
     s->exported = false;
+    s->is_constant = false;
+    s->constant = 0;
     s->parent_scope = NULL;
     return s;
 }
@@ -38,6 +40,7 @@ Symbol* SBfromFun(const char* name, const ValueType vt, const size_t param_count
     s->as.fun.param_ptr = 0;
     s->as.fun.param_types = MEMmalloc(sizeof(ValueType) * param_count);
     s->as.fun.param_dim_counts = MEMmalloc(sizeof(size_t) * param_count);
+    s->as.fun.dead_params = NULL;
     return s;
 }
 
@@ -92,6 +95,7 @@ void SBfree(Symbol** s_ptr) {
             MEMfree(s->as.fun.label_name);
             MEMfree(s->as.fun.param_types);
             MEMfree(s->as.fun.param_dim_counts);
+            MEMfree(s->as.fun.dead_params);
             if (!s->imported) STfree(&s->as.fun.scope);
             break;
         case ST_ARRAYVAR:
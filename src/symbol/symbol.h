@@ -18,6 +18,7 @@ typedef struct {
     size_t param_ptr;
     ValueType* param_types;
     size_t* param_dim_counts;           // Only non-zero for param_types that are arrays
+    bool* dead_params;                  // Parameters that are not passed; NULL if all are
     struct SymbolTable* scope;          // Scope belonging to this function
 } FunData;
 
@@ -32,6 +33,8 @@ typedef struct Symbol {
     size_t offset;                      // Offset within scope
     bool imported;                      // True for imported identifiers
     bool exported;                      // True for exported identifiers
+    bool is_constant;                   // True for int parameters that every call passes the same value
+    int constant;                       // Value of a constant parameter
     struct SymbolTable* parent_scope;   // Scope this symbol is assigned to
     union {
         ArrayData array;
@@ -0,0 +1,438 @@
+// src/vm/loader.c
+
+#include "vm.h"
+
+#include "bytecode/binary.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE_LEN 4096
+#define MAX_TOKENS 64
+
+typedef struct LabelEntry {
+    char* name;
+    size_t target;
+} LabelEntry;
+
+typedef enum {
+    REF_EXPORT,                         // Target of a function export
+    REF_ARG0,                           // First operand of an instruction
+    REF_ARG1,                           // Second operand of an instruction
+} RefKind;
+
+typedef struct LabelRef {               // Label use that is resolved once all labels are known
+    char* name;
+    RefKind kind;
+    size_t index;                       // Export index or code index, depending on kind
+} LabelRef;
+
+typedef struct Loader {
+    const char* path;
+    size_t line;
+    VMModule* module;
+    size_t code_size, const_size, global_size;
+    size_t fun_import_size, var_import_size, fun_export_size, var_export_size;
+    LabelEntry* labels;
+    size_t label_count, label_size;
+    LabelRef* refs;
+    size_t ref_count, ref_size;
+    bool had_error;
+} Loader;
+
+#define GROW(arr, count, size) do { \
+    if ((count) >= (size)) { \
+        (size) = (size) == 0 ? 16 : (size) * 2; \
+        (arr) = realloc((arr), (size) * sizeof(*(arr))); \
+    } \
+} while (false)
+
+/**
+ * Reports an error at the current line of the assembly file
+ * @param ld loader state
+ * @param msg error message
+ * @param detail offending text, may be NULL
+ */
+static void load_error(Loader* ld, const char* msg, const char* detail) {
+    fprintf(stderr, "civvm-lite: %s:%lu: %s '%s'\n", ld->path, ld->line, msg, detail ? detail : "");
+    ld->had_error = true;
+}
+
+/**
+ * Copies a string into newly allocated memory
+ * @param s string to copy
+ * @return copy of the string
+ */
+static char* copy_str(const char* s) {
+    const size_t len = strlen(s);
+    char* res = malloc(len + 1);
+    memcpy(res, s, len + 1);
+    return res;
+}
+
+/**
+ * Splits a line into whitespace separated tokens. Quotes around names are stripped.
+ * Everything after a ';' is treated as a comment.
+ * @param line line to split, modified in place
+ * @param tokens set to the start of every token
+ * @return amount of tokens found
+ */
+static size_t tokenise(char* line, char** tokens) {
+    size_t count = 0;
+    char* p = line;
+
+    while (*p != '\0' && count < MAX_TOKENS) {
+        while (isspace((unsigned char) *p)) p++;
+        if (*p == '\0' || *p == ';') break;
+
+        if (*p == '"') {
+            p++;
+            tokens[count++] = p;
+            while (*p != '\0' && *p != '"') p++;
+        } else {
+            tokens[count++] = p;
+            while (*p != '\0' && !isspace((unsigned char) *p)) p++;
+        }
+
+        if (*p != '\0') *p++ = '\0';
+    }
+
+    return count;
+}
+
+/**
+ * Parses a type name as used in import and export directives
+ * @param s type name
+ * @param kind set to the parsed kind
+ * @return true if the type name is known
+ */
+static bool parse_kind(const char* s, ValueKind* kind) {
+    if (strcmp(s, "int") == 0) *kind = VK_INT;
+    else if (strcmp(s, "float") == 0) *kind = VK_FLOAT;
+    else if (strcmp(s, "bool") == 0) *kind = VK_BOOL;
+    else if (strcmp(s, "void") == 0) *kind = VK_VOID;
+    else if (strcmp(s, "int[]") == 0 || strcmp(s, "float[]") == 0 || strcmp(s, "bool[]") == 0) *kind = VK_ARRAY;
+    else return false;
+    return true;
+}
+
+/**
+ * Registers a label use that is resolved after the whole file is read
+ * @param ld loader state
+ * @param name label name
+ * @param kind where the resolved target is stored
+ * @param index export index or code index, depending on kind
+ */
+static void add_label_ref(Loader* ld, const char* name, const RefKind kind, const size_t index) {
+    GROW(ld->refs, ld->ref_count, ld->ref_size);
+    ld->refs[ld->ref_count++] = (LabelRef){copy_str(name), kind, index};
+}
+
+/**
+ * Parses a directive line, which declares constants, globals, imports and exports
+ * @param ld loader state
+ * @param tok tokens of the line
+ * @param n amount of tokens
+ */
+static void parse_directive(Loader* ld, char** tok, const size_t n) {
+    VMModule* m = ld->module;
+
+    if (strcmp(tok[0], ".const") == 0 && n == 3) {
+        GROW(m->consts, m->const_count, ld->const_size);
+        VMValue v;
+        if (strcmp(tok[1], "int") == 0) v.i = (int32_t) strtol(tok[2], NULL, 10);
+        else if (strcmp(tok[1], "float") == 0) v.f = strtof(tok[2], NULL);
+        else if (strcmp(tok[1], "bool") == 0) v.b = strcmp(tok[2], "true") == 0;
+        else { load_error(ld, "unknown constant type", tok[1]); return; }
+        m->consts[m->const_count++] = v;
+    } else if (strcmp(tok[0], ".global") == 0 && n == 2) {
+        GROW(m->globals, m->global_count, ld->global_size);
+        m->globals[m->global_count++] = (VMValue){0};
+    } else if (strcmp(tok[0], ".importfun") == 0 && n >= 3) {
+        GROW(m->fun_imports, m->fun_import_count, ld->fun_import_size);
+        VMFunImport* imp = &m->fun_imports[m->fun_import_count++];
+        memset(imp, 0, sizeof(*imp));
+        imp->name = copy_str(tok[1]);
+        if (!parse_kind(tok[2], &imp->ret)) load_error(ld, "unknown return type", tok[2]);
+        imp->arg_count = n - 3;
+    } else if (strcmp(tok[0], ".importvar") == 0 && n == 3) {
+        GROW(m->var_imports, m->var_import_count, ld->var_import_size);
+        VMVarImport* imp = &m->var_imports[m->var_import_count++];
+        imp->name = copy_str(tok[1]);
+        imp->slot = NULL;
+        if (!parse_kind(tok[2], &imp->kind)) load_error(ld, "unknown variable type", tok[2]);
+    } else if (strcmp(tok[0], ".exportfun") == 0 && n >= 4) {
+        GROW(m->fun_exports, m->fun_export_count, ld->fun_export_size);
+        VMFunExport* exp = &m->fun_exports[m->fun_export_count++];
+        exp->name = copy_str(tok[1]);
+        if (!parse_kind(tok[2], &exp->ret)) load_error(ld, "unknown return type", tok[2]);
+        exp->arg_count = n - 4;
+        exp->target = 0;
+        add_label_ref(ld, tok[n - 1], REF_EXPORT, m->fun_export_count - 1);
+    } else if (strcmp(tok[0], ".exportvar") == 0 && n == 3) {
+        GROW(m->var_exports, m->var_export_count, ld->var_export_size);
+        VMVarExport* exp = &m->var_exports[m->var_export_count++];
+        exp->name = copy_str(tok[1]);
+        exp->global_index = strtoul(tok[2], NULL, 10);
+    } else {
+        load_error(ld, "malformed directive", tok[0]);
+    }
+}
+
+/**
+ * Parses an instruction line and appends it to the code of the module
+ * @param ld loader state
+ * @param tok tokens of the line
+ * @param n amount of tokens
+ */
+static void parse_instruction(Loader* ld, char** tok, const size_t n) {
+    VMModule* m = ld->module;
+
+    Opcode op;
+    if (!OPfind(tok[0], &op)) {
+        load_error(ld, "unknown instruction", tok[0]);
+        return;
+    }
+
+    const OpInfo* info = &OPCODE_TABLE[op];
+    if (n - 1 != info->operand_count) {
+        load_error(ld, "wrong operand count for", tok[0]);
+        return;
+    }
+
+    GROW(m->code, m->code_len, ld->code_size);
+    VMInstr* instr = &m->code[m->code_len++];
+    instr->op = op;
+    instr->arg0 = 0;
+    instr->arg1 = 0;
+    instr->line = ld->line;
+
+    for (size_t i = 0; i < info->operand_count; i++) {
+        int32_t* slot = i == 0 ? &instr->arg0 : &instr->arg1;
+        if (info->operands[i] == OPND_LABEL) {
+            add_label_ref(ld, tok[i + 1], i == 0 ? REF_ARG0 : REF_ARG1, m->code_len - 1);
+        } else {
+            char* end;
+            *slot = (int32_t) strtol(tok[i + 1], &end, 10);
+            if (*end != '\0') load_error(ld, "invalid operand", tok[i + 1]);
+        }
+    }
+}
+
+/**
+ * Finds the code index of a label
+ * @param ld loader state
+ * @param name label name
+ * @param target set to the code index of the label
+ * @return true if the label exists
+ */
+static bool find_label(const Loader* ld, const char* name, size_t* target) {
+    for (size_t i = 0; i < ld->label_count; i++) {
+        if (strcmp(ld->labels[i].name, name) == 0) {
+            *target = ld->labels[i].target;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Resolves all registered label uses and frees the label administration
+ * @param ld loader state
+ */
+static void resolve_labels(Loader* ld) {
+    VMModule* m = ld->module;
+
+    for (size_t i = 0; i < ld->ref_count; i++) {
+        LabelRef* ref = &ld->refs[i];
+        size_t target;
+        if (!find_label(ld, ref->name, &target)) {
+            load_error(ld, "undefined label", ref->name);
+        } else {
+            switch (ref->kind) {
+                case REF_EXPORT: m->fun_exports[ref->index].target = target; break;
+                case REF_ARG0: m->code[ref->index].arg0 = (int32_t) target; break;
+                case REF_ARG1: m->code[ref->index].arg1 = (int32_t) target; break;
+            }
+        }
+        free(ref->name);
+    }
+
+    for (size_t i = 0; i < ld->label_count; i++) free(ld->labels[i].name);
+    free(ld->labels);
+    free(ld->refs);
+}
+
+/**
+ * Maps a type of the binary format to the kind of value it holds
+ * @param type binary type
+ * @return value kind
+ */
+static ValueKind bin_kind(const BinType type) {
+    switch (type) {
+        case BT_INT: return VK_INT;
+        case BT_FLOAT: return VK_FLOAT;
+        case BT_BOOL: return VK_BOOL;
+        case BT_VOID: return VK_VOID;
+        default: return VK_ARRAY;
+    }
+}
+
+/**
+ * Loads a binary module as produced by civicc --emit=binary. Labels are
+ * already resolved, so the tables are copied over directly.
+ * @param path path to the module, for diagnostics
+ * @param f file positioned at the start of the module
+ * @return loaded module, or NULL on error
+ */
+static VMModule* load_binary(const char* path, FILE* f) {
+    BinModule bin;
+    if (!BINread(f, &bin)) {
+        fprintf(stderr, "civvm-lite: %s: malformed binary module\n", path);
+        BINfree(&bin);
+        return NULL;
+    }
+
+    VMModule* m = calloc(1, sizeof(VMModule));
+    m->path = copy_str(path);
+
+    m->code_len = bin.code_len;
+    m->code = calloc(bin.code_len, sizeof(VMInstr));
+    for (size_t i = 0; i < bin.code_len; i++) {
+        // There are no assembly lines, so diagnostics refer to the instruction number
+        m->code[i] = (VMInstr){bin.code[i].op, bin.code[i].args[0], bin.code[i].args[1], i + 1};
+    }
+
+    m->const_count = bin.const_count;
+    m->consts = calloc(bin.const_count, sizeof(VMValue));
+    for (size_t i = 0; i < bin.const_count; i++) {
+        switch (bin.consts[i].type) {
+            case BT_FLOAT: m->consts[i].f = bin.consts[i].as.f; break;
+            case BT_BOOL: m->consts[i].b = bin.consts[i].as.b; break;
+            default: m->consts[i].i = bin.consts[i].as.i; break;
+        }
+    }
+
+    m->global_count = bin.global_count;
+    m->globals = calloc(bin.global_count, sizeof(VMValue));
+
+    m->fun_import_count = bin.fun_import_count;
+    m->fun_imports = calloc(bin.fun_import_count, sizeof(VMFunImport));
+    for (size_t i = 0; i < bin.fun_import_count; i++) {
+        m->fun_imports[i].name = copy_str(bin.fun_imports[i].name);
+        m->fun_imports[i].ret = bin_kind(bin.fun_imports[i].ret);
+        m->fun_imports[i].arg_count = bin.fun_imports[i].arg_count;
+    }
+
+    m->var_import_count = bin.var_import_count;
+    m->var_imports = calloc(bin.var_import_count, sizeof(VMVarImport));
+    for (size_t i = 0; i < bin.var_import_count; i++) {
+        m->var_imports[i].name = copy_str(bin.var_imports[i].name);
+        m->var_imports[i].kind = bin_kind(bin.var_imports[i].type);
+    }
+
+    m->fun_export_count = bin.fun_export_count;
+    m->fun_exports = calloc(bin.fun_export_count, sizeof(VMFunExport));
+    for (size_t i = 0; i < bin.fun_export_count; i++) {
+        m->fun_exports[i].name = copy_str(bin.fun_exports[i].name);
+        m->fun_exports[i].ret = bin_kind(bin.fun_exports[i].ret);
+        m->fun_exports[i].arg_count = bin.fun_exports[i].arg_count;
+        m->fun_exports[i].target = bin.fun_exports[i].target;
+    }
+
+    m->var_export_count = bin.var_export_count;
+    m->var_exports = calloc(bin.var_export_count, sizeof(VMVarExport));
+    for (size_t i = 0; i < bin.var_export_count; i++) {
+        m->var_exports[i].name = copy_str(bin.var_exports[i].name);
+        m->var_exports[i].global_index = bin.var_exports[i].global_index;
+    }
+
+    // Stack depths let calls check the operand stack before entering a function
+    if (bin.stack_count > 0) {
+        m->stack_needs = calloc(bin.code_len + 1, sizeof(size_t));
+        for (size_t i = 0; i < bin.stack_count; i++) m->stack_needs[bin.stacks[i].target] = bin.stacks[i].depth;
+    }
+
+    BINfree(&bin);
+    return m;
+}
+
+/**
+ * Loads a module as produced by civicc, either textual assembly or a binary module
+ * @param path path to assembly file or binary module
+ * @return loaded module, or NULL on error
+ */
+VMModule* VMloadModule(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "civvm-lite: cannot open '%s'\n", path);
+        return NULL;
+    }
+
+    if (BINisBinary(f)) {
+        VMModule* m = load_binary(path, f);
+        fclose(f);
+        return m;
+    }
+
+    Loader ld;
+    memset(&ld, 0, sizeof(ld));
+    ld.path = path;
+    ld.module = calloc(1, sizeof(VMModule));
+    ld.module->path = copy_str(path);
+
+    char buf[MAX_LINE_LEN];
+    char* tok[MAX_TOKENS];
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        ld.line++;
+        const size_t n = tokenise(buf, tok);
+        if (n == 0) continue;
+
+        const size_t len = strlen(tok[0]);
+        if (tok[0][0] == '.') {
+            parse_directive(&ld, tok, n);
+        } else if (n == 1 && len > 1 && tok[0][len - 1] == ':') {
+            tok[0][len - 1] = '\0';
+            GROW(ld.labels, ld.label_count, ld.label_size);
+            ld.labels[ld.label_count++] = (LabelEntry){copy_str(tok[0]), ld.module->code_len};
+        } else {
+            parse_instruction(&ld, tok, n);
+        }
+    }
+    fclose(f);
+
+    resolve_labels(&ld);
+
+    if (ld.had_error) {
+        VMfreeModule(&ld.module);
+        return NULL;
+    }
+
+    return ld.module;
+}
+
+/**
+ * Frees a module and sets its pointer to NULL
+ * @param module_ptr double pointer to module
+ */
+void VMfreeModule(VMModule** module_ptr) {
+    VMModule* m = *module_ptr;
+
+    for (size_t i = 0; i < m->fun_import_count; i++) free(m->fun_imports[i].name);
+    for (size_t i = 0; i < m->var_import_count; i++) free(m->var_imports[i].name);
+    for (size_t i = 0; i < m->fun_export_count; i++) free(m->fun_exports[i].name);
+    for (size_t i = 0; i < m->var_export_count; i++) free(m->var_exports[i].name);
+
+    free(m->fun_imports);
+    free(m->var_imports);
+    free(m->fun_exports);
+    free(m->var_exports);
+    free(m->code);
+    free(m->consts);
+    free(m->globals);
+    free(m->stack_needs);
+    free(m->path);
+    free(m);
+    *module_ptr = NULL;
+}
@@ -0,0 +1,99 @@
+// src/vm/main.c
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "bytecode/binary.h"
+
+#define DEFAULT_STACK_SIZE (1 << 20)
+
+static void Usage(char *program) {
+    char *program_bin = strrchr(program, '/');
+    if (program_bin)
+        program = program_bin + 1;
+
+    printf("Usage: %s [OPTION...] <assembly file>...\n", program);
+    printf("Options:\n");
+    printf("  -h                           This help message.\n");
+    printf("  --count/-c                   Report executed instruction counts to STDERR.\n");
+    printf("  --stack/-s <size>            Operand stack size in values.\n");
+    printf("  --disassemble/-d             Print binary modules as assembly instead of running them.\n");
+}
+
+/**
+ * Prints a binary module as textual assembly to STDOUT
+ * @param path path to the binary module
+ * @return true on success
+ */
+static bool disassemble(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "civvm-lite: cannot open '%s'\n", path);
+        return false;
+    }
+
+    BinModule bin;
+    const bool ok = BINread(f, &bin);
+    fclose(f);
+    if (ok) BINdisassemble(stdout, &bin);
+    else fprintf(stderr, "civvm-lite: %s: not a binary module\n", path);
+
+    BINfree(&bin);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"count", no_argument, 0, 'c'},
+        {"stack", required_argument, 0, 's'},
+        {"disassemble", no_argument, 0, 'd'},
+        {0, 0, 0, 0}};
+
+    bool count = false;
+    bool disassemble_only = false;
+    size_t stack_size = DEFAULT_STACK_SIZE;
+    int option_index;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hcds:", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'c': count = true; break;
+            case 'd': disassemble_only = true; break;
+            case 's': stack_size = strtoul(optarg, NULL, 10); break;
+            case 'h': Usage(argv[0]); exit(EXIT_SUCCESS);
+            default: Usage(argv[0]); exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc) {
+        Usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (disassemble_only) {
+        bool ok = true;
+        for (int i = optind; i < argc; i++) ok = disassemble(argv[i]) && ok;
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    VM vm;
+    VMinit(&vm, stack_size);
+    vm.module_count = (size_t) (argc - optind);
+    vm.modules = calloc(vm.module_count, sizeof(VMModule*));
+
+    for (int i = optind; i < argc; i++) {
+        vm.modules[i - optind] = VMloadModule(argv[i]);
+        if (vm.modules[i - optind] == NULL) exit(EXIT_FAILURE);
+    }
+
+    if (!VMlink(&vm)) exit(EXIT_FAILURE);
+
+    const int ret = VMrun(&vm);
+    if (count) VMreportCounts(&vm, stderr);
+
+    VMfree(&vm);
+    return ret;
+}
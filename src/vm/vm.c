@@ -0,0 +1,512 @@
+// src/vm/vm.c
+
+#include "vm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_LOCALS_SIZE 1024
+#define INITIAL_FRAMES_SIZE 64
+
+/* Reports a runtime error with the assembly line of the failing instruction and stops */
+#define RUNTIME_ERROR(m, instr, fmt, ...) do { \
+    fprintf(stderr, "civvm-lite: runtime error at %s:%lu: ", (m)->path, (instr)->line); \
+    fprintf(stderr, fmt, ##__VA_ARGS__); \
+    fprintf(stderr, "\n"); \
+    exit(EXIT_FAILURE); \
+} while (false)
+
+#define PUSH(v) do { \
+    if (vm->sp >= vm->stack_size) RUNTIME_ERROR(m, instr, "operand stack overflow (%lu values)", vm->stack_size); \
+    vm->stack[vm->sp++] = (v); \
+    if (vm->sp > vm->max_sp) vm->max_sp = vm->sp; \
+} while (false)
+
+/* With known stack depths, overflows are reported at the call instead of deep inside the callee */
+#define CHECK_STACK(callee, target, arg_count) do { \
+    if ((callee)->stack_needs != NULL && vm->sp - (arg_count) + (callee)->stack_needs[target] > vm->stack_size) { \
+        RUNTIME_ERROR(m, instr, "operand stack overflow, callee needs %lu values", (callee)->stack_needs[target]); \
+    } \
+} while (false)
+
+#define POP() (vm->stack[--vm->sp])
+#define TOP() (vm->stack[vm->sp - 1])
+
+#define GROW_TO(arr, size, needed) do { \
+    while ((needed) > (size)) { \
+        (size) *= 2; \
+        (arr) = realloc((arr), (size) * sizeof(*(arr))); \
+    } \
+} while (false)
+
+/**
+ * Initialises a virtual machine without any modules
+ * @param vm machine to initialise
+ * @param stack_size maximum amount of values on the operand stack
+ */
+void VMinit(VM* vm, const size_t stack_size) {
+    memset(vm, 0, sizeof(*vm));
+    vm->stack_size = stack_size;
+    vm->stack = malloc(stack_size * sizeof(VMValue));
+    vm->locals_size = INITIAL_LOCALS_SIZE;
+    vm->locals = calloc(vm->locals_size, sizeof(VMValue));
+    vm->frames_size = INITIAL_FRAMES_SIZE;
+    vm->frames = malloc(vm->frames_size * sizeof(VMFrame));
+    vm->pending_size = INITIAL_FRAMES_SIZE;
+    vm->pending_links = malloc(vm->pending_size * sizeof(long));
+}
+
+/**
+ * Frees all memory owned by the machine, including its modules and arrays
+ * @param vm machine to free
+ */
+void VMfree(VM* vm) {
+    for (size_t i = 0; i < vm->module_count; i++) VMfreeModule(&vm->modules[i]);
+    free(vm->modules);
+
+    VMArray* arr = vm->arrays;
+    while (arr != NULL) {
+        VMArray* next = arr->next;
+        free(arr->data);
+        free(arr);
+        arr = next;
+    }
+
+    free(vm->stack);
+    free(vm->locals);
+    free(vm->frames);
+    free(vm->pending_links);
+}
+
+/**
+ * Finds the function of civic.h an import refers to
+ * @param name imported function name
+ * @return builtin function, or BUILTIN_NONE if it is not one
+ */
+static Builtin find_builtin(const char* name) {
+    if (strcmp(name, "printInt") == 0) return BUILTIN_PRINT_INT;
+    if (strcmp(name, "printFloat") == 0) return BUILTIN_PRINT_FLOAT;
+    if (strcmp(name, "scanInt") == 0) return BUILTIN_SCAN_INT;
+    if (strcmp(name, "scanFloat") == 0) return BUILTIN_SCAN_FLOAT;
+    if (strcmp(name, "printSpaces") == 0) return BUILTIN_PRINT_SPACES;
+    if (strcmp(name, "printNewlines") == 0) return BUILTIN_PRINT_NEWLINES;
+    return BUILTIN_NONE;
+}
+
+/**
+ * Finds a function exported by a module
+ * @param m module to search
+ * @param name function name
+ * @return export entry, or NULL if the module does not export the function
+ */
+static const VMFunExport* find_fun_export(const VMModule* m, const char* name) {
+    for (size_t i = 0; i < m->fun_export_count; i++) {
+        if (strcmp(m->fun_exports[i].name, name) == 0) return &m->fun_exports[i];
+    }
+    return NULL;
+}
+
+/**
+ * Finds a variable exported by a module
+ * @param m module to search
+ * @param name variable name
+ * @return export entry, or NULL if the module does not export the variable
+ */
+static const VMVarExport* find_var_export(const VMModule* m, const char* name) {
+    for (size_t i = 0; i < m->var_export_count; i++) {
+        if (strcmp(m->var_exports[i].name, name) == 0) return &m->var_exports[i];
+    }
+    return NULL;
+}
+
+/**
+ * Resolves all function and variable imports of all loaded modules
+ * @param vm machine with loaded modules
+ * @return true if every import was resolved
+ */
+bool VMlink(VM* vm) {
+    bool ok = true;
+
+    for (size_t i = 0; i < vm->module_count; i++) {
+        VMModule* m = vm->modules[i];
+
+        for (size_t j = 0; j < m->fun_import_count; j++) {
+            VMFunImport* imp = &m->fun_imports[j];
+            for (size_t k = 0; k < vm->module_count && imp->module == NULL; k++) {
+                const VMFunExport* exp = find_fun_export(vm->modules[k], imp->name);
+                if (exp != NULL) {
+                    imp->module = vm->modules[k];
+                    imp->target = exp->target;
+                }
+            }
+
+            if (imp->module == NULL) imp->builtin = find_builtin(imp->name);
+            if (imp->module == NULL && imp->builtin == BUILTIN_NONE) {
+                fprintf(stderr, "civvm-lite: %s: unresolved function import '%s'\n", m->path, imp->name);
+                ok = false;
+            }
+        }
+
+        for (size_t j = 0; j < m->var_import_count; j++) {
+            VMVarImport* imp = &m->var_imports[j];
+            for (size_t k = 0; k < vm->module_count && imp->slot == NULL; k++) {
+                const VMVarExport* exp = find_var_export(vm->modules[k], imp->name);
+                if (exp != NULL && exp->global_index < vm->modules[k]->global_count) {
+                    imp->slot = &vm->modules[k]->globals[exp->global_index];
+                }
+            }
+
+            if (imp->slot == NULL) {
+                fprintf(stderr, "civvm-lite: %s: unresolved variable import '%s'\n", m->path, imp->name);
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Allocates a zeroed array that is freed when the machine is freed
+ * @param vm machine to allocate for
+ * @param size amount of elements
+ * @return new array
+ */
+static VMArray* new_array(VM* vm, const size_t size) {
+    VMArray* arr = malloc(sizeof(VMArray));
+    arr->size = size;
+    arr->data = calloc(size == 0 ? 1 : size, sizeof(VMValue));
+    arr->next = vm->arrays;
+    vm->arrays = arr;
+    return arr;
+}
+
+/**
+ * Pushes a new frame for a subroutine call and moves the arguments from the
+ * operand stack into its first locals
+ * @param vm machine to run on
+ * @param ret_module module to return to
+ * @param ret_pc code index to return to
+ * @param arg_count amount of arguments on the operand stack
+ */
+static void push_frame(VM* vm, VMModule* ret_module, const size_t ret_pc, const size_t arg_count) {
+    if (vm->frame_count == vm->frames_size) {
+        vm->frames_size *= 2;
+        vm->frames = realloc(vm->frames, vm->frames_size * sizeof(VMFrame));
+    }
+
+    VMFrame* frame = &vm->frames[vm->frame_count++];
+    frame->locals_base = vm->locals_top;
+    frame->local_count = arg_count;
+    frame->static_link = vm->pending_count > 0 ? vm->pending_links[--vm->pending_count] : -1;
+    frame->ret_module = ret_module;
+    frame->ret_pc = ret_pc;
+
+    GROW_TO(vm->locals, vm->locals_size, vm->locals_top + arg_count);
+    memcpy(&vm->locals[vm->locals_top], &vm->stack[vm->sp - arg_count], arg_count * sizeof(VMValue));
+    vm->sp -= arg_count;
+    vm->locals_top += arg_count;
+}
+
+/**
+ * Remembers the static link for the frame created by the next jsr
+ * @param vm machine to run on
+ * @param link frame index of the lexically enclosing function, -1 for none
+ */
+static void push_link(VM* vm, const long link) {
+    if (vm->pending_count == vm->pending_size) {
+        vm->pending_size *= 2;
+        vm->pending_links = realloc(vm->pending_links, vm->pending_size * sizeof(long));
+    }
+    vm->pending_links[vm->pending_count++] = link;
+}
+
+/**
+ * Follows the static link chain starting at a frame
+ * @param vm machine to run on
+ * @param frame frame index to start from
+ * @param depth amount of links to follow
+ * @return frame index reached, -1 if the chain ends first
+ */
+static long follow_links(const VM* vm, long frame, int32_t depth) {
+    while (depth-- > 0 && frame >= 0) frame = vm->frames[frame].static_link;
+    return frame;
+}
+
+/**
+ * Runs the function at pc until it returns to the caller of this function
+ * @param vm machine to run on
+ * @param m module containing the function
+ * @param pc code index of the function label
+ * @param result receives the return value of the function
+ */
+static void execute(VM* vm, VMModule* m, size_t pc, VMValue* result) {
+    const size_t entry_frames = vm->frame_count;
+    push_frame(vm, NULL, 0, 0);
+
+    if (m->stack_needs != NULL && vm->sp + m->stack_needs[pc] > vm->stack_size) {
+        fprintf(stderr, "civvm-lite: %s: operand stack of %lu values is too small, entry needs %lu\n",
+            m->path, vm->stack_size, m->stack_needs[pc]);
+        exit(EXIT_FAILURE);
+    }
+
+    VMInstr* code = m->code;
+    VMFrame* frame = &vm->frames[vm->frame_count - 1];
+    VMValue* locals = &vm->locals[frame->locals_base];
+
+    for (;;) {
+        const VMInstr* instr = &code[pc++];
+        vm->op_counts[instr->op]++;
+
+        switch (instr->op) {
+            case OP_ILOAD: case OP_FLOAD: case OP_BLOAD: case OP_ALOAD:
+                PUSH(locals[instr->arg0]); break;
+            case OP_ILOAD_0: case OP_FLOAD_0: case OP_BLOAD_0: case OP_ALOAD_0: PUSH(locals[0]); break;
+            case OP_ILOAD_1: case OP_FLOAD_1: case OP_BLOAD_1: case OP_ALOAD_1: PUSH(locals[1]); break;
+            case OP_ILOAD_2: case OP_FLOAD_2: case OP_BLOAD_2: case OP_ALOAD_2: PUSH(locals[2]); break;
+            case OP_ILOAD_3: case OP_FLOAD_3: case OP_BLOAD_3: case OP_ALOAD_3: PUSH(locals[3]); break;
+            case OP_ILOADN: case OP_FLOADN: case OP_BLOADN: case OP_ALOADN: {
+                const long f = follow_links(vm, (long) (vm->frame_count - 1), instr->arg0);
+                if (f < 0) RUNTIME_ERROR(m, instr, "static link chain too short");
+                PUSH(vm->locals[vm->frames[f].locals_base + instr->arg1]);
+                break;
+            }
+            case OP_ILOADG: case OP_FLOADG: case OP_BLOADG: case OP_ALOADG:
+                PUSH(m->globals[instr->arg0]); break;
+            case OP_ILOADE: case OP_FLOADE: case OP_BLOADE: case OP_ALOADE:
+                PUSH(*m->var_imports[instr->arg0].slot); break;
+            case OP_ILOADC: case OP_FLOADC:
+                PUSH(m->consts[instr->arg0]); break;
+            case OP_ILOADC_0: PUSH(((VMValue){.i = 0})); break;
+            case OP_ILOADC_1: PUSH(((VMValue){.i = 1})); break;
+            case OP_ILOADC_M1: PUSH(((VMValue){.i = -1})); break;
+            case OP_FLOADC_0: PUSH(((VMValue){.f = 0.0f})); break;
+            case OP_FLOADC_1: PUSH(((VMValue){.f = 1.0f})); break;
+            case OP_BLOADC_T: PUSH(((VMValue){.b = true})); break;
+            case OP_BLOADC_F: PUSH(((VMValue){.b = false})); break;
+
+            case OP_ISTORE: case OP_FSTORE: case OP_BSTORE: case OP_ASTORE:
+                if ((size_t) instr->arg0 >= frame->local_count) RUNTIME_ERROR(m, instr, "local %d out of frame", instr->arg0);
+                locals[instr->arg0] = POP(); break;
+            case OP_ISTOREN: case OP_FSTOREN: case OP_BSTOREN: case OP_ASTOREN: {
+                const long f = follow_links(vm, (long) (vm->frame_count - 1), instr->arg0);
+                if (f < 0) RUNTIME_ERROR(m, instr, "static link chain too short");
+                vm->locals[vm->frames[f].locals_base + instr->arg1] = POP();
+                break;
+            }
+            case OP_ISTOREG: case OP_FSTOREG: case OP_BSTOREG: case OP_ASTOREG:
+                m->globals[instr->arg0] = POP(); break;
+            case OP_ISTOREE: case OP_FSTOREE: case OP_BSTOREE: case OP_ASTOREE:
+                *m->var_imports[instr->arg0].slot = POP(); break;
+
+            case OP_INEWA: case OP_FNEWA: case OP_BNEWA: {
+                const int32_t size = POP().i;
+                if (size < 0) RUNTIME_ERROR(m, instr, "negative array size %d", size);
+                PUSH(((VMValue){.a = new_array(vm, (size_t) size)}));
+                break;
+            }
+            case OP_ILOADA: case OP_FLOADA: case OP_BLOADA: {
+                const VMArray* arr = POP().a;
+                const int32_t idx = POP().i;
+                if (idx < 0 || (size_t) idx >= arr->size) RUNTIME_ERROR(m, instr, "array index %d out of bounds", idx);
+                PUSH(arr->data[idx]);
+                break;
+            }
+            case OP_ISTOREA: case OP_FSTOREA: case OP_BSTOREA: {
+                VMArray* arr = POP().a;
+                const int32_t idx = POP().i;
+                const VMValue v = POP();
+                if (idx < 0 || (size_t) idx >= arr->size) RUNTIME_ERROR(m, instr, "array index %d out of bounds", idx);
+                arr->data[idx] = v;
+                break;
+            }
+
+            case OP_IADD: { const int32_t r = POP().i; TOP().i = (int32_t) ((uint32_t) TOP().i + (uint32_t) r); break; }
+            case OP_ISUB: { const int32_t r = POP().i; TOP().i = (int32_t) ((uint32_t) TOP().i - (uint32_t) r); break; }
+            case OP_IMUL: { const int32_t r = POP().i; TOP().i = (int32_t) ((uint32_t) TOP().i * (uint32_t) r); break; }
+            case OP_IDIV: {
+                const int32_t r = POP().i;
+                if (r == 0) RUNTIME_ERROR(m, instr, "division by zero");
+                // Dividing INT32_MIN by -1 wraps like negation instead of trapping
+                if (r == -1) TOP().i = (int32_t) (0u - (uint32_t) TOP().i);
+                else TOP().i /= r;
+                break;
+            }
+            case OP_IREM: {
+                const int32_t r = POP().i;
+                if (r == 0) RUNTIME_ERROR(m, instr, "division by zero");
+                if (r == -1) TOP().i = 0;
+                else TOP().i %= r;
+                break;
+            }
+            case OP_FADD: { const float r = POP().f; TOP().f += r; break; }
+            case OP_FSUB: { const float r = POP().f; TOP().f -= r; break; }
+            case OP_FMUL: { const float r = POP().f; TOP().f *= r; break; }
+            case OP_FDIV: { const float r = POP().f; TOP().f /= r; break; }
+            case OP_BADD: { const bool r = POP().b; TOP().b = TOP().b || r; break; }
+            case OP_BMUL: { const bool r = POP().b; TOP().b = TOP().b && r; break; }
+            case OP_INEG: TOP().i = (int32_t) (0u - (uint32_t) TOP().i); break;
+            case OP_FNEG: TOP().f = -TOP().f; break;
+            case OP_BNOT: TOP().b = !TOP().b; break;
+
+            case OP_ILT: { const int32_t r = POP().i; TOP().b = TOP().i < r; break; }
+            case OP_ILE: { const int32_t r = POP().i; TOP().b = TOP().i <= r; break; }
+            case OP_IGT: { const int32_t r = POP().i; TOP().b = TOP().i > r; break; }
+            case OP_IGE: { const int32_t r = POP().i; TOP().b = TOP().i >= r; break; }
+            case OP_IEQ: { const int32_t r = POP().i; TOP().b = TOP().i == r; break; }
+            case OP_INE: { const int32_t r = POP().i; TOP().b = TOP().i != r; break; }
+            case OP_FLT: { const float r = POP().f; TOP().b = TOP().f < r; break; }
+            case OP_FLE: { const float r = POP().f; TOP().b = TOP().f <= r; break; }
+            case OP_FGT: { const float r = POP().f; TOP().b = TOP().f > r; break; }
+            case OP_FGE: { const float r = POP().f; TOP().b = TOP().f >= r; break; }
+            case OP_FEQ: { const float r = POP().f; TOP().b = TOP().f == r; break; }
+            case OP_FNE: { const float r = POP().f; TOP().b = TOP().f != r; break; }
+            case OP_BEQ: { const bool r = POP().b; TOP().b = TOP().b == r; break; }
+            case OP_BNE: { const bool r = POP().b; TOP().b = TOP().b != r; break; }
+
+            case OP_I2F: TOP().f = (float) TOP().i; break;
+            case OP_F2I: TOP().i = (int32_t) TOP().f; break;
+
+            case OP_IINC: locals[instr->arg0].i += m->consts[instr->arg1].i; break;
+            case OP_IINC_1: locals[instr->arg0].i++; break;
+            case OP_IDEC: locals[instr->arg0].i -= m->consts[instr->arg1].i; break;
+            case OP_IDEC_1: locals[instr->arg0].i--; break;
+
+            case OP_IPOP: case OP_FPOP: case OP_BPOP: case OP_APOP: vm->sp--; break;
+
+            case OP_JUMP: pc = (size_t) instr->arg0; break;
+            case OP_BRANCH_T: if (POP().b) pc = (size_t) instr->arg0; break;
+            case OP_BRANCH_F: if (!POP().b) pc = (size_t) instr->arg0; break;
+
+            case OP_ISR: push_link(vm, frame->static_link); break;
+            case OP_ISRN: push_link(vm, follow_links(vm, frame->static_link, instr->arg0)); break;
+            case OP_ISRL: push_link(vm, (long) (vm->frame_count - 1)); break;
+            case OP_ISRG: push_link(vm, -1); break;
+
+            case OP_JSR:
+                if ((size_t) instr->arg0 > vm->sp) RUNTIME_ERROR(m, instr, "not enough arguments on stack");
+                CHECK_STACK(m, (size_t) instr->arg1, (size_t) instr->arg0);
+                push_frame(vm, m, pc, (size_t) instr->arg0);
+                pc = (size_t) instr->arg1;
+                frame = &vm->frames[vm->frame_count - 1];
+                locals = &vm->locals[frame->locals_base];
+                break;
+            case OP_JSRE: {
+                const VMFunImport* imp = &m->fun_imports[instr->arg0];
+                if (imp->builtin != BUILTIN_NONE) {
+                    vm->pending_count--;
+                    switch (imp->builtin) {
+                        case BUILTIN_PRINT_INT: printf("%d", POP().i); break;
+                        case BUILTIN_PRINT_FLOAT: printf("%f", POP().f); break;
+                        case BUILTIN_SCAN_INT: {
+                            int v = 0;
+                            if (scanf("%d", &v) != 1) v = 0;
+                            PUSH(((VMValue){.i = v}));
+                            break;
+                        }
+                        case BUILTIN_SCAN_FLOAT: {
+                            float v = 0.0f;
+                            if (scanf("%f", &v) != 1) v = 0.0f;
+                            PUSH(((VMValue){.f = v}));
+                            break;
+                        }
+                        case BUILTIN_PRINT_SPACES: for (int32_t n = POP().i; n > 0; n--) putchar(' '); break;
+                        case BUILTIN_PRINT_NEWLINES: for (int32_t n = POP().i; n > 0; n--) putchar('\n'); break;
+                        default: break;
+                    }
+                    break;
+                }
+
+                if (imp->arg_count > vm->sp) RUNTIME_ERROR(m, instr, "not enough arguments on stack");
+                CHECK_STACK(imp->module, imp->target, imp->arg_count);
+                push_frame(vm, m, pc, imp->arg_count);
+                m = imp->module;
+                code = m->code;
+                pc = imp->target;
+                frame = &vm->frames[vm->frame_count - 1];
+                locals = &vm->locals[frame->locals_base];
+                break;
+            }
+            case OP_ESR: {
+                const size_t count = (size_t) instr->arg0;
+                if (count > frame->local_count) {
+                    GROW_TO(vm->locals, vm->locals_size, frame->locals_base + count);
+                    memset(&vm->locals[frame->locals_base + frame->local_count], 0,
+                        (count - frame->local_count) * sizeof(VMValue));
+                    frame->local_count = count;
+                    vm->locals_top = frame->locals_base + count;
+                    locals = &vm->locals[frame->locals_base];
+                }
+                break;
+            }
+
+            case OP_IRETURN: case OP_FRETURN: case OP_BRETURN: case OP_ARETURN: case OP_RETURN: {
+                const bool has_value = instr->op != OP_RETURN;
+                const VMValue ret = has_value ? POP() : (VMValue){0};
+
+                vm->locals_top = frame->locals_base;
+                VMModule* ret_module = frame->ret_module;
+                pc = frame->ret_pc;
+                vm->frame_count--;
+
+                if (vm->frame_count == entry_frames) {
+                    *result = ret;
+                    return;
+                }
+
+                m = ret_module;
+                code = m->code;
+                frame = &vm->frames[vm->frame_count - 1];
+                locals = &vm->locals[frame->locals_base];
+                if (has_value) PUSH(ret);
+                break;
+            }
+
+            default:
+                RUNTIME_ERROR(m, instr, "unsupported instruction %s", OPCODE_TABLE[instr->op].name);
+        }
+    }
+}
+
+/**
+ * Runs the __init function of every module and then the exported main function
+ * @param vm machine with linked modules
+ * @return return value of main
+ */
+int VMrun(VM* vm) {
+    VMValue result;
+
+    for (size_t i = 0; i < vm->module_count; i++) {
+        const VMFunExport* init = find_fun_export(vm->modules[i], "__init");
+        if (init != NULL) execute(vm, vm->modules[i], init->target, &result);
+    }
+
+    for (size_t i = 0; i < vm->module_count; i++) {
+        const VMFunExport* main_fun = find_fun_export(vm->modules[i], "main");
+        if (main_fun != NULL) {
+            execute(vm, vm->modules[i], main_fun->target, &result);
+            fflush(stdout);
+            return main_fun->ret == VK_INT ? result.i : 0;
+        }
+    }
+
+    fprintf(stderr, "civvm-lite: no module exports a main function\n");
+    return EXIT_FAILURE;
+}
+
+/**
+ * Writes the executed instruction count, maximum stack depth and an opcode histogram
+ * @param vm machine that has run
+ * @param f file to write report to
+ */
+void VMreportCounts(const VM* vm, FILE* f) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < OP_COUNT_; i++) total += vm->op_counts[i];
+
+    fprintf(f, "executed instructions: %llu\n", (unsigned long long) total);
+    fprintf(f, "max operand stack depth: %lu\n", vm->max_sp);
+    for (size_t i = 0; i < OP_COUNT_; i++) {
+        if (vm->op_counts[i] == 0) continue;
+        fprintf(f, "  %-10s %llu\n", OPCODE_TABLE[i].name, (unsigned long long) vm->op_counts[i]);
+    }
+}
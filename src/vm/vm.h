@@ -0,0 +1,137 @@
+// src/vm/vm.h
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bytecode/opcodes.h"
+
+/* Value kinds that can live in a global, constant or import slot */
+typedef enum {
+    VK_INT,
+    VK_FLOAT,
+    VK_BOOL,
+    VK_ARRAY,
+    VK_VOID,
+} ValueKind;
+
+typedef struct VMArray {
+    size_t size;
+    union VMValue* data;
+    struct VMArray* next;               // All arrays are chained so they can be freed at exit
+} VMArray;
+
+typedef union VMValue {
+    int32_t i;
+    float f;
+    bool b;
+    VMArray* a;
+} VMValue;
+
+typedef struct VMInstr {
+    Opcode op;
+    int32_t arg0, arg1;                 // Labels are resolved to code indices while loading
+    size_t line;                        // Source line in the assembly file, for diagnostics
+} VMInstr;
+
+typedef enum {
+    BUILTIN_NONE,
+    BUILTIN_PRINT_INT,
+    BUILTIN_PRINT_FLOAT,
+    BUILTIN_SCAN_INT,
+    BUILTIN_SCAN_FLOAT,
+    BUILTIN_PRINT_SPACES,
+    BUILTIN_PRINT_NEWLINES,
+} Builtin;
+
+typedef struct VMFunImport {
+    char* name;
+    ValueKind ret;
+    size_t arg_count;
+    Builtin builtin;                    // Set when resolved to a function of civic.h
+    struct VMModule* module;            // Set when resolved to an export of another module
+    size_t target;                      // Code index inside the resolved module
+} VMFunImport;
+
+typedef struct VMVarImport {
+    char* name;
+    ValueKind kind;
+    VMValue* slot;                      // Global slot of the exporting module
+} VMVarImport;
+
+typedef struct VMFunExport {
+    char* name;
+    ValueKind ret;
+    size_t arg_count;
+    size_t target;
+} VMFunExport;
+
+typedef struct VMVarExport {
+    char* name;
+    size_t global_index;
+} VMVarExport;
+
+typedef struct VMModule {
+    char* path;
+    VMInstr* code;
+    size_t code_len;
+    VMValue* consts;
+    size_t const_count;
+    VMValue* globals;
+    size_t global_count;
+    VMFunImport* fun_imports;
+    size_t fun_import_count;
+    VMVarImport* var_imports;
+    size_t var_import_count;
+    VMFunExport* fun_exports;
+    size_t fun_export_count;
+    VMVarExport* var_exports;
+    size_t var_export_count;
+    size_t* stack_needs;                // Operand stack depth per function entry, NULL if unknown
+} VMModule;
+
+typedef struct VMFrame {
+    size_t locals_base;                 // First local of this frame in the locals area
+    size_t local_count;
+    long static_link;                   // Frame index of the lexically enclosing function, -1 for none
+    VMModule* ret_module;
+    size_t ret_pc;
+} VMFrame;
+
+typedef struct VM {
+    VMModule** modules;
+    size_t module_count;
+
+    VMValue* stack;
+    size_t sp;
+    size_t stack_size;
+    size_t max_sp;                      // Highest operand stack depth reached
+
+    VMValue* locals;
+    size_t locals_top;
+    size_t locals_size;
+
+    VMFrame* frames;
+    size_t frame_count;
+    size_t frames_size;
+
+    long* pending_links;                // Static links created by isr* awaiting their jsr
+    size_t pending_count;
+    size_t pending_size;
+
+    VMArray* arrays;
+
+    uint64_t op_counts[OP_COUNT_];      // Executed instructions per opcode
+} VM;
+
+VMModule* VMloadModule(const char* path);
+void VMfreeModule(VMModule** module_ptr);
+
+void VMinit(VM* vm, size_t stack_size);
+void VMfree(VM* vm);
+bool VMlink(VM* vm);
+int VMrun(VM* vm);
+void VMreportCounts(const VM* vm, FILE* f);
@@ -0,0 +1,1766 @@
+/**
+ * @file
+ *
+ * Traversal: X86CodeGeneration
+ * UID      : XCG
+ *
+ * Generates x86-64 assembly for the GNU assembler when civicc runs with
+ * --emit=x86. The result follows the System V ABI, so it links with the
+ * system toolchain and with civicrt, which provides the functions of civic.h.
+ * - Expressions are evaluated into %eax or %xmm0; intermediate values that
+ *   have to survive the evaluation of another operand are pushed.
+ * - Locals, parameters and loop counters that are not floats live in the
+ *   callee-saved registers %rbx and %r12-%r15, assigned by linear scan over
+ *   their live intervals. Variables that do not get a register, and variables
+ *   that nested functions access, live in the frame.
+ * - Nested functions receive the frame pointer of the function that defines
+ *   them in %r10 and keep it at -8(%rbp); following that static link reaches
+ *   the variables of every enclosing function.
+ * - Arrays are allocated with calloc, with four bytes per element, and local
+ *   arrays are freed when their function returns.
+ * - Global initialisation runs from .init_array.
+ */
+
+#include <math.h>
+#include <stdarg.h>
+
+#include "ccn/ccn.h"
+#include "ccngen/ast.h"
+#include "ccngen/trav.h"
+
+#include "common.h"
+#include "global/globals.h"
+#include "optimisation/consteval.h"
+#include "symbol/table.h"
+
+// Callee-saved registers available to variables
+#define REG_COUNT 5
+// Registers for integer and float arguments of the System V ABI
+#define INT_ARG_COUNT 6
+#define FLOAT_ARG_COUNT 8
+
+static const char* REGS64[REG_COUNT] = {"%rbx", "%r12", "%r13", "%r14", "%r15"};
+static const char* REGS32[REG_COUNT] = {"%ebx", "%r12d", "%r13d", "%r14d", "%r15d"};
+static const char* INT_ARGS64[INT_ARG_COUNT] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+static const char* INT_ARGS32[INT_ARG_COUNT] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
+
+typedef struct Buffer {
+    char* data;
+    size_t len;
+    size_t size;
+} Buffer;
+
+typedef struct Location {
+    int reg;                            // Index in REGS64, or -1 for a frame slot
+    int offset;                         // Offset of the frame slot from %rbp
+} Location;
+
+typedef struct Interval {
+    Symbol* symbol;
+    size_t start;                       // First and last position the variable is used at
+    size_t end;
+    bool candidate;                     // Can be kept in a register
+    int reg;
+} Interval;
+
+typedef struct Loop {
+    size_t start;
+    size_t end;
+} Loop;
+
+typedef struct Liveness {
+    const Symbol* fun;
+    Interval* intervals;
+    size_t count;
+    size_t size;
+    htable_st* index;                   // Symbol to index of its interval plus one
+    Loop* loops;
+    size_t loop_count;
+    size_t loop_size;
+    size_t pos;
+    bool capturing;                     // Scanning nested functions for captured variables
+} Liveness;
+
+typedef struct FunState {
+    Symbol* fun;                        // NULL for the module initialiser
+    Buffer body;
+    int frame_size;                     // Bytes of the frame below %rbp
+    size_t depth;                       // Outstanding 8 byte pushes
+    bool used_regs[REG_COUNT];
+    int reg_saves[REG_COUNT];           // Frame slots of the saved callee-saved registers
+    const Symbol** arrays;              // Local arrays, freed when the function returns
+    size_t array_count;
+    size_t array_size;
+    size_t ret_label;
+} FunState;
+
+static SymbolTable* CURRENT_SCOPE;
+static FunState* FS;
+
+static Buffer TEXT;
+static Buffer DATA;
+static Buffer BSS;
+
+static htable_st* LOCATIONS = NULL;     // Local variable to its Location
+static htable_st* LINK_NAMES = NULL;    // Imported and exported global to its CiviC name
+static const Symbol* MAIN_FUN = NULL;   // Exported main function, if this module has one
+static size_t LABEL_COUNT = 0;
+
+// Type of the last traversed expression, its value is in %eax, %rax or %xmm0
+static ValueType LAST_TYPE = VT_NULL;
+
+static void buf_vprintf(Buffer* b, const char* fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    const size_t n = (size_t) vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+
+    if (b->len + n + 1 > b->size) {
+        b->size = (b->len + n + 1) * 2;
+        ARRAY_RESIZE(b->data, b->size);
+    }
+    vsnprintf(b->data + b->len, n + 1, fmt, args);
+    b->len += n;
+}
+
+static void buf_printf(Buffer* b, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    buf_vprintf(b, fmt, args);
+    va_end(args);
+}
+
+static void buf_free(Buffer* b) {
+    MEMfree(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->size = 0;
+}
+
+/**
+ * Writes an instruction to the function being generated
+ * @param fmt format of the instruction, without newline
+ */
+static void emit(const char* fmt, ...) {
+    buf_printf(&FS->body, "    ");
+
+    va_list args;
+    va_start(args, fmt);
+    buf_vprintf(&FS->body, fmt, args);
+    va_end(args);
+
+    buf_printf(&FS->body, "\n");
+}
+
+static size_t new_label() {
+    return LABEL_COUNT++;
+}
+
+static void place_label(const size_t label) {
+    buf_printf(&FS->body, ".L%lu:\n", label);
+}
+
+static void push_reg(const char* reg) {
+    emit("pushq %s", reg);
+    FS->depth++;
+}
+
+static void pop_reg(const char* reg) {
+    emit("popq %s", reg);
+    FS->depth--;
+}
+
+/**
+ * Pushes the value of the last expression
+ * @param vt type of the value
+ */
+static void push_result(const ValueType vt) {
+    if (vt == VT_FLOAT) emit("movd %%xmm0, %%eax");
+    push_reg("%rax");
+}
+
+/**
+ * Calls a C function without stack arguments, keeping the stack aligned
+ * @param target function to call
+ */
+static void call_aligned(const char* target) {
+    const bool pad = FS->depth % 2 != 0;
+    if (pad) emit("subq $8, %%rsp");
+    emit("call %s", target);
+    if (pad) emit("addq $8, %%rsp");
+}
+
+/**
+ * Reserves a slot in the frame of the current function
+ * @param size size of the slot in bytes
+ * @return offset of the slot from %rbp
+ */
+static int alloc_slot(const int size) {
+    FS->frame_size += size;
+    FS->frame_size = (FS->frame_size + size - 1) / size * size;
+    return -FS->frame_size;
+}
+
+static size_t fun_level(const Symbol* fun) {
+    return fun->parent_scope->nesting_level;
+}
+
+static bool is_wide(const Symbol* s) {
+    return IS_ARRAY(s->vtype);
+}
+
+static uint32_t float_bits(const float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+/**
+ * Generates the assembly name of a function
+ * @param fun function symbol
+ * @return name, to be freed by the caller
+ */
+static char* fun_name(const Symbol* fun) {
+    if (fun->imported || fun->exported) return STRfmt("civic_%s", fun->name);
+    return STRfmt("f%s", fun->as.fun.label_name);
+}
+
+/**
+ * Generates the label of a global variable
+ * @param s variable symbol
+ * @return label, to be freed by the caller
+ */
+static char* global_label(const Symbol* s) {
+    const char* link_name = HTlookup(LINK_NAMES, (void*) s);
+    if (link_name != NULL) return STRfmt("civic_%s", link_name);
+    return STRfmt("g_%s", s->name);
+}
+
+/**
+ * Generates the operand that accesses a variable from the current function.
+ * Variables of enclosing functions are reached through %r11, so the operand
+ * has to be used before anything else is emitted.
+ * @param s variable symbol
+ * @return operand, to be freed by the caller
+ */
+static char* var_operand(const Symbol* s) {
+    if (s->parent_scope->nesting_level == 0) {
+        char* label = global_label(s);
+        char* res = STRfmt("%s(%%rip)", label);
+        MEMfree(label);
+        return res;
+    }
+
+    const Location* loc = HTlookup(LOCATIONS, (void*) s);
+#ifdef DEBUGGING
+    ASSERT_MSG((loc != NULL), "X86: No location for variable %s", s->name);
+#endif // DEBUGGING
+
+    const size_t depth = fun_level(FS->fun) - fun_level(s->parent_scope->parent_fun);
+    if (depth == 0) {
+        if (loc->reg >= 0) return STRcpy(is_wide(s) ? REGS64[loc->reg] : REGS32[loc->reg]);
+        return STRfmt("%d(%%rbp)", loc->offset);
+    }
+
+    // Follow the static links to the frame of the enclosing function
+    emit("movq -8(%%rbp), %%r11");
+    for (size_t i = 1; i < depth; i++) emit("movq -8(%%r11), %%r11");
+    return STRfmt("%d(%%r11)", loc->offset);
+}
+
+/**
+ * Generates the operand of an array dimension, which is an immediate when
+ * every call passes the same value
+ * @param dim dimension symbol
+ * @return operand, to be freed by the caller
+ */
+static char* dim_operand(const Symbol* dim) {
+    if (dim->is_constant) return STRfmt("$%d", dim->constant);
+    return var_operand(dim);
+}
+
+/**
+ * Generates the operand of an int or bool literal or scalar variable
+ * @param node expression node
+ * @return operand, or NULL if the expression has to be evaluated; to be freed by the caller
+ */
+static char* simple_operand(node_st* node) {
+    switch (NODE_TYPE(node)) {
+        case NT_NUM: return STRfmt("$%d", NUM_VAL(node));
+        case NT_BOOL: return STRcpy(BOOL_VAL(node) ? "$1" : "$0");
+        case NT_VAR: {
+            const Symbol* s = VAR_SYMBOL(node);
+            if (VAR_INDICES(node) != NULL || (s->vtype != VT_NUM && s->vtype != VT_BOOL)) return NULL;
+            return var_operand(s);
+        }
+        default: return NULL;
+    }
+}
+
+/**
+ * Stores the value of the last expression in a variable
+ * @param s variable symbol
+ */
+static void store_result(const Symbol* s) {
+    char* op = var_operand(s);
+    if (s->vtype == VT_FLOAT) emit("movss %%xmm0, %s", op);
+    else if (is_wide(s)) emit("movq %%rax, %s", op);
+    else emit("movl %%eax, %s", op);
+    MEMfree(op);
+}
+
+/**
+ * Computes the row-major element index of an array access into %rax
+ * @param arr array symbol
+ * @param indices first exprs node of the indices
+ */
+static void gen_flat_index(const Symbol* arr, node_st* indices) {
+    TRAVdo(EXPRS_EXPR(indices));
+
+    size_t i = 1;
+    for (node_st* e = EXPRS_NEXT(indices); e != NULL; e = EXPRS_NEXT(e), i++) {
+        char* op = simple_operand(EXPRS_EXPR(e));
+        if (op == NULL) {
+            push_result(VT_NUM);
+            TRAVdo(EXPRS_EXPR(e));
+            emit("movl %%eax, %%ecx");
+            pop_reg("%rax");
+            op = STRcpy("%ecx");
+        }
+
+        char* dim = dim_operand(arr->as.array.dims[i]);
+        emit("imull %s, %%eax", dim);
+        emit("addl %s, %%eax", op);
+        MEMfree(dim);
+        MEMfree(op);
+    }
+
+    emit("cltq");
+}
+
+/**
+ * Computes the amount of elements of an array into %rax
+ * @param arr array symbol
+ */
+static void gen_array_size(const Symbol* arr) {
+    for (size_t i = 0; i < arr->as.array.dim_count; i++) {
+        char* dim = dim_operand(arr->as.array.dims[i]);
+        if (i == 0) {
+            emit(dim[0] == '$' ? "movq %s, %%rax" : "movslq %s, %%rax", dim);
+        } else {
+            emit(dim[0] == '$' ? "movq %s, %%rcx" : "movslq %s, %%rcx", dim);
+            emit("imulq %%rcx, %%rax");
+        }
+        MEMfree(dim);
+    }
+}
+
+/**
+ * Stores the values of an array expression in row-major order. Errors on a
+ * value that follows a nested array expression, like the bytecode does.
+ * @param arr array symbol
+ * @param node ArrExpr or value expression
+ * @param index index of the next element, advanced past the stored values
+ */
+static void store_arrexpr(const Symbol* arr, node_st* node, size_t* index) {
+    if (NODE_TYPE(node) == NT_ARREXPR) {
+        bool only_arrexpr = false;
+        for (node_st* e = ARREXPR_EXPRS(node); e != NULL; e = EXPRS_NEXT(e)) {
+            if (NODE_TYPE(EXPRS_EXPR(e)) == NT_ARREXPR) {
+                only_arrexpr = true;
+            } else if (only_arrexpr) {
+                USER_ERROR("Inconsistent initialisation value shape of array");
+                global.had_error = true;
+            }
+            store_arrexpr(arr, EXPRS_EXPR(e), index);
+        }
+        return;
+    }
+
+    TRAVdo(node);
+    char* op = var_operand(arr);
+    emit("movq %s, %%rcx", op);
+    if (LAST_TYPE == VT_FLOAT) emit("movss %%xmm0, %lu(%%rcx)", *index * 4);
+    else emit("movl %%eax, %lu(%%rcx)", *index * 4);
+    (*index)++;
+    MEMfree(op);
+}
+
+/**
+ * Generates the dimensions, allocation and initialisation of a declared array
+ * @param arr array symbol
+ * @param dims dimension expressions
+ * @param init initialiser, may be NULL
+ */
+static void define_array(const Symbol* arr, node_st* dims, node_st* init) {
+    size_t i = 0;
+    for (node_st* e = dims; e != NULL; e = EXPRS_NEXT(e), i++) {
+        TRAVdo(EXPRS_EXPR(e));
+        store_result(arr->as.array.dims[i]);
+    }
+
+    gen_array_size(arr);
+    emit("movq %%rax, %%rdi");
+    emit("movl $4, %%esi");
+    call_aligned("calloc@PLT");
+    store_result(arr);
+
+    if (arr->parent_scope->nesting_level > 0) {
+        if (FS->array_count == FS->array_size) {
+            FS->array_size = FS->array_size == 0 ? INITIAL_LIST_SIZE : FS->array_size * 2;
+            ARRAY_RESIZE(FS->arrays, FS->array_size);
+        }
+        FS->arrays[FS->array_count++] = arr;
+    }
+
+    ConstValue v;
+    if (init == NULL || (CEfromLiteral(init, &v) && CEisZero(v))) {
+        // calloc already zeroed the elements
+    } else if (NODE_TYPE(init) == NT_ARREXPR) {
+        size_t index = 0;
+        store_arrexpr(arr, init, &index);
+    } else {
+        TRAVdo(init);
+        if (LAST_TYPE == VT_FLOAT) emit("movd %%xmm0, %%eax");
+        emit("movl %%eax, %%edx");
+        gen_array_size(arr);
+        char* op = var_operand(arr);
+        emit("movq %s, %%rcx", op);
+        MEMfree(op);
+
+        const size_t loop = new_label();
+        const size_t end = new_label();
+        place_label(loop);
+        emit("testq %%rax, %%rax");
+        emit("je .L%lu", end);
+        emit("decq %%rax");
+        emit("movl %%edx, (%%rcx,%%rax,4)");
+        emit("jmp .L%lu", loop);
+        place_label(end);
+    }
+}
+
+/**
+ * Finds the scope of a for-loop, counting loops like context analysis does
+ * @param scope scope containing the loop
+ * @param node For node
+ * @return scope of the loop
+ */
+static SymbolTable* enter_loop(const SymbolTable* scope, node_st* node) {
+    char* name = STRfmt("%lu_%s", scope->for_loop_counter, FOR_VAR(node));
+    const Symbol* s = STlookup(scope, name);
+    MEMfree(name);
+    return s->as.forloop.scope;
+}
+
+static void leave_loop(SymbolTable* loop_scope) {
+    loop_scope->for_loop_counter = 0;
+    loop_scope->parent_scope->for_loop_counter++;
+}
+
+/**
+ * Records a use of a variable at the current position
+ * @param l liveness of the function
+ * @param s variable symbol
+ */
+static void touch(Liveness* l, Symbol* s) {
+    const SymbolTable* scope = s->parent_scope;
+    if (scope->nesting_level == 0 || scope->parent_fun != l->fun) return;
+
+    size_t i = (size_t) HTlookup(l->index, s);
+    if (i == 0) {
+        if (l->count == l->size) {
+            l->size = l->size == 0 ? INITIAL_LIST_SIZE : l->size * 2;
+            ARRAY_RESIZE(l->intervals, l->size);
+        }
+        l->intervals[l->count] = (Interval) {s, l->pos, l->pos, s->vtype != VT_FLOAT, -1};
+        i = ++l->count;
+        HTinsert(l->index, s, (void*) i);
+    }
+
+    Interval* interval = &l->intervals[i - 1];
+    if (l->capturing) {
+        interval->candidate = false;
+    } else {
+        interval->end = l->pos++;
+    }
+
+    // Indexing and passing arrays read their dimensions
+    for (size_t d = 0; IS_ARRAY(s->vtype) && d < s->as.array.dim_count; d++) touch(l, s->as.array.dims[d]);
+}
+
+static void scan_expr(Liveness* l, node_st* node) {
+    if (node == NULL) return;
+
+    switch (NODE_TYPE(node)) {
+        case NT_BINOP: scan_expr(l, BINOP_LEFT(node)); scan_expr(l, BINOP_RIGHT(node)); break;
+        case NT_MONOP: scan_expr(l, MONOP_OPERAND(node)); break;
+        case NT_CAST: scan_expr(l, CAST_EXPR(node)); break;
+        case NT_FUNCALL: scan_expr(l, FUNCALL_FUN_ARGS(node)); break;
+        case NT_ARREXPR: scan_expr(l, ARREXPR_EXPRS(node)); break;
+        case NT_EXPRS: scan_expr(l, EXPRS_EXPR(node)); scan_expr(l, EXPRS_NEXT(node)); break;
+        case NT_VAR:
+            scan_expr(l, VAR_INDICES(node));
+            touch(l, VAR_SYMBOL(node));
+            break;
+        default: break;
+    }
+}
+
+static void scan_stmts(Liveness* l, SymbolTable* scope, node_st* stmts);
+
+/**
+ * Scans a loop statement, recording the positions it covers
+ * @param l liveness of the function
+ * @param scope scope of the loop body
+ * @param cond condition, may be NULL
+ * @param block statements of the loop
+ */
+static void scan_loop(Liveness* l, SymbolTable* scope, node_st* cond, node_st* block) {
+    const size_t start = l->pos;
+    scan_expr(l, cond);
+    scan_stmts(l, scope, block);
+
+    if (l->capturing) return;
+    if (l->loop_count == l->loop_size) {
+        l->loop_size = l->loop_size == 0 ? INITIAL_LIST_SIZE : l->loop_size * 2;
+        ARRAY_RESIZE(l->loops, l->loop_size);
+    }
+    l->loops[l->loop_count++] = (Loop) {start, l->pos};
+}
+
+static void scan_stmts(Liveness* l, SymbolTable* scope, node_st* stmts) {
+    for (; stmts != NULL; stmts = STMTS_NEXT(stmts)) {
+        node_st* stmt = STMTS_STMT(stmts);
+        switch (NODE_TYPE(stmt)) {
+            case NT_ASSIGN:
+                scan_expr(l, ASSIGN_EXPR(stmt));
+                scan_expr(l, VARLET_INDICES(ASSIGN_LET(stmt)));
+                touch(l, VARLET_SYMBOL(ASSIGN_LET(stmt)));
+                break;
+            case NT_EXPRSTMT: scan_expr(l, EXPRSTMT_EXPR(stmt)); break;
+            case NT_RETURN: scan_expr(l, RETURN_EXPR(stmt)); break;
+            case NT_IFELSE:
+                scan_expr(l, IFELSE_COND(stmt));
+                scan_stmts(l, scope, IFELSE_THEN(stmt));
+                scan_stmts(l, scope, IFELSE_ELSE_BLOCK(stmt));
+                break;
+            case NT_WHILE: scan_loop(l, scope, WHILE_COND(stmt), WHILE_BLOCK(stmt)); break;
+            case NT_DOWHILE: scan_loop(l, scope, DOWHILE_COND(stmt), DOWHILE_BLOCK(stmt)); break;
+            case NT_FOR: {
+                scan_expr(l, FOR_START_EXPR(stmt));
+                if (l->capturing) {
+                    scan_expr(l, FOR_STOP(stmt));
+                    scan_expr(l, FOR_STEP(stmt));
+                    scan_stmts(l, scope, FOR_BLOCK(stmt));
+                    break;
+                }
+
+                // The loop variable is set before the stop and step are evaluated
+                SymbolTable* loop_scope = enter_loop(scope, stmt);
+                Symbol* var = STlookup(loop_scope, FOR_VAR(stmt));
+                touch(l, var);
+                scan_expr(l, FOR_STOP(stmt));
+                scan_expr(l, FOR_STEP(stmt));
+                scan_loop(l, loop_scope, NULL, FOR_BLOCK(stmt));
+                // The increment at the end of each iteration uses the loop variable
+                touch(l, var);
+                leave_loop(loop_scope);
+                break;
+            }
+            default: break;
+        }
+    }
+}
+
+/**
+ * Marks the variables of the function that nested functions access, these
+ * have to stay in the frame
+ * @param l liveness of the function
+ * @param fundefs first FunDefs node of a function body
+ */
+static void scan_captures(Liveness* l, node_st* fundefs) {
+    for (; fundefs != NULL; fundefs = FUNDEFS_NEXT(fundefs)) {
+        node_st* body = FUNDEF_BODY(FUNDEFS_FUNDEF(fundefs));
+        for (node_st* decl = FUNBODY_DECLS(body); decl != NULL; decl = VARDECL_NEXT(decl)) {
+            scan_expr(l, VARDECL_DIMS(decl));
+            scan_expr(l, VARDECL_INIT(decl));
+        }
+        scan_captures(l, FUNBODY_LOCAL_FUNDEFS(body));
+        scan_stmts(l, NULL, FUNBODY_STMTS(body));
+    }
+}
+
+/**
+ * Computes the live intervals of the variables of a function
+ * @param l liveness to fill
+ * @param node FunDef node
+ */
+static void scan_function(Liveness* l, node_st* node) {
+    SymbolTable* scope = l->fun->as.fun.scope;
+    node_st* body = FUNDEF_BODY(node);
+
+    l->capturing = true;
+    scan_captures(l, FUNBODY_LOCAL_FUNDEFS(body));
+    l->capturing = false;
+
+    // Parameters are defined on entry
+    for (node_st* param = FUNDEF_PARAMS(node); param != NULL; param = PARAM_NEXT(param)) {
+        for (node_st* id = PARAM_DIMS(param); id != NULL; id = IDS_NEXT(id)) touch(l, STlookup(scope, IDS_NAME(id)));
+        touch(l, STlookup(scope, PARAM_NAME(param)));
+    }
+
+    // Arrays are allocated before their initialiser runs
+    for (node_st* decl = FUNBODY_DECLS(body); decl != NULL; decl = VARDECL_NEXT(decl)) {
+        Symbol* s = STlookup(scope, VARDECL_NAME(decl));
+        scan_expr(l, VARDECL_DIMS(decl));
+        if (IS_ARRAY(s->vtype)) touch(l, s);
+        scan_expr(l, VARDECL_INIT(decl));
+        touch(l, s);
+    }
+
+    scope->for_loop_counter = 0;
+    scan_stmts(l, scope, FUNBODY_STMTS(body));
+    scope->for_loop_counter = 0;
+
+    // Local arrays are freed on return
+    for (node_st* decl = FUNBODY_DECLS(body); decl != NULL; decl = VARDECL_NEXT(decl)) {
+        const Symbol* s = STlookup(scope, VARDECL_NAME(decl));
+        if (IS_ARRAY(s->vtype)) l->intervals[(size_t) HTlookup(l->index, (void*) s) - 1].end = l->pos;
+    }
+
+    // A variable that is live when a loop starts stays live until the loop ends
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < l->count; i++) {
+            Interval* interval = &l->intervals[i];
+            for (size_t j = 0; j < l->loop_count; j++) {
+                const Loop* loop = &l->loops[j];
+                if (interval->start < loop->start && interval->end >= loop->start && interval->end < loop->end) {
+                    interval->end = loop->end;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+static int compare_start(const void* a, const void* b) {
+    const Interval* x = *(Interval* const*) a;
+    const Interval* y = *(Interval* const*) b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/**
+ * Assigns callee-saved registers to live intervals by linear scan. When no
+ * register is free, the interval that ends last is kept in the frame.
+ * @param l liveness of the function
+ */
+static void linear_scan(Liveness* l) {
+    Interval** order = MEMmalloc(sizeof(Interval*) * (l->count + 1));
+    size_t n = 0;
+    for (size_t i = 0; i < l->count; i++) {
+        if (l->intervals[i].candidate) order[n++] = &l->intervals[i];
+    }
+    qsort(order, n, sizeof(Interval*), compare_start);
+
+    Interval* active[REG_COUNT] = {NULL};
+    for (size_t i = 0; i < n; i++) {
+        Interval* cur = order[i];
+
+        // Expire intervals that ended before this one starts
+        for (int r = 0; r < REG_COUNT; r++) {
+            if (active[r] != NULL && active[r]->end < cur->start) active[r] = NULL;
+        }
+
+        int free_reg = -1;
+        int last = -1;
+        for (int r = 0; r < REG_COUNT; r++) {
+            if (active[r] == NULL && free_reg < 0) free_reg = r;
+            if (active[r] != NULL && (last < 0 || active[r]->end > active[last]->end)) last = r;
+        }
+
+        if (free_reg >= 0) {
+            cur->reg = free_reg;
+            active[free_reg] = cur;
+        } else if (active[last]->end > cur->end) {
+            active[last]->reg = -1;
+            cur->reg = last;
+            active[last] = cur;
+        }
+    }
+
+    MEMfree(order);
+}
+
+/**
+ * Places the variables of a function in registers or frame slots
+ * @param fun function symbol
+ * @param node FunDef node
+ */
+static void layout_function(const Symbol* fun, node_st* node) {
+    Liveness l = {0};
+    l.fun = fun;
+    l.index = HTnew_Ptr(VARTABLE_SIZE);
+
+    scan_function(&l, node);
+    linear_scan(&l);
+
+    for (size_t i = 0; i < l.count; i++) {
+        const Interval* interval = &l.intervals[i];
+        if (interval->reg >= 0) FS->used_regs[interval->reg] = true;
+    }
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (FS->used_regs[r]) FS->reg_saves[r] = alloc_slot(8);
+    }
+
+    for (size_t i = 0; i < l.count; i++) {
+        const Interval* interval = &l.intervals[i];
+        Location* loc = MEMmalloc(sizeof(Location));
+        loc->reg = interval->reg;
+        loc->offset = interval->reg >= 0 ? 0 : alloc_slot(is_wide(interval->symbol) ? 8 : 4);
+        HTinsert(LOCATIONS, interval->symbol, loc);
+    }
+
+    HTdelete(l.index);
+    MEMfree(l.intervals);
+    MEMfree(l.loops);
+}
+
+/**
+ * Moves the parameters from their System V locations to their own
+ * @param fun function symbol
+ * @param params first Param node
+ */
+static void move_params(const Symbol* fun, node_st* params) {
+    const SymbolTable* scope = fun->as.fun.scope;
+    const bool* dead = fun->as.fun.dead_params;
+    size_t int_count = 0;
+    size_t float_count = 0;
+    size_t stack_count = 0;
+    size_t i = 0;
+
+    for (node_st* param = params; param != NULL; param = PARAM_NEXT(param)) {
+        node_st* id = PARAM_DIMS(param);
+        for (bool done = false; !done; i++) {
+            const Symbol* s;
+            if (id != NULL) {
+                s = STlookup(scope, IDS_NAME(id));
+                id = IDS_NEXT(id);
+            } else {
+                s = STlookup(scope, PARAM_NAME(param));
+                done = true;
+            }
+            if (dead != NULL && dead[i]) continue;
+
+            const bool has_location = HTlookup(LOCATIONS, (void*) s) != NULL;
+            char* op = has_location ? var_operand(s) : NULL;
+            if (s->vtype == VT_FLOAT) {
+                if (float_count < FLOAT_ARG_COUNT) {
+                    if (op != NULL) emit("movss %%xmm%lu, %s", float_count, op);
+                    float_count++;
+                } else {
+                    if (op != NULL) emit("movss %lu(%%rbp), %%xmm0", 16 + 8 * stack_count);
+                    if (op != NULL) emit("movss %%xmm0, %s", op);
+                    stack_count++;
+                }
+            } else if (int_count < INT_ARG_COUNT) {
+                if (op != NULL) emit("%s %s, %s", is_wide(s) ? "movq" : "movl",
+                    is_wide(s) ? INT_ARGS64[int_count] : INT_ARGS32[int_count], op);
+                int_count++;
+            } else {
+                if (op != NULL) {
+                    emit(is_wide(s) ? "movq %lu(%%rbp), %%rax" : "movl %lu(%%rbp), %%eax", 16 + 8 * stack_count);
+                    emit(is_wide(s) ? "movq %%rax, %s" : "movl %%eax, %s", op);
+                }
+                stack_count++;
+            }
+            MEMfree(op);
+        }
+    }
+}
+
+/**
+ * Generates the return path: frees the local arrays and restores the
+ * callee-saved registers, keeping the return value
+ */
+static void gen_epilogue() {
+    place_label(FS->ret_label);
+
+    if (FS->array_count > 0) {
+        const int slot = alloc_slot(8);
+        const bool is_float = FS->fun != NULL && FS->fun->vtype == VT_FLOAT;
+        emit(is_float ? "movss %%xmm0, %d(%%rbp)" : "movq %%rax, %d(%%rbp)", slot);
+        for (size_t i = 0; i < FS->array_count; i++) {
+            char* op = var_operand(FS->arrays[i]);
+            emit("movq %s, %%rdi", op);
+            call_aligned("free@PLT");
+            MEMfree(op);
+        }
+        emit(is_float ? "movss %d(%%rbp), %%xmm0" : "movq %d(%%rbp), %%rax", slot);
+    }
+
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (FS->used_regs[r]) emit("movq %d(%%rbp), %s", FS->reg_saves[r], REGS64[r]);
+    }
+    emit("leave");
+    emit("ret");
+}
+
+/**
+ * Writes a generated function with its prologue to the text section
+ * @param name assembly name of the function
+ * @param global whether the function is visible to other modules
+ */
+static void write_function(const char* name, const bool global) {
+    const int frame = (FS->frame_size + 15) / 16 * 16;
+
+    buf_printf(&TEXT, "\n");
+    if (global) buf_printf(&TEXT, "    .globl %s\n", name);
+    buf_printf(&TEXT, "    .type %s, @function\n%s:\n", name, name);
+    buf_printf(&TEXT, "    pushq %%rbp\n    movq %%rsp, %%rbp\n");
+    if (frame > 0) buf_printf(&TEXT, "    subq $%d, %%rsp\n", frame);
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (FS->used_regs[r]) buf_printf(&TEXT, "    movq %s, %d(%%rbp)\n", REGS64[r], FS->reg_saves[r]);
+    }
+    if (FS->body.data != NULL) buf_printf(&TEXT, "%s", FS->body.data);
+    buf_printf(&TEXT, "    .size %s, .-%s\n", name, name);
+}
+
+/**
+ * Evaluates the right operand of a float operation into %xmm1, keeping the
+ * left operand in %xmm0
+ * @param right right operand
+ */
+static void gen_float_rhs(node_st* right) {
+    if (NODE_TYPE(right) == NT_FLOAT) {
+        emit("movl $%u, %%ecx", float_bits(FLOAT_VAL(right)));
+        emit("movd %%ecx, %%xmm1");
+    } else if (NODE_TYPE(right) == NT_VAR && VAR_INDICES(right) == NULL) {
+        char* op = var_operand(VAR_SYMBOL(right));
+        emit("movss %s, %%xmm1", op);
+        MEMfree(op);
+    } else {
+        push_result(VT_FLOAT);
+        TRAVdo(right);
+        emit("movaps %%xmm0, %%xmm1");
+        pop_reg("%rax");
+        emit("movd %%eax, %%xmm0");
+    }
+}
+
+/**
+ * Generates a float operation on %xmm0 and %xmm1
+ * @param op operation
+ */
+static void gen_float_op(const enum BinOpType op) {
+    switch (op) {
+        case BO_add: emit("addss %%xmm1, %%xmm0"); return;
+        case BO_sub: emit("subss %%xmm1, %%xmm0"); return;
+        case BO_mul: emit("mulss %%xmm1, %%xmm0"); return;
+        case BO_div: emit("divss %%xmm1, %%xmm0"); return;
+        case BO_lt: emit("ucomiss %%xmm0, %%xmm1"); emit("seta %%al"); break;
+        case BO_le: emit("ucomiss %%xmm0, %%xmm1"); emit("setae %%al"); break;
+        case BO_gt: emit("ucomiss %%xmm1, %%xmm0"); emit("seta %%al"); break;
+        case BO_ge: emit("ucomiss %%xmm1, %%xmm0"); emit("setae %%al"); break;
+        case BO_eq:
+            emit("ucomiss %%xmm1, %%xmm0");
+            emit("sete %%al");
+            emit("setnp %%cl");
+            emit("andb %%cl, %%al");
+            break;
+        case BO_ne:
+            emit("ucomiss %%xmm1, %%xmm0");
+            emit("setne %%al");
+            emit("setp %%cl");
+            emit("orb %%cl, %%al");
+            break;
+        default:
+#ifdef DEBUGGING
+            ERROR("X86: unexpected float binop %i", op);
+#endif // DEBUGGING
+            return;
+    }
+    emit("movzbl %%al, %%eax");
+}
+
+/**
+ * Jumps to a label depending on a condition, comparing integers directly
+ * instead of materialising a bool
+ * @param node condition
+ * @param label label to jump to
+ * @param when value of the condition that jumps
+ */
+static void branch(node_st* node, const size_t label, const bool when) {
+    if (NODE_TYPE(node) == NT_BOOL) {
+        if (BOOL_VAL(node) == when) emit("jmp .L%lu", label);
+        return;
+    }
+
+    if (NODE_TYPE(node) == NT_MONOP && MONOP_OP(node) == MO_not) {
+        branch(MONOP_OPERAND(node), label, !when);
+        return;
+    }
+
+    if (NODE_TYPE(node) == NT_BINOP && (BINOP_OP(node) == BO_and || BINOP_OP(node) == BO_or)) {
+        // Jumping on true through an and, or on false through an or, needs both operands
+        const bool both = (BINOP_OP(node) == BO_and) == when;
+        if (both) {
+            const size_t skip = new_label();
+            branch(BINOP_LEFT(node), skip, !when);
+            branch(BINOP_RIGHT(node), label, when);
+            place_label(skip);
+        } else {
+            branch(BINOP_LEFT(node), label, when);
+            branch(BINOP_RIGHT(node), label, when);
+        }
+        return;
+    }
+
+    const char* jumps[][2] = {
+        [BO_lt] = {"jge", "jl"}, [BO_le] = {"jg", "jle"}, [BO_gt] = {"jle", "jg"},
+        [BO_ge] = {"jl", "jge"}, [BO_eq] = {"jne", "je"}, [BO_ne] = {"je", "jne"},
+    };
+
+    if (NODE_TYPE(node) == NT_BINOP && BINOP_OP(node) >= BO_lt && BINOP_OP(node) <= BO_ne) {
+        TRAVdo(BINOP_LEFT(node));
+        if (LAST_TYPE != VT_FLOAT) {
+            char* op = simple_operand(BINOP_RIGHT(node));
+            if (op == NULL) {
+                push_result(LAST_TYPE);
+                TRAVdo(BINOP_RIGHT(node));
+                emit("movl %%eax, %%ecx");
+                pop_reg("%rax");
+                op = STRcpy("%ecx");
+            }
+            emit("cmpl %s, %%eax", op);
+            emit("%s .L%lu", jumps[BINOP_OP(node)][when], label);
+            MEMfree(op);
+            return;
+        }
+
+        // Floats compare through a bool, as unordered operands need care
+        gen_float_rhs(BINOP_RIGHT(node));
+        gen_float_op(BINOP_OP(node));
+    } else {
+        TRAVdo(node);
+    }
+
+    emit("testl %%eax, %%eax");
+    emit("%s .L%lu", when ? "jne" : "je", label);
+}
+
+/**
+ * Records the linkage names of the imported and exported globals
+ * @param decls first Decls node
+ */
+static void collect_link_names(node_st* decls) {
+    for (; decls != NULL; decls = DECLS_NEXT(decls)) {
+        node_st* decl = DECLS_DECL(decls);
+        const bool imported = NODE_TYPE(decl) == NT_GLOBDECL;
+        if (!imported && (NODE_TYPE(decl) != NT_GLOBDEF || !GLOBDEF_EXPORT(decl))) continue;
+
+        char* name = imported ? GLOBDECL_NAME(decl) : GLOBDEF_NAME(decl);
+        Symbol* s = STlookup(GB_GLOBAL_SCOPE, name);
+        HTinsert(LINK_NAMES, s, STRcpy(name));
+
+        // Imported dimensions are linked by the name the exporting module gives them
+        for (size_t i = 0; IS_ARRAY(s->vtype) && i < s->as.array.dim_count; i++) {
+            Symbol* dim = s->as.array.dims[i];
+            HTinsert(LINK_NAMES, dim, imported ? generate_array_dim_name(name, i) : STRcpy(dim->name));
+        }
+    }
+}
+
+static void init_state(FunState* state, Symbol* fun) {
+    memset(state, 0, sizeof(*state));
+    state->fun = fun;
+    state->ret_label = new_label();
+}
+
+static void free_state(FunState* state) {
+    buf_free(&state->body);
+    MEMfree(state->arrays);
+}
+
+/**
+ * Declares a global variable in the data or bss section
+ * @param label label of the variable
+ * @param global whether the variable is exported
+ * @param size size in bytes
+ * @param value initial bits, for a variable in the data section
+ * @param has_value whether the variable has an initial value
+ */
+static void declare_global(const char* label, const bool global, const int size, const uint32_t value,
+                           const bool has_value) {
+    Buffer* section = has_value ? &DATA : &BSS;
+    if (global) buf_printf(section, "    .globl %s\n", label);
+    buf_printf(section, "    .align %d\n%s:\n", size, label);
+    if (has_value) buf_printf(section, "    .long %u\n", value);
+    else buf_printf(section, "    .zero %d\n", size);
+}
+
+/**
+ * Writes the generated sections and the entry point of the module
+ * @param f output file
+ * @param has_init whether the module has an initialiser
+ */
+static void write_module(FILE* f, const bool has_init) {
+    fprintf(f, "# Generated by civicc from %s\n\n    .text\n", file_basename(global.input_file));
+    if (TEXT.data != NULL) fprintf(f, "%s", TEXT.data);
+
+    if (MAIN_FUN != NULL) {
+        fprintf(f, "\n    .globl main\n    .type main, @function\nmain:\n");
+        fprintf(f, "    pushq %%rbp\n    movq %%rsp, %%rbp\n    call civic_main\n");
+        if (MAIN_FUN->vtype != VT_NUM) fprintf(f, "    xorl %%eax, %%eax\n");
+        fprintf(f, "    popq %%rbp\n    ret\n    .size main, .-main\n");
+    }
+
+    if (DATA.data != NULL) fprintf(f, "\n    .data\n%s", DATA.data);
+    if (BSS.data != NULL) fprintf(f, "\n    .bss\n%s", BSS.data);
+    if (has_init) fprintf(f, "\n    .section .init_array, \"aw\"\n    .align 8\n    .quad module_init\n");
+    fprintf(f, "\n    .section .note.GNU-stack, \"\", @progbits\n");
+}
+
+/**
+ * @fn XCGprogram
+ */
+node_st *XCGprogram(node_st *node)
+{
+    if (global.emit != EMIT_X86 || global.had_error) return node;
+
+    LABEL_COUNT = 0;
+    LOCATIONS = HTnew_Ptr(VARTABLE_SIZE);
+    LINK_NAMES = HTnew_Ptr(VARTABLE_SIZE);
+    collect_link_names(PROGRAM_DECLS(node));
+    CURRENT_SCOPE = GB_GLOBAL_SCOPE;
+    MAIN_FUN = NULL;
+
+    FunState init;
+    init_state(&init, NULL);
+    FS = &init;
+
+    TRAVchildren(node);
+
+    // The module initialiser runs before main
+    if (init.body.len > 0) {
+        gen_epilogue();
+        write_function("module_init", false);
+    }
+
+    // Nothing is written after errors
+    FILE* f = global.had_error ? NULL : GLBopenOutput(false);
+    if (f != NULL) {
+        write_module(f, init.body.len > 0);
+        GLBcloseOutput(f);
+    } else if (!global.had_error) {
+        USER_ERROR("Could not create assembly file %s", global.output_file);
+        global.had_error = true;
+    }
+
+    free_state(&init);
+    buf_free(&TEXT);
+    buf_free(&DATA);
+    buf_free(&BSS);
+    for (htable_iter_st* iter = HTiterate(LOCATIONS); iter; iter = HTiterateNext(iter)) {
+        MEMfree(HTiterValue(iter));
+    }
+    HTdelete(LOCATIONS);
+    LOCATIONS = NULL;
+    for (htable_iter_st* iter = HTiterate(LINK_NAMES); iter; iter = HTiterateNext(iter)) {
+        MEMfree(HTiterValue(iter));
+    }
+    HTdelete(LINK_NAMES);
+    LINK_NAMES = NULL;
+
+    return node;
+}
+
+/**
+ * @fn XCGglobdecl
+ */
+node_st *XCGglobdecl(node_st *node)
+{
+    // Imported variables are resolved by the linker
+    return node;
+}
+
+/**
+ * @fn XCGglobdef
+ */
+node_st *XCGglobdef(node_st *node)
+{
+    const Symbol* s = STlookup(CURRENT_SCOPE, GLOBDEF_NAME(node));
+    const bool exported = GLOBDEF_EXPORT(node);
+
+    if (IS_ARRAY(s->vtype)) {
+        for (size_t i = 0; i < s->as.array.dim_count; i++) {
+            char* dim = global_label(s->as.array.dims[i]);
+            declare_global(dim, exported, 4, 0, false);
+            MEMfree(dim);
+        }
+
+        char* label = global_label(s);
+        declare_global(label, exported, 8, 0, false);
+        MEMfree(label);
+
+        define_array(s, GLOBDEF_DIMS(node), GLOBDEF_INIT(node));
+        return node;
+    }
+
+    char* label = global_label(s);
+    node_st* init = GLOBDEF_INIT(node);
+    ConstValue v;
+    if (init != NULL && CEfromLiteral(init, &v)) {
+        // Literals initialise the variable statically
+        const uint32_t bits = v.vtype == VT_FLOAT ? float_bits(v.as.f) : (uint32_t) (v.vtype == VT_BOOL ? v.as.b : v.as.i);
+        declare_global(label, exported, 4, bits, true);
+    } else {
+        declare_global(label, exported, 4, 0, false);
+        if (init != NULL) {
+            TRAVdo(init);
+            store_result(s);
+        }
+    }
+    MEMfree(label);
+
+    return node;
+}
+
+/**
+ * @fn XCGfundef
+ */
+node_st *XCGfundef(node_st *node)
+{
+    Symbol* fun = STlookup(CURRENT_SCOPE, FUNDEF_NAME(node));
+    if (fun->imported) return node;
+
+    if (fun->exported && STReq(fun->name, "main")) MAIN_FUN = fun;
+
+    FunState state;
+    init_state(&state, fun);
+    FunState* prev_state = FS;
+    SymbolTable* prev_scope = CURRENT_SCOPE;
+    FS = &state;
+    CURRENT_SCOPE = fun->as.fun.scope;
+
+    // The static link sits right below the saved frame pointer
+    if (fun_level(fun) > 0) alloc_slot(8);
+    layout_function(fun, node);
+
+    // Nested functions need the layout of this function
+    node_st* body = FUNDEF_BODY(node);
+    TRAVopt(FUNBODY_LOCAL_FUNDEFS(body));
+
+    if (fun_level(fun) > 0) emit("movq %%r10, -8(%%rbp)");
+    move_params(fun, FUNDEF_PARAMS(node));
+
+    TRAVopt(FUNBODY_DECLS(body));
+    CURRENT_SCOPE->for_loop_counter = 0;
+    TRAVopt(FUNBODY_STMTS(body));
+    CURRENT_SCOPE->for_loop_counter = 0;
+
+    gen_epilogue();
+    char* name = fun_name(fun);
+    write_function(name, fun->exported);
+    MEMfree(name);
+
+    FS = prev_state;
+    CURRENT_SCOPE = prev_scope;
+    free_state(&state);
+
+    return node;
+}
+
+/**
+ * @fn XCGvardecl
+ */
+node_st *XCGvardecl(node_st *node)
+{
+    const Symbol* s = STlookup(CURRENT_SCOPE, VARDECL_NAME(node));
+
+    if (IS_ARRAY(s->vtype)) {
+        define_array(s, VARDECL_DIMS(node), VARDECL_INIT(node));
+    } else if (VARDECL_INIT(node) == NULL || NODE_TYPE(VARDECL_INIT(node)) == NT_NUM
+               || NODE_TYPE(VARDECL_INIT(node)) == NT_BOOL) {
+        char* value = VARDECL_INIT(node) == NULL ? STRcpy("$0") : simple_operand(VARDECL_INIT(node));
+        char* op = var_operand(s);
+        emit("movl %s, %s", value, op);
+        MEMfree(op);
+        MEMfree(value);
+    } else {
+        TRAVdo(VARDECL_INIT(node));
+        store_result(s);
+    }
+
+    TRAVnext(node);
+    return node;
+}
+
+/**
+ * @fn XCGassign
+ */
+node_st *XCGassign(node_st *node)
+{
+    node_st* let = ASSIGN_LET(node);
+    const Symbol* s = VARLET_SYMBOL(let);
+    node_st* expr = ASSIGN_EXPR(node);
+
+    if (VARLET_INDICES(let) == NULL) {
+        if (NODE_TYPE(expr) == NT_NUM || NODE_TYPE(expr) == NT_BOOL) {
+            char* value = simple_operand(expr);
+            char* op = var_operand(s);
+            emit("movl %s, %s", value, op);
+            MEMfree(op);
+            MEMfree(value);
+        } else {
+            TRAVdo(expr);
+            store_result(s);
+        }
+        return node;
+    }
+
+    // The value is computed before the indices
+    TRAVdo(expr);
+    push_result(LAST_TYPE);
+    gen_flat_index(s, VARLET_INDICES(let));
+    char* op = var_operand(s);
+    emit("movq %s, %%rcx", op);
+    MEMfree(op);
+    pop_reg("%rdx");
+    emit("movl %%edx, (%%rcx,%%rax,4)");
+
+    return node;
+}
+
+/**
+ * @fn XCGexprstmt
+ */
+node_st *XCGexprstmt(node_st *node)
+{
+    TRAVexpr(node);
+    return node;
+}
+
+/**
+ * @fn XCGreturn
+ */
+node_st *XCGreturn(node_st *node)
+{
+    TRAVexpr(node);
+    emit("jmp .L%lu", FS->ret_label);
+    return node;
+}
+
+/**
+ * @fn XCGifelse
+ */
+node_st *XCGifelse(node_st *node)
+{
+    const size_t end = new_label();
+    const size_t other = IFELSE_ELSE_BLOCK(node) != NULL ? new_label() : end;
+
+    branch(IFELSE_COND(node), other, false);
+    TRAVthen(node);
+    if (IFELSE_ELSE_BLOCK(node) != NULL) {
+        emit("jmp .L%lu", end);
+        place_label(other);
+        TRAVelse_block(node);
+    }
+    place_label(end);
+
+    return node;
+}
+
+/**
+ * @fn XCGwhile
+ */
+node_st *XCGwhile(node_st *node)
+{
+    // The condition is checked at the bottom, so each iteration takes one jump
+    const size_t body = new_label();
+    const size_t cond = new_label();
+
+    emit("jmp .L%lu", cond);
+    place_label(body);
+    TRAVblock(node);
+    place_label(cond);
+    branch(WHILE_COND(node), body, true);
+
+    return node;
+}
+
+/**
+ * @fn XCGdowhile
+ */
+node_st *XCGdowhile(node_st *node)
+{
+    const size_t body = new_label();
+
+    place_label(body);
+    TRAVblock(node);
+    branch(DOWHILE_COND(node), body, true);
+
+    return node;
+}
+
+/**
+ * @fn XCGfor
+ */
+node_st *XCGfor(node_st *node)
+{
+    SymbolTable* loop_scope = enter_loop(CURRENT_SCOPE, node);
+    CURRENT_SCOPE = loop_scope;
+    const Symbol* var = STlookup(loop_scope, FOR_VAR(node));
+
+    // Start, stop and step are evaluated once, before the loop
+    TRAVstart_expr(node);
+    store_result(var);
+
+    char* stop;
+    if (NODE_TYPE(FOR_STOP(node)) == NT_NUM) {
+        stop = simple_operand(FOR_STOP(node));
+    } else {
+        TRAVstop(node);
+        const int slot = alloc_slot(4);
+        emit("movl %%eax, %d(%%rbp)", slot);
+        stop = STRfmt("%d(%%rbp)", slot);
+    }
+
+    ConstValue step = {.vtype = VT_NUM, .as.i = 1};
+    const bool constant_step = FOR_STEP(node) == NULL || CEevaluate(FOR_STEP(node), NULL, &step);
+    int step_slot = 0;
+    if (!constant_step) {
+        TRAVstep(node);
+        step_slot = alloc_slot(4);
+        emit("movl %%eax, %d(%%rbp)", step_slot);
+    }
+
+    const size_t top = new_label();
+    const size_t body = new_label();
+    const size_t end = new_label();
+
+    place_label(top);
+    char* op = var_operand(var);
+    emit("movl %s, %%eax", op);
+    MEMfree(op);
+    if (constant_step) {
+        emit("cmpl %s, %%eax", stop);
+        emit("%s .L%lu", step.as.i >= 0 ? "jge" : "jle", end);
+    } else {
+        const size_t negative = new_label();
+        emit("cmpl $0, %d(%%rbp)", step_slot);
+        emit("jl .L%lu", negative);
+        emit("cmpl %s, %%eax", stop);
+        emit("jge .L%lu", end);
+        emit("jmp .L%lu", body);
+        place_label(negative);
+        emit("cmpl %s, %%eax", stop);
+        emit("jle .L%lu", end);
+    }
+
+    place_label(body);
+    TRAVblock(node);
+
+    op = var_operand(var);
+    if (!constant_step) {
+        emit("movl %d(%%rbp), %%eax", step_slot);
+        emit("addl %%eax, %s", op);
+    } else if (step.as.i == 1) {
+        emit("incl %s", op);
+    } else {
+        emit("addl $%d, %s", step.as.i, op);
+    }
+    MEMfree(op);
+    emit("jmp .L%lu", top);
+    place_label(end);
+
+    CURRENT_SCOPE = loop_scope->parent_scope;
+    leave_loop(loop_scope);
+    MEMfree(stop);
+
+    return node;
+}
+
+/**
+ * Whether an argument can be loaded straight into its argument register
+ * @param arg argument expression
+ * @return whether the argument is a literal or a variable
+ */
+static bool is_simple_arg(node_st* arg) {
+    switch (NODE_TYPE(arg)) {
+        case NT_NUM:
+        case NT_BOOL:
+        case NT_FLOAT: return true;
+        case NT_VAR: return VAR_INDICES(arg) == NULL;
+        default: return false;
+    }
+}
+
+/**
+ * Loads a simple argument into its argument register
+ * @param arg argument expression, or NULL for a dimension
+ * @param dim dimension symbol when arg is NULL
+ * @param int_count integer registers in use
+ * @param float_count float registers in use
+ */
+static void load_simple_arg(node_st* arg, const Symbol* dim, size_t* int_count, size_t* float_count) {
+    if (arg == NULL) {
+        char* op = dim_operand(dim);
+        emit("movl %s, %s", op, INT_ARGS32[(*int_count)++]);
+        MEMfree(op);
+        return;
+    }
+
+    if (NODE_TYPE(arg) == NT_FLOAT) {
+        emit("movl $%u, %%eax", float_bits(FLOAT_VAL(arg)));
+        emit("movd %%eax, %%xmm%lu", (*float_count)++);
+        return;
+    }
+
+    if (NODE_TYPE(arg) == NT_VAR) {
+        const Symbol* s = VAR_SYMBOL(arg);
+        char* op = var_operand(s);
+        if (s->vtype == VT_FLOAT) emit("movss %s, %%xmm%lu", op, (*float_count)++);
+        else if (is_wide(s)) emit("movq %s, %s", op, INT_ARGS64[(*int_count)++]);
+        else emit("movl %s, %s", op, INT_ARGS32[(*int_count)++]);
+        MEMfree(op);
+        return;
+    }
+
+    char* op = simple_operand(arg);
+    emit("movl %s, %s", op, INT_ARGS32[(*int_count)++]);
+    MEMfree(op);
+}
+
+/**
+ * @fn XCGfuncall
+ */
+node_st *XCGfuncall(node_st *node)
+{
+    const Symbol* fun = FUNCALL_SYMBOL(node);
+    const bool* dead = fun->as.fun.dead_params;
+
+    // Collect the live arguments; arrays pass their dimensions first
+    size_t size = INITIAL_LIST_SIZE;
+    size_t count = 0;
+    node_st** args = MEMmalloc(sizeof(node_st*) * size);
+    const Symbol** dims = MEMmalloc(sizeof(Symbol*) * size);
+    bool* floats = MEMmalloc(sizeof(bool) * size);
+    size_t i = 0;
+    for (node_st* e = FUNCALL_FUN_ARGS(node); e != NULL; e = EXPRS_NEXT(e)) {
+        node_st* arg = EXPRS_EXPR(e);
+        const Symbol* arr = NODE_TYPE(arg) == NT_VAR ? VAR_SYMBOL(arg) : NULL;
+        const size_t dim_count = arr != NULL && VAR_INDICES(arg) == NULL && IS_ARRAY(arr->vtype)
+                                     ? arr->as.array.dim_count : 0;
+        for (size_t j = 0; j <= dim_count; j++, i++) {
+            if (dead != NULL && dead[i]) continue;
+            if (count == size) {
+                size *= 2;
+                ARRAY_RESIZE(args, size);
+                ARRAY_RESIZE(dims, size);
+                ARRAY_RESIZE(floats, size);
+            }
+            args[count] = j < dim_count ? NULL : arg;
+            dims[count] = j < dim_count ? arr->as.array.dims[j] : NULL;
+            floats[count] = fun->as.fun.param_types[i] == VT_FLOAT;
+            count++;
+        }
+    }
+
+    // Arguments that do not fit in registers go on the stack, in order
+    bool* on_stack = MEMmalloc(sizeof(bool) * size);
+    size_t int_count = 0;
+    size_t float_count = 0;
+    size_t stack_count = 0;
+    bool simple = true;
+    for (size_t a = 0; a < count; a++) {
+        on_stack[a] = floats[a] ? float_count++ >= FLOAT_ARG_COUNT : int_count++ >= INT_ARG_COUNT;
+        stack_count += on_stack[a];
+        simple = simple && (args[a] == NULL || is_simple_arg(args[a]));
+    }
+
+    size_t popped = 0;
+    int_count = 0;
+    float_count = 0;
+    if (simple && stack_count == 0) {
+        // Nothing can change the arguments while they are loaded
+        if (FS->depth % 2 != 0) {
+            emit("subq $8, %%rsp");
+            FS->depth++;
+            popped = 1;
+        }
+        for (size_t a = 0; a < count; a++) load_simple_arg(args[a], dims[a], &int_count, &float_count);
+    } else {
+        // Evaluate the arguments from left to right onto the stack
+        for (size_t a = 0; a < count; a++) {
+            if (args[a] == NULL) {
+                char* op = dim_operand(dims[a]);
+                emit("movl %s, %%eax", op);
+                MEMfree(op);
+                push_reg("%rax");
+            } else {
+                TRAVdo(args[a]);
+                push_result(LAST_TYPE);
+            }
+        }
+
+        const bool pad = (FS->depth + stack_count) % 2 != 0;
+        if (pad) {
+            emit("subq $8, %%rsp");
+            FS->depth++;
+        }
+
+        size_t pushed = 0;
+        for (size_t a = count; a-- > 0;) {
+            if (!on_stack[a]) continue;
+            emit("pushq %lu(%%rsp)", 8 * (count - 1 - a + pad + pushed));
+            FS->depth++;
+            pushed++;
+        }
+
+        for (size_t a = 0; a < count; a++) {
+            if (on_stack[a]) continue;
+            const size_t offset = 8 * (count - 1 - a + pad + stack_count);
+            if (floats[a]) emit("movss %lu(%%rsp), %%xmm%lu", offset, float_count++);
+            else emit("movq %lu(%%rsp), %s", offset, INT_ARGS64[int_count++]);
+        }
+        popped = count + pad + stack_count;
+    }
+
+    // Nested functions get the frame of the function that defines them
+    if (fun_level(fun) > 0) {
+        const size_t current = FS->fun == NULL ? 0 : fun_level(FS->fun);
+        if (fun_level(fun) == current + 1) {
+            emit("movq %%rbp, %%r10");
+        } else {
+            emit("movq -8(%%rbp), %%r10");
+            for (size_t hop = fun_level(fun); hop < current; hop++) emit("movq -8(%%r10), %%r10");
+        }
+    }
+
+    char* name = fun_name(fun);
+    emit(fun->imported ? "call %s@PLT" : "call %s", name);
+    MEMfree(name);
+
+    if (popped > 0) emit("addq $%lu, %%rsp", 8 * popped);
+    FS->depth -= popped;
+
+    // C only defines the lowest byte of a returned bool
+    if (fun->imported && fun->vtype == VT_BOOL) emit("movzbl %%al, %%eax");
+
+    LAST_TYPE = fun->vtype;
+    MEMfree(args);
+    MEMfree(dims);
+    MEMfree(floats);
+    MEMfree(on_stack);
+    return node;
+}
+
+/**
+ * @fn XCGcast
+ */
+node_st *XCGcast(node_st *node)
+{
+    TRAVexpr(node);
+    const ValueType from = LAST_TYPE;
+    const ValueType to = ct_to_vt(CAST_TYPE(node), false);
+
+    if (from == to) {
+        // Nothing to convert
+    } else if (to == VT_FLOAT) {
+        emit("cvtsi2ssl %%eax, %%xmm0");
+    } else if (to == VT_BOOL && from == VT_FLOAT) {
+        emit("xorps %%xmm1, %%xmm1");
+        emit("ucomiss %%xmm1, %%xmm0");
+        emit("setne %%al");
+        emit("setp %%cl");
+        emit("orb %%cl, %%al");
+        emit("movzbl %%al, %%eax");
+    } else if (to == VT_BOOL) {
+        emit("testl %%eax, %%eax");
+        emit("setne %%al");
+        emit("movzbl %%al, %%eax");
+    } else if (from == VT_FLOAT) {
+        emit("cvttss2si %%xmm0, %%eax");
+    }
+
+    LAST_TYPE = to;
+    return node;
+}
+
+/**
+ * @fn XCGbinop
+ */
+node_st *XCGbinop(node_st *node)
+{
+    const enum BinOpType op = BINOP_OP(node);
+    const bool comparison = op >= BO_lt && op <= BO_ne;
+
+    // Short-circuiting operators become branches
+    if (op == BO_and || op == BO_or) {
+        const size_t end = new_label();
+        TRAVleft(node);
+        emit("testl %%eax, %%eax");
+        emit("%s .L%lu", op == BO_and ? "je" : "jne", end);
+        TRAVright(node);
+        place_label(end);
+        LAST_TYPE = VT_BOOL;
+        return node;
+    }
+
+    TRAVleft(node);
+    const ValueType vt = LAST_TYPE;
+
+    if (vt == VT_FLOAT) {
+        gen_float_rhs(BINOP_RIGHT(node));
+        gen_float_op(op);
+        LAST_TYPE = comparison ? VT_BOOL : VT_FLOAT;
+        return node;
+    }
+
+    char* right = simple_operand(BINOP_RIGHT(node));
+    if (right == NULL) {
+        push_result(vt);
+        TRAVright(node);
+        emit("movl %%eax, %%ecx");
+        pop_reg("%rax");
+        right = STRcpy("%ecx");
+    }
+
+    switch (op) {
+        case BO_add: emit(vt == VT_BOOL ? "orl %s, %%eax" : "addl %s, %%eax", right); break;
+        case BO_sub: emit("subl %s, %%eax", right); break;
+        case BO_mul: emit(vt == VT_BOOL ? "andl %s, %%eax" : "imull %s, %%eax", right); break;
+        case BO_div:
+        case BO_mod: {
+            // idivl traps on INT_MIN / -1, the VM wraps like negation instead
+            const char* by_minus_one = op == BO_div ? "negl %eax" : "xorl %eax, %eax";
+            if (STReq(right, "$-1")) {
+                emit("%s", by_minus_one);
+                break;
+            }
+            const bool check = right[0] != '$';
+            const size_t minus_one = check ? new_label() : 0;
+            const size_t end = check ? new_label() : 0;
+            if (!STReq(right, "%ecx")) emit("movl %s, %%ecx", right);
+            if (check) {
+                emit("cmpl $-1, %%ecx");
+                emit("je .L%lu", minus_one);
+            }
+            emit("cltd");
+            emit("idivl %%ecx");
+            if (op == BO_mod) emit("movl %%edx, %%eax");
+            if (check) {
+                emit("jmp .L%lu", end);
+                place_label(minus_one);
+                emit("%s", by_minus_one);
+                place_label(end);
+            }
+            break;
+        }
+        default: {
+            const char* sets[] = {
+                [BO_lt] = "setl", [BO_le] = "setle", [BO_gt] = "setg",
+                [BO_ge] = "setge", [BO_eq] = "sete", [BO_ne] = "setne",
+            };
+            emit("cmpl %s, %%eax", right);
+            emit("%s %%al", sets[op]);
+            emit("movzbl %%al, %%eax");
+            break;
+        }
+    }
+    MEMfree(right);
+
+    LAST_TYPE = comparison ? VT_BOOL : vt;
+    return node;
+}
+
+/**
+ * @fn XCGmonop
+ */
+node_st *XCGmonop(node_st *node)
+{
+    TRAVoperand(node);
+
+    if (MONOP_OP(node) == MO_not) {
+        emit("xorl $1, %%eax");
+    } else if (LAST_TYPE == VT_FLOAT) {
+        emit("movd %%xmm0, %%eax");
+        emit("xorl $0x80000000, %%eax");
+        emit("movd %%eax, %%xmm0");
+    } else {
+        emit("negl %%eax");
+    }
+
+    return node;
+}
+
+/**
+ * @fn XCGvar
+ */
+node_st *XCGvar(node_st *node)
+{
+    const Symbol* s = VAR_SYMBOL(node);
+
+    if (VAR_INDICES(node) == NULL) {
+        char* op = var_operand(s);
+        if (s->vtype == VT_FLOAT) emit("movss %s, %%xmm0", op);
+        else if (is_wide(s)) emit("movq %s, %%rax", op);
+        else emit("movl %s, %%eax", op);
+        MEMfree(op);
+        LAST_TYPE = s->vtype;
+        return node;
+    }
+
+    gen_flat_index(s, VAR_INDICES(node));
+    char* op = var_operand(s);
+    emit("movq %s, %%rcx", op);
+    MEMfree(op);
+
+    LAST_TYPE = demote_array_type(s->vtype);
+    if (LAST_TYPE == VT_FLOAT) emit("movss (%%rcx,%%rax,4), %%xmm0");
+    else emit("movl (%%rcx,%%rax,4), %%eax");
+
+    return node;
+}
+
+/**
+ * @fn XCGnum
+ */
+node_st *XCGnum(node_st *node)
+{
+    if (NUM_VAL(node) == 0) emit("xorl %%eax, %%eax");
+    else emit("movl $%d, %%eax", NUM_VAL(node));
+
+    LAST_TYPE = VT_NUM;
+    return node;
+}
+
+/**
+ * @fn XCGfloat
+ */
+node_st *XCGfloat(node_st *node)
+{
+    const uint32_t bits = float_bits(FLOAT_VAL(node));
+    if (bits == 0) {
+        emit("xorps %%xmm0, %%xmm0");
+    } else {
+        emit("movl $%u, %%eax", bits);
+        emit("movd %%eax, %%xmm0");
+    }
+
+    LAST_TYPE = VT_FLOAT;
+    return node;
+}
+
+/**
+ * @fn XCGbool
+ */
+node_st *XCGbool(node_st *node)
+{
+    emit("movl $%d, %%eax", BOOL_VAL(node) ? 1 : 0);
+    LAST_TYPE = VT_BOOL;
+    return node;
+}
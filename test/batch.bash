@@ -0,0 +1,48 @@
+#!/usr/bin/env bash
+
+# Compiles the test programs of each directory with one civicc --batch, read
+# from a response file, and compares every output with a separate compilation.
+# A batch with an erroneous program has to fail and report its diagnostics
+# under the file name, in input order.
+#
+# Usage: batch.bash <civicc> [CATEGORY...]
+
+USAGE="<civicc> [CATEGORY...]"
+source "$(dirname "$0")/lib.bash"
+shift
+CATEGORIES=${*:-basic nested_funs arrays}
+
+for dir in $(for c in $CATEGORIES; do echo $c/check_success $c/functional; done); do
+    files=$(ls $dir/*.cvc 2> /dev/null)
+    if [[ -z "$files" ]]; then continue; fi
+
+    echo "$files" > "$OUT/inputs"
+    rm -rf "$OUT/batch"
+    if ! "$CIVCC" ${CFLAGS-} --batch -j 4 -d "$OUT/batch" @"$OUT/inputs" > /dev/null; then
+        fail "$dir: batch failed"
+        continue
+    fi
+
+    for file in $files; do
+        name=$(basename "${file%.cvc}")
+        "$CIVCC" ${CFLAGS-} -o "$OUT/single.s" "$file" > /dev/null 2>&1
+        if ! cmp -s "$OUT/single.s" "$OUT/batch/$name.s"; then
+            fail "$file: batch output differs"
+        fi
+    done
+    echo "$dir: $(echo "$files" | wc -l) files"
+done
+
+# Diagnostics of the failing files, in the order they were given
+errors=$(ls basic/check_error/*.cvc | head -3)
+success=$(ls basic/check_success/*.cvc | head -1)
+if "$CIVCC" --batch -d "$OUT/errors" $errors $success 2> "$OUT/errors.txt" > /dev/null; then
+    fail "batch with errors succeeded"
+elif [[ "$(grep -E '\.cvc:$' "$OUT/errors.txt")" != "$(echo "$errors" | sed 's/$/:/')" ]]; then
+    cat "$OUT/errors.txt"
+    fail "diagnostics are not ordered by input"
+elif [[ ! -f "$OUT/errors/$(basename "${success%.cvc}").s" ]]; then
+    fail "batch with errors did not compile the other files"
+fi
+
+finish "batch outputs match"
@@ -0,0 +1,74 @@
+#!/usr/bin/env bash
+
+# Compiles the test programs twice with a fresh CIVICC_CACHE_DIR. The second
+# round has to hit the cache for every program and write the same outputs,
+# the printed program included.
+# Changing an option has to miss, moving the source to another directory has
+# to hit, and a small CIVICC_CACHE_SIZE has to evict.
+#
+# Usage: cache.bash <civicc> [CATEGORY...]
+
+USAGE="<civicc> [CATEGORY...]"
+source "$(dirname "$0")/lib.bash"
+shift
+CATEGORIES=${*:-basic nested_funs arrays}
+export CIVICC_CACHE_DIR="$OUT/cache"
+
+function stat_of {
+    "$CIVCC" --cache-stats | awk -v k="$1" '$1 == k { print $2 }'
+}
+
+FILES=$(test_programs $CATEGORIES)
+n=0
+
+for file in $FILES; do
+    n=$((n + 1))
+    "$CIVCC" -g -o "$OUT/$n.s" "$file" > "$OUT/$n.out" 2> "$OUT/$n.err"
+done
+if [[ "$(stat_of misses)" != "$n" || "$(stat_of hits)" != "0" ]]; then
+    fail "first round did not miss every program"
+fi
+
+n=0
+for file in $FILES; do
+    n=$((n + 1))
+    "$CIVCC" -g -o "$OUT/cached.s" "$file" > "$OUT/cached.out" 2> "$OUT/cached.err"
+    if ! cmp -s "$OUT/$n.s" "$OUT/cached.s" || ! cmp -s "$OUT/$n.s.lines" "$OUT/cached.s.lines" ||
+       ! cmp -s "$OUT/$n.out" "$OUT/cached.out" || ! cmp -s "$OUT/$n.err" "$OUT/cached.err"; then
+        fail "$file: cached output differs"
+    fi
+done
+if [[ "$(stat_of hits)" != "$n" ]]; then
+    fail "second round did not hit every program"
+fi
+
+# Output options are part of the key
+file=$(echo "$FILES" | head -1)
+"$CIVCC" --emit=binary -o "$OUT/binary.o" "$file" > /dev/null 2>&1
+if [[ "$(stat_of misses)" != "$((n + 1))" ]]; then
+    fail "changed options hit the cache"
+fi
+
+# Only the name of the input is part of the key, not its directory
+mkdir "$OUT/elsewhere"
+cp "$file" "$OUT/elsewhere/"
+hits=$(stat_of hits)
+"$CIVCC" -g -o "$OUT/moved.s" "$OUT/elsewhere/$(basename "$file")" > /dev/null 2>&1
+if [[ "$(stat_of hits)" != "$((hits + 1))" ]] || ! cmp -s "$OUT/1.s" "$OUT/moved.s"; then
+    fail "same source in another directory missed the cache"
+fi
+
+# Failed compilations are not stored
+"$CIVCC" -o "$OUT/error.s" basic/check_error/undefined_var.cvc > /dev/null 2>&1
+if "$CIVCC" -o "$OUT/error.s" basic/check_error/undefined_var.cvc > /dev/null 2>&1; then
+    fail "failed compilation hit the cache"
+fi
+
+# Bounded to a few entries, the least recently used ones go
+size=$(stat -c %s "$OUT/1.s")
+CIVICC_CACHE_SIZE=$((size * 4)) "$CIVCC" -o "$OUT/evict.s" "$file" > /dev/null 2>&1
+if [[ "$(stat_of entries)" -gt 4 ]]; then
+    fail "cache was not evicted down to its size"
+fi
+
+finish "$n programs hit the cache"
@@ -0,0 +1,58 @@
+#!/usr/bin/env bash
+
+# Compiles a generated program with --incremental, then edits it one step at a
+# time and recompiles. Every recompilation has to write the same output as a
+# full compilation of the edited program, and reuse the code of the functions
+# the edit did not touch.
+#
+# Usage: incremental.bash <civicc> [FUNCTIONS]
+
+USAGE="<civicc> [FUNCTIONS]"
+source "$(dirname "$0")/lib.bash"
+FUNCTIONS=${2:-40}
+
+# Writes the program; function $1 gets body constant $2, $3 blank lines go before it, the global is $4
+function generate {
+    generate_functions "$FUNCTIONS" "$@"
+}
+
+# Recompiles after an edit and compares with a full compilation; $1 describes the edit, $2 the expected reuse
+function check {
+    local reused
+    reused=$("$CIVCC" $FLAGS -v --incremental -o "$OUT/inc.s" "$OUT/prog.cvc" 2>&1 > /dev/null |
+        sed -n 's/^Reused the code of \([0-9]*\) of.*/\1/p')
+    "$CIVCC" $FLAGS -o "$OUT/full.s" "$OUT/prog.cvc" > /dev/null 2>&1
+
+    if ! cmp -s "$OUT/inc.s" "$OUT/full.s"; then
+        fail "$1 with '$FLAGS': output differs from a full compilation"
+    elif [[ -f "$OUT/full.s.lines" ]] && ! cmp -s "$OUT/inc.s.lines" "$OUT/full.s.lines"; then
+        fail "$1 with '$FLAGS': line table differs from a full compilation"
+    elif [[ "$reused" != "$2" ]]; then
+        fail "$1 with '$FLAGS': reused ${reused:-no} functions instead of $2"
+    fi
+}
+
+for FLAGS in "" "-g" "--emit=binary"; do
+    rm -f "$OUT"/inc.s* "$OUT"/full.s*
+    generate -1 0 0 1.5 > "$OUT/prog.cvc"
+    check "first compilation" 0
+    check "unchanged program" $((FUNCTIONS + 1))
+
+    # Every function but the edited one and main is reused, its new constant shifts the pool
+    generate 3 12345 0 1.5 > "$OUT/prog.cvc"
+    check "edited body" "$FUNCTIONS"
+
+    # Moved functions keep their code, their lines are updated
+    generate 3 12345 5 1.5 > "$OUT/prog.cvc"
+    check "inserted lines" $((FUNCTIONS + 1))
+
+    # Globals belong to the module, nothing is reused
+    generate 3 12345 5 2.5 > "$OUT/prog.cvc"
+    check "changed global" 0
+
+    # Going back reuses the state of the last compilation only
+    generate 3 7 5 2.5 > "$OUT/prog.cvc"
+    check "edited body again" "$FUNCTIONS"
+done
+
+finish "$FUNCTIONS functions recompile incrementally like a full compilation"
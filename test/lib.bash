@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+
+# Setup and reporting shared by the test scripts, sourced with the arguments
+# of the script after setting USAGE to its arguments:
+#     USAGE="<civicc> [CATEGORY...]"
+#     source "$(dirname "$0")/lib.bash"
+# Sets CIVCC to the absolute path of the compiler, enters the test directory
+# and creates the scratch directory OUT. On exit, the processes in BACKGROUND
+# are stopped and OUT is removed.
+
+CIVCC=$1
+if [[ -z "$CIVCC" ]]; then
+    echo "Usage: $0 ${USAGE:-<civicc>}"
+    exit 1
+fi
+if [[ "$CIVCC" == */* ]]; then
+    CIVCC="$(cd "$(dirname "$CIVCC")" && pwd)/$(basename "$CIVCC")"
+fi
+
+cd "$(dirname "${BASH_SOURCE[0]}")" || exit 1
+
+OUT=$(mktemp -d)
+BACKGROUND=()
+trap 'kill "${BACKGROUND[@]}" 2> /dev/null; rm -rf "$OUT"' EXIT
+
+failed=0
+
+# Reports a failed check, $* describes it
+function fail {
+    echo "$*"
+    failed=$((failed + 1))
+}
+
+# Exits with the amount of failed checks, or prints $1 if there were none
+function finish {
+    if [[ $failed -gt 0 ]]; then
+        echo "$failed failures"
+        exit 1
+    fi
+    echo "$1"
+}
+
+# Lists the programs that compile in the categories $*
+function test_programs {
+    for c in "$@"; do
+        ls $c/check_success/*.cvc $c/functional/*.cvc 2> /dev/null
+    done
+}
+
+# Writes a program of $1 similar functions called in a chain from main.
+# Function $2 gets body constant $3 and is preceded by $4 blank lines, the
+# global the functions scale with is $5. Without $2 no function is edited.
+function generate_functions {
+    local count=$1 edited=${2:--1} constant=$3 blank=${4:-0} scale=${5:-1.5}
+    echo "extern void printInt(int val);"
+    echo "float scale = $scale;"
+    for ((i = 0; i < count; i++)); do
+        if ((i == edited)); then
+            for ((l = 0; l < blank; l++)); do echo; done
+        fi
+        echo "int f$i(int x) {"
+        echo "    int s = $( ((i == edited)) && echo "$constant" || echo "$i");"
+        echo "    int[4] a = [x, $i, 2, 3];"
+        echo "    for (int j = 0, x) { if (j % 2 == 0) { s = s + a[j % 4]; } else { s = s - 1; } }"
+        echo "    while (s > 1000) { s = s / 2; }"
+        echo "    return s + (int) ((float) x * scale);"
+        echo "}"
+    done
+    echo "export int main() {"
+    echo "    int s = 0;"
+    for ((i = 0; i < count; i++)); do
+        echo "    s = f$i(s % 7);"
+    done
+    echo "    printInt(s);"
+    echo "    return 0;"
+    echo "}"
+}
@@ -0,0 +1,154 @@
+// test/lib/compile_buffer.c
+
+/* Compiles test programs through libcivicc. Every program has to compile to the
+ * same unit each time, also after failed compilations and from several threads
+ * at once. Programs after -- have to fail with diagnostics.
+ *
+ * Usage: civicc-libtest <program.cvc>... [-- <erroneous.cvc>...]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/civicc.h"
+
+#define THREAD_COUNT 4
+
+typedef struct Program {
+    const char* path;
+    char* src;
+    size_t len;
+    char* expected;                     // Unit of the first compilation
+    size_t expected_size;
+} Program;
+
+static Program* PROGRAMS = NULL;
+static size_t PROGRAM_COUNT = 0;
+
+static char* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char* buf = malloc((size_t) size + 1);
+    *len = fread(buf, 1, (size_t) size, f);
+    buf[*len] = '\0';
+    fclose(f);
+    return buf;
+}
+
+/**
+ * Compiles a program and compares the unit with its first compilation
+ * @param ctx context to compile with
+ * @param prog program
+ * @return whether the compilation succeeded with the expected unit
+ */
+static bool compile_same(CiviccContext* ctx, const Program* prog) {
+    CiviccOutput out;
+    const int status = civicc_compile_buffer(ctx, prog->src, prog->len, &out);
+    const bool same = status == 0 && out.size == prog->expected_size
+        && memcmp(out.data, prog->expected, out.size) == 0;
+    if (!same) {
+        fprintf(stderr, "%s: status %d, unit differs from the first compilation\n%s",
+            prog->path, status, out.diagnostics ? out.diagnostics : "");
+    }
+    civicc_output_free(&out);
+    return same;
+}
+
+static void* compile_all(void* arg) {
+    (void) arg;
+    CiviccContext* ctx = civicc_context_new();
+    size_t failed = 0;
+    for (size_t i = 0; i < PROGRAM_COUNT; i++) {
+        civicc_set_name(ctx, PROGRAMS[i].path);
+        failed += !compile_same(ctx, &PROGRAMS[i]);
+    }
+    civicc_context_free(ctx);
+    return (void*) failed;
+}
+
+int main(int argc, char** argv) {
+    int first_error = argc;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            first_error = i + 1;
+            break;
+        }
+        PROGRAMS = realloc(PROGRAMS, (PROGRAM_COUNT + 1) * sizeof(Program));
+        Program* prog = &PROGRAMS[PROGRAM_COUNT++];
+        prog->path = argv[i];
+        prog->src = read_file(argv[i], &prog->len);
+        if (prog->src == NULL) {
+            fprintf(stderr, "Could not read %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    CiviccContext* ctx = civicc_context_new();
+    size_t failed = 0;
+
+    for (size_t i = 0; i < PROGRAM_COUNT; i++) {
+        Program* prog = &PROGRAMS[i];
+        CiviccOutput out;
+        civicc_set_name(ctx, prog->path);
+        if (civicc_compile_buffer(ctx, prog->src, prog->len, &out) != 0) {
+            fprintf(stderr, "%s: compilation failed\n%s", prog->path, out.diagnostics);
+            return EXIT_FAILURE;
+        }
+        prog->expected = out.data;
+        prog->expected_size = out.size;
+        free(out.diagnostics);
+
+        failed += !compile_same(ctx, prog);
+    }
+
+    // Errors may not leave state behind for the next compilation
+    for (int i = first_error; i < argc; i++) {
+        size_t len;
+        char* src = read_file(argv[i], &len);
+        if (src == NULL) {
+            fprintf(stderr, "Could not read %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+
+        CiviccOutput out;
+        civicc_set_name(ctx, argv[i]);
+        const int status = civicc_compile_buffer(ctx, src, len, &out);
+        if (status != 1 || out.diagnostics_size == 0) {
+            fprintf(stderr, "%s: expected an error with diagnostics, got status %d\n", argv[i], status);
+            failed++;
+        }
+        civicc_output_free(&out);
+        free(src);
+
+        if (PROGRAM_COUNT > 0) {
+            civicc_set_name(ctx, PROGRAMS[0].path);
+            failed += !compile_same(ctx, &PROGRAMS[0]);
+        }
+    }
+    civicc_context_free(ctx);
+
+    pthread_t threads[THREAD_COUNT];
+    for (size_t i = 0; i < THREAD_COUNT; i++) pthread_create(&threads[i], NULL, compile_all, NULL);
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        void* thread_failed;
+        pthread_join(threads[i], &thread_failed);
+        failed += (size_t) thread_failed;
+    }
+
+    for (size_t i = 0; i < PROGRAM_COUNT; i++) {
+        free(PROGRAMS[i].src);
+        free(PROGRAMS[i].expected);
+    }
+    free(PROGRAMS);
+
+    printf("%lu programs, %d erroneous, %lu failures\n",
+        PROGRAM_COUNT, first_error < argc ? argc - first_error : 0, failed);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,20 +1,72 @@
 #!/usr/bin/env bash
-if [[ -z "${TOOLCHAIN}" ]]; then
+
+# civvm-lite reads assembly directly, so assembling only copies the file
+function assemble_lite {
+    local in="" out=""
+    while [[ $# -gt 0 ]]; do
+        if [[ "$1" == "-o" ]]; then out=$2; shift 2; else in=$1; shift; fi
+    done
+    cp "$in" "$out"
+}
+
+# The C backend is compiled by the host C compiler and linked into an executable
+function assemble_c {
+    local in="" out=""
+    while [[ $# -gt 0 ]]; do
+        if [[ "$1" == "-o" ]]; then out=$2; shift 2; else in=$1; shift; fi
+    done
+    "${CC:-cc}" -O2 -c -x c "$in" -o "$out"
+}
+
+# The x86 backend writes GNU assembler, its programs link against civicrt
+function assemble_x86 {
+    local in="" out=""
+    while [[ $# -gt 0 ]]; do
+        if [[ "$1" == "-o" ]]; then out=$2; shift 2; else in=$1; shift; fi
+    done
+    "${CC:-cc}" -c -x assembler "$in" -o "$out"
+}
+
+function run_native {
+    "${CC:-cc}" -o tmp.bin "$@" ${CIVIC_RT-} -lm && ./tmp.bin
+    local status=$?
+    rm -f tmp.bin
+    return $status
+}
+
+RUN_FUNCTIONAL=${RUN_FUNCTIONAL-0}
+
+if [[ "${BACKEND}" == "c" ]]; then
+    CIVAS=assemble_c
+    CIVVM=run_native
+    CFLAGS="${CFLAGS-} --emit=c"
+elif [[ "${BACKEND}" == "x86" ]]; then
+    CIVAS=assemble_x86
+    CIVVM=run_native
+    CFLAGS="${CFLAGS-} --emit=x86"
+elif [[ -z "${TOOLCHAIN}" && $RUN_FUNCTIONAL -eq 1 ]]; then
     CIVRUN="$(command -v civrun)"
-    if [[ -z "${CIVRUN}" ]]; then
+    if [[ -n "${CIVRUN}" ]]; then
+        TOOLCHAIN="$(dirname "$CIVRUN")"
+    elif [[ -z "${CIVVM_LITE}" ]]; then
         echo "Could not find toolchain directory in PATH, rerun ctest as:"
         echo "TOOLCHAIN=<TOOLCHAIN_DIR> ctest"
         echo "Where <TOOLCHAIN_DIR> is the directory where you installed the" \
              "toolchain."
         exit 1
     fi
-    TOOLCHAIN="$(dirname "$CIVRUN")"
 fi
 
-CIVAS="${TOOLCHAIN}/civas"
-CIVVM="${TOOLCHAIN}/civvm"
+if [[ "${BACKEND}" == "c" || "${BACKEND}" == "x86" ]]; then
+    :
+elif [[ -n "${TOOLCHAIN}" ]]; then
+    CIVAS="${TOOLCHAIN}/civas"
+    CIVVM="${TOOLCHAIN}/civvm"
+else
+    CIVAS=assemble_lite
+    CIVVM="${CIVVM_LITE}"
+fi
 CFLAGS=${CFLAGS-}
-RUN_FUNCTIONAL=${RUN_FUNCTIONAL-0}
 
 ALIGN=52
 
@@ -40,7 +92,7 @@ function check_output {
     total_tests=$((total_tests+1))
     printf "%-${ALIGN}s " $file:
 
-    if "$CIVCC" $CGLAGS -o tmp.s $file > tmp.out 2>&1 &&
+    if "$CIVCC" $CFLAGS -o tmp.s $file > tmp.out 2>&1 &&
        "$CIVAS" tmp.s -o tmp.o > tmp.out 2>&1 &&
        "$CIVVM" tmp.o > tmp.out 2>&1 &&
        mv tmp.out tmp.res &&
@@ -56,7 +108,7 @@ function check_output {
         failed_tests=$((failed_tests+1))
     fi
 
-    rm -f tmp.res tmp.s tmp.o tmp.out
+    rm -f tmp.res tmp.s tmp.s.prof tmp.s.lines tmp.o tmp.out
 }
 
 # Special case: multiple files must be compiled and run together (e.g., for
@@ -83,7 +135,7 @@ function check_combined {
         ofile=${file%.*}.o
         ofiles="$ofiles $ofile"
 
-        if "$CIVCC" $CGLAGS -o $asfile $file > /dev/null 2>&1 &&
+        if "$CIVCC" $CFLAGS -o $asfile $file > /dev/null 2>&1 &&
            "$CIVAS" -o $ofile $asfile 2>&1
         then
             compiled_files="$compiled_files `basename $file`"
@@ -112,7 +164,7 @@ function check_combined {
         failed_tests=$((failed_tests+1))
     fi
 
-    rm -f $d/*.s $d/*.o tmp.out tmp.res
+    rm -f $d/*.s $d/*.o $dir/*.s.prof $dir/*.s.lines tmp.out tmp.res
 }
 
 # Easy tests, check if the parser, context analysis and typechecking work
@@ -148,7 +200,7 @@ function check_return {
         fi
     fi
 
-    rm -f tmp.s tmp.out
+    rm -f tmp.s tmp.s.prof tmp.s.lines tmp.out
 }
 
 function run_dir {
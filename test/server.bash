@@ -0,0 +1,149 @@
+#!/usr/bin/env bash
+
+# Starts civicc --server and compiles the test programs through --connect,
+# several clients at a time. Every output has to match a compilation in
+# process, line tables and counter mappings included, erroneous programs
+# have to fail with their diagnostics.
+#
+# Usage: server.bash <civicc> [CATEGORY...]
+
+USAGE="<civicc> [CATEGORY...]"
+source "$(dirname "$0")/lib.bash"
+shift
+CATEGORIES=${*:-basic nested_funs arrays}
+SOCKET="$OUT/civicc.sock"
+# Scratch directories of servers that get killed are removed with OUT
+export TMPDIR="$OUT"
+
+# Waits until a server listens on $1
+function wait_socket {
+    for ((i = 0; i < 50; i++)); do
+        [[ -S "$1" ]] && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+"$CIVCC" --server "$SOCKET" &
+SERVER=$!
+BACKGROUND+=($SERVER)
+
+if ! wait_socket "$SOCKET"; then
+    echo "server did not start"
+    exit 1
+fi
+
+# Waits for the running clients, but not for the server
+function wait_clients {
+    local clients
+    clients=$(jobs -p | grep -v "^$SERVER\$")
+    if [[ -n "$clients" ]]; then
+        wait $clients
+    fi
+}
+
+n=0
+for file in $(test_programs $CATEGORIES); do
+    n=$((n + 1))
+    out="$OUT/$n"
+    (
+        for flags in "" "-g" "-fprofile-counts"; do
+            rm -f "$out.local"* "$out.remote"*
+            "$CIVCC" $flags -o "$out.local" "$file" > /dev/null 2>&1
+            if ! "$CIVCC" $flags --connect "$SOCKET" -o "$out.remote" "$file" 2> "$out.err"; then
+                echo "$file: compilation on the server failed"
+                cat "$out.err"
+                touch "$out.failed"
+            fi
+            for ext in "" .lines .prof; do
+                if [[ -e "$out.local$ext" || -e "$out.remote$ext" ]] && ! cmp -s "$out.local$ext" "$out.remote$ext"; then
+                    echo "$file: output$ext of the server differs with '$flags'"
+                    touch "$out.failed"
+                fi
+            done
+        done
+    ) &
+
+    # A few clients at a time
+    if ((n % 8 == 0)); then
+        wait_clients
+    fi
+done
+wait_clients
+failed=$(ls "$OUT"/*.failed 2> /dev/null | wc -l)
+
+for file in basic/check_error/*.cvc; do
+    if "$CIVCC" --connect "$SOCKET" -o "$OUT/error.s" "$file" 2> "$OUT/error.err"; then
+        fail "$file: compiled on the server"
+    elif [[ ! -s "$OUT/error.err" ]]; then
+        fail "$file: no diagnostics from the server"
+    fi
+done
+
+# Sends $1 as a raw request and prints the status of the response
+function raw_request {
+    python3 - "$SOCKET" "$1" << 'END'
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.settimeout(5)
+s.connect(sys.argv[1])
+s.sendall(sys.argv[2].encode())
+response = b""
+try:
+    while True:
+        data = s.recv(65536)
+        if not data:
+            break
+        response += data
+except socket.timeout:
+    pass
+print(response.split(b" ")[0].decode() if response else "none")
+END
+}
+
+# Malformed source lengths are rejected without waiting for the source
+if command -v python3 > /dev/null; then
+    for length in 18446744073709551615 18446744073709551616 1000000000000 -1 12x; do
+        status=$(raw_request "source $length
+int x;")
+        if [[ "$status" != "1" ]]; then
+            fail "source length $length: got status ${status:-none} instead of an error"
+        fi
+    done
+fi
+
+# A second server must neither take over the socket of a live one nor replace other files
+program=$(test_programs basic | head -1)
+if timeout 5 "$CIVCC" --server "$SOCKET" 2> /dev/null; then
+    fail "second server started on a live socket"
+elif ! "$CIVCC" --connect "$SOCKET" -o "$OUT/after.s" "$program" 2> /dev/null; then
+    fail "second server took the socket of the first"
+fi
+echo "not a socket" > "$OUT/regular"
+if timeout 5 "$CIVCC" --server "$OUT/regular" 2> /dev/null || [[ "$(cat "$OUT/regular")" != "not a socket" ]]; then
+    fail "server replaced a regular file"
+fi
+
+kill $SERVER
+wait $SERVER
+if [[ -e "$SOCKET" ]]; then
+    fail "server did not remove its socket"
+fi
+
+# The socket of a server that died is replaced
+"$CIVCC" --server "$OUT/stale.sock" &
+STALE=$!
+wait_socket "$OUT/stale.sock"
+kill -9 $STALE
+wait $STALE 2> /dev/null
+"$CIVCC" --server "$OUT/stale.sock" &
+BACKGROUND+=($!)
+for ((i = 0; i < 50; i++)); do
+    "$CIVCC" --connect "$OUT/stale.sock" -o "$OUT/stale.s" "$program" 2> /dev/null && break
+    sleep 0.1
+done
+if [[ $i -eq 50 ]]; then
+    fail "server did not replace a stale socket"
+fi
+
+finish "$n programs compile the same on the server"
@@ -0,0 +1,89 @@
+#!/usr/bin/env bash
+
+# Starts civicc --watch on a generated program and saves edits to it, in
+# place and by renaming a new file over it. Every save has to write the same
+# output as a fresh compilation, errors have to be reported and saving
+# without changes must not compile again.
+#
+# Usage: watch.bash <civicc>
+
+source "$(dirname "$0")/lib.bash"
+SRC="$OUT/prog.cvc"
+
+# Writes the program, the body of the second function returns $1
+function generate {
+    echo "extern void printInt(int val);"
+    echo "int f(int x) { return x * 3; }"
+    echo "int g(int x) { return $1; }"
+    echo "export int main() {"
+    echo "    printInt(f(2) + g(4));"
+    echo "    return 0;"
+    echo "}"
+}
+
+generate "x + 1" > "$SRC"
+"$CIVCC" --watch -o "$OUT/watched.s" "$SRC" 2> "$OUT/log" &
+WATCHER=$!
+BACKGROUND+=($WATCHER)
+
+# Waits until the log has $1 lines matching $2
+function wait_log {
+    for ((i = 0; i < 100; i++)); do
+        [[ $(grep -c "$2" "$OUT/log") -ge $1 ]] && return 0
+        sleep 0.05
+    done
+    return 1
+}
+
+compiled=1
+
+# Waits for the next compilation and compares it with a fresh one; $1 describes the save
+function check {
+    compiled=$((compiled + 1))
+    if ! wait_log $compiled "^Compiled"; then
+        fail "$1: no compilation"
+        return
+    fi
+    "$CIVCC" -o "$OUT/fresh.s" "$SRC" > /dev/null 2>&1
+    if ! cmp -s "$OUT/watched.s" "$OUT/fresh.s"; then
+        fail "$1: output differs from a fresh compilation"
+    fi
+}
+
+if ! wait_log 1 "^Compiled"; then
+    echo "first compilation did not finish"
+    cat "$OUT/log"
+    exit 1
+fi
+
+generate "x - 7" > "$SRC"
+check "saved in place"
+
+generate "x * x" > "$OUT/prog.tmp"
+mv "$OUT/prog.tmp" "$SRC"
+check "saved by renaming"
+
+generate "x +" > "$SRC"
+if ! wait_log 1 "failed"; then
+    fail "syntax error not reported"
+fi
+
+generate "x + 2" > "$SRC"
+check "fixed the error"
+
+# Saving the same source again does not compile
+generate "x + 2" > "$SRC"
+sleep 0.3
+if [[ $(grep -c "^Compiled" "$OUT/log") -ne $compiled ]]; then
+    fail "unchanged save compiled again"
+fi
+
+kill $WATCHER
+if ! wait $WATCHER; then
+    fail "watcher did not exit cleanly"
+fi
+
+if [[ $failed -gt 0 ]]; then
+    cat "$OUT/log"
+fi
+finish "$compiled saves compiled like fresh compilations"